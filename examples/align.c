@@ -3,20 +3,30 @@
  */
 
 /* This program is a larger example that uses Spica library. This program
- * allows to align (register) sequence of PNG images and stack them into
- * a single PNG image. The program uses argp library to implement command-line
- * arguments parsing. All configuration parameters of used Spica components
- * (SStarFinder, SSmallChangeAligner, SBrutAligner, SStarMatcher) may be set.
- * However, the default settings work quite well. */
-
+ * allows to align (register) sequence of PNG or FITS images and stack them
+ * into a single PNG or FITS image. The program uses argp library to
+ * implement command-line arguments parsing. All configuration parameters of
+ * used Spica components (SStarFinder, SSmallChangeAligner, SAsterismAligner,
+ * SBrutAligner, SStarMatcher) may be set. SRansacAligner uses the default
+ * settings. However, the default settings work quite well. Images are
+ * decoded ahead by SImageLoader, in parallel with processing of previous
+ * images. Stars found on images may be kept in SStarCache, to speed up next
+ * runs, and the alignment may be saved in a file, to stack images again
+ * without aligning them. */
+
+#include <SAlignment.h>
 #include <SImage.h>
+#include <SImageLoader.h>
 #include <SCoarseAlign.h>
+#include <SStarCache.h>
 #include <SStarFinder.h>
 #include <SStarMatcher.h>
 
 #include <argp.h>
+#include <math.h>
 #include <stdarg.h>
 #include <stdlib.h>
+#include <string.h>
 
 /* ========================================================================= */
 /* Description of command-line parameters */
@@ -27,17 +37,34 @@
 #define OPT_BR_THRESHOLD      'b'
 #define OPT_CAN_THRESHOLD     'c'
 #define OPT_FIT_STEPS         'F'
+#define OPT_FIT_ELLIPTIC      'e'
+#define OPT_BACKGROUND_BOX    'B'
+#define OPT_NOISE_THRESHOLD   'N'
 #define OPT_MIN_DIST          'm'
 #define OPT_SIGMA             's'
 #define OPT_SC_DIST_THRESHOLD 't'
 #define OPT_SC_STARS          'M'
+#define OPT_A_STAR_NUM        'a'
+#define OPT_A_REF_STARS       'A'
 #define OPT_B_DIST_TOL        'T'
 #define OPT_B_RANK_STARS      'R'
 #define OPT_B_REF_STARS       'r'
 #define OPT_B_ROT_TOL         'O'
 #define OPT_B_SCALE_TOL       'S'
 #define OPT_B_STAR_NUM        'n'
+#define OPT_B_THREADS         'j'
 #define OPT_M_DIST_THRESHOLD  'D'
+#define OPT_M_PRUNE_INTERVAL  'I'
+#define OPT_M_MAX_STARS       'K'
+#define OPT_M_MODEL           'L'
+#define OPT_M_POLY_ORDER      'Q'
+#define OPT_M_FIX_DISTORTION  'X'
+#define OPT_PHASE_CORR        'p'
+#define OPT_PC_SCALE          'P'
+#define OPT_L_THREADS         'J'
+#define OPT_L_QUEUE_LENGTH    'q'
+#define OPT_STAR_CACHE        'C'
+#define OPT_ALIGNMENT         'w'
 
 const char *argp_program_version = "align v0.1";
 static const char doc[] =
@@ -47,7 +74,8 @@ static struct argp_option options[] = {
   { "dark-frame", OPT_DARK_FRAME, "FILE", 0,
     "Subtract dark frame read from SIWW FILE." },
   { "output", OPT_OUTPUT, "FILE", 0,
-    "Set name of the output file." },
+    "Set name of the output file. Files with .fits extension are saved "
+    "in FITS format (with full precision), other files in PNG format." },
   { "verbose", OPT_VERBOSE, 0, 0,
     "Increase verbosity level. May be used several times." },
   { "brightness-threshold", OPT_BR_THRESHOLD, "NUM", 0,
@@ -56,6 +84,15 @@ static struct argp_option options[] = {
     "Candidate star brightness threshold of star finder." },
   { "fit-steps", OPT_FIT_STEPS, "N", 0,
     "Number of steps of fitting algorithm." },
+  { "elliptic", OPT_FIT_ELLIPTIC, 0, 0,
+    "Fit elliptical gaussian functions to stars (slower, but more precise "
+    "for elongated stars)." },
+  { "background-box", OPT_BACKGROUND_BOX, "N", 0,
+    "Use background model with boxes of size N pixels during star-finding "
+    "(0 disables the model)." },
+  { "noise-threshold", OPT_NOISE_THRESHOLD, "NUM", 0,
+    "Brightness threshold of star finder in units of noise sigma "
+    "(used only with background model)." },
   { "min-dist", OPT_MIN_DIST, "NUM", 0,
     "Minimal distance between stars to be considered as separate stars, "
     "during star-finding." },
@@ -67,6 +104,11 @@ static struct argp_option options[] = {
   { "sc-stars", OPT_SC_STARS, "N", 0,
     "Minimal number of matched stars required by small-change aligner, "
     "required to accept the alignment." },
+  { "a-star-num", OPT_A_STAR_NUM, "N", 0,
+    "Number of input stars used by triangle-matching coarse alignment." },
+  { "a-ref-stars", OPT_A_REF_STARS, "N", 0,
+    "Number of reference stars used by triangle-matching coarse "
+    "alignment." },
   { "b-dist-tol", OPT_B_DIST_TOL, "NUM", 0,
     "Maximal distance between stars when they are treated as the same star, "
     "used by slower coarse-align algorithm." },
@@ -74,33 +116,73 @@ static struct argp_option options[] = {
     "Number of stars used for ranking of coarse alignment (slower "
     "algorithm)." },
   { "b-ref-stars", OPT_B_REF_STARS, "N", 0,
-    "Number of reference stars used by slower coarse alignment." },
+    "Number of reference stars used by slower coarse alignment "
+    "(default 100)." },
   { "b-rot-tol", OPT_B_ROT_TOL, "NUM", 0,
     "Allowed rotation tolerance of coarse aligner." },
   { "b-scale-tol", OPT_B_SCALE_TOL, "NUM", 0,
     "Allowed scale tolerance of coarse aligner." },
   { "b-star-num", OPT_B_STAR_NUM, "N", 0,
     "Number of input stars used by slower coarse alignment." },
+  { "b-threads", OPT_B_THREADS, "N", 0,
+    "Number of threads used by slower coarse alignment "
+    "(0 means one thread per processor)." },
   { "m-dist-threshold", OPT_M_DIST_THRESHOLD, "NUM", 0,
     "Maximal distance between two stars, to be considered as same star "
     "by a star matcher." },
+  { "m-prune-interval", OPT_M_PRUNE_INTERVAL, "N", 0,
+    "Remove reference stars that were matched only once, every N images "
+    "(0 disables pruning)." },
+  { "m-max-stars", OPT_M_MAX_STARS, "N", 0,
+    "Keep at most N brightest reference stars during pruning." },
+  { "m-model", OPT_M_MODEL, "MODEL", 0,
+    "Type of transformation fitted to matched stars: shift, linear "
+    "(default), affine, projective, or polynomial." },
+  { "m-poly-order", OPT_M_POLY_ORDER, "N", 0,
+    "Order of the lens distortion fitted by polynomial model." },
+  { "m-fix-distortion", OPT_M_FIX_DISTORTION, 0, 0,
+    "Fit the lens distortion only once (on the first aligned image), "
+    "and use it for all other images (requires polynomial model)." },
+  { "phase-corr", OPT_PHASE_CORR, 0, 0,
+    "Align images with too few stars (and images that cannot be aligned by "
+    "stars) by phase correlation with the first image. Only shifts are "
+    "found in that way." },
+  { "pc-scale", OPT_PC_SCALE, "N", 0,
+    "Scale down images N times before phase correlation." },
+  { "l-threads", OPT_L_THREADS, "N", 0,
+    "Number of threads used for decoding images "
+    "(0 means one thread per processor)." },
+  { "l-queue-length", OPT_L_QUEUE_LENGTH, "N", 0,
+    "Maximal number of images decoded ahead." },
+  { "star-cache", OPT_STAR_CACHE, "DIR", 0,
+    "Store stars found on images in existing directory DIR, and reuse them "
+    "in next runs with the same star-finder parameters and dark frame." },
+  { "alignment", OPT_ALIGNMENT, "FILE", 0,
+    "Save the alignment of images in FILE, periodically during alignment. "
+    "If FILE exists, images already aligned in it are not aligned again, "
+    "so the interrupted alignment is resumed, or (if all images were "
+    "aligned) images are only stacked." },
   { 0 }
 };
 
 /* ========================================================================= */
 /* Input sequence of images.
  *
- * Images are processed in three passes. During the first pass (command line
+ * Images are processed in two passes. During the first pass (command line
  * parsing) only file name is set, and image is not loaded into a memory.
- * The second pass is the most complex. For each image algorithm searches for
- * stars on an image, and align them with stars found on previous images.
- * Transformation that aligns stars is stored in the `images` array. 
- * Additionally, during the second pass determines the format and the size of
- * the result image. During the third pass, images are stacked together.
+ * During the second pass, for each image algorithm searches for stars on
+ * an image, and align them with stars found on previous images.
+ * Transformation that aligns stars is stored in the `images` array. Then
+ * the image is stacked on the result image, which grows as needed, so each
+ * image is decoded only once.
  * */
 typedef struct image {
   const char  *fname;
   STransform_t transform;
+  /* Set if stars of the image were found in the star cache */
+  int          cached;
+  /* Stars found on the image, during the second pass */
+  SStarSet_t   stars;
 } image_t;
 static image_t *images;    /* Array of images */
 static size_t image_n = 0; /* Length of `images` array */
@@ -108,8 +190,30 @@ static size_t image_n = 0; /* Length of `images` array */
 /* Settings of Spica algorithms used by this program */
 static SStarFinder_t         finder;
 static SSmallChangeAligner_t scAligner;
+static SAsterismAligner_t    astAligner;
+static SRansacAligner_t      ransacAligner;
 static SBrutAligner_t        brutAligner;
 static SStarMatcher_t        matcher;
+static SPhaseCorrAligner_t   pcAligner;
+static SImageLoader_t        loader;
+
+/* Set by --phase-corr command line option */
+static int use_phase_corr = 0;
+
+/* Transformation of previous frame, used by SSmallChangeAligner_t */
+static STransform_t prev_tr = { .type = STr_Drop };
+
+/* Number of brightest reference stars used by SBrutAligner_t, unless set by
+ * --b-ref-stars command line option. The table of their pairs takes memory
+ * quadratic in this number */
+#define BRUT_REF_STAR_N 100
+
+/* Set when reference stars were updated since the reference of
+ * SBrutAligner_t was set */
+static int brut_ref_stale = 1;
+
+/* Set by --m-fix-distortion command line option */
+static int fix_distortion = 0;
 
 /* Optional dark frame. May be set by --dark-frame command line option.
  * Dark frame should be stored in SIWW file, obtained by e.g. stack-dark
@@ -119,6 +223,16 @@ static SImage_t *dark_frame = NULL;
 /* Output file name. May be changed by --output command line option */
 static const char *output_fname = "output.png";
 
+/* Directory of the star cache. May be set by --star-cache command line
+ * option */
+static const char *star_cache_dir = NULL;
+static SStarCache_t cache;
+
+/* File of the alignment. May be set by --alignment command line option.
+ * The alignment is saved every ALIGNMENT_SAVE_INTERVAL images */
+static const char *alignment_fname = NULL;
+#define ALIGNMENT_SAVE_INTERVAL 16
+
 /* ========================================================================= */
 /* Logging */
 
@@ -153,6 +267,18 @@ static int parse_int(struct argp_state *state, const char *arg) {
   return result;
 }
 
+static STransformType_t parse_model(
+  struct argp_state *state, const char *arg)
+{
+  if (!strcmp(arg, "shift"))      return STr_Shift;
+  if (!strcmp(arg, "linear"))     return STr_Linear;
+  if (!strcmp(arg, "affine"))     return STr_Affine;
+  if (!strcmp(arg, "projective")) return STr_Projective;
+  if (!strcmp(arg, "polynomial")) return STr_Polynomial;
+  argp_error(state, "Invalid transformation model: %s", arg);
+  return STr_Linear;
+}
+
 static error_t parse_opt(int key, char *arg, struct argp_state *state) {
   switch (key) {
   case OPT_DARK_FRAME:
@@ -180,6 +306,15 @@ static error_t parse_opt(int key, char *arg, struct argp_state *state) {
   case OPT_FIT_STEPS:
     finder.fitSteps = parse_int(state, arg);
     break;
+  case OPT_FIT_ELLIPTIC:
+    finder.fitMethod = SFit_Elliptic;
+    break;
+  case OPT_BACKGROUND_BOX:
+    finder.backgroundBox = parse_int(state, arg);
+    break;
+  case OPT_NOISE_THRESHOLD:
+    finder.noiseThreshold = parse_float(state, arg);
+    break;
   case OPT_MIN_DIST:
     finder.minDist = parse_float(state, arg);
     break;
@@ -192,6 +327,12 @@ static error_t parse_opt(int key, char *arg, struct argp_state *state) {
   case OPT_SC_STARS:
     scAligner.minStarN = parse_int(state, arg);
     break;
+  case OPT_A_STAR_NUM:
+    astAligner.starN = parse_int(state, arg);
+    break;
+  case OPT_A_REF_STARS:
+    astAligner.refStarN = parse_int(state, arg);
+    break;
   case OPT_B_DIST_TOL:
     brutAligner.distTol = parse_float(state, arg);
     break;
@@ -210,9 +351,45 @@ static error_t parse_opt(int key, char *arg, struct argp_state *state) {
   case OPT_B_STAR_NUM:
     brutAligner.starN = parse_int(state, arg);
     break;
+  case OPT_B_THREADS:
+    brutAligner.threadN = parse_int(state, arg);
+    break;
   case OPT_M_DIST_THRESHOLD:
     matcher.distThreshold = parse_float(state, arg);
     break;
+  case OPT_M_PRUNE_INTERVAL:
+    matcher.pruneInterval = parse_int(state, arg);
+    break;
+  case OPT_M_MAX_STARS:
+    matcher.maxStars = parse_int(state, arg);
+    break;
+  case OPT_M_MODEL:
+    matcher.model = parse_model(state, arg);
+    break;
+  case OPT_M_POLY_ORDER:
+    matcher.polyOrder = parse_int(state, arg);
+    break;
+  case OPT_M_FIX_DISTORTION:
+    fix_distortion = 1;
+    break;
+  case OPT_PHASE_CORR:
+    use_phase_corr = 1;
+    break;
+  case OPT_PC_SCALE:
+    pcAligner.scale = parse_int(state, arg);
+    break;
+  case OPT_L_THREADS:
+    loader.threadN = parse_int(state, arg);
+    break;
+  case OPT_L_QUEUE_LENGTH:
+    loader.queueLength = parse_int(state, arg);
+    break;
+  case OPT_STAR_CACHE:
+    star_cache_dir = arg;
+    break;
+  case OPT_ALIGNMENT:
+    alignment_fname = arg;
+    break;
   case ARGP_KEY_ARG:
     images[image_n++].fname = arg;
     break;
@@ -224,6 +401,222 @@ static error_t parse_opt(int key, char *arg, struct argp_state *state) {
 
 static struct argp argp = { options, parse_opt, 0, doc, 0, 0, 0 };
 
+/* ========================================================================= */
+/* Check if the file name has given extension */
+static int has_extension(const char *fname, const char *ext) {
+  size_t len     = strlen(fname);
+  size_t ext_len = strlen(ext);
+  return len >= ext_len && strcmp(fname + len - ext_len, ext) == 0;
+}
+
+/* ========================================================================= */
+/* Update format and size of the result image, after adding an aligned
+ * image */
+static void extend_result(
+  SAlignment_t       *al,
+  const SImage_t     *img,
+  const STransform_t *tr)
+{
+  if (img->format > al->format) {
+    al->format = img->format;
+  }
+  al->boundingBox = SBoundingBox_union(al->boundingBox,
+    STransform_boundingBox(tr, SImage_boundingBox(img)));
+}
+
+/* Copy of the stars found so far, brightest first. Stars of the matcher
+ * are in order of their ids */
+static void sorted_reference(SStarSet_t *ref) {
+  SStarSet_clone_at(ref, &matcher.sset);
+  SStarSet_sort(ref);
+}
+
+/* Set the reference of SBrutAligner_t to the stars found so far */
+static void set_brut_reference(void) {
+  SStarSet_t ref;
+  sorted_reference(&ref);
+  if (SBrutAligner_setReference(&brutAligner, &ref) != SPICA_OK)
+    s_log(1, "\tCannot build the reference of SBrutAligner");
+  SStarSet_deinit(&ref);
+  brut_ref_stale = 0;
+}
+
+/* ========================================================================= */
+/* Find stars on the image (unless they are cached), and align them with
+ * stars found on previous images */
+static void align_image(image_t *image, const SImage_t *img, SAlignment_t *al)
+{
+  /* Default transformation -- drop the image -- in case of insufficient
+   * number of stars on it */
+  image->transform.type = STr_Drop;
+
+  /* Find stars, unless they are cached. The set is owned by `sset` from
+   * now on */
+  SStarSet_t sset = image->stars;
+  if (image->cached) {
+    s_log(2, "\t%d stars found in cache", (int)sset.length);
+  } else {
+    SStarFinder_findStars_at(&sset, &finder, img);
+    s_log(2, "\t%d stars found", (int)sset.length);
+    if (star_cache_dir)
+      SStarCache_store(&cache, image->fname, &sset,
+        img->format, img->width, img->height);
+  }
+
+  /* skip this image, if there are too few stars on it, unless it can be
+   * aligned by phase correlation */
+  if (sset.length <= 2) {
+    if (use_phase_corr && pcAligner.refSpectrum != NULL) {
+      s_log(3, "\tToo few stars, running SPhaseCorrAligner");
+      image->transform = SPhaseCorrAligner_align(&pcAligner, img);
+      if (image->transform.type != STr_Drop)
+        extend_result(al, img, &image->transform);
+    }
+    SStarSet_deinit(&sset);
+    return;
+  }
+
+  if (matcher.sset.length == 0) {
+    /* If it is the first valid image in the sequence, then just use the
+     * identity transformation. Its stars are also the reference of
+     * SAsterismAligner */
+    image->transform.type = STr_Identity;
+    SAsterismAligner_setReference(&astAligner, &sset);
+    if (use_phase_corr)
+      SPhaseCorrAligner_setReference(&pcAligner, img);
+  } else {
+    /* Otherwise, try to coarsely align to previously found stars using fast
+     * SSmallChangeAligner algorithm */
+    s_log(4, "\tRunning SSmallChangeAligner");
+    STransform_t tr =
+      SSmallChangeAligner_alignIndexed(&scAligner,
+        &matcher.sset, &matcher.index, &prev_tr, &sset);
+    /* On failure, fallback to SAsterismAligner, which does not need the
+     * previous transformation */
+    if (tr.type == STr_Drop) {
+      s_log(3, "\tFallback to SAsterismAligner");
+      tr = SAsterismAligner_align(&astAligner, &sset);
+    }
+    /* Then try SRansacAligner against all stars found so far */
+    if (tr.type == STr_Drop) {
+      s_log(3, "\tFallback to SRansacAligner");
+      tr = SRansacAligner_alignIndexed(&ransacAligner,
+        &matcher.sset, &matcher.index, &sset);
+    }
+    /* Phase correlation finds only shifts, but it does not depend on
+     * stars */
+    if (tr.type == STr_Drop && use_phase_corr) {
+      s_log(3, "\tFallback to SPhaseCorrAligner");
+      tr = SPhaseCorrAligner_align(&pcAligner, img);
+    }
+    /* If it fails too, fallback to slower SBrutAligner algorithm */
+    if (tr.type == STr_Drop) {
+      s_log(3, "\tFallback to SBrutAligner");
+      if (brut_ref_stale)
+        set_brut_reference();
+      tr = SBrutAligner_alignToReference(&brutAligner, &sset);
+    }
+
+    if (tr.type != STr_Drop) {
+      s_log(4, "\tMatching stars");
+      /* Then, perform fine matching and alignment using SStarMatcher */
+      SStarMatcher_matchStars(&matcher, &tr, &sset);
+      image->transform = SStarMatcher_getTransform(&matcher, &sset);
+
+      /* The first fitted distortion is used for all next images */
+      if (fix_distortion && matcher.distortion.order < 2 &&
+          image->transform.type == STr_Polynomial) {
+        s_log(2, "\tFixing lens distortion");
+        matcher.distortion = image->transform.poly;
+      }
+    }
+  }
+
+  if (image->transform.type != STr_Drop) {
+    /* On matching success, update set of stars in SStarMatcher */
+    SStarMatcher_update(&matcher, &image->transform, &sset);
+    brut_ref_stale = 1;
+    /* and update format and size of the result image */
+    extend_result(al, img, &image->transform);
+  }
+
+  /* Cleanup temporary data used during processing of this image */
+  SStarSet_deinit(&sset);
+}
+
+/* ========================================================================= */
+/* Stack aligned image on the result image. The result is a canvas placed at
+ * (x_origin, y_origin) in coordinates of the reference image, and it grows
+ * when the image does not fit in it. */
+static void stack_image(
+  SImage_t           *result,
+  int                *x_origin,
+  int                *y_origin,
+  const SImage_t     *img,
+  const STransform_t *tr,
+  SRemap_t           *remap)
+{
+  SBoundingBox_t bb = STransform_boundingBox(tr, SImage_boundingBox(img));
+  if (result->format == SFmt_Invalid) {
+    /* The first stacked image: the canvas starts at its top-left corner */
+    *x_origin = (int)floorf(bb.minX);
+    *y_origin = (int)floorf(bb.minY);
+    SImage_init(result, 1, 1, img->format);
+    SImage_clear(result);
+  } else if (img->format > result->format) {
+    /* Color image stacked on gray-scale ones: convert the whole canvas */
+    SImage_t converted;
+    SImage_toFormat_at(&converted, result, img->format);
+    SImage_deinit(result);
+    *result = converted;
+  }
+  if (SImage_expand(result, x_origin, y_origin, bb) != SPICA_OK) {
+    s_log(0, "Cannot expand the result image, image skipped");
+    return;
+  }
+
+  /* Shift the image to coordinates of the canvas */
+  STransform_t tr_shift =
+    STransform_shift(-SVec2f((float)*x_origin, (float)*y_origin));
+  STransform_t tr_canvas = STransform_compose(&tr_shift, tr);
+  SImage_stackTrRemap(result, &tr_canvas, img, remap);
+}
+
+/* ========================================================================= */
+/* Load the alignment of the beginning of the sequence, saved by previous
+ * run, together with the state of the star matcher. Returns the number of
+ * images already aligned. */
+static size_t load_alignment(SAlignment_t *al) {
+  if (SAlignment_load(al, NULL, alignment_fname) != SPICA_OK)
+    return 0;
+
+  /* The saved sequence should be a prefix of the current one */
+  size_t i;
+  int ok = al->length <= image_n;
+  for (i = 0; ok && i < al->length; i++)
+    ok = strcmp(al->frames[i].fname, images[i].fname) == 0;
+  if (!ok || SAlignment_load(al, &matcher, alignment_fname) != SPICA_OK) {
+    s_log(0, "%s does not match the sequence, aligning all images",
+      alignment_fname);
+    SAlignment_deinit(al);
+    SAlignment_init(al);
+    return 0;
+  }
+
+  for (i = 0; i < al->length; i++)
+    images[i].transform = al->frames[i].transform;
+  return al->length;
+}
+
+/* Record the alignment of the first n images, and save it together with
+ * the state of the star matcher */
+static void save_alignment(SAlignment_t *al, size_t n) {
+  for (size_t i = al->length; i < n; i++)
+    SAlignment_add(al, images[i].fname, &images[i].transform);
+  if (SAlignment_save(al, &matcher, alignment_fname) != SPICA_OK)
+    s_log(0, "Cannot save the alignment to %s", alignment_fname);
+}
+
 /* ========================================================================= */
 /* main function */
 
@@ -235,146 +628,133 @@ int main(int argc, char **argv) {
   /* Initialize Spica components with default values */
   SStarFinder_init(&finder);
   SSmallChangeAligner_init(&scAligner);
+  SAsterismAligner_init(&astAligner);
+  SRansacAligner_init(&ransacAligner);
   SBrutAligner_init(&brutAligner);
+  brutAligner.refStarN = BRUT_REF_STAR_N;
   SStarMatcher_init(&matcher);
+  SPhaseCorrAligner_init(&pcAligner);
+  SImageLoader_init(&loader);
 
   /* ----------------------------------------------------------------------- */
   /* First pass -- parsing command line options */
   argp_parse(&argp, argc, argv, 0, 0, 0);
 
   /* ----------------------------------------------------------------------- */
-  /* Second pass -- alignment */
+  /* Second pass -- alignment and stacking */
 
   size_t i;
-  /* Format and size of the result image */
-  SImageFormat_t fmt = SFmt_Invalid;
-  SBoundingBox_t bb = SBoundingBox_empty();
-  /* Transformation of previous frame, used by SSmallChangeAligner_t */
-  STransform_t prev_tr = { .type = STr_Drop };
+  /* Transformations of images, and format and size of the result image */
+  SAlignment_t alignment;
+  SAlignment_init(&alignment);
+  /* File names of images to be loaded */
+  const char **fnames = malloc(sizeof(const char *) * (image_n + 1));
+  /* Result image, and its origin in coordinates of the reference image.
+   * It is created by the first stacked image */
+  SImage_t result;
+  SImage_init(&result, 0, 0, SFmt_Invalid);
+  int x_origin = 0;
+  int y_origin = 0;
+  /* Remapping grid of lens distortion, shared by images with the same
+   * distortion */
+  SRemap_t remap;
+  SRemap_init(&remap);
+
+  /* Images aligned by the previous run are only stacked. Next images are
+   * aligned as in the interrupted run, except that asterisms are matched
+   * against the reference stars */
+  size_t start = alignment_fname ? load_alignment(&alignment) : 0;
+  if (start > 0) {
+    s_log(1, "Resuming alignment after %d images", (int)start);
+    SStarSet_t ref;
+    sorted_reference(&ref);
+    SAsterismAligner_setReference(&astAligner, &ref);
+    SStarSet_deinit(&ref);
+  }
+
+  /* Stars found by previous runs are taken from the star cache */
+  if (star_cache_dir) {
+    SStarCache_init(&cache, star_cache_dir, &finder);
+    if (dark_frame)
+      SStarCache_addKey(&cache, dark_frame->data, SImage_dataSize(dark_frame));
+  }
+  for (i = 0; i < image_n; i++) {
+    fnames[i] = images[i].fname;
+    SStarSet_init(&images[i].stars);
+    images[i].cached = i >= start && star_cache_dir != NULL &&
+      SStarCache_load(&cache, images[i].fname, &images[i].stars,
+        NULL, NULL, NULL) == SPICA_OK;
+  }
+  if (SImageLoader_start(&loader, fnames, image_n)) {
+    return 1;
+  }
   
   for (i = 0; i < image_n; i++) {
-    /* Default transformation -- drop the image -- in case of error during
-     * loading an image or insufficient number of stars on it */
-    images[i].transform.type = STr_Drop;
+    if (alignment_fname && i > start && i % ALIGNMENT_SAVE_INTERVAL == 0)
+      save_alignment(&alignment, i);
 
-    /* Load an image */
+    /* Get the next decoded image. The loader returns images in order */
     s_log(1, "%s", images[i].fname);
-    SImage_t img;
-    if (SImage_loadPNG_at(&img, images[i].fname)) {
-      SImage_deinit(&img);
+    SImage_t *img = SImageLoader_next(&loader, NULL);
+    if (img->format == SFmt_Invalid) {
+      if (i >= start)
+        images[i].transform.type = STr_Drop;
+      SStarSet_deinit(&images[i].stars);
+      SImageLoader_release(&loader, img);
       continue;
     }
 
     /* Subtract dark frame, if any */
     if (dark_frame)
-      SImage_sub(&img, 0, 0, dark_frame);
-    
-    /* Find stars */
-    SStarSet_t sset;
-    SStarSet_init(&sset);
-    SStarFinder_findStars_at(&sset, &finder, &img);
-    s_log(2, "\t%d stars found", (int)sset.length);
-
-    /* skip this image, if there are too few stars on it */
-    if (sset.length <= 2) {
-      SStarSet_deinit(&sset);
-      SImage_deinit(&img);
-      continue;
-    }
-
-    if (matcher.sset.length == 0) {
-      /* If it is the first valid image in the sequence, then just use the
-       * identity transformation */
-      images[i].transform.type = STr_Identity;
-    } else {
-      /* Otherwise, try to coarsely align to previously found stars using fast
-       * SSmallChangeAligner algorithm */
-      s_log(4, "\tRunning SSmallChangeAligner");
-      STransform_t tr =
-        SSmallChangeAligner_align(&scAligner, &matcher.sset, &prev_tr, &sset);
-      /* On failure, fallback to slower SBrutAligner algorithm */
-      if (tr.type == STr_Drop) {
-        s_log(3, "\tFallback to SBrutAligner");
-        tr = SBrutAligner_align(&brutAligner, &matcher.sset, &sset);
-      }
-
-      if (tr.type != STr_Drop) {
-        s_log(4, "\tMatching stars");
-        /* Then, perform fine matching and alignment using SStarMatcher */
-        SStarMatcher_matchStars(&matcher, &tr, &sset);
-        images[i].transform = SStarMatcher_getTransform(&matcher, &sset);
-      }
+      SImage_sub(img, 0, 0, dark_frame);
+
+    if (i >= start) {
+      align_image(&images[i], img, &alignment);
+    } else if (use_phase_corr && images[i].transform.type == STr_Identity) {
+      /* The first image aligned by the previous run is the reference of
+       * phase correlation */
+      SPhaseCorrAligner_setReference(&pcAligner, img);
     }
 
     if (images[i].transform.type != STr_Drop) {
       /* Set `prev_tr` to help to align next image */
       prev_tr = images[i].transform;
-      /* On matching success, update set of stars in SStarMatcher */
-      SStarMatcher_update(&matcher, &images[i].transform, &sset);
-      /* and update format and size of the result image */
-      if (img.format > fmt) {
-        fmt = img.format;
-      }
-      bb = SBoundingBox_union(bb,
-        STransform_boundingBox(&images[i].transform,
-          SImage_boundingBox(&img)));
+      /* Stack image on the result */
+      stack_image(&result, &x_origin, &y_origin, img, &images[i].transform,
+        &remap);
     }
 
-    /* Cleanup temporary data used during processing of this image */
-    SStarSet_deinit(&sset);
-    SImage_deinit(&img);
+    SImageLoader_release(&loader, img);
   }
 
+  if (alignment_fname && start < image_n)
+    save_alignment(&alignment, image_n);
+
+  SImageLoader_deinit(&loader);
+  SBrutAligner_deinit(&brutAligner);
+  SRemap_deinit(&remap);
+  free(fnames);
+
   /* If the result image is empty, abort the program */
-  if (SBoundingBox_isEmpty(bb) || fmt == SFmt_Invalid) {
+  SBoundingBox_t bb = alignment.boundingBox;
+  SAlignment_deinit(&alignment);
+  if (SBoundingBox_isEmpty(bb) || result.format == SFmt_Invalid) {
     return 1;
   }
 
-  /* ----------------------------------------------------------------------- */
-  /* Third pass -- stacking */
-
-  /* Compute additional shift transformation that puts most top-left pixel to
-   * (0,0) coordinates */
-  STransform_t tr_shift = STransform_shift(-SVec2f(bb.minX, bb.minY));
-  /* Determine the size of the result image */
-  int width  = (int)(bb.maxX - bb.minX) + 1;
-  int height = (int)(bb.maxY - bb.minY) + 1;
-  /* Create result image, end initialize it with "no data". */
-  SImage_t result;
-  s_log(1, "Creating image of size %d x %d", width, height);
-  SImage_init(&result, width, height, fmt);
-  SImage_clear(&result);
-
-  for (i = 0; i < image_n; i++) {
-    /* Skip images marked with STr_Drop transformation. They are invalid, or
-     * the program was unable to align them */
-    if (images[i].transform.type == STr_Drop) continue;
-    /* Compose transformation with `tr_shift`, in order to fix image
-     * coordinates */
-    images[i].transform = STransform_compose(&tr_shift, &images[i].transform);
-
-    /* Load the image again. Images are loaded twice in order to save memory.
-     * In such approach the entire sequence may be enormously large, because is
-     * only only image is stored in memory at time */
-    s_log(1, "%s", images[i].fname);
-    SImage_t img;
-    if (SImage_loadPNG_at(&img, images[i].fname)) {
-      SImage_deinit(&img);
-      continue;
-    }
-
-    /* Subtract dark frame, again */
-    if (dark_frame)
-      SImage_sub(&img, 0, 0, dark_frame);
-    
-    /* Stack image on the result */
-    SImage_stackTr(&result, &images[i].transform, &img);
-
-    SImage_deinit(&img);
-  }
+  /* Remove unused margins of the result image, left by its growth */
+  int min_x  = (int)floorf(bb.minX);
+  int min_y  = (int)floorf(bb.minY);
+  int width  = (int)ceilf(bb.maxX) - min_x + 1;
+  int height = (int)ceilf(bb.maxY) - min_y + 1;
+  s_log(1, "Result image of size %d x %d", width, height);
+  SImage_crop(&result, min_x - x_origin, min_y - y_origin, width, height);
 
   /* Save the result image */
-  SImage_savePNG(&result, SPF_RGB16, output_fname);
+  if (has_extension(output_fname, ".fits"))
+    SImage_saveFITS(&result, output_fname);
+  else
+    SImage_savePNG(&result, SPF_RGB16, output_fname);
 
   return 0;
 }
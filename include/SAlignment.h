@@ -0,0 +1,123 @@
+/* This file is part of Spica, released under MIT license.
+ * See LICENSE for details.
+ */
+
+/* Author: Piotr Polesiuk, 2022 */
+
+/** \file SAlignment.h
+ * \brief Result of aligning a sequence of images, stored in a file
+ *
+ * Aligning a sequence is much more expensive than stacking it, and its
+ * result is small: a transformation of each image, the format and the
+ * bounding box of the stacked image. SAlignment_t collects them, so they
+ * can be saved in a small versioned file next to the sequence. Such file
+ * allows to stack the sequence again (e.g., with different settings)
+ * without aligning it. Together with the state of SStarMatcher_t, it also
+ * allows to resume interrupted alignment, or to align more images to the
+ * same reference stars.
+ */
+
+#ifndef __SPICA_ALIGNMENT_H__
+#define __SPICA_ALIGNMENT_H__
+
+#include "SBoundingBox.h"
+#include "SCommon.h"
+#include "SImage.h"
+#include "SStarMatcher.h"
+#include "STransform.h"
+
+#include <stddef.h>
+
+/** \brief Aligned image */
+typedef struct SAlignedFrame {
+  /** \brief Name of the image file, owned by SAlignment_t */
+  char        *fname;
+  /** \brief Transformation of the image, or \ref STr_Drop if the image
+   *    could not be aligned */
+  STransform_t transform;
+} SAlignedFrame_t;
+
+/** \brief Result of aligning a sequence of images */
+typedef struct SAlignment {
+  /** \brief Number of aligned images.
+   *
+   * This field should be used read only */
+  size_t           length;
+  /** \brief The number of elements of frames array prepared to holding
+   *    images.
+   *
+   * This field should be used read only. It may be automatically increased
+   * by \ref SAlignment_add function. */
+  size_t           capacity;
+  /** \brief Array of aligned images, in order of the sequence */
+  SAlignedFrame_t *frames;
+  /** \brief Format of the stacked image */
+  SImageFormat_t   format;
+  /** \brief Bounding box of the stacked image, in coordinates of the
+   *    reference image */
+  SBoundingBox_t   boundingBox;
+} SAlignment_t;
+
+/** \brief Initialize already allocated SAlignment_t
+ *
+ * Field       | Default value
+ * ----------- | -------------
+ * length      | 0
+ * format      | SFmt_Invalid
+ * boundingBox | empty
+ *
+ * To deinitialize it, call \ref SAlignment_deinit function.
+ *
+ * \param al Pointer to already allocated SAlignment_t. */
+void SAlignment_init(SAlignment_t *al);
+
+/** \brief Deinitialize SAlignment_t initialized by \ref SAlignment_init
+ *
+ * \param al Pointer to SAlignment_t to be deinitialized */
+void SAlignment_deinit(SAlignment_t *al);
+
+/** \brief Add aligned image at the end of the sequence
+ *
+ * The format and the bounding box are not updated.
+ *
+ * \param al Alignment of the sequence
+ * \param fname Name of the image file. It is copied.
+ * \param tr Transformation of the image */
+void SAlignment_add(
+  SAlignment_t       *al,
+  const char         *fname,
+  const STransform_t *tr);
+
+/** \brief Save the alignment to a file
+ *
+ * The file is written to a temporary file first, and then renamed, so
+ * the alignment may be saved periodically during a long computation: the
+ * file always contains some complete state.
+ *
+ * \param al Alignment of the sequence
+ * \param sm If not NULL, the state of the matcher (see
+ *   \ref SStarMatcher_write) is saved too.
+ * \param fname Name of the file
+ *
+ * \returns \ref SPICA_OK on success, or \ref SPICA_ERROR on error. */
+int SAlignment_save(
+  const SAlignment_t   *al,
+  const SStarMatcher_t *sm,
+  const char           *fname);
+
+/** \brief Load the alignment saved by \ref SAlignment_save
+ *
+ * \param al Initialized SAlignment_t. Its contents is replaced by the
+ *   loaded alignment. It is not changed on error.
+ * \param sm If not NULL, the state of the matcher is replaced by the
+ *   saved one (see \ref SStarMatcher_read). If the file does not contain
+ *   the state of the matcher, it is not changed.
+ * \param fname Name of the file
+ *
+ * \returns \ref SPICA_OK on success, or \ref SPICA_ERROR on error. */
+int SAlignment_load(
+  SAlignment_t   *al,
+  SStarMatcher_t *sm,
+  const char     *fname);
+
+#endif /* __SPICA_ALIGNMENT_H__ */
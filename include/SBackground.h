@@ -0,0 +1,112 @@
+/* This file is part of Spica, released under MIT license.
+ * See LICENSE for details.
+ */
+
+/* Author: Piotr Polesiuk, 2022 */
+
+/** \file SBackground.h
+ * \brief Background and noise model of an image
+ *
+ * The model is computed at low resolution: the image is divided into square
+ * boxes, and for each box the background level (σ-clipped median) and the
+ * noise (σ-clipped, scaled median absolute deviation) are computed. The
+ * obtained mesh is smoothed by 3x3 median filter, and values between mesh
+ * nodes are computed using bicubic interpolation. This is similar to the
+ * background estimation of SExtractor.
+ */
+
+#ifndef __SPICA_BACKGROUND_H__
+#define __SPICA_BACKGROUND_H__
+
+#include "SImage.h"
+#include "SVec.h"
+
+/** \brief Background and noise model of an image */
+typedef struct SBackground {
+  /** \brief Size of the box (in pixels) that corresponds to a single mesh
+   *    node.
+   *
+   * This field should be used read only. */
+  unsigned boxSize;
+  /** \brief Number of mesh nodes in a single row.
+   *
+   * This field should be used read only. */
+  unsigned meshWidth;
+  /** \brief Number of rows of the mesh.
+   *
+   * This field should be used read only. */
+  unsigned meshHeight;
+  /** \brief Background level (normalized brightness) in mesh nodes */
+  float   *level;
+  /** \brief Standard deviation of the noise in mesh nodes */
+  float   *noise;
+} SBackground_t;
+
+/** \brief Initialize already allocated SBackground_t
+ *
+ * Freshly initialized model is empty: it has no mesh nodes, and both
+ * background level and noise are equal to zero everywhere. To deinitialize
+ * it, call \ref SBackground_deinit function.
+ *
+ * \param bkg Pointer to already allocated SBackground_t.
+ *
+ * \sa SBackground_alloc */
+void SBackground_init(SBackground_t *bkg);
+
+/** \brief Deinitialize SBackground_t initialized by \ref SBackground_init
+ *
+ * This function frees only internal resources used by SBackground_t. It does
+ * not free the memory occupied by SBackground_t itself.
+ *
+ * \param bkg Pointer to SBackground_t to be deinitialized
+ *
+ * \sa SBackground_free */
+void SBackground_deinit(SBackground_t *bkg);
+
+/** \brief Allocate and initialize new SBackground_t
+ *
+ * \return Pointer to the newly allocated empty model, or NULL on malloc
+ *   error. The model can be freed with \ref SBackground_free function.
+ *
+ * \sa SBackground_init */
+SBackground_t *SBackground_alloc(void);
+
+/** \brief Free model previously allocated with \ref SBackground_alloc
+ *
+ * \param bkg Pointer to the model. It may be NULL.
+ *
+ * \sa SBackground_deinit */
+void SBackground_free(SBackground_t *bkg);
+
+/** \brief Compute background and noise model of an image
+ *
+ * The previous contents of \p bkg is discarded.
+ *
+ * \param bkg Initialized background model
+ * \param image Image. If it is not in \ref SFmt_Gray format, its gray-scale
+ *   values are used.
+ * \param box_size Size of the box (in pixels) that corresponds to a single
+ *   mesh node. It should be significantly larger than stars on the image.
+ *   Should be greater than 0. */
+void SBackground_estimate(
+  SBackground_t  *bkg,
+  const SImage_t *image,
+  unsigned        box_size);
+
+/** \brief Background level at given position
+ *
+ * \param bkg Background model
+ * \param pos Position on the image
+ *
+ * \return Normalized background brightness interpolated from the mesh */
+float SBackground_level(const SBackground_t *bkg, SVec2f_t pos);
+
+/** \brief Noise level at given position
+ *
+ * \param bkg Background model
+ * \param pos Position on the image
+ *
+ * \return Standard deviation of the noise interpolated from the mesh */
+float SBackground_noise(const SBackground_t *bkg, SVec2f_t pos);
+
+#endif /* __SPICA_BACKGROUND_H__ */
@@ -0,0 +1,78 @@
+/* This file is part of Spica, released under MIT license.
+ * See LICENSE for details.
+ */
+
+/* Author: Piotr Polesiuk, 2022 */
+
+/** \file SBatchAlign.h
+ * \brief Parallel alignment of many star sets against one reference
+ *
+ * In multi-pass workflows, the reference set of stars (e.g., SStarMatcher_t
+ * built during the first pass) does not change, so many star sets can be
+ * aligned against it independently. Functions of this module align them
+ * in parallel, sharing the read-only spatial index of the reference set.
+ */
+
+#ifndef __SPICA_BATCH_ALIGN_H__
+#define __SPICA_BATCH_ALIGN_H__
+
+#include "SCoarseAlign.h"
+#include "SStarMatcher.h"
+
+/** \brief Settings of batch alignment */
+typedef struct SBatchAligner {
+  /** \brief Coarse aligner used when an initial guess of the transformation
+   *    is known */
+  SSmallChangeAligner_t scAligner;
+  /** \brief Coarse aligner used when there is no guess, or
+   *    \ref scAligner fails */
+  SRansacAligner_t      ransacAligner;
+  /** \brief Minimal fraction of stars matched to the reference set, to
+   *    accept the alignment found using the guess. Otherwise, the set is
+   *    aligned again using \ref ransacAligner. */
+  float                 minMatchedRatio;
+  /** \brief Number of threads. Non-positive value means one thread per
+   *    processor. */
+  int                   threadN;
+} SBatchAligner_t;
+
+/** \brief Initialize SBatchAligner_t with default values
+ *
+ * Coarse aligners are initialized with their default values (see
+ * \ref SSmallChangeAligner_init and \ref SRansacAligner_init).
+ *
+ * Field           | Default value
+ * --------------- | -------------
+ * minMatchedRatio | 0.5f
+ * threadN         | 0
+ */
+void SBatchAligner_init(SBatchAligner_t *aligner);
+
+/** \brief Align many star sets against the reference set of a matcher
+ *
+ * Each set is aligned independently: first it is coarsely aligned by
+ * \ref SSmallChangeAligner_t starting from the guess, then its stars are
+ * matched by \ref SStarMatcher_matchStars, and the transformation is
+ * computed by \ref SStarMatcher_getTransform. The slower
+ * \ref SRansacAligner_t is used only when there is no guess, or when too
+ * few stars were matched. The matcher is not updated.
+ *
+ * \param aligner Settings
+ * \param sm Matcher with the reference set of stars
+ * \param ssets Array of \p n star sets. Their stars are matched to the
+ *   reference set, i.e., their index and id fields are set.
+ * \param n Number of star sets
+ * \param guess Array of \p n initial guesses of transformations (e.g., from
+ *   the previous pass), or NULL. Guesses of type \ref STr_Drop are ignored.
+ * \param result Array of \p n transformations, where the results are
+ *   stored. Sets that cannot be aligned get \ref STr_Drop
+ *   transformation. */
+void SBatchAligner_align(
+  const SBatchAligner_t *aligner,
+  const SStarMatcher_t  *sm,
+  SStarSet_t            *ssets,
+  size_t                 n,
+  const STransform_t    *guess,
+  STransform_t          *result);
+
+#endif /* __SPICA_BATCH_ALIGN_H__ */
@@ -14,7 +14,9 @@
 #ifndef __SPICA_COARSE_ALIGN_H__
 #define __SPICA_COARSE_ALIGN_H__
 
+#include "SImage.h"
 #include "SStar.h"
+#include "SStarIndex.h"
 #include "STransform.h"
 
 /** \brief Coarse alignment method based on assumption that transformations
@@ -55,19 +57,55 @@ void SSmallChangeAligner_init(SSmallChangeAligner_t *aligner);
  *
  * \returns Transformation that transforms positions of stars from
  *   \p sset to positions of corresponding stars from \p ref_sset,
- *   or \ref STr_Drop transformation when no matching was found. */
+ *   or \ref STr_Drop transformation when no matching was found.
+ *
+ * \sa SSmallChangeAligner_alignIndexed */
 STransform_t SSmallChangeAligner_align(
   const SSmallChangeAligner_t *aligner,
   const SStarSet_t *ref_sset,
   const STransform_t *prev_tr,
   const SStarSet_t *sset);
 
+/** \brief Run SSmallChangeAligner_t with already indexed reference set
+ *
+ * This function works as \ref SSmallChangeAligner_align, but it uses
+ * given spatial index of the reference set (e.g., index field of
+ * SStarMatcher_t), instead of building a temporary one.
+ *
+ * \param aligner Settings of the aligner
+ * \param ref_sset Reference set of stars
+ * \param ref_index Spatial index of \p ref_sset
+ * \param prev_tr Transformation from the previous frame
+ * \param sset Set of stars
+ *
+ * \returns The same as \ref SSmallChangeAligner_align. */
+STransform_t SSmallChangeAligner_alignIndexed(
+  const SSmallChangeAligner_t *aligner,
+  const SStarSet_t *ref_sset,
+  const SStarIndex_t *ref_index,
+  const STransform_t *prev_tr,
+  const SStarSet_t *sset);
+
+/** \brief Pair of reference stars used by \ref SBrutAligner_t */
+typedef struct SBrutRefPair {
+  /** \brief Squared distance between the stars */
+  float lengthSq;
+  /** \brief Index of the first star */
+  int   a;
+  /** \brief Index of the second star (a < b) */
+  int   b;
+} SBrutRefPair_t;
+
 /** \brief Coarse alignment that tries to match each pair of stars to each pair
  *    of reference stars and picks the best such matching.
  *
  * This method is relatively slow (O(n^6)) but works well in practice. To
  * speed-up matching it is possible to narrow search space by setting how
- * scaling and rotation is should be close to the identity transformation. */
+ * scaling and rotation is should be close to the identity transformation.
+ * Pairs of reference stars are sorted by their length, so only pairs that
+ * respect \ref scaleTol are enumerated for each input pair. The table of
+ * pairs takes O(refStarN^2) memory. It can be built once for many frames
+ * by \ref SBrutAligner_setReference. */
 typedef struct SBrutAligner {
   /** \brief Number of stars from input star set used to find pair that
    *    matches pair from reference set. First \ref starN stars are taken.
@@ -75,7 +113,8 @@ typedef struct SBrutAligner {
   int starN;
   /** \brief Number of stars from reference set used to find matching pair.
    *    First \ref refStarN stars are taken. Negative value means to take
-   *    all stars. */
+   *    all stars. It should not be changed after
+   *    \ref SBrutAligner_setReference. */
   int refStarN;
   /** \brief Number of stars from input star set used to measure quality
    *    of alignment. First \ref rankStarN stars are taken. Negative value
@@ -91,9 +130,29 @@ typedef struct SBrutAligner {
    *    is almost the same as angle in radians. Values greater than 2.0f
    *    means that every rotation is allowed */
   float rotTol;
+  /** \brief Number of threads used by the aligner. Non-positive value
+   *    means one thread per processor. The result does not depend on the
+   *    number of threads. */
+  int   threadN;
+
+  /** \brief Copy of the reference set of stars set by
+   *    \ref SBrutAligner_setReference.
+   *
+   * This field should be used read only. */
+  SStarSet_t      refSset;
+  /** \brief Pairs of the first \ref refStarN reference stars sorted by
+   *    length.
+   *
+   * This field should be used read only. */
+  SBrutRefPair_t *refPairs;
+  /** \brief The number of elements of \ref refPairs.
+   *
+   * This field should be used read only. */
+  size_t          refPairN;
 } SBrutAligner_t;
 
-/** \brief Initialize SBrutAligner_t with default values
+/** \brief Initialize SBrutAligner_t with default values and empty
+ *    reference
  *
  * Field     | Default value
  * --------- | -------------
@@ -103,10 +162,57 @@ typedef struct SBrutAligner {
  * distTol   | 1.5f
  * scaleTol  | 0.1f
  * rotTol    | 3.0f
+ * threadN   | 1
+ *
+ * To deinitialize it, call \ref SBrutAligner_deinit function.
  */
 void SBrutAligner_init(SBrutAligner_t *aligner);
 
+/** \brief Deinitialize SBrutAligner_t initialized by
+ *    \ref SBrutAligner_init
+ *
+ * This function frees only internal resources used by SBrutAligner_t. It
+ * does not free the memory occupied by SBrutAligner_t itself. */
+void SBrutAligner_deinit(SBrutAligner_t *aligner);
+
+/** \brief Set the reference set of stars, and build the table of its pairs
+ *
+ * The reference can be reused for many frames by
+ * \ref SBrutAligner_alignToReference. It should be set again, when the
+ * reference set changes.
+ *
+ * \param aligner Aligner
+ * \param ref_sset Reference set of stars, e.g., from SStarMatcher_t. It
+ *   should be sorted (brightest stars first), since only the first
+ *   \ref refStarN stars form pairs. It is copied, so it may be freed or
+ *   modified later.
+ *
+ * \returns \ref SPICA_OK on success, or \ref SPICA_ERROR when the table
+ *   cannot be allocated. On error the reference is empty. */
+int SBrutAligner_setReference(
+  SBrutAligner_t   *aligner,
+  const SStarSet_t *ref_sset);
+
+/** \brief Run SBrutAligner_t against the reference set by
+ *    \ref SBrutAligner_setReference
+ *
+ * The result is the same as of \ref SBrutAligner_align with the same
+ * reference set, but the table of reference pairs is not built again.
+ *
+ * \param aligner Aligner with already set reference
+ * \param sset Set of stars
+ *
+ * \returns Transformation that transforms positions of stars from
+ *   \p sset to positions of corresponding reference stars, or
+ *   \ref STr_Drop transformation when no matching was found. */
+STransform_t SBrutAligner_alignToReference(
+  const SBrutAligner_t *aligner,
+  const SStarSet_t     *sset);
+
 /** \brief Run SBrutAligner_t
+ *
+ * The table of reference pairs is built for this call only. The reference
+ * set by \ref SBrutAligner_setReference is not used.
  *
  * \param aligner Settings of the aligner
  * \param ref_sset Reference set of stars, e.g., from SStarMatcher_t
@@ -114,10 +220,303 @@ void SBrutAligner_init(SBrutAligner_t *aligner);
  *
  * \returns Transformation that transforms positions of stars from
  *   \p sset to positions of corresponding stars from \p ref_sset,
- *   or \ref STr_Drop transformation when no matching was found. */
+ *   or \ref STr_Drop transformation when no matching was found (or when
+ *   the table of reference pairs cannot be allocated). */
 STransform_t SBrutAligner_align(
   const SBrutAligner_t *aligner,
   const SStarSet_t *ref_sset,
   const SStarSet_t *sset);
 
+/** \brief Coarse alignment by random sampling of pairs of stars (RANSAC).
+ *
+ * In each iteration, two input stars and two reference stars of similar
+ * brightness rank are sampled. If the transformation that maps the former
+ * pair to the latter respects scale and rotation tolerance, its support
+ * (the number of input stars with a reference star nearby) is counted using
+ * a spatial index of the reference set. The search stops, when the best
+ * support found so far implies that a correct sample would have been drawn
+ * with probability \ref confidence. The result is refined by the linear
+ * regression on all supporting stars.
+ *
+ * Unlike \ref SBrutAligner_t, the cost of this method depends mostly on the
+ * fraction of stars present on both images, not on their number. Results
+ * are deterministic for a fixed \ref seed.
+ */
+typedef struct SRansacAligner {
+  /** \brief Number of the brightest input stars that are sampled. Negative
+   *    value means all stars. */
+  int      starN;
+  /** \brief Number of the brightest reference stars that are sampled.
+   *    Negative value means all stars. */
+  int      refStarN;
+  /** \brief Number of the brightest input stars used to count the support
+   *    of the transformation. Negative value means all stars. */
+  int      rankStarN;
+  /** \brief Maximal difference of brightness ranks of input and reference
+   *    star, to sample them as a corresponding pair. */
+  int      rankTol;
+  /** \brief Maximal distance between stars (measured in sigmas) when they
+   *    are treated as same star. */
+  float    distTol;
+  /** \brief Allowed scale tolerance. E.g. 0.1f means 10% error range. */
+  float    scaleTol;
+  /** \brief Allowed rotation tolerance, measured in distance between unit
+   *    vector and its rotated and normalized version, as in
+   *    \ref SBrutAligner_t. Values greater than 2.0f means that every
+   *    rotation is allowed. */
+  float    rotTol;
+  /** \brief Required probability of drawing a correct sample. */
+  float    confidence;
+  /** \brief Maximal number of iterations. */
+  int      maxIter;
+  /** \brief Minimal number of supporting stars, to accept matching
+   *    (otherwise \ref STr_Drop is returned). */
+  int      minStarN;
+  /** \brief Seed of the pseudo-random number generator. */
+  unsigned seed;
+} SRansacAligner_t;
+
+/** \brief Initialize SRansacAligner_t with default values
+ *
+ * Field      | Default value
+ * ---------- | -------------
+ * starN      | 30
+ * refStarN   | 40
+ * rankStarN  | 50
+ * rankTol    | 8
+ * distTol    | 1.5f
+ * scaleTol   | 0.1f
+ * rotTol     | 3.0f
+ * confidence | 0.999f
+ * maxIter    | 100000
+ * minStarN   | 4
+ * seed       | 1
+ */
+void SRansacAligner_init(SRansacAligner_t *aligner);
+
+/** \brief Run SRansacAligner_t
+ *
+ * \param aligner Settings of the aligner
+ * \param ref_sset Reference set of stars, e.g., from SStarMatcher_t
+ * \param sset Set of stars
+ *
+ * \returns Transformation that transforms positions of stars from
+ *   \p sset to positions of corresponding stars from \p ref_sset,
+ *   or \ref STr_Drop transformation when no matching was found.
+ *
+ * \sa SRansacAligner_alignIndexed */
+STransform_t SRansacAligner_align(
+  const SRansacAligner_t *aligner,
+  const SStarSet_t *ref_sset,
+  const SStarSet_t *sset);
+
+/** \brief Run SRansacAligner_t with already indexed reference set
+ *
+ * This function works as \ref SRansacAligner_align, but it uses
+ * given spatial index of the reference set (e.g., index field of
+ * SStarMatcher_t), instead of building a temporary one.
+ *
+ * \param aligner Settings of the aligner
+ * \param ref_sset Reference set of stars
+ * \param ref_index Spatial index of \p ref_sset
+ * \param sset Set of stars
+ *
+ * \returns The same as \ref SRansacAligner_align. */
+STransform_t SRansacAligner_alignIndexed(
+  const SRansacAligner_t *aligner,
+  const SStarSet_t *ref_sset,
+  const SStarIndex_t *ref_index,
+  const SStarSet_t *sset);
+
+/** \brief Triangle of stars used by \ref SAsterismAligner_t */
+typedef struct SAsterism {
+  /** \brief Indices of vertices, ordered by the length of the opposite side
+   *    (the longest first) */
+  int      star[3];
+  /** \brief Shape descriptor: lengths of the second and the third side
+   *    divided by the length of the longest side. It is invariant under
+   *    translation, rotation, and scaling. */
+  SVec2f_t desc;
+  /** \brief Orientation of vertices: 1 for counter-clockwise, -1 for
+   *    clockwise */
+  int      orient;
+  /** \brief Key of the hash-table cell that contains the descriptor */
+  int      key;
+} SAsterism_t;
+
+/** \brief Coarse alignment based on matching triangles of stars.
+ *
+ * Triangles formed by the brightest reference stars are described by
+ * their shape (see \ref SAsterism_t), and stored in a hash table once, by
+ * \ref SAsterismAligner_setReference. Then, for each frame, triangles
+ * formed by its brightest stars are looked up in the table. Each pair of
+ * similar triangles votes for three pairs of corresponding stars. Pairs with
+ * the most votes are used to fit the transformation, which is refined by
+ * iterative rejection of outliers and matching of all stars. The cost of
+ * aligning a frame depends only on \ref starN and the size of the table,
+ * not on the number of reference stars.
+ *
+ * This method does not need any initial guess, and works for arbitrary
+ * rotation and scale, so it is a fast replacement for \ref SBrutAligner_t.
+ */
+typedef struct SAsterismAligner {
+  /** \brief Number of brightest stars of each frame used to form
+   *    triangles. */
+  int   starN;
+  /** \brief Number of brightest reference stars used to form triangles. */
+  int   refStarN;
+  /** \brief Tolerance of triangle descriptors. It should not be changed
+   *    after \ref SAsterismAligner_setReference. */
+  float descTol;
+  /** \brief Maximal distance between stars (measured in sigmas) when they
+   *    are treated as same star. */
+  float distTol;
+  /** \brief Minimal number of matched stars, to accept matching (otherwise
+   *    \ref STr_Drop is returned). */
+  int   minStarN;
+
+  /** \brief Copy of the reference set of stars.
+   *
+   * This field should be used read only. */
+  SStarSet_t   refSset;
+  /** \brief Spatial index of \ref refSset.
+   *
+   * This field should be used read only. */
+  SStarIndex_t refIndex;
+  /** \brief Triangles of reference stars sorted by key.
+   *
+   * This field should be used read only. */
+  SAsterism_t *refAsterisms;
+  /** \brief The number of elements of \ref refAsterisms.
+   *
+   * This field should be used read only. */
+  size_t       refAsterismN;
+} SAsterismAligner_t;
+
+/** \brief Initialize SAsterismAligner_t with default values and empty
+ *    reference
+ *
+ * Field     | Default value
+ * --------- | -------------
+ * starN     | 20
+ * refStarN  | 30
+ * descTol   | 0.01f
+ * distTol   | 1.5f
+ * minStarN  | 4
+ *
+ * To deinitialize it, call \ref SAsterismAligner_deinit function.
+ */
+void SAsterismAligner_init(SAsterismAligner_t *aligner);
+
+/** \brief Deinitialize SAsterismAligner_t initialized by
+ *    \ref SAsterismAligner_init
+ *
+ * This function frees only internal resources used by SAsterismAligner_t.
+ * It does not free the memory occupied by SAsterismAligner_t itself. */
+void SAsterismAligner_deinit(SAsterismAligner_t *aligner);
+
+/** \brief Set the reference set of stars, and build the table of its
+ *    triangles.
+ *
+ * The reference can be reused for many frames. It should be set again,
+ * when the reference set changes significantly.
+ *
+ * \param aligner Aligner
+ * \param ref_sset Reference set of stars, e.g., from SStarMatcher_t. It
+ *   should be sorted (brightest stars first). It is copied, so it may be
+ *   freed or modified later. */
+void SAsterismAligner_setReference(
+  SAsterismAligner_t *aligner,
+  const SStarSet_t   *ref_sset);
+
+/** \brief Run SAsterismAligner_t
+ *
+ * \param aligner Aligner with already set reference
+ * \param sset Set of stars. It should be sorted (brightest stars first).
+ *
+ * \returns Transformation that transforms positions of stars from
+ *   \p sset to positions of corresponding reference stars, or
+ *   \ref STr_Drop transformation when no matching was found. */
+STransform_t SAsterismAligner_align(
+  const SAsterismAligner_t *aligner,
+  const SStarSet_t         *sset);
+
+/** \brief Coarse alignment of images (not stars) by phase correlation.
+ *
+ * Images are scaled down by \ref scale, converted to gray-scale, and
+ * multiplied by the Hann window. The shift between an image and the
+ * reference is found as the peak of the inverse Fourier transform of the
+ * normalized cross-power spectrum, refined to sub-pixel precision by fitting
+ * a parabola. The spectrum of the reference is computed once, by
+ * \ref SPhaseCorrAligner_setReference, so aligning a frame costs one forward
+ * and one inverse FFT.
+ *
+ * This method does not need any stars, so it works on star-poor images,
+ * but it can find only translations (\ref STr_Shift).
+ */
+typedef struct SPhaseCorrAligner {
+  /** \brief Factor of scaling down images before the FFT. It should not be
+   *    changed after \ref SPhaseCorrAligner_setReference. */
+  unsigned  scale;
+  /** \brief Minimal height of the correlation peak, to accept the shift
+   *    (otherwise \ref STr_Drop is returned). The height of the peak is 1.0
+   *    for identical images, and it is close to 0 for unrelated ones. */
+  float     minPeak;
+
+  /** \brief Width of the FFT (a power of two), or 0 if there is no
+   *    reference.
+   *
+   * This field should be used read only. */
+  unsigned  fftWidth;
+  /** \brief Height of the FFT (a power of two).
+   *
+   * This field should be used read only. */
+  unsigned  fftHeight;
+  /** \brief Complex conjugate of the spectrum of the reference image.
+   *
+   * This field should be used read only. */
+  SVec2f_t *refSpectrum;
+} SPhaseCorrAligner_t;
+
+/** \brief Initialize SPhaseCorrAligner_t with default values and empty
+ *    reference
+ *
+ * Field   | Default value
+ * ------- | -------------
+ * scale   | 4
+ * minPeak | 0.05f
+ *
+ * To deinitialize it, call \ref SPhaseCorrAligner_deinit function.
+ */
+void SPhaseCorrAligner_init(SPhaseCorrAligner_t *aligner);
+
+/** \brief Deinitialize SPhaseCorrAligner_t initialized by
+ *    \ref SPhaseCorrAligner_init
+ *
+ * This function frees only internal resources used by SPhaseCorrAligner_t.
+ * It does not free the memory occupied by SPhaseCorrAligner_t itself. */
+void SPhaseCorrAligner_deinit(SPhaseCorrAligner_t *aligner);
+
+/** \brief Set the reference image, and compute its spectrum.
+ *
+ * \param aligner Aligner
+ * \param image Reference image. It is not used after this function
+ *   returns. */
+void SPhaseCorrAligner_setReference(
+  SPhaseCorrAligner_t *aligner,
+  const SImage_t      *image);
+
+/** \brief Run SPhaseCorrAligner_t
+ *
+ * \param aligner Aligner with already set reference
+ * \param image Image to be aligned. It should have the same size as the
+ *   reference image.
+ *
+ * \returns \ref STr_Shift transformation that transforms positions on
+ *   \p image to positions on the reference image, or \ref STr_Drop
+ *   transformation when the correlation peak is too low. */
+STransform_t SPhaseCorrAligner_align(
+  const SPhaseCorrAligner_t *aligner,
+  const SImage_t            *image);
+
 #endif /* __SPICA_COARSE_ALIGN_H__ */
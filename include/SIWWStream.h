@@ -0,0 +1,162 @@
+/* This file is part of Spica, released under MIT license.
+ * See LICENSE for details.
+ */
+
+/* Author: Piotr Polesiuk, 2022 */
+
+/** \file SIWWStream.h
+ * \brief Reading and writing [SIWW](extraDoc/siww.md) files by bands of rows
+ *
+ * Functions like \ref SImage_loadSIWW_at and \ref SImage_saveSIWW move the
+ * whole image at once. SIWWStream_t allows to process images that do not
+ * fit in the memory: the file is read or written sequentially, by bands of
+ * consecutive rows, stored in images of the width of the file. For tiled
+ * files only a single row of tiles is kept in memory.
+ *
+ * Typical reading loop looks like follows.
+ * ~~~~~{.c}
+ * SIWWStream_t stream;
+ * SIWWStream_init(&stream);
+ * if (SIWWStream_openRead(&stream, fname) == SPICA_OK) {
+ *   SImage_t band;
+ *   SImage_init(&band, stream.width, 64, stream.format);
+ *   while (stream.row < stream.height) {
+ *     unsigned y = stream.row;
+ *     if (SIWWStream_read(&stream, &band) != SPICA_OK) break;
+ *     // process rows y, ..., y + 63
+ *   }
+ *   SImage_deinit(&band);
+ * }
+ * SIWWStream_close(&stream);
+ * ~~~~~
+ */
+
+#ifndef __SPICA_SIWW_STREAM_H__
+#define __SPICA_SIWW_STREAM_H__
+
+#include "SImage.h"
+
+/** \brief Internal state of opened SIWWStream_t */
+typedef struct SIWWStreamState SIWWStreamState_t;
+
+/** \brief Stream of rows of [SIWW](extraDoc/siww.md) file */
+typedef struct SIWWStream {
+  /** \brief Version of written files: 1 (plain) or 2 (tiled). It is used
+   *    by \ref SIWWStream_openWrite. */
+  int                version;
+  /** \brief Width of tiles of written files. It is used by
+   *    \ref SIWWStream_openWrite. */
+  unsigned           tileWidth;
+  /** \brief Height of tiles of written files. Written rows are buffered,
+   *    until the whole row of tiles is complete. It is used by
+   *    \ref SIWWStream_openWrite. */
+  unsigned           tileHeight;
+  /** \brief If non-zero, tiles of written files are compressed. It is used
+   *    by \ref SIWWStream_openWrite. */
+  int                compress;
+
+  /** \brief Format of the image.
+   *
+   * This field should be used read only. */
+  SImageFormat_t     format;
+  /** \brief Width of the image.
+   *
+   * This field should be used read only. */
+  unsigned           width;
+  /** \brief Height of the image.
+   *
+   * This field should be used read only. */
+  unsigned           height;
+  /** \brief The next row to be read or written.
+   *
+   * This field should be used read only. */
+  unsigned           row;
+  /** \brief Internal state, or NULL when the stream is not opened.
+   *
+   * This field should be used read only. */
+  SIWWStreamState_t *state;
+} SIWWStream_t;
+
+/** \brief Initialize already allocated SIWWStream_t
+ *
+ * Field       | Default value
+ * ----------- | -------------
+ * version     | 2
+ * tileWidth   | 256
+ * tileHeight  | 32
+ * compress    | 1
+ *
+ * To close the stream (and deinitialize it), call \ref SIWWStream_close
+ * function.
+ *
+ * \param stream Pointer to already allocated SIWWStream_t. */
+void SIWWStream_init(SIWWStream_t *stream);
+
+/** \brief Open [SIWW](extraDoc/siww.md) file for reading
+ *
+ * Both plain and tiled files can be read. On success, format and size of
+ * the image are available in the fields of the stream.
+ *
+ * \param stream Initialized stream, that is not opened
+ * \param fname Name of the file
+ *
+ * \returns \ref SPICA_OK on success, or \ref SPICA_ERROR on error. */
+int SIWWStream_openRead(SIWWStream_t *stream, const char *fname);
+
+/** \brief Create [SIWW](extraDoc/siww.md) file for writing
+ *
+ * \param stream Initialized stream, that is not opened
+ * \param fname Name of the file
+ * \param format Format of the image (not \ref SFmt_Invalid)
+ * \param width Width of the image (at most 65535)
+ * \param height Height of the image (at most 65535)
+ *
+ * \returns \ref SPICA_OK on success, or \ref SPICA_ERROR on error. */
+int SIWWStream_openWrite(
+  SIWWStream_t  *stream,
+  const char    *fname,
+  SImageFormat_t format,
+  unsigned       width,
+  unsigned       height);
+
+/** \brief Read the next band of rows
+ *
+ * Reads band->height rows, starting from the row given by the row field
+ * of the stream, and advances the stream. Rows out of the image have no
+ * data (zero weight).
+ *
+ * \param stream Stream opened for reading
+ * \param band Image of the same format and width as the stream
+ *
+ * \returns \ref SPICA_OK on success, or \ref SPICA_ERROR on error. */
+int SIWWStream_read(SIWWStream_t *stream, SImage_t *band);
+
+/** \brief Move the stream opened for reading to the given row
+ *
+ * \returns \ref SPICA_OK on success, or \ref SPICA_ERROR on error. */
+int SIWWStream_seek(SIWWStream_t *stream, unsigned row);
+
+/** \brief Write the next band of rows
+ *
+ * Writes band->height rows (or fewer rows, when the image ends), starting
+ * from the row given by the row field of the stream, and advances the
+ * stream.
+ *
+ * \param stream Stream opened for writing
+ * \param band Image of the same format and width as the stream
+ *
+ * \returns \ref SPICA_OK on success, or \ref SPICA_ERROR on error. */
+int SIWWStream_write(SIWWStream_t *stream, const SImage_t *band);
+
+/** \brief Close the stream
+ *
+ * Written files are completed: rows that were not written have no data.
+ * The stream can be opened again afterwards.
+ *
+ * \param stream Initialized stream. It may be not opened.
+ *
+ * \returns \ref SPICA_OK on success, or \ref SPICA_ERROR when the file could
+ *   not be completed. */
+int SIWWStream_close(SIWWStream_t *stream);
+
+#endif /* __SPICA_SIWW_STREAM_H__ */
@@ -25,6 +25,7 @@
 
 #include "SBoundingBox.h"
 #include "SCommon.h"
+#include "SRemap.h"
 #include "SVec.h"
 #include "STransform.h"
 
@@ -121,6 +122,28 @@ void SImage_init(
  * \sa SImage_free */
 void SImage_deinit(SImage_t *image);
 
+/** \brief Change the size and format of already initialized SImage_t
+ *
+ * The buffer of the image is reused when it has exactly the size needed
+ * for the new dimensions and format, so repeatedly loading frames of the
+ * same size does not allocate memory. Otherwise the image is
+ * deinitialized and initialized again, as by \ref SImage_init.
+ *
+ * The data of the image is not preserved.
+ *
+ * \param image Pointer to initialized SImage_t (it may be an
+ *   \ref SFmt_Invalid image).
+ * \param width  Width of an image (in pixels).
+ * \param height Height of an image (in pixels).
+ * \param format Format of an image. It may be ignored on error.
+ *
+ * \sa SImage_init */
+void SImage_reinit(
+  SImage_t      *image,
+  unsigned       width,
+  unsigned       height,
+  SImageFormat_t format);
+
 /** \brief Allocate and initialize new SImage_t
  *
  * When \p width or \p height are invalid, or system is unable to allocate
@@ -262,6 +285,57 @@ void SImage_scaleDown_at(
  * \sa SImage_scaleDown_at */
 SImage_t *SImage_scaleDown(const SImage_t *image, unsigned factor);
 
+/** \brief Grow the image, so it covers given bounding box
+ *
+ * The image is treated as a canvas placed at (\p *x_origin,
+ * \p *y_origin), i.e., its pixel (x, y) corresponds to the point
+ * (x + \p *x_origin, y + \p *y_origin). If some pixels covered by \p bb
+ * are outside the image, new pixels (with no data) are added on sides of
+ * the image, and the origin is moved accordingly. Contents of existing
+ * pixels is preserved.
+ *
+ * The image grows by at least half of its size in each direction it grows,
+ * so growing the image by many small bounding boxes (e.g., stacking
+ * images as they are aligned) takes amortized linear time. Use
+ * \ref SImage_crop to remove unused margins afterwards.
+ *
+ * \param image Image (not \ref SFmt_Invalid)
+ * \param x_origin X coordinate of the origin of the image
+ * \param y_origin Y coordinate of the origin of the image
+ * \param bb Bounding box that should be covered by the image
+ *
+ * \returns \ref SPICA_OK on success, or \ref SPICA_ERROR when the image
+ *   would be too large, or on malloc error. On error the image and its
+ *   origin are not changed.
+ *
+ * \sa SImage_crop */
+int SImage_expand(
+  SImage_t      *image,
+  int           *x_origin,
+  int           *y_origin,
+  SBoundingBox_t bb);
+
+/** \brief Crop the image to given rectangle
+ *
+ * Parts of the rectangle outside the image have no data.
+ *
+ * \param image Image (not \ref SFmt_Invalid)
+ * \param x X coordinate of the top-left corner of the rectangle
+ * \param y Y coordinate of the top-left corner of the rectangle
+ * \param width Width of the rectangle (positive)
+ * \param height Height of the rectangle (positive)
+ *
+ * \returns \ref SPICA_OK on success, or \ref SPICA_ERROR on error. On
+ *   error the image is not changed.
+ *
+ * \sa SImage_expand */
+int SImage_crop(
+  SImage_t *image,
+  int       x,
+  int       y,
+  unsigned  width,
+  unsigned  height);
+
 /** @} */
 /* ========================================================================= */
 /** @name Data access
@@ -567,6 +641,47 @@ void SImage_stackTrInv(
   const STransform_t *tr,
   const SImage_t     *src);
 
+/** \brief Stack transformed image on another, using a remapping grid
+ *
+ * This function does the same as \ref SImage_stackTr. For
+ * \ref STr_Polynomial transformations, the inverse of the distortion is not
+ * evaluated for each pixel, but it is interpolated from the grid kept in
+ * \p remap. The grid is rebuilt only when the distortion changes, so it is
+ * shared by all images taken with the same optics.
+ *
+ * \param tgt Image on which pixels are stacked
+ * \param tr  Transformation that transforms coordinates on \p src to
+ *   corresponding coordinates on \p tgt
+ * \param src Source image
+ * \param remap Remapping grid. If it is NULL, a temporary grid is used.
+ *
+ * \sa SImage_stackTr, SImage_stackTrInvRemap */
+void SImage_stackTrRemap(
+  SImage_t           *tgt,
+  const STransform_t *tr,
+  const SImage_t     *src,
+  SRemap_t           *remap);
+
+/** \brief Stack transformed image on another using inversed transformation
+ *    and a remapping grid
+ *
+ * This function does the same as \ref SImage_stackTrInv, but the
+ * distortion of \ref STr_Polynomial transformations is interpolated from
+ * the grid kept in \p remap.
+ *
+ * \param tgt Image on which pixels are stacked
+ * \param tr  Transformation that transforms coordinates on \p tgt to
+ *   corresponding coordinates on \p src
+ * \param src Source image
+ * \param remap Remapping grid. If it is NULL, a temporary grid is used.
+ *
+ * \sa SImage_stackTrInv, SImage_stackTrRemap */
+void SImage_stackTrInvRemap(
+  SImage_t           *tgt,
+  const STransform_t *tr,
+  const SImage_t     *src,
+  SRemap_t           *remap);
+
 /** \brief Apply mask on image
  *
  * Applying mask is a multiplication both pixel values and weight by a 
@@ -855,6 +970,51 @@ void SImage_invert(SImage_t *image);
  * \sa SImage_loadPNG */
 int SImage_loadPNG_at(SImage_t *image, const char *fname);
 
+/** \brief load PNG image, reusing the buffer of \p image
+ *
+ * It works like \ref SImage_loadPNG_at, but \p image must be
+ * initialized (e.g., by a previous load), and its buffer is reused when the
+ * loaded image has the same size, as in \ref SImage_reinit. It is useful for
+ * loading sequences of frames.
+ *
+ * \param image Pointer to initialized SImage_t
+ * \param fname File name of the PNG image
+ *
+ * \return \ref SPICA_OK on success or \ref SPICA_ERROR on fail. On error the
+ *   \p image is deinitialized, and initialized as \ref SFmt_Invalid image.
+ *
+ * \sa SImage_loadPNG_at */
+int SImage_loadPNG_into(SImage_t *image, const char *fname);
+
+/** \brief load PNG image as a gray-scale image, optionally binned
+ *
+ * Rows are converted to gray-scale (as by \ref SImage_toFormat) while they
+ * are decoded, and they are also accumulated into the \p binned image,
+ * which is the same as the result of \ref SImage_scaleDown of the gray-scale
+ * image. The image in the format of the file is never stored in memory.
+ * Buffers of \p gray and \p binned images are reused, as by
+ * \ref SImage_reinit.
+ *
+ * \param gray Initialized image for the gray-scale image, or NULL if it is
+ *   not needed.
+ * \param binned Initialized image for the binned gray-scale image. It is
+ *   ignored when \p factor is 0.
+ * \param factor Binning factor, or 0 for no binning
+ * \param format If not NULL, the format of the image stored in the file is
+ *   written there.
+ * \param fname File name of the PNG image
+ *
+ * \return \ref SPICA_OK on success or \ref SPICA_ERROR on fail. On error the
+ *   images are deinitialized, and initialized as \ref SFmt_Invalid images.
+ *
+ * \sa SImage_loadPNG_into */
+int SImage_loadPNGGray_into(
+  SImage_t       *gray,
+  SImage_t       *binned,
+  unsigned        factor,
+  SImageFormat_t *format,
+  const char     *fname);
+
 /** \brief load PNG image from file.
  *
  * \param fname File name of the PNG image
@@ -878,6 +1038,9 @@ int SImage_savePNG(
   const char     *fname);
 
 /** \brief load [SIWW](extraDoc/siww.md) image int allocated \ref SImage_t
+ *
+ * Both plain (version 1) and tiled (version 2) files are supported. Tiles
+ * of version 2 files are decompressed in parallel.
  *
  * \param image Pointer to the SImage_t structure. The \ref SImage_loadSIWW_at
  *   will initialize this memory using \ref SImage_init function. If \p image
@@ -890,6 +1053,52 @@ int SImage_savePNG(
  * \sa SImage_loadSIWW */
 int SImage_loadSIWW_at(SImage_t *image, const char *fname);
 
+/** \brief load [SIWW](extraDoc/siww.md) image, reusing the buffer of \p image
+ *
+ * It works like \ref SImage_loadSIWW_at, but \p image must be
+ * initialized (e.g., by a previous load), and its buffer is reused when the
+ * loaded image has the same size, as in \ref SImage_reinit. It is useful for
+ * loading sequences of frames.
+ *
+ * \param image Pointer to initialized SImage_t
+ * \param fname File name of the [SIWW](extraDoc/siww.md) image
+ *
+ * \return \ref SPICA_OK on success or \ref SPICA_ERROR on fail. On error the
+ *   \p image is deinitialized, and initialized as \ref SFmt_Invalid image.
+ *
+ * \sa SImage_loadSIWW_at */
+int SImage_loadSIWW_into(SImage_t *image, const char *fname);
+
+/** \brief load [SIWW](extraDoc/siww.md) image as a gray-scale image,
+ *    optionally binned
+ *
+ * Rows are converted to gray-scale (as by \ref SImage_toFormat) while they
+ * are decoded, and they are also accumulated into the \p binned image,
+ * which is the same as the result of \ref SImage_scaleDown of the gray-scale
+ * image. The image in the format of the file is never stored in memory:
+ * the file is read by bands of rows (see \ref SIWWStream.h). Buffers of
+ * \p gray and \p binned images are reused, as by \ref SImage_reinit.
+ *
+ * \param gray Initialized image for the gray-scale image, or NULL if it is
+ *   not needed.
+ * \param binned Initialized image for the binned gray-scale image. It is
+ *   ignored when \p factor is 0.
+ * \param factor Binning factor, or 0 for no binning
+ * \param format If not NULL, the format of the image stored in the file is
+ *   written there.
+ * \param fname File name of the [SIWW](extraDoc/siww.md) image
+ *
+ * \return \ref SPICA_OK on success or \ref SPICA_ERROR on fail. On error the
+ *   images are deinitialized, and initialized as \ref SFmt_Invalid images.
+ *
+ * \sa SImage_loadSIWW_into */
+int SImage_loadSIWWGray_into(
+  SImage_t       *gray,
+  SImage_t       *binned,
+  unsigned        factor,
+  SImageFormat_t *format,
+  const char     *fname);
+
 /** \brief load [SIWW](extraDoc/siww.md) image from file.
  *
  * \param fname File name of the [SIWW](extraDoc/siww.md) image
@@ -900,7 +1109,37 @@ int SImage_loadSIWW_at(SImage_t *image, const char *fname);
  * \sa SImage_loadSIWW_at */
 SImage_t *SImage_loadSIWW(const char *fname);
 
+/** \brief load a rectangular region of [SIWW](extraDoc/siww.md) image
+ *
+ * For tiled (version 2) files, only tiles that intersect the region are
+ * read and decompressed (in parallel). Parts of the region that lie out of
+ * the image have no data (zero weight).
+ *
+ * \param image Pointer to the SImage_t structure. It will be initialized
+ *   as an image of size \p width × \p height, using \ref SImage_init
+ *   function. If \p image already contains an image, the
+ *   \ref SImage_deinit should be called first.
+ * \param fname File name of the [SIWW](extraDoc/siww.md) image
+ * \param x Column of the image that becomes the first column of the region
+ * \param y Row of the image that becomes the first row of the region
+ * \param width Width of the region
+ * \param height Height of the region
+ *
+ * \return \ref SPICA_OK on success or \ref SPICA_ERROR on fail. On error the
+ *   \p image is initialized as \ref SFmt_Invalid image.
+ *
+ * \sa SImage_loadSIWW_at */
+int SImage_loadSIWWRegion(
+  SImage_t   *image,
+  const char *fname,
+  int         x,
+  int         y,
+  unsigned    width,
+  unsigned    height);
+
 /** \brief save image into [SIWW](extraDoc/siww.md) file.
+ *
+ * The image is saved as a plain (version 1) file.
  *
  * \param image Image to be saved
  * \param fname Name of the output file
@@ -908,6 +1147,95 @@ SImage_t *SImage_loadSIWW(const char *fname);
  * \return \ref SPICA_OK on success or \ref SPICA_ERROR on fail. */
 int SImage_saveSIWW(const SImage_t *image, const char *fname);
 
+/** \brief save image into tiled [SIWW](extraDoc/siww.md) file (version 2).
+ *
+ * Tiles are compressed in parallel. Regions of such files can be loaded by
+ * \ref SImage_loadSIWWRegion without reading the whole file.
+ *
+ * \param image Image to be saved. Its width and height must not exceed
+ *   65535.
+ * \param fname Name of the output file
+ * \param tileWidth Width of tiles (0 means 256)
+ * \param tileHeight Height of tiles (0 means 256)
+ * \param compress If non-zero, tiles are byte-shuffled and compressed by
+ *   deflate.
+ *
+ * \return \ref SPICA_OK on success or \ref SPICA_ERROR on fail. */
+int SImage_saveSIWWTiled(
+  const SImage_t *image,
+  const char     *fname,
+  unsigned        tileWidth,
+  unsigned        tileHeight,
+  int             compress);
+
+/** \brief load FITS image into allocated \ref SImage_t
+ *
+ * Images with 2 axes are loaded as \ref SFmt_Gray images, and images with
+ * 3 axes, where the third axis has length 3, as color images. Pixels are
+ * taken from the primary HDU, or from the first image extension when the
+ * primary HDU is empty. All data types (BITPIX 8, 16, 32, 64, -32, and -64)
+ * are supported, and scaled by BZERO and BSCALE keywords. Integer data
+ * is additionally normalized as in PNG files, so unsigned 16-bit FITS and
+ * PNG images of the same data are loaded identically. Floating point data
+ * is loaded as is.
+ *
+ * Weights of pixels are read from the image extension named WEIGHT, if
+ * any, of the same width and height. It may contain a single plane, or one
+ * plane per channel (the image is loaded as \ref SFmt_SeparateRGB then).
+ * Otherwise all weights are equal to 1. Rows are loaded in the order of the
+ * file, without flipping the image.
+ *
+ * \param image Pointer to the SImage_t structure. The \ref SImage_loadFITS_at
+ *   will initialize this memory using \ref SImage_init function. If \p image
+ *   already contains an image, the \ref SImage_deinit should be called first.
+ * \param fname File name of the FITS image
+ *
+ * \return \ref SPICA_OK on success or \ref SPICA_ERROR on fail. On error the
+ *   \p image is initialized as \ref SFmt_Invalid image.
+ *
+ * \sa SImage_loadFITS */
+int SImage_loadFITS_at(SImage_t *image, const char *fname);
+
+/** \brief load FITS image, reusing the buffer of \p image
+ *
+ * It works like \ref SImage_loadFITS_at, but \p image must be
+ * initialized (e.g., by a previous load), and its buffer is reused when the
+ * loaded image has the same size, as in \ref SImage_reinit. It is useful for
+ * loading sequences of frames.
+ *
+ * \param image Pointer to initialized SImage_t
+ * \param fname File name of the FITS image
+ *
+ * \return \ref SPICA_OK on success or \ref SPICA_ERROR on fail. On error the
+ *   \p image is deinitialized, and initialized as \ref SFmt_Invalid image.
+ *
+ * \sa SImage_loadFITS_at */
+int SImage_loadFITS_into(SImage_t *image, const char *fname);
+
+/** \brief load FITS image from file.
+ *
+ * \param fname File name of the FITS image
+ *
+ * \return newly allocated \ref SImage_t. The image should be freed using
+ *   \ref SImage_free function.
+ *
+ * \sa SImage_loadFITS_at */
+SImage_t *SImage_loadFITS(const char *fname);
+
+/** \brief save image into FITS file.
+ *
+ * Normalized values of pixels are saved as 32-bit floats in the primary
+ * HDU, so other programs see the image as is, and their weights in the image
+ * extension named WEIGHT. \ref SImage_loadFITS_at multiplies them back, so
+ * the values of loaded pixels may differ from the saved ones by float
+ * rounding errors. Weights are saved exactly.
+ *
+ * \param image Image to be saved
+ * \param fname Name of the output file
+ *
+ * \return \ref SPICA_OK on success or \ref SPICA_ERROR on fail. */
+int SImage_saveFITS(const SImage_t *image, const char *fname);
+
 /** @} */
 /* ========================================================================= */
 /** @name Image metadata and statistics
@@ -0,0 +1,149 @@
+/* This file is part of Spica, released under MIT license.
+ * See LICENSE for details.
+ */
+
+/* Author: Piotr Polesiuk, 2022 */
+
+/** \file SImageLoader.h
+ * \brief Parallel prefetching of image files
+ *
+ * Decoding compressed images (e.g., inflating PNG files) takes a large part
+ * of the processing time of an image sequence, and it runs on a single
+ * core. SImageLoader_t decodes images ahead of time on a pool of worker
+ * threads, while the caller processes earlier frames. Frames are returned
+ * in the order of file names, through a bounded queue, so at most
+ * queueLength decoded images are kept in memory at once.
+ *
+ * PNG, [SIWW](extraDoc/siww.md), and FITS files are supported. The type of
+ * a file is recognized by its contents.
+ *
+ * When only stars are needed, frames can be decoded directly to gray-scale
+ * images, optionally together with their binned copies (see gray and
+ * binning fields, and \ref SStarFinder_findStarsBinned_at).
+ */
+
+#ifndef __SPICA_IMAGE_LOADER_H__
+#define __SPICA_IMAGE_LOADER_H__
+
+#include "SImage.h"
+
+/** \brief Internal state of running SImageLoader_t */
+typedef struct SImageLoaderState SImageLoaderState_t;
+
+/** \brief Parallel loader of a sequence of images */
+typedef struct SImageLoader {
+  /** \brief Number of worker threads. Non-positive value means one thread
+   *    per processor. It is used by \ref SImageLoader_start. */
+  int                  threadN;
+  /** \brief Maximal number of frames decoded ahead, or held by the caller
+   *    (at least 1). It is used by \ref SImageLoader_start. */
+  int                  queueLength;
+  /** \brief If non-zero, frames are decoded directly to gray-scale images
+   *    (see \ref SImage_loadPNGGray_into). It is used by
+   *    \ref SImageLoader_start. */
+  int                  gray;
+  /** \brief Binning factor of gray-scale frames, or 0. If it is positive,
+   *    binned frames are available through \ref SImageLoader_binned. It is
+   *    used by \ref SImageLoader_start. */
+  unsigned             binning;
+  /** \brief Internal state, or NULL when the loader is not started.
+   *
+   * This field should be used read only. */
+  SImageLoaderState_t *state;
+} SImageLoader_t;
+
+/** \brief Initialize already allocated SImageLoader_t
+ *
+ * Field       | Default value
+ * ----------- | -------------
+ * threadN     | 0
+ * queueLength | 4
+ * gray        | 0
+ * binning     | 0
+ *
+ * To deinitialize it, call \ref SImageLoader_deinit function.
+ *
+ * \param loader Pointer to already allocated SImageLoader_t. */
+void SImageLoader_init(SImageLoader_t *loader);
+
+/** \brief Deinitialize SImageLoader_t initialized by \ref SImageLoader_init
+ *
+ * Worker threads are stopped, and all frames that were not returned yet
+ * are discarded. Frames obtained by \ref SImageLoader_next become invalid.
+ *
+ * \param loader Pointer to SImageLoader_t to be deinitialized */
+void SImageLoader_deinit(SImageLoader_t *loader);
+
+/** \brief Start loading a sequence of images
+ *
+ * If the loader is already running, the previous sequence is discarded
+ * first, as by \ref SImageLoader_deinit.
+ *
+ * \param loader Loader
+ * \param fnames Array of \p n file names. The array and names must be
+ *   valid until the loader is deinitialized or started again.
+ * \param n Number of files
+ *
+ * \returns \ref SPICA_OK on success, or \ref SPICA_ERROR when the loader
+ *   cannot be started (e.g., on malloc error). */
+int SImageLoader_start(
+  SImageLoader_t    *loader,
+  const char *const *fnames,
+  size_t             n);
+
+/** \brief Get the next frame of the sequence
+ *
+ * This function waits until the next frame is decoded. Frames that cannot
+ * be loaded are returned as images of \ref SFmt_Invalid format. The caller
+ * should give frames back by \ref SImageLoader_release. It may keep up to
+ * queueLength frames at once, but the next frame can be obtained only while
+ * it keeps fewer than queueLength frames.
+ *
+ * \param loader Started loader
+ * \param index If not NULL, the position of the frame in the sequence is
+ *   stored there.
+ *
+ * \returns Pointer to the image owned by the loader, or NULL when all frames
+ *   were returned, or when the caller keeps queueLength frames (the next
+ *   frame would never be decoded then). */
+SImage_t *SImageLoader_next(SImageLoader_t *loader, size_t *index);
+
+/** \brief Give back a frame obtained by \ref SImageLoader_next
+ *
+ * Its slot in the queue is used for decoding one of the next frames. The
+ * buffer of the image is reused for the next frame, if it has the same size,
+ * so loading a sequence of frames of equal size does not allocate memory.
+ *
+ * \param loader Loader
+ * \param image Image returned by \ref SImageLoader_next */
+void SImageLoader_release(SImageLoader_t *loader, SImage_t *image);
+
+/** \brief Binned copy of a frame obtained by \ref SImageLoader_next
+ *
+ * \param loader Loader
+ * \param image Image returned by \ref SImageLoader_next, and not released
+ *   yet
+ *
+ * \returns The gray-scale frame scaled down by the binning factor (see
+ *   binning field of SImageLoader_t), or NULL when frames are not binned. It
+ *   is valid until the frame is released. */
+const SImage_t *SImageLoader_binned(
+  const SImageLoader_t *loader,
+  const SImage_t       *image);
+
+/** \brief Format of the file of a frame obtained by \ref SImageLoader_next
+ *
+ * It differs from the format of the frame, when frames are decoded to
+ * gray-scale images.
+ *
+ * \param loader Loader
+ * \param image Image returned by \ref SImageLoader_next, and not released
+ *   yet
+ *
+ * \returns Format of the image stored in the file, or \ref SFmt_Invalid
+ *   when the file could not be loaded. */
+SImageFormat_t SImageLoader_fileFormat(
+  const SImageLoader_t *loader,
+  const SImage_t       *image);
+
+#endif /* __SPICA_IMAGE_LOADER_H__ */
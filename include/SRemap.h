@@ -0,0 +1,116 @@
+/* This file is part of Spica, released under MIT license.
+ * See LICENSE for details.
+ */
+
+/* Author: Piotr Polesiuk, 2022 */
+
+/** \file SRemap.h
+ * \brief Cached remapping of positions by polynomial distortion
+ *
+ * Evaluating polynomial distortion (and especially its inverse) for each
+ * pixel of a stacked image is slow. SRemap_t keeps the distortion evaluated
+ * exactly at nodes of a coarse grid, and positions between nodes are
+ * interpolated bilinearly. The grid depends only on the distortion, so
+ * a single SRemap_t can be reused for all images taken with the same
+ * optics.
+ */
+
+#ifndef __SPICA_REMAP_H__
+#define __SPICA_REMAP_H__
+
+#include "SBoundingBox.h"
+#include "STransform.h"
+
+#include <stddef.h>
+
+/** \brief Distortion evaluated on a regular grid */
+typedef struct SRemap {
+  /** \brief Distance between grid nodes (in pixels).
+   *
+   * Changing it causes rebuilding of the grid on the next call to
+   * \ref SRemap_prepare. */
+  unsigned         step;
+  /** \brief Non-zero, when the grid keeps the inverse of the distortion.
+   *
+   * This field should be used read only. */
+  int              inverse;
+  /** \brief Distortion evaluated on the grid.
+   *
+   * This field should be used read only. */
+  STransformPoly_t poly;
+  /** \brief Area covered by the grid.
+   *
+   * This field should be used read only. */
+  SBoundingBox_t   area;
+  /** \brief Distance between nodes of the current grid.
+   *
+   * This field should be used read only. */
+  unsigned         gridStep;
+  /** \brief Number of columns of grid nodes.
+   *
+   * This field should be used read only. */
+  unsigned         gridWidth;
+  /** \brief Number of rows of grid nodes.
+   *
+   * This field should be used read only. */
+  unsigned         gridHeight;
+  /** \brief Distorted positions of grid nodes (row by row) */
+  SVec2f_t        *grid;
+} SRemap_t;
+
+/** \brief Initialize already allocated SRemap_t
+ *
+ * Freshly initialized SRemap_t has no grid.
+ *
+ * Field | Default value
+ * ----- | -------------
+ * step  | 32
+ *
+ * To deinitialize it, call \ref SRemap_deinit function.
+ *
+ * \param remap Pointer to already allocated SRemap_t. */
+void SRemap_init(SRemap_t *remap);
+
+/** \brief Deinitialize SRemap_t initialized by \ref SRemap_init
+ *
+ * This function frees only internal resources used by SRemap_t. It does
+ * not free the memory occupied by SRemap_t itself.
+ *
+ * \param remap Pointer to SRemap_t to be deinitialized */
+void SRemap_deinit(SRemap_t *remap);
+
+/** \brief Prepare the grid for given distortion and area
+ *
+ * The grid is rebuilt only if the current one was built for a different
+ * distortion or direction, it does not cover \p area, or the step has
+ * changed.
+ *
+ * \param remap Remapping structure
+ * \param poly Distortion
+ * \param inverse If non-zero, the inverse of the distortion is evaluated
+ *   (using \ref STransformPoly_applyInverse).
+ * \param area Area where positions will be remapped
+ *
+ * \returns 1 when the grid was rebuilt, and 0 when it was reused. */
+int SRemap_prepare(
+  SRemap_t               *remap,
+  const STransformPoly_t *poly,
+  int                     inverse,
+  SBoundingBox_t          area);
+
+/** \brief Remap an array of positions
+ *
+ * Positions outside of the area of the grid are extrapolated from the
+ * nearest cell.
+ *
+ * \param remap Remapping structure with prepared grid
+ * \param src Array of \p n positions
+ * \param dst Array of \p n remapped positions. It may be equal to \p src.
+ * \param n Number of positions */
+void SRemap_apply(
+  const SRemap_t *remap,
+  const SVec2f_t *src,
+  SVec2f_t       *dst,
+  size_t          n);
+
+#endif /* __SPICA_REMAP_H__ */
@@ -11,9 +11,11 @@
 #ifndef __SPICA_STAR_H__
 #define __SPICA_STAR_H__
 
+#include "SCommon.h"
 #include "SVec.h"
 
 #include <stddef.h>
+#include <stdio.h>
 
 /** \brief Representation of a star on an image */
 typedef struct SStar {
@@ -23,8 +25,24 @@ typedef struct SStar {
   float    brightness;
   /** \brief background brightness */
   float    bias;
-  /** \brief sigma of fit gaussian function */
+  /** \brief sigma of fit gaussian function
+   *
+   * For elliptical stars, it is a geometric mean of \ref sigmaX and
+   * \ref sigmaY. */
   float    sigma;
+  /** \brief sigma of fit elliptical gaussian function along its first
+   *    (longer) axis.
+   *
+   * This field and fields \ref sigmaY and \ref theta are set by fitting
+   * procedures that fit elliptical gaussian function. For circular stars,
+   * both \ref sigmaX and \ref sigmaY are equal to \ref sigma. */
+  float    sigmaX;
+  /** \brief sigma of fit elliptical gaussian function along its second
+   *    (shorter) axis */
+  float    sigmaY;
+  /** \brief angle (in radians, between -π/2 and π/2) between X axis and
+   *    the first axis of fit elliptical gaussian function */
+  float    theta;
   /** \brief index of a star in associated data structure
    *
    * If stars from multiple star sets are matched together, this field
@@ -33,6 +51,13 @@ typedef struct SStar {
    * Default value (set by \ref SStar_init) is -1, and means that the star
    * does not appear in any other data structure. */
   int    index;
+  /** \brief stable identifier of a star in associated data structure
+   *
+   * Unlike \ref index, which is a position in the associated structure,
+   * identifiers do not change when the structure is compacted (see
+   * \ref SStarMatcher_prune). Default value (set by \ref SStar_init) is -1,
+   * and means that the star has no identifier. */
+  int    id;
   /** \brief weight of a star
    *
    * The field is used by aggregated sets of stars. It describes how many
@@ -136,4 +161,33 @@ void SStarSet_add(SStarSet_t *sset, const SStar_t *star);
  * \param sset Set to be sorted */
 void SStarSet_sort(SStarSet_t *sset);
 
+/** \brief Write set of stars to a binary file
+ *
+ * All fields of stars are written in a compact little-endian format (44
+ * bytes per star), so the set can be read back by \ref SStarSet_read on
+ * any machine, without loss of precision. The set is written at the current
+ * position of \p file, so it can be embedded in other files.
+ *
+ * \param sset Set of stars
+ * \param file File opened for writing in binary mode
+ *
+ * \returns \ref SPICA_OK on success, or \ref SPICA_ERROR on write error.
+ *
+ * \sa SStarSet_read */
+int SStarSet_write(const SStarSet_t *sset, FILE *file);
+
+/** \brief Read set of stars written by \ref SStarSet_write
+ *
+ * \param sset Set of stars that will be expended by read stars. In most
+ *   cases should be empty.
+ * \param file File opened for reading in binary mode, at the position where
+ *   the set was written.
+ *
+ * \returns \ref SPICA_OK on success, or \ref SPICA_ERROR on read error, or
+ *   when the data is invalid. On error, some of stars may be added to
+ *   \p sset.
+ *
+ * \sa SStarSet_write */
+int SStarSet_read(SStarSet_t *sset, FILE *file);
+
 #endif /* __SPICA_STAR_H__ */
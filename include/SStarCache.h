@@ -0,0 +1,116 @@
+/* This file is part of Spica, released under MIT license.
+ * See LICENSE for details.
+ */
+
+/* Author: Piotr Polesiuk, 2022 */
+
+/** \file SStarCache.h
+ * \brief Persistent cache of stars found on image files
+ *
+ * Finding stars is the most expensive step of aligning a sequence, and its
+ * result depends only on the image and on the parameters of the star
+ * finder. SStarCache_t stores stars found on each image file in a separate
+ * file in a cache directory, so the next run of a program with the same
+ * star finder parameters (e.g., with different stacking settings) may skip
+ * both decoding images and finding stars.
+ *
+ * An entry is valid only for the same key and the same image file: the
+ * key is a hash of the parameters of SStarFinder_t and any additional data
+ * mixed by \ref SStarCache_addKey (e.g., dark frame), and the image file
+ * must have the same modification time and size. Stale entries are simply
+ * replaced.
+ */
+
+#ifndef __SPICA_STAR_CACHE_H__
+#define __SPICA_STAR_CACHE_H__
+
+#include "SImage.h"
+#include "SStar.h"
+#include "SStarFinder.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+/** \brief Cache of sets of stars found on image files */
+typedef struct SStarCache {
+  /** \brief Directory of cache files. It must exist. */
+  const char *directory;
+  /** \brief Key of cache entries, computed by \ref SStarCache_init and
+   *    \ref SStarCache_addKey.
+   *
+   * This field should be used read only. */
+  uint64_t    key;
+} SStarCache_t;
+
+/** \brief Initialize already allocated SStarCache_t
+ *
+ * Field       | Default value
+ * ----------- | -------------
+ * directory   | \p directory
+ * key         | hash of \p finder
+ *
+ * The cache does not need to be deinitialized.
+ *
+ * \param cache Pointer to already allocated SStarCache_t.
+ * \param directory Directory of cache files. The string must be valid as
+ *   long as the cache is used.
+ * \param finder Configuration of star-finder algorithm used to find stars
+ *   stored in the cache */
+void SStarCache_init(
+  SStarCache_t        *cache,
+  const char          *directory,
+  const SStarFinder_t *finder);
+
+/** \brief Mix additional data into the key of cache entries
+ *
+ * It should be used for all data other than the image file and star finder
+ * parameters, that affect found stars, e.g., a dark frame subtracted from
+ * images before finding stars.
+ *
+ * \param cache Cache
+ * \param data Data to be mixed into the key
+ * \param size Size of data (in bytes) */
+void SStarCache_addKey(SStarCache_t *cache, const void *data, size_t size);
+
+/** \brief Load stars found on the image file from the cache
+ *
+ * \param cache Cache
+ * \param fname Name of the image file
+ * \param sset Set of stars that will be expended by cached stars. In most
+ *   cases should be empty. It is not changed on error.
+ * \param format If not NULL, the format of the image file is stored there.
+ * \param width If not NULL, the width of the image is stored there.
+ * \param height If not NULL, the height of the image is stored there.
+ *
+ * \returns \ref SPICA_OK on success, or \ref SPICA_ERROR if there is no
+ *   valid entry for the file. */
+int SStarCache_load(
+  const SStarCache_t *cache,
+  const char         *fname,
+  SStarSet_t         *sset,
+  SImageFormat_t     *format,
+  unsigned           *width,
+  unsigned           *height);
+
+/** \brief Store stars found on the image file in the cache
+ *
+ * The entry is written to a temporary file first, and then renamed, so
+ * interrupted programs do not leave broken entries.
+ *
+ * \param cache Cache
+ * \param fname Name of the image file
+ * \param sset Stars found on the image
+ * \param format Format of the image file
+ * \param width Width of the image
+ * \param height Height of the image
+ *
+ * \returns \ref SPICA_OK on success, or \ref SPICA_ERROR on error. */
+int SStarCache_store(
+  const SStarCache_t *cache,
+  const char         *fname,
+  const SStarSet_t   *sset,
+  SImageFormat_t      format,
+  unsigned            width,
+  unsigned            height);
+
+#endif /* __SPICA_STAR_CACHE_H__ */
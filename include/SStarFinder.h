@@ -10,21 +10,44 @@
  * Implementation of simple algorithm of finding stars on images. The
  * algorithm consists of the following steps:
  *
+ * 0. Optionally, estimate background and noise model of the image (see
+ *      backgroundBox field of SStarFinder_t and \ref SBackground.h).
  * 1. Scale the image down σ (rounded to integral) times.
- * 2. Find pixels that are local maximums on the scaled images,
- *      and are bright enough (see candidateThreshold field of SStarFinder_t).
+ * 2. Find pixels that are local maximums on the scaled images (see
+ *      candidateRadius field of SStarFinder_t), and are bright enough (see
+ *      candidateThreshold field of SStarFinder_t). Both local maximums and
+ *      local background are computed by separable sliding-window filters,
+ *      so the cost does not depend on the size of the neighbourhood.
  * 3. For those pixels, fit the 2D gaussian function on original image
- *      with subpixel precision (σ parameter is fix).
- * 4. Accept the star if it is bright enough (see brightnessThreshold field of
- *      SStarFinder_t).
+ *      with subpixel precision (see fitMethod field of SStarFinder_t).
+ *      Fitting stops after
+ *      fitSteps steps, or earlier, when the position of the star converges
+ *      (see fitTolerance field of SStarFinder_t).
+ * 4. Accept the star if it is bright enough (see brightnessThreshold and
+ *      noiseThreshold fields of SStarFinder_t).
  * 5. Sort stars that are found.
  */
 
 #ifndef __SPICA_STAR_FINDER_H__
 #define __SPICA_STAR_FINDER_H__
 
+#include "SBackground.h"
 #include "SImage.h"
 #include "SStar.h"
+#include "STransform.h"
+
+/** \brief Method of fitting stars */
+typedef enum SStarFitMethod {
+  /** Circular gaussian function with fixed σ. Position, brightness and bias
+   * (unless background model is used) are fit (see \ref SStar_fitTol). */
+  SFit_Gauss,
+  /** Elliptical gaussian function fit by Levenberg-Marquardt algorithm.
+   * Position, brightness, bias (unless background model is used) and the
+   * shape are fit (see
+   * \ref SStar_fitElliptic). It is slower, but gives unbiased positions of
+   * elongated stars, and usually needs only a few steps. */
+  SFit_Elliptic
+} SStarFitMethod_t;
 
 /** \brief Configuration of SStarFinder algorithm */
 typedef struct SStarFinder {
@@ -41,13 +64,50 @@ typedef struct SStarFinder {
    *
    * This value is multiplied by \ref brightnessThreshold, and obtained value is
    * used as a threshold of difference between pixel and background brightness
-   * on scaled image. */
+   * on scaled image. The background is the mean brightness of pixels just
+   * outside the neighbourhood of the pixel (see \ref candidateRadius), or
+   * the level from the background model (see \ref backgroundBox). */
   float candidateThreshold;
+  /** \brief Radius of the neighbourhood used to find candidates in step 2
+   *    of the algorithm.
+   *
+   * Candidate should be a local maximum in the square of
+   * 2·\ref candidateRadius + 1 pixels on the scaled image. */
+  int   candidateRadius;
+  /** \brief Maximal number of stars to find.
+   *
+   * If it is not negative, candidates found in step 2 of the algorithm are
+   * ranked by their brightness (using a bounded heap), and only the highest
+   * ones (\ref maxStars and a safety margin) are fit. Then only
+   * \ref maxStars brightest stars are kept. This makes finding stars on
+   * dense fields much cheaper, when stars are needed only for alignment.
+   * Negative value means no limit. */
+  int   maxStars;
   /** \brief Minimal distance between stars (measured in \ref sigma units) to
    *     be considered as separate stars */
   float minDist;
-  /** \brief Number of steps in fitting procedure */
+  /** \brief Maximal number of steps in fitting procedure */
   int   fitSteps;
+  /** \brief Fitting procedure stops when the star moves by less than
+   *    \ref fitTolerance pixels in a single step */
+  float fitTolerance;
+  /** \brief Method of fitting stars */
+  SStarFitMethod_t fitMethod;
+  /** \brief Size of the box (in pixels) of the background model.
+   *
+   * If it is greater than 0, background and noise model is computed once
+   * per image (see \ref SBackground_estimate). Then the bias of stars is
+   * read from the model instead of being fit, and candidates and stars are
+   * additionally required to be \ref noiseThreshold times brighter than the
+   * noise. If it is 0, bias is estimated locally for each star. */
+  unsigned backgroundBox;
+  /** \brief Threshold of star brightness in units of noise σ.
+   *
+   * Used only when \ref backgroundBox is greater than 0. Then a star is put
+   * on a list only if its brightness is at least \ref noiseThreshold times
+   * larger than standard deviation of the noise at the star position (and
+   * at least \ref brightnessThreshold). */
+  float noiseThreshold;
 } SStarFinder_t;
 
 /** \brief Initialize SStarFinder with default values
@@ -57,8 +117,14 @@ typedef struct SStarFinder {
  * sigma               | 3.0f
  * brightnessThreshold | 0.1f 
  * candidateThreshold  | 0.5f 
+ * candidateRadius     | 1
+ * maxStars            | -1
  * minDist             | 2.0f
  * fitSteps            | 30
+ * fitTolerance        | 0.001f
+ * fitMethod           | SFit_Gauss
+ * backgroundBox       | 0
+ * noiseThreshold      | 5.0f
  * */
 void SStarFinder_init(SStarFinder_t *finder);
 
@@ -81,12 +147,119 @@ SStarSet_t *SStarFinder_findStars(
  * \param finder Configuration of star-finder algorithm
  * \param image Image to search for stars
  *
- * \sa SStarFinder_findStars */
+ * \sa SStarFinder_findStars, SStarFinder_findStarsBkg */
 void SStarFinder_findStars_at(
   SStarSet_t          *sset,
   const SStarFinder_t *finder,
   const SImage_t      *image);
 
+/** \brief Find stars on given image using precomputed background model
+ *
+ * This function works as \ref SStarFinder_findStars_at, but it uses given
+ * background model instead of computing one (backgroundBox field of
+ * \p finder is ignored). It is useful, when the model is needed also for
+ * other purposes.
+ *
+ * \param sset Set of stars that will be expended by newly found stars.
+ * \param finder Configuration of star-finder algorithm
+ * \param image Image to search for stars
+ * \param bkg Background model of \p image. If it is NULL, the bias of stars
+ *   is estimated locally.
+ *
+ * \sa SStarFinder_findStars_at */
+void SStarFinder_findStarsBkg(
+  SStarSet_t          *sset,
+  const SStarFinder_t *finder,
+  const SImage_t      *image,
+  const SBackground_t *bkg);
+
+/** \brief Scale factor of step 1 of the algorithm
+ *
+ * It is σ rounded down to an integer, but at least 1.
+ *
+ * \param finder Configuration of star-finder algorithm
+ *
+ * \returns Factor of binning images before searching for candidates
+ *
+ * \sa SStarFinder_findStarsBinned_at */
+unsigned SStarFinder_binning(const SStarFinder_t *finder);
+
+/** \brief Find stars on given image, that is already scaled down
+ *
+ * This function works as \ref SStarFinder_findStars_at, but candidates are
+ * searched on the given \p binned image, instead of scaling \p image down.
+ * Together with \ref SImage_loadPNGGray_into or
+ * \ref SImage_loadSIWWGray_into, it allows to find stars without storing
+ * the image in its original format, and without intermediate copies.
+ *
+ * \param sset Set of stars that will be expended by newly found stars.
+ * \param finder Configuration of star-finder algorithm
+ * \param image Image to search for stars. It is used without conversion,
+ *   when it is in \ref SFmt_Gray format.
+ * \param binned Gray-scale \p image scaled down by
+ *   \ref SStarFinder_binning (see \ref SImage_scaleDown), or NULL. In the
+ *   latter case, this function works exactly as
+ *   \ref SStarFinder_findStars_at.
+ *
+ * \sa SStarFinder_findStars_at */
+void SStarFinder_findStarsBinned_at(
+  SStarSet_t          *sset,
+  const SStarFinder_t *finder,
+  const SImage_t      *image,
+  const SImage_t      *binned);
+
+/** \brief Find stars on given image, starting from stars found on previous
+ *    image of a sequence
+ *
+ * Instead of searching the whole image, each star of \p prev is moved to
+ * the position predicted by \p tr, and fit there (see
+ * \ref SStarFinder_fitStar). The star is kept if it is bright enough, and
+ * the fit did not move it further than minDist (in σ units) from the
+ * predicted position. This is much faster than
+ * \ref SStarFinder_findStars_at, but new stars are never found, so full
+ * detection should be run from time to time (see \ref SStarTracker_t).
+ *
+ * Other fields of stars (e.g., index) are copied from \p prev.
+ *
+ * \param sset Set of stars that will be expended by tracked stars.
+ * \param finder Configuration of star-finder algorithm
+ * \param image Image to search for stars
+ * \param bkg Background model of \p image, or NULL (see
+ *   \ref SStarFinder_findStarsBkg).
+ * \param prev Stars found on the previous image
+ * \param tr Transformation that maps positions on the previous image to
+ *   predicted positions on \p image. NULL means identity. For
+ *   \ref STr_Drop transformation no stars are tracked.
+ *
+ * \sa SStarFinder_findStars_at */
+void SStarFinder_trackStars_at(
+  SStarSet_t          *sset,
+  const SStarFinder_t *finder,
+  const SImage_t      *image,
+  const SBackground_t *bkg,
+  const SStarSet_t    *prev,
+  const STransform_t  *tr);
+
+/** \brief Fit star on grayscale image using settings of the star finder
+ *
+ * The star is fit using method selected by fitMethod field of \p finder,
+ * with at most fitSteps steps and tolerance set by fitTolerance field.
+ *
+ * \param finder Configuration of star-finder algorithm
+ * \param star Star to be fit. Its position, sigma, brightness and bias are
+ *   used as a starting point.
+ * \param image Image with given star. Should be in \ref SFmt_Gray format.
+ * \param bkg Background model of \p image. If it is not NULL, the bias of
+ *   the star is read from the model instead of being fit.
+ *
+ * \returns The number of performed steps.
+ */
+int SStarFinder_fitStar(
+  const SStarFinder_t *finder,
+  SStar_t             *star,
+  const SImage_t      *image,
+  const SBackground_t *bkg);
+
 /** \brief Fit star on grayscale image
  *
  * During the fitting process, star position, brightness and bias (background
@@ -95,7 +268,60 @@ void SStarFinder_findStars_at(
  * \param star Star to be fit
  * \param image Image with given star. Should be in \ref SFmt_Gray format.
  * \param steps Number of steps of fitting process (Should be greater than 0).
+ *
+ * \sa SStar_fitTol
  */
 void SStar_fit(SStar_t *star, const SImage_t *image, int steps);
 
+/** \brief Fit star on grayscale image, and stop when the fit converges
+ *
+ * This function works as \ref SStar_fit, but the fitting process stops
+ * earlier, when a single step moves the star by less than \p tol pixels.
+ *
+ * \param star Star to be fit
+ * \param image Image with given star. Should be in \ref SFmt_Gray format.
+ * \param bkg Background model of \p image, or NULL. If it is given, the
+ *   bias is not fit, but read from the model at the position of the star.
+ *   Fewer parameters makes the fit faster and more stable for faint stars.
+ * \param steps Maximal number of steps of fitting process.
+ * \param tol Tolerance of star position (in pixels). For \p tol equal to 0,
+ *   exactly \p steps steps are performed.
+ *
+ * \returns The number of performed steps.
+ *
+ * \sa SStar_fit
+ */
+int SStar_fitTol(
+  SStar_t             *star,
+  const SImage_t      *image,
+  const SBackground_t *bkg,
+  int                  steps,
+  float                tol);
+
+/** \brief Fit elliptical star on grayscale image
+ *
+ * This function uses Levenberg-Marquardt algorithm to fit the elliptical
+ * gaussian function. Star position, brightness, bias, and shape (fields
+ * sigma, sigmaX, sigmaY, and theta) are adjusted to fit data on the image.
+ * The initial value of sigma field determines the size of the window around
+ * the star, which is used for fitting. The fitting process stops, when
+ * a single step moves the star by less than \p tol pixels, and does not
+ * improve the fit significantly.
+ *
+ * \param star Star to be fit
+ * \param image Image with given star. Should be in \ref SFmt_Gray format.
+ * \param bkg Background model of \p image, or NULL. If it is given, the
+ *   bias is not fit, but read from the model at the position of the star.
+ * \param steps Maximal number of steps of fitting process.
+ * \param tol Tolerance of star position (in pixels).
+ *
+ * \returns The number of performed steps.
+ */
+int SStar_fitElliptic(
+  SStar_t             *star,
+  const SImage_t      *image,
+  const SBackground_t *bkg,
+  int                  steps,
+  float                tol);
+
 #endif /* __SPICA_STAR_FINDER_H__ */
@@ -0,0 +1,171 @@
+/* This file is part of Spica, released under MIT license.
+ * See LICENSE for details.
+ */
+
+/* Author: Piotr Polesiuk, 2022 */
+
+/** \file SStarIndex.h
+ * \brief Spatial index of stars
+ *
+ * The index divides the plane into square cells, and keeps stars of each
+ * non-empty cell in a hash table. Finding the nearest star inspects only
+ * the cells close to the query point, so it takes expected constant time
+ * instead of time linear in the number of stars. The index refers to stars
+ * by their positions in the indexed SStarSet_t, so it can be updated
+ * incrementally, when stars are added or moved.
+ */
+
+#ifndef __SPICA_STAR_INDEX_H__
+#define __SPICA_STAR_INDEX_H__
+
+#include "SStar.h"
+
+/** \brief Spatial index of a set of stars */
+typedef struct SStarIndex {
+  /** \brief Size of a single cell (in pixels).
+   *
+   * It can be changed only when the index is empty. */
+  float  cellSize;
+  /** \brief Upper bound of sigma of indexed stars.
+   *
+   * This field should be used read only. */
+  float  maxSigma;
+  /** \brief Number of indexed stars: stars of the indexed set with indices
+   *    below this value are in the index.
+   *
+   * This field should be used read only. */
+  size_t length;
+  /** \brief Size of arrays of per-star data.
+   *
+   * This field should be used read only. */
+  size_t capacity;
+  /** \brief Size of the hash table (a power of two).
+   *
+   * This field should be used read only. */
+  size_t bucketN;
+  /** \brief The first star of each bucket, or -1 */
+  int   *head;
+  /** \brief The next star in the same bucket, or -1 */
+  int   *next;
+  /** \brief Cell coordinates of each star */
+  int   *cellX;
+  /** \brief Cell coordinates of each star */
+  int   *cellY;
+} SStarIndex_t;
+
+/** \brief Initialize already allocated SStarIndex_t
+ *
+ * Freshly initialized index is empty. Its cellSize is 16.0f. To
+ * deinitialize it, call \ref SStarIndex_deinit function.
+ *
+ * \param idx Pointer to already allocated SStarIndex_t.
+ *
+ * \sa SStarIndex_alloc */
+void SStarIndex_init(SStarIndex_t *idx);
+
+/** \brief Deinitialize SStarIndex_t initialized by \ref SStarIndex_init
+ *
+ * This function frees only internal resources used by SStarIndex_t. It does
+ * not free the memory occupied by SStarIndex_t itself.
+ *
+ * \param idx Pointer to SStarIndex_t to be deinitialized
+ *
+ * \sa SStarIndex_free */
+void SStarIndex_deinit(SStarIndex_t *idx);
+
+/** \brief Allocate and initialize new SStarIndex_t
+ *
+ * \return Pointer to the newly allocated empty index, or NULL on malloc
+ *   error. The index can be freed with \ref SStarIndex_free function.
+ *
+ * \sa SStarIndex_init */
+SStarIndex_t *SStarIndex_alloc(void);
+
+/** \brief Free index previously allocated with \ref SStarIndex_alloc
+ *
+ * \param idx Pointer to the index. It may be NULL.
+ *
+ * \sa SStarIndex_deinit */
+void SStarIndex_free(SStarIndex_t *idx);
+
+/** \brief Create copy of an index, and store it in already allocated
+ *    SStarIndex_t
+ *
+ * \param dst Pointer to the destination SStarIndex_t structure. The function
+ *   will initialize this memory, so it can be later deinitialized using
+ *   \ref SStarIndex_deinit function.
+ * \param idx Source index. */
+void SStarIndex_clone_at(SStarIndex_t *dst, const SStarIndex_t *idx);
+
+/** \brief Remove all stars from the index
+ *
+ * \param idx Index */
+void SStarIndex_clear(SStarIndex_t *idx);
+
+/** \brief Build index of all stars in the set
+ *
+ * The previous contents of the index is discarded.
+ *
+ * \param idx Index
+ * \param sset Set of stars to be indexed */
+void SStarIndex_build(SStarIndex_t *idx, const SStarSet_t *sset);
+
+/** \brief Add new stars to the index
+ *
+ * Stars of \p sset at positions from length field of \p idx up to the
+ * length of \p sset are added to the index. This function should be called
+ * after new stars are added to the indexed set.
+ *
+ * \param idx Index of \p sset
+ * \param sset Indexed set of stars */
+void SStarIndex_add(SStarIndex_t *idx, const SStarSet_t *sset);
+
+/** \brief Update the index after a star has changed its position or sigma
+ *
+ * \param idx Index of \p sset
+ * \param sset Indexed set of stars
+ * \param i Position of the modified star in \p sset. If the star is not
+ *   indexed yet, this function does nothing. */
+void SStarIndex_move(SStarIndex_t *idx, const SStarSet_t *sset, size_t i);
+
+/** \brief Check if the index is up to date with the set of stars
+ *
+ * It takes time linear in the number of stars, but it is much faster than
+ * building the index. It allows to detect that the set was modified without
+ * updating the index.
+ *
+ * \param idx Index of \p sset
+ * \param sset Indexed set of stars
+ *
+ * \returns Non-zero value if all stars of \p sset are indexed, and none of
+ *   them has changed its position or sigma in a way that affects
+ *   \ref SStarIndex_nearest. Zero otherwise. */
+int SStarIndex_isValid(const SStarIndex_t *idx, const SStarSet_t *sset);
+
+/** \brief Find the nearest indexed star
+ *
+ * The distance between star at \p pos with sigma equal to \p sigma and
+ * star s is measured in geometric mean of their sigmas, i.e., it is equal to
+ * |pos - s.pos| / sqrt(sigma · s.sigma). If there are several nearest stars,
+ * the one with the lowest index is returned.
+ *
+ * \param idx Index of \p sset
+ * \param sset Indexed set of stars
+ * \param pos Position of the query
+ * \param sigma Sigma of the query
+ * \param max_dist Maximal distance (in the metric described above)
+ * \param dist_sq If not NULL, the square of the distance to the returned
+ *   star is stored there.
+ *
+ * \returns Position of the nearest star in \p sset, or -1 if there is no
+ *   star not further than \p max_dist. Stars at distance exactly
+ *   \p max_dist are found. */
+int SStarIndex_nearest(
+  const SStarIndex_t *idx,
+  const SStarSet_t   *sset,
+  SVec2f_t            pos,
+  float               sigma,
+  float               max_dist,
+  float              *dist_sq);
+
+#endif /* __SPICA_STAR_INDEX_H__ */
@@ -12,6 +12,7 @@
 #define __SPICA_STAR_MATCHER_H__
 
 #include "SStar.h"
+#include "SStarIndex.h"
 #include "STransform.h"
 
 /** \brief The structure that aggregates matched stars
@@ -32,9 +33,66 @@ typedef struct SStarMatcher {
   /** \brief Maximal distance between two stars, to be considered as same star
    *    (measured in geometric mean of their sigmas). */
   float      distThreshold;
+  /** \brief Type of transformation fitted by
+   *    \ref SStarMatcher_getTransform.
+   *
+   * It should be one of \ref STr_Shift, \ref STr_Linear, \ref STr_Affine,
+   * \ref STr_Projective, or \ref STr_Polynomial. */
+  STransformType_t model;
+  /** \brief Order of the polynomial distortion fitted by
+   *    \ref STr_Polynomial model (from 2 to
+   *    \ref STRANSFORM_POLY_MAX_ORDER). */
+  int        polyOrder;
+  /** \brief Fixed distortion of the optics.
+   *
+   * When the model is \ref STr_Polynomial and the order of this distortion
+   * is at least 2, only the affine transformation applied after it is
+   * fitted. Then all transformations share the same distortion, so the
+   * remapping grid (see \ref SRemap_t) can be reused while stacking. */
+  STransformPoly_t distortion;
+  /** \brief Spatial index of \ref sset
+   *
+   * It is updated by all functions that modify \ref sset. If \ref sset
+   * is modified directly, the index should be rebuilt using
+   * \ref SStarIndex_build. Otherwise, \ref SStarMatcher_matchStars
+   * detects it (see \ref SStarIndex_isValid) and uses a temporary index. */
+  SStarIndex_t index;
+  /** \brief Number of updates between automatic prunings of the reference
+   *    set (see \ref SStarMatcher_prune). Zero or negative value disables
+   *    automatic pruning. */
+  int        pruneInterval;
+  /** \brief Minimal weight of a reference star that survives pruning.
+   *    Stars added since the previous pruning are never removed for their
+   *    weight. */
+  int        pruneMinWeight;
+  /** \brief Maximal number of reference stars kept by pruning (the
+   *    brightest ones). Negative value means no limit. */
+  int        maxStars;
+  /** \brief Number of updates since the last pruning.
+   *
+   * This field should be used read only. */
+  int        updateN;
+  /** \brief Identifier of the next star added to the reference set.
+   *
+   * This field should be used read only. */
+  int        nextId;
+  /** \brief Identifier of the first star added since the last pruning.
+   *
+   * This field should be used read only. */
+  int        pruneIdMark;
 } SStarMatcher_t;
 
 /** \brief Initialize already allocated SStarMatcher_t
+ *
+ * Field          | Default value
+ * -------------- | -------------
+ * distThreshold  | 1.4f
+ * model          | STr_Linear
+ * polyOrder      | 3
+ * distortion     | none (order 0)
+ * pruneInterval  | 0
+ * pruneMinWeight | 2
+ * maxStars       | -1
  *
  * To deinitialize it, call \ref SStarMatcher_deinit function.
  *
@@ -96,7 +154,8 @@ SStarMatcher_t *SStarMatcher_clone(const SStarMatcher_t *sm);
  * This function for each star in \p sset transformed by \p tr transformation
  * tries to find a corresponding star in \p sm matcher state. If the closest
  * star is closer than distThreshold, the star index (for star in \p sset) is
- * set to point to the matched star, otherwise the index is set to -1.
+ * set to point to the matched star, and its id is set to the id of the
+ * matched star. Otherwise, both index and id are set to -1.
  * Other fields of stars in \p sset reamain unchanged.
  *
  * \param sm SStarMatcher structure with set of reference stars and other
@@ -107,13 +166,23 @@ SStarMatcher_t *SStarMatcher_clone(const SStarMatcher_t *sm);
 void SStarMatcher_matchStars(
   const SStarMatcher_t *sm, const STransform_t *tr, SStarSet_t *sset);
 
-/** \brief Fine alignment of matched stars, based on complex linear regression
+/** \brief Fine alignment of matched stars, based on least squares fitting
  *
  * This function computes a transformation that maps stars from \p sset to
- * reference stars in \p sm. The algorithm uses complex linear regression to
- * fit complex linear function (see \ref STr_Linear). Before calling this
- * function, star indices in \p sset should be set, e.g., using
- * \ref SStarMatcher_matchStars function.
+ * reference stars in \p sm. The type of the transformation is given by the
+ * model field of \p sm. For \ref STr_Linear model the algorithm uses complex
+ * linear regression. Affine transformations are fitted by ordinary least
+ * squares, and projective ones by minimizing the algebraic error (direct
+ * linear transformation) of normalized coordinates. Polynomial
+ * transformations are fitted by ordinary least squares, with the
+ * distortion centered at the mean position of matched stars, unless the
+ * distortion is fixed. When there are too few matched stars to fit the
+ * model (one for translation, two for linear, three for affine, four for
+ * projective transformation, and the number of coefficients of each
+ * coordinate for polynomial one), or they are in a degenerate
+ * configuration, \ref STr_Drop transformation is returned.
+ * Before calling this function, star indices in \p sset should be set,
+ * e.g., using \ref SStarMatcher_matchStars function.
  *
  * \param sm SStarMatcher_t structure containing reference set of stars.
  * \param sset Set of stars with indices pointing to reference set
@@ -127,8 +196,13 @@ STransform_t SStarMatcher_getTransform(
  *
  * This function fixes positions of reference stars by new data from
  * \p sset aligned by \p tr transformation. Stars in \p sset that were
- * not matched are added to the reference set and their index is set
- * respectively. Star set \p sset should be matched and fine aligned first.
+ * not matched are added to the reference set with a fresh id, and their
+ * index and id are set respectively. Star set \p sset should be matched and
+ * fine aligned first.
+ *
+ * Every pruneInterval updates (if pruneInterval is positive), the reference
+ * set is pruned by \ref SStarMatcher_prune, and indices of stars in \p sset
+ * are remapped.
  *
  * \param sm SStarMatcher_t with reference set of stars
  * \param tr Transformation used to align stars from \p sset to reference set
@@ -136,4 +210,63 @@ STransform_t SStarMatcher_getTransform(
 void SStarMatcher_update(
   SStarMatcher_t *sm, const STransform_t *tr, SStarSet_t *sset);
 
+/** \brief Remove weak stars from the reference set, and compact it.
+ *
+ * Stars with weight below pruneMinWeight that were added before the
+ * previous pruning are removed (most of them are noise detections). Then,
+ * if there are more than maxStars stars left, only the brightest ones are
+ * kept. The order of remaining stars is preserved, and they keep their ids,
+ * but their positions in the set (indices) change. The spatial index is
+ * rebuilt.
+ *
+ * Indices stored in star sets matched earlier become invalid. Use ids and
+ * \ref SStarMatcher_indexOf to find stars after pruning.
+ *
+ * \param sm SStarMatcher_t with reference set of stars
+ * \param sset If not NULL, indices of stars of this set are remapped to the
+ *   new positions (or set to -1 for removed stars). */
+void SStarMatcher_prune(SStarMatcher_t *sm, SStarSet_t *sset);
+
+/** \brief Find reference star with given id
+ *
+ * This function uses binary search, since stars in the reference set are
+ * sorted by their ids, unless the set was reordered directly.
+ *
+ * \param sm SStarMatcher_t with reference set of stars
+ * \param id Identifier of a star
+ *
+ * \returns Position of the star in the reference set, or -1 if there is no
+ *   such star (e.g., it was removed by \ref SStarMatcher_prune). */
+int SStarMatcher_indexOf(const SStarMatcher_t *sm, int id);
+
+/** \brief Write the state of SStarMatcher_t to a binary file
+ *
+ * Only the state is written: the reference set of stars, the fixed
+ * distortion, and counters used by pruning. Settings (distThreshold, model,
+ * etc.) are not written, since they are usually given by the user. The
+ * state is written at the current position of \p file, so it can be
+ * embedded in other files.
+ *
+ * \param sm SStarMatcher_t
+ * \param file File opened for writing in binary mode
+ *
+ * \returns \ref SPICA_OK on success, or \ref SPICA_ERROR on write error.
+ *
+ * \sa SStarMatcher_read */
+int SStarMatcher_write(const SStarMatcher_t *sm, FILE *file);
+
+/** \brief Read the state of SStarMatcher_t written by
+ *    \ref SStarMatcher_write
+ *
+ * The state of \p sm is replaced by the read one, and the spatial index is
+ * rebuilt. Settings of \p sm are not changed, so matching may continue
+ * with the same (or different) settings.
+ *
+ * \param sm Initialized SStarMatcher_t. It is not changed on error.
+ * \param file File opened for reading in binary mode
+ *
+ * \returns \ref SPICA_OK on success, or \ref SPICA_ERROR on read error or
+ *   invalid data. */
+int SStarMatcher_read(SStarMatcher_t *sm, FILE *file);
+
 #endif /* __SPICA_STAR_MATCHER_H__ */
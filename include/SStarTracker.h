@@ -0,0 +1,126 @@
+/* This file is part of Spica, released under MIT license.
+ * See LICENSE for details.
+ */
+
+/* Author: Piotr Polesiuk, 2022 */
+
+/** \file SStarTracker.h
+ * \brief Finding stars on a sequence of images
+ *
+ * Stars on consecutive images of a sequence move only a little, so instead
+ * of searching each image from scratch, stars found on the previous image
+ * can be refit around their predicted positions (see
+ * \ref SStarFinder_trackStars_at). Tracking never finds new stars, so from
+ * time to time a full detection pass is needed. SStarTracker_t decides when
+ * to do it.
+ */
+
+#ifndef __SPICA_STAR_TRACKER_H__
+#define __SPICA_STAR_TRACKER_H__
+
+#include "SBackground.h"
+#include "SStarFinder.h"
+
+/** \brief State of star tracking on a sequence of images */
+typedef struct SStarTracker {
+  /** \brief Full detection is run every \ref detectPeriod images. Values
+   *    less than 2 mean that full detection is run on every image. */
+  int   detectPeriod;
+  /** \brief Full detection is also run, when tracking keeps fewer than
+   *    \ref minTrackedRatio of stars found by the last full detection. */
+  float minTrackedRatio;
+
+  /** \brief Stars found on the previous image.
+   *
+   * This field should be used read only. */
+  SStarSet_t    sset;
+  /** \brief Background model computed by the last full detection (empty
+   *    when backgroundBox field of the finder is 0).
+   *
+   * This field should be used read only. */
+  SBackground_t bkg;
+  /** \brief The number of stars found by the last full detection.
+   *
+   * This field should be used read only. */
+  size_t        detectedN;
+  /** \brief The number of images since the last full detection, or 0 when
+   *    no detection has been run yet.
+   *
+   * This field should be used read only. */
+  int           frameN;
+} SStarTracker_t;
+
+/** \brief Initialize already allocated SStarTracker_t with default settings
+ *
+ * Field           | Default value
+ * --------------- | -------------
+ * detectPeriod    | 10
+ * minTrackedRatio | 0.7f
+ *
+ * To deinitialize it, call \ref SStarTracker_deinit function.
+ *
+ * \param tracker Pointer to already allocated SStarTracker_t.
+ *
+ * \sa SStarTracker_alloc */
+void SStarTracker_init(SStarTracker_t *tracker);
+
+/** \brief Deinitialize SStarTracker_t initialized by \ref SStarTracker_init
+ *
+ * This function frees only internal resources used by SStarTracker_t. It
+ * does not free the memory occupied by SStarTracker_t itself.
+ *
+ * \param tracker Pointer to SStarTracker_t to be deinitialized
+ *
+ * \sa SStarTracker_free */
+void SStarTracker_deinit(SStarTracker_t *tracker);
+
+/** \brief Allocate and initialize new SStarTracker_t
+ *
+ * \return Pointer to the newly allocated SStarTracker_t, or NULL on malloc
+ *   error. It can be freed with \ref SStarTracker_free function.
+ *
+ * \sa SStarTracker_init */
+SStarTracker_t *SStarTracker_alloc(void);
+
+/** \brief Free SStarTracker_t previously allocated with
+ *    \ref SStarTracker_alloc
+ *
+ * \param tracker Pointer to the SStarTracker_t structure. It may be NULL.
+ *
+ * \sa SStarTracker_deinit */
+void SStarTracker_free(SStarTracker_t *tracker);
+
+/** \brief Force full detection on the next image
+ *
+ * \param tracker Star tracker */
+void SStarTracker_reset(SStarTracker_t *tracker);
+
+/** \brief Find stars on the next image of a sequence
+ *
+ * Stars are tracked from the previous image (see
+ * \ref SStarFinder_trackStars_at), unless full detection is needed. Full
+ * detection (see \ref SStarFinder_findStars_at) is run on the first image,
+ * every detectPeriod images, when \p tr is \ref STr_Drop, and when too many
+ * stars are lost by tracking.
+ *
+ * If backgroundBox field of \p finder is greater than 0, the background
+ * model is computed only by full detection, and reused for tracking.
+ *
+ * \param tracker Star tracker
+ * \param sset Set of stars that will be expended by found stars. In most
+ *   cases should be empty.
+ * \param finder Configuration of star-finder algorithm. It should not change
+ *   between calls.
+ * \param image Next image of the sequence
+ * \param tr Transformation that maps positions on the previous image to
+ *   predicted positions on \p image. NULL means identity.
+ *
+ * \returns 1 if full detection was run, and 0 otherwise. */
+int SStarTracker_findStars_at(
+  SStarTracker_t      *tracker,
+  SStarSet_t          *sset,
+  const SStarFinder_t *finder,
+  const SImage_t      *image,
+  const STransform_t  *tr);
+
+#endif /* __SPICA_STAR_TRACKER_H__ */
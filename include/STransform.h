@@ -12,8 +12,12 @@
 #define __SPICA_TRANSFORM_H__
 
 #include "SBoundingBox.h"
+#include "SCommon.h"
 #include "SVec.h"
 
+#include <stddef.h>
+#include <stdio.h>
+
 /** \brief Type of STransform_t transformation */
 typedef enum STransformType {
   /** No transformation. Just drop this image. */
@@ -23,9 +27,40 @@ typedef enum STransformType {
   /** Translation-only */
   STr_Shift,
   /** Rotation and translation -- linear function on complex numbers */
-  STr_Linear
+  STr_Linear,
+  /** Affine transformation -- allows shear and different scales along the
+   * axes */
+  STr_Affine,
+  /** Projective transformation (homography) */
+  STr_Projective,
+  /** Polynomial lens distortion followed by an affine transformation */
+  STr_Polynomial
 } STransformType_t;
 
+/** \brief Maximal order of polynomial distortion */
+#define STRANSFORM_POLY_MAX_ORDER 5
+
+/** \brief Maximal number of terms of polynomial distortion */
+#define STRANSFORM_POLY_TERMS 18
+
+/** \brief Polynomial distortion of 2D vectors (SIP-style).
+ *
+ * Vector (x, y) is distorted to (x, y) + Σ coef[k] · u^(d-j) · v^j, where
+ * u = (x - center[0]) · scale, and v = (y - center[1]) · scale. The sum ranges
+ * over all terms of degree d from 2 to order, and terms are sorted by their
+ * degree d, then by j. */
+typedef struct STransformPoly {
+  /** \brief Order of the polynomial (at most \ref STRANSFORM_POLY_MAX_ORDER).
+   *    Orders below 2 mean no distortion. */
+  int      order;
+  /** \brief Center of the distortion */
+  SVec2f_t center;
+  /** \brief Inverse of the unit of length used by the polynomial */
+  float    scale;
+  /** \brief Coefficients of the polynomial (in pixels) */
+  SVec2f_t coef[STRANSFORM_POLY_TERMS];
+} STransformPoly_t;
+
 /** \brief Transformation of 2D vectors. */
 typedef struct STransform {
   /** \brief  Type of the transformation */
@@ -38,8 +73,22 @@ typedef struct STransform {
   SVec2f_t         rot;
   /** \brief Translation vector (added to translated vector).
    *
-   * Ignored by \ref STr_Identity and \ref STr_Drop transformations */
+   * Ignored by \ref STr_Identity, \ref STr_Drop, \ref STr_Affine, and
+   * \ref STr_Projective transformations */
   SVec2f_t         shift;
+  /** \brief Matrix of the transformation in homogeneous coordinates.
+   *
+   * Vector (x, y) is mapped to (x'/w', y'/w'), where
+   * (x', y', w') = mat · (x, y, 1). For \ref STr_Affine transformations the
+   * last row is always (0, 0, 1). This field is used only by
+   * \ref STr_Affine, \ref STr_Projective, and \ref STr_Polynomial
+   * transformations. For the last one, it is applied after the
+   * distortion. */
+  float            mat[3][3];
+  /** \brief Distortion applied before the affine transformation.
+   *
+   * Used only by \ref STr_Polynomial transformations. */
+  STransformPoly_t poly;
 } STransform_t;
 
 /** \brief Create translation by given vector */
@@ -57,13 +106,45 @@ static inline STransform_t STransform_shift(SVec2f_t shift)
 static inline STransform_t STransform_linear(SVec2f_t rot, SVec2f_t shift)
   __attribute__((unused));
 
-/** \brief Compute the inverse transformation */
+/** \brief Create transformation from a matrix
+ *
+ * \param type \ref STr_Affine, \ref STr_Projective, or
+ *   \ref STr_Polynomial. For affine and polynomial transformations the last
+ *   row of \p mat is ignored. Polynomial transformations are created without
+ *   distortion; it should be set in the poly field.
+ * \param mat Matrix of the transformation in homogeneous coordinates
+ *   (see mat field of \ref STransform_t): nine values in row-major
+ *   order. */
+STransform_t STransform_matrix(STransformType_t type, const float *mat);
+
+/** \brief Apply polynomial distortion to given vector */
+SVec2f_t STransformPoly_apply(const STransformPoly_t *poly, SVec2f_t v);
+
+/** \brief Apply inverse of polynomial distortion to given vector
+ *
+ * The inverse is computed numerically by Newton's method, so it is much
+ * slower than \ref STransformPoly_apply. */
+SVec2f_t STransformPoly_applyInverse(const STransformPoly_t *poly, SVec2f_t v);
+
+/** \brief Check if two polynomial distortions are equal */
+int STransformPoly_equal(
+  const STransformPoly_t *poly1,
+  const STransformPoly_t *poly2);
+
+/** \brief Compute the inverse transformation
+ *
+ * The inverse of \ref STr_Polynomial transformation is not polynomial, so it
+ * is approximated by a polynomial of the maximal order, fitted in the area
+ * around the center of the distortion. */
 STransform_t STransform_inverse(const STransform_t *tr);
 
 /** \brief Compose two transformations.
  *
  * The order of arguments is the same as for composition of functions:
- * \p tr2 is applied first. */
+ * \p tr1 is applied first. Composition of \ref STr_Polynomial transformation
+ * with a transformation applied after it, other than \ref STr_Projective or
+ * \ref STr_Polynomial, is exact. Other compositions with
+ * \ref STr_Polynomial transformations are approximated by polynomials. */
 STransform_t STransform_compose(
   const STransform_t *tr2,
   const STransform_t *tr1);
@@ -71,7 +152,26 @@ STransform_t STransform_compose(
 /** \brief Apply transformation to given vector */
 SVec2f_t STransform_apply(const STransform_t *tr, SVec2f_t v);
 
+/** \brief Apply transformation to an array of vectors
+ *
+ * This function is equivalent to calling \ref STransform_apply for each
+ * vector, but it dispatches on the type of the transformation only once, and
+ * it transforms two vectors at once, using SIMD instructions.
+ *
+ * \param tr Transformation
+ * \param src Array of \p n vectors to transform
+ * \param dst Array of \p n transformed vectors. It may be equal to \p src.
+ * \param n Number of vectors */
+void STransform_applyBatch(
+  const STransform_t *tr,
+  const SVec2f_t     *src,
+  SVec2f_t           *dst,
+  size_t              n);
+
 /** \brief Apply transformation to SBoundingBox_t
+ *
+ * For \ref STr_Projective transformations the result is exact only when the
+ * line mapped to infinity does not cross the bounding box.
  *
  * \returns SBoundingBox_t that is large enough, to contain transformed
  *   bounding box. */
@@ -79,6 +179,42 @@ SBoundingBox_t STransform_boundingBox(
   const STransform_t *tr,
   SBoundingBox_t      bb);
 
+/** \brief Write transformation to a binary file
+ *
+ * Transformations are written in a fixed-size (216 bytes) little-endian
+ * format, at the current position of \p file, so they can be embedded in
+ * other files.
+ *
+ * \returns \ref SPICA_OK on success, or \ref SPICA_ERROR on write error.
+ *
+ * \sa STransform_read */
+int STransform_write(const STransform_t *tr, FILE *file);
+
+/** \brief Read transformation written by \ref STransform_write
+ *
+ * \param tr Place where the transformation is stored. It is not changed on
+ *   error.
+ * \param file File opened for reading in binary mode
+ *
+ * \returns \ref SPICA_OK on success, or \ref SPICA_ERROR on read error or
+ *   invalid data. */
+int STransform_read(STransform_t *tr, FILE *file);
+
+/** \brief Write polynomial distortion to a binary file
+ *
+ * The format is the same as the distortion part of
+ * \ref STransform_write.
+ *
+ * \returns \ref SPICA_OK on success, or \ref SPICA_ERROR on write error. */
+int STransformPoly_write(const STransformPoly_t *poly, FILE *file);
+
+/** \brief Read polynomial distortion written by
+ *    \ref STransformPoly_write
+ *
+ * \returns \ref SPICA_OK on success, or \ref SPICA_ERROR on read error or
+ *   invalid data. In the last case, \p poly is not changed. */
+int STransformPoly_read(STransformPoly_t *poly, FILE *file);
+
 /* ========================================================================= */
 static inline STransform_t STransform_shift(SVec2f_t shift) {
   STransform_t tr = {
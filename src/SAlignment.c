@@ -0,0 +1,187 @@
+/* This file is part of Spica, released under MIT license.
+ * See LICENSE for details.
+ */
+
+/* Author: Piotr Polesiuk, 2022 */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "SAlignment.h"
+
+#include "SDataRepr.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define ALIGNMENT_MAGIC   "SPICAALN"
+#define ALIGNMENT_VERSION 1
+
+/* Longer file names are treated as broken files */
+#define MAX_FNAME_LENGTH (1 << 20)
+
+/* The header is followed by the frames (the length of the name, the name,
+ * and the transformation), and the state of the matcher, if any */
+typedef struct FileHeader {
+  char     magic[8];
+  uint32_t version;
+  uint32_t length;
+  uint32_t format;
+  uint32_t has_matcher;
+  uint32_t bb[4];
+} FileHeader_t;
+
+void SAlignment_init(SAlignment_t *al) {
+  al->length      = 0;
+  al->capacity    = 0;
+  al->frames      = NULL;
+  al->format      = SFmt_Invalid;
+  al->boundingBox = SBoundingBox_empty();
+}
+
+void SAlignment_deinit(SAlignment_t *al) {
+  for (size_t i = 0; i < al->length; i++)
+    free(al->frames[i].fname);
+  free(al->frames);
+}
+
+void SAlignment_add(
+  SAlignment_t       *al,
+  const char         *fname,
+  const STransform_t *tr)
+{
+  if (al->length == al->capacity) {
+    al->capacity += 1 + (al->capacity >> 1);
+    al->frames = realloc(al->frames, sizeof(SAlignedFrame_t) * al->capacity);
+  }
+
+  size_t len = strlen(fname);
+  SAlignedFrame_t *frame = &al->frames[al->length++];
+  frame->fname = malloc(len + 1);
+  memcpy(frame->fname, fname, len + 1);
+  frame->transform = *tr;
+}
+
+/* ========================================================================= */
+static int writeAlignment(
+  const SAlignment_t *al, const SStarMatcher_t *sm, FILE *file)
+{
+  if (al->length > UINT32_MAX) return 0;
+
+  FileHeader_t header = {
+    .magic       = ALIGNMENT_MAGIC,
+    .version     = SLittleEndian32(ALIGNMENT_VERSION),
+    .length      = SLittleEndian32(al->length),
+    .format      = SLittleEndian32(al->format),
+    .has_matcher = SLittleEndian32(sm != NULL),
+    .bb = {
+      SLittleEndianFromFloat(al->boundingBox.minX),
+      SLittleEndianFromFloat(al->boundingBox.minY),
+      SLittleEndianFromFloat(al->boundingBox.maxX),
+      SLittleEndianFromFloat(al->boundingBox.maxY)
+    }
+  };
+  if (fwrite(&header, sizeof(header), 1, file) != 1) return 0;
+
+  for (size_t i = 0; i < al->length; i++) {
+    const SAlignedFrame_t *frame = &al->frames[i];
+    size_t   len    = strlen(frame->fname);
+    uint32_t len_le = SLittleEndian32(len);
+    if (len > MAX_FNAME_LENGTH ||
+        fwrite(&len_le, sizeof(len_le), 1, file) != 1 ||
+        fwrite(frame->fname, 1, len, file) != len ||
+        STransform_write(&frame->transform, file) != SPICA_OK)
+      return 0;
+  }
+
+  return sm == NULL || SStarMatcher_write(sm, file) == SPICA_OK;
+}
+
+int SAlignment_save(
+  const SAlignment_t   *al,
+  const SStarMatcher_t *sm,
+  const char           *fname)
+{
+  size_t len = strlen(fname) + 32;
+  char *tmp_name = malloc(len + 1);
+  if (tmp_name == NULL) return SPICA_ERROR;
+  snprintf(tmp_name, len + 1, "%s.tmp%ld", fname, (long)getpid());
+
+  int ok = 0;
+  FILE *file = fopen(tmp_name, "wb");
+  if (file != NULL) {
+    ok = writeAlignment(al, sm, file);
+    ok = fclose(file) == 0 && ok;
+    if (ok) ok = rename(tmp_name, fname) == 0;
+    if (!ok) remove(tmp_name);
+  }
+
+  free(tmp_name);
+  return ok ? SPICA_OK : SPICA_ERROR;
+}
+
+/* ------------------------------------------------------------------------- */
+static int readAlignment(SAlignment_t *al, SStarMatcher_t *sm, FILE *file) {
+  FileHeader_t header;
+  if (fread(&header, sizeof(header), 1, file) != 1 ||
+      memcmp(header.magic, ALIGNMENT_MAGIC, 8) != 0 ||
+      SLittleEndian32(header.version) != ALIGNMENT_VERSION ||
+      SLittleEndian32(header.format) > SFmt_SeparateRGB)
+    return 0;
+
+  al->format = SLittleEndian32(header.format);
+  al->boundingBox.minX = SLittleEndianToFloat(header.bb[0]);
+  al->boundingBox.minY = SLittleEndianToFloat(header.bb[1]);
+  al->boundingBox.maxX = SLittleEndianToFloat(header.bb[2]);
+  al->boundingBox.maxY = SLittleEndianToFloat(header.bb[3]);
+
+  uint32_t length = SLittleEndian32(header.length);
+  for (uint32_t i = 0; i < length; i++) {
+    uint32_t len;
+    if (fread(&len, sizeof(len), 1, file) != 1) return 0;
+    len = SLittleEndian32(len);
+    if (len > MAX_FNAME_LENGTH) return 0;
+
+    char *fname = malloc(len + 1);
+    STransform_t tr;
+    int ok = fname != NULL
+      && fread(fname, 1, len, file) == len
+      && STransform_read(&tr, file) == SPICA_OK;
+    if (ok) {
+      fname[len] = '\0';
+      SAlignment_add(al, fname, &tr);
+    }
+    free(fname);
+    if (!ok) return 0;
+  }
+
+  /* The matcher is read last, so it is not changed when other data is
+   * broken */
+  if (sm != NULL && SLittleEndian32(header.has_matcher))
+    return SStarMatcher_read(sm, file) == SPICA_OK;
+  return 1;
+}
+
+int SAlignment_load(
+  SAlignment_t   *al,
+  SStarMatcher_t *sm,
+  const char     *fname)
+{
+  FILE *file = fopen(fname, "rb");
+  if (file == NULL) return SPICA_ERROR;
+
+  SAlignment_t result;
+  SAlignment_init(&result);
+  int ok = readAlignment(&result, sm, file);
+  fclose(file);
+
+  if (!ok) {
+    SAlignment_deinit(&result);
+    return SPICA_ERROR;
+  }
+  SAlignment_deinit(al);
+  *al = result;
+  return SPICA_OK;
+}
@@ -0,0 +1,266 @@
+/* This file is part of Spica, released under MIT license.
+ * See LICENSE for details.
+ */
+
+/* Author: Piotr Polesiuk, 2022 */
+
+#include "SBackground.h"
+
+#include <assert.h>
+#include <math.h>
+#include <stddef.h>
+#include <stdlib.h>
+
+/* Number of iterations of σ-clipping */
+#define CLIP_STEPS   3
+/* Values further than CLIP_SIGMA·σ from the median are rejected */
+#define CLIP_SIGMA   3.0f
+/* Ratio between σ and median absolute deviation for normal distribution */
+#define MAD_TO_SIGMA 1.4826f
+/* Larger boxes are subsampled, such that at most BOX_SAMPLES x BOX_SAMPLES
+ * pixels of a box are used. It is enough for robust statistics. */
+#define BOX_SAMPLES  32
+
+/* ========================================================================= */
+void SBackground_init(SBackground_t *bkg) {
+  bkg->boxSize    = 0;
+  bkg->meshWidth  = 0;
+  bkg->meshHeight = 0;
+  bkg->level      = NULL;
+  bkg->noise      = NULL;
+}
+
+void SBackground_deinit(SBackground_t *bkg) {
+  free(bkg->level);
+  free(bkg->noise);
+}
+
+SBackground_t *SBackground_alloc(void) {
+  SBackground_t *bkg = malloc(sizeof(SBackground_t));
+  if (bkg == NULL) return NULL;
+
+  SBackground_init(bkg);
+  return bkg;
+}
+
+void SBackground_free(SBackground_t *bkg) {
+  if (bkg == NULL) return;
+  SBackground_deinit(bkg);
+  free(bkg);
+}
+
+/* ========================================================================= */
+/* Wirth's selection algorithm. It reorders the array. */
+static float selectKth(float *a, size_t n, size_t k) {
+  ptrdiff_t lo = 0;
+  ptrdiff_t hi = n - 1;
+  ptrdiff_t kk = k;
+  while (lo < hi) {
+    float pivot = a[kk];
+    ptrdiff_t i = lo;
+    ptrdiff_t j = hi;
+    do {
+      while (a[i] < pivot) i++;
+      while (pivot < a[j]) j--;
+      if (i <= j) {
+        float t = a[i];
+        a[i] = a[j];
+        a[j] = t;
+        i++;
+        j--;
+      }
+    } while (i <= j);
+    if (j < kk) lo = i;
+    if (kk < i) hi = j;
+  }
+  return a[kk];
+}
+
+static float median(float *a, size_t n) {
+  return selectKth(a, n, n / 2);
+}
+
+/* ------------------------------------------------------------------------- */
+/* Compute σ-clipped statistics of values in a single box. The array of
+ * values is destroyed. Returns 0 for empty box. */
+static int boxStats(
+  float *val, float *tmp, size_t n, float *level, float *noise)
+{
+  if (n == 0) return 0;
+
+  float med   = 0.0f;
+  float sigma = 0.0f;
+  for (int step = 0; step < CLIP_STEPS; step++) {
+    med = median(val, n);
+    for (size_t i = 0; i < n; i++)
+      tmp[i] = fabsf(val[i] - med);
+    sigma = MAD_TO_SIGMA * median(tmp, n);
+
+    /* Reject outliers, e.g., stars */
+    float lim = CLIP_SIGMA * sigma;
+    size_t m = 0;
+    for (size_t i = 0; i < n; i++) {
+      if (fabsf(val[i] - med) <= lim) val[m++] = val[i];
+    }
+    if (m == n || m == 0) break;
+    n = m;
+  }
+
+  *level = med;
+  *noise = sigma;
+  return 1;
+}
+
+/* ------------------------------------------------------------------------- */
+/* Fill nodes of empty boxes (marked as NaN) with median of other nodes */
+static void fillEmpty(float *mesh, float *tmp, size_t n) {
+  size_t m = 0;
+  for (size_t i = 0; i < n; i++) {
+    if (!isnan(mesh[i])) tmp[m++] = mesh[i];
+  }
+  float v = (m == 0 ? 0.0f : median(tmp, m));
+  for (size_t i = 0; i < n; i++) {
+    if (isnan(mesh[i])) mesh[i] = v;
+  }
+}
+
+/* ------------------------------------------------------------------------- */
+/* 3x3 median filter of the mesh. It removes nodes spoiled by large objects,
+ * e.g., bright stars. */
+static void medianFilter(float *mesh, float *tmp, unsigned w, unsigned h) {
+  float *src = tmp + 9;
+  for (size_t i = 0; i < (size_t)w * h; i++) src[i] = mesh[i];
+
+  for (unsigned y = 0; y < h; y++) {
+    for (unsigned x = 0; x < w; x++) {
+      size_t n = 0;
+      for (unsigned y1 = (y > 0 ? y - 1 : 0); y1 <= y + 1 && y1 < h; y1++) {
+        for (unsigned x1 = (x > 0 ? x - 1 : 0); x1 <= x + 1 && x1 < w; x1++)
+          tmp[n++] = src[y1 * w + x1];
+      }
+      mesh[y * w + x] = median(tmp, n);
+    }
+  }
+}
+
+/* ------------------------------------------------------------------------- */
+void SBackground_estimate(
+  SBackground_t  *bkg,
+  const SImage_t *image,
+  unsigned        box_size)
+{
+  assert(box_size > 0);
+
+  SBackground_deinit(bkg);
+  SBackground_init(bkg);
+  if (image->format == SFmt_Invalid) return;
+
+  unsigned mw = (image->width  + box_size - 1) / box_size;
+  unsigned mh = (image->height + box_size - 1) / box_size;
+  size_t mesh_n = (size_t)mw * mh;
+  unsigned step = (box_size + BOX_SAMPLES - 1) / BOX_SAMPLES;
+  size_t box_n  = (size_t)BOX_SAMPLES * BOX_SAMPLES;
+
+  bkg->level = malloc(sizeof(float) * mesh_n);
+  bkg->noise = malloc(sizeof(float) * mesh_n);
+  /* Buffer for values in a box, and temporary buffer of the same size
+   * (also used for filtering the mesh) */
+  size_t buf_n = box_n > mesh_n + 9 ? box_n : mesh_n + 9;
+  float *val = malloc(sizeof(float) * buf_n);
+  float *tmp = malloc(sizeof(float) * buf_n);
+
+  if (bkg->level == NULL || bkg->noise == NULL || val == NULL || tmp == NULL) {
+    free(val);
+    free(tmp);
+    SBackground_deinit(bkg);
+    SBackground_init(bkg);
+    return;
+  }
+
+  bkg->boxSize    = box_size;
+  bkg->meshWidth  = mw;
+  bkg->meshHeight = mh;
+
+  for (unsigned my = 0; my < mh; my++) {
+    for (unsigned mx = 0; mx < mw; mx++) {
+      unsigned x0 = mx * box_size;
+      unsigned y0 = my * box_size;
+      size_t n = 0;
+      for (unsigned y = y0; y < y0 + box_size && y < image->height;
+          y += step) {
+        for (unsigned x = x0; x < x0 + box_size && x < image->width;
+            x += step) {
+          SVec2f_t pix = (image->format == SFmt_Gray
+            ? image->data_gray[y * image->width + x]
+            : SImage_pixelGray(image, x, y));
+          if (pix[1] > 0.0f) val[n++] = pix[0] / pix[1];
+        }
+      }
+
+      size_t i = (size_t)my * mw + mx;
+      if (!boxStats(val, tmp, n, &bkg->level[i], &bkg->noise[i])) {
+        bkg->level[i] = NAN;
+        bkg->noise[i] = NAN;
+      }
+    }
+  }
+
+  fillEmpty(bkg->level, tmp, mesh_n);
+  fillEmpty(bkg->noise, tmp, mesh_n);
+  medianFilter(bkg->level, tmp, mw, mh);
+  medianFilter(bkg->noise, tmp, mw, mh);
+
+  free(val);
+  free(tmp);
+}
+
+/* ========================================================================= */
+/* Catmull-Rom cubic spline weights */
+static void cubicWeights(float f, float w[4]) {
+  float f2 = f * f;
+  float f3 = f2 * f;
+  w[0] = 0.5f * (-f3 + 2.0f * f2 - f);
+  w[1] = 0.5f * (3.0f * f3 - 5.0f * f2 + 2.0f);
+  w[2] = 0.5f * (-3.0f * f3 + 4.0f * f2 + f);
+  w[3] = 0.5f * (f3 - f2);
+}
+
+inline static int clampi(int x, int max) {
+  return x < 0 ? 0 : x > max ? max : x;
+}
+
+static float interpolate(
+  const SBackground_t *bkg, const float *mesh, SVec2f_t pos)
+{
+  if (bkg->meshWidth == 0) return 0.0f;
+
+  /* Mesh nodes are placed in centers of boxes */
+  float tx = (pos[0] + 0.5f) / bkg->boxSize - 0.5f;
+  float ty = (pos[1] + 0.5f) / bkg->boxSize - 0.5f;
+  int ix = (int)floorf(tx);
+  int iy = (int)floorf(ty);
+  float wx[4], wy[4];
+  cubicWeights(tx - ix, wx);
+  cubicWeights(ty - iy, wy);
+
+  int max_x = bkg->meshWidth  - 1;
+  int max_y = bkg->meshHeight - 1;
+  float result = 0.0f;
+  for (int j = 0; j < 4; j++) {
+    const float *row = mesh + clampi(iy + j - 1, max_y) * bkg->meshWidth;
+    float v = 0.0f;
+    for (int i = 0; i < 4; i++)
+      v += wx[i] * row[clampi(ix + i - 1, max_x)];
+    result += wy[j] * v;
+  }
+  return result;
+}
+
+float SBackground_level(const SBackground_t *bkg, SVec2f_t pos) {
+  return interpolate(bkg, bkg->level, pos);
+}
+
+float SBackground_noise(const SBackground_t *bkg, SVec2f_t pos) {
+  float noise = interpolate(bkg, bkg->noise, pos);
+  return noise < 0.0f ? 0.0f : noise;
+}
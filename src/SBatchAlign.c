@@ -0,0 +1,116 @@
+/* This file is part of Spica, released under MIT license.
+ * See LICENSE for details.
+ */
+
+/* Author: Piotr Polesiuk, 2022 */
+
+#include "SBatchAlign.h"
+#include "SParallel.h"
+
+void SBatchAligner_init(SBatchAligner_t *aligner) {
+  SSmallChangeAligner_init(&aligner->scAligner);
+  SRansacAligner_init(&aligner->ransacAligner);
+  aligner->minMatchedRatio = 0.5f;
+  aligner->threadN         = 0;
+}
+
+/* ========================================================================= */
+typedef struct Batch {
+  const SBatchAligner_t *aligner;
+  /* Matcher with up-to-date spatial index */
+  const SStarMatcher_t  *sm;
+  SStarSet_t            *ssets;
+  const STransform_t    *guess;
+  STransform_t          *result;
+} Batch_t;
+
+/* Fine alignment after coarse alignment tr. Returns the number of matched
+ * stars. */
+static size_t fineAlign(
+  const SStarMatcher_t *sm,
+  SStarSet_t *sset,
+  STransform_t *tr)
+{
+  if (tr->type == STr_Drop) {
+    /* Forget matches of the previous attempt */
+    for (size_t i = 0; i < sset->length; i++) {
+      sset->data[i].index = -1;
+      sset->data[i].id    = -1;
+    }
+    return 0;
+  }
+
+  SStarMatcher_matchStars(sm, tr, sset);
+  *tr = SStarMatcher_getTransform(sm, sset);
+
+  size_t matched = 0;
+  for (size_t i = 0; i < sset->length; i++)
+    matched += sset->data[i].index >= 0;
+  return matched;
+}
+
+static void alignSet(void *arg, size_t i) {
+  Batch_t *batch = arg;
+  const SBatchAligner_t *aligner = batch->aligner;
+  const SStarMatcher_t  *sm      = batch->sm;
+  SStarSet_t            *sset    = &batch->ssets[i];
+
+  STransform_t tr = {
+    .type  = STr_Drop,
+    .rot   = { 1.0f, 0.0f },
+    .shift = { 0.0f, 0.0f }
+  };
+
+  if (sset->length <= 2) {
+    batch->result[i] = tr;
+    return;
+  }
+
+  if (batch->guess != NULL) {
+    tr = SSmallChangeAligner_alignIndexed(&aligner->scAligner,
+      &sm->sset, &sm->index, &batch->guess[i], sset);
+    size_t matched = fineAlign(sm, sset, &tr);
+    if (matched < aligner->minMatchedRatio * sset->length)
+      tr.type = STr_Drop;
+  }
+
+  /* Fallback to the slower coarse aligner only where needed */
+  if (tr.type == STr_Drop) {
+    tr = SRansacAligner_alignIndexed(&aligner->ransacAligner,
+      &sm->sset, &sm->index, sset);
+    fineAlign(sm, sset, &tr);
+  }
+  batch->result[i] = tr;
+}
+
+/* ------------------------------------------------------------------------- */
+void SBatchAligner_align(
+  const SBatchAligner_t *aligner,
+  const SStarMatcher_t  *sm,
+  SStarSet_t            *ssets,
+  size_t                 n,
+  const STransform_t    *guess,
+  STransform_t          *result)
+{
+  /* When the reference set was modified directly, a single temporary index
+   * is shared by all threads, instead of building one for each set */
+  SStarMatcher_t tmp_sm;
+  int valid = SStarIndex_isValid(&sm->index, &sm->sset);
+  if (!valid) {
+    tmp_sm = *sm;
+    SStarIndex_init(&tmp_sm.index);
+    SStarIndex_build(&tmp_sm.index, &tmp_sm.sset);
+  }
+
+  Batch_t batch = {
+    .aligner = aligner,
+    .sm      = valid ? sm : &tmp_sm,
+    .ssets   = ssets,
+    .guess   = guess,
+    .result  = result
+  };
+  SParallel_for(SParallel_threadN(aligner->threadN), n, alignSet, &batch);
+
+  if (batch.sm == &tmp_sm)
+    SStarIndex_deinit(&tmp_sm.index);
+}
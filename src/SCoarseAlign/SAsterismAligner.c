@@ -0,0 +1,387 @@
+/* This file is part of Spica, released under MIT license.
+ * See LICENSE for details.
+ */
+
+/* Author: Piotr Polesiuk, 2022 */
+
+#include "SCoarseAlign.h"
+#include "SCoarseAlign/SLinearFit.h"
+
+#include <math.h>
+#include <stdlib.h>
+
+/* Triangles with the shortest side below this fraction of the longest side
+ * are too thin to have stable descriptors */
+#define MIN_SIDE_RATIO 0.1f
+
+/* Star correspondences with fewer votes than this fraction of the largest
+ * number of votes are not used for the initial fit */
+#define VOTE_RATIO 0.25f
+
+void SAsterismAligner_init(SAsterismAligner_t *aligner) {
+  aligner->starN        = 20;
+  aligner->refStarN     = 30;
+  aligner->descTol      = 0.01f;
+  aligner->distTol      = 1.5f;
+  aligner->minStarN     = 4;
+  aligner->refAsterisms = NULL;
+  aligner->refAsterismN = 0;
+  SStarSet_init(&aligner->refSset);
+  SStarIndex_init(&aligner->refIndex);
+}
+
+void SAsterismAligner_deinit(SAsterismAligner_t *aligner) {
+  free(aligner->refAsterisms);
+  SStarSet_deinit(&aligner->refSset);
+  SStarIndex_deinit(&aligner->refIndex);
+}
+
+/* ========================================================================= */
+static int minIntOpt(int a, int b) {
+  if (a < 0 || b < a) return b;
+  else return a;
+}
+
+/* Number of cells of the descriptor hash table in each dimension */
+static int keyWidth(float desc_tol) {
+  return (int)ceilf(1.0f / desc_tol) + 2;
+}
+
+static int keyOf(float desc_tol, int qx, int qy) {
+  return qx * keyWidth(desc_tol) + qy;
+}
+
+/* Compute the asterism of three stars. Returns 0 when the triangle is
+ * degenerate, or its vertices cannot be reliably ordered. */
+static int makeAsterism(
+  SAsterism_t *ast,
+  float desc_tol,
+  const SStarSet_t *sset,
+  int i, int j, int k)
+{
+  int v[3] = { i, j, k };
+  SVec2f_t p[3];
+  float side[3];
+  for (int n = 0; n < 3; n++) p[n] = sset->data[v[n]].pos;
+  /* side[n] is opposite to vertex n */
+  for (int n = 0; n < 3; n++)
+    side[n] = sqrtf(SVec2f_lengthSq(p[(n + 1) % 3] - p[(n + 2) % 3]));
+
+  /* Sort vertices by the length of the opposite side, the longest first */
+  for (int a = 0; a < 2; a++) {
+    for (int b = 2; b > a; b--) {
+      if (side[b] > side[b - 1]) {
+        float    ts = side[b]; side[b] = side[b - 1]; side[b - 1] = ts;
+        int      tv = v[b];    v[b]    = v[b - 1];    v[b - 1]    = tv;
+        SVec2f_t tp = p[b];    p[b]    = p[b - 1];    p[b - 1]    = tp;
+      }
+    }
+  }
+
+  if (!(side[2] > MIN_SIDE_RATIO * side[0])) return 0;
+  /* Nearly equal sides would make the order of vertices unstable */
+  if (side[0] - side[1] < desc_tol * side[0]) return 0;
+  if (side[1] - side[2] < desc_tol * side[0]) return 0;
+
+  SVec2f_t d1 = p[1] - p[0];
+  SVec2f_t d2 = p[2] - p[0];
+  float cross = d1[0] * d2[1] - d1[1] * d2[0];
+
+  for (int n = 0; n < 3; n++) ast->star[n] = v[n];
+  ast->desc   = SVec2f(side[1] / side[0], side[2] / side[0]);
+  ast->orient = cross > 0.0f ? 1 : -1;
+  ast->key    = keyOf(desc_tol,
+    (int)(ast->desc[0] / desc_tol), (int)(ast->desc[1] / desc_tol));
+  return 1;
+}
+
+/* Compute all non-degenerate asterisms of the first star_n stars. The
+ * returned array should be freed by the caller. */
+static SAsterism_t *makeAsterisms(
+  size_t *result_n,
+  float desc_tol,
+  const SStarSet_t *sset,
+  int star_n)
+{
+  size_t n = 0;
+  if (star_n >= 3) {
+    n = (size_t)star_n * (star_n - 1) * (star_n - 2) / 6;
+  }
+  SAsterism_t *result = malloc(sizeof(SAsterism_t) * (n > 0 ? n : 1));
+
+  n = 0;
+  for (int i = 0; i < star_n; i++) {
+    for (int j = i + 1; j < star_n; j++) {
+      for (int k = j + 1; k < star_n; k++) {
+        if (makeAsterism(&result[n], desc_tol, sset, i, j, k)) n++;
+      }
+    }
+  }
+  *result_n = n;
+  return result;
+}
+
+static int compareAsterisms(const void *p1, const void *p2) {
+  const SAsterism_t *a1 = p1;
+  const SAsterism_t *a2 = p2;
+  if (a1->key != a2->key) return a1->key < a2->key ? -1 : 1;
+  /* Make the order deterministic */
+  for (int n = 0; n < 3; n++) {
+    if (a1->star[n] != a2->star[n])
+      return a1->star[n] < a2->star[n] ? -1 : 1;
+  }
+  return 0;
+}
+
+/* ========================================================================= */
+void SAsterismAligner_setReference(
+  SAsterismAligner_t *aligner,
+  const SStarSet_t   *ref_sset)
+{
+  SStarSet_deinit(&aligner->refSset);
+  SStarSet_clone_at(&aligner->refSset, ref_sset);
+  SStarIndex_build(&aligner->refIndex, &aligner->refSset);
+
+  free(aligner->refAsterisms);
+  int ref_star_n = minIntOpt(aligner->refStarN, ref_sset->length);
+  aligner->refAsterisms = makeAsterisms(&aligner->refAsterismN,
+    aligner->descTol, &aligner->refSset, ref_star_n);
+  qsort(aligner->refAsterisms, aligner->refAsterismN, sizeof(SAsterism_t),
+    compareAsterisms);
+}
+
+/* ========================================================================= */
+/* Index of the first reference asterism with key not less than given one */
+static size_t lowerBound(const SAsterismAligner_t *aligner, int key) {
+  size_t lo = 0;
+  size_t hi = aligner->refAsterismN;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (aligner->refAsterisms[mid].key < key) lo = mid + 1;
+    else hi = mid;
+  }
+  return lo;
+}
+
+/* Add votes of all reference asterisms similar to ast */
+static void voteAsterism(
+  const SAsterismAligner_t *aligner,
+  int *votes,
+  int ref_star_n,
+  const SAsterism_t *ast)
+{
+  float tol = aligner->descTol;
+  int qx = (int)(ast->desc[0] / tol);
+  int qy = (int)(ast->desc[1] / tol);
+
+  for (int x = qx - 1; x <= qx + 1; x++) {
+    /* Cells with consecutive y have consecutive keys */
+    int key0 = keyOf(tol, x, qy - 1);
+    int key1 = keyOf(tol, x, qy + 1);
+    for (size_t r = lowerBound(aligner, key0);
+         r < aligner->refAsterismN && aligner->refAsterisms[r].key <= key1;
+         r++)
+    {
+      const SAsterism_t *ref = &aligner->refAsterisms[r];
+      if (ref->orient != ast->orient) continue;
+      if (fabsf(ref->desc[0] - ast->desc[0]) > tol) continue;
+      if (fabsf(ref->desc[1] - ast->desc[1]) > tol) continue;
+
+      for (int n = 0; n < 3; n++)
+        votes[ast->star[n] * ref_star_n + ref->star[n]]++;
+    }
+  }
+}
+
+/* ------------------------------------------------------------------------- */
+/* Pair of corresponding stars */
+typedef struct Pair {
+  int   star;
+  int   refStar;
+  int   votes;
+} Pair_t;
+
+static int comparePairs(const void *p1, const void *p2) {
+  const Pair_t *a = p1;
+  const Pair_t *b = p2;
+  if (a->votes != b->votes) return a->votes > b->votes ? -1 : 1;
+  if (a->star != b->star) return a->star < b->star ? -1 : 1;
+  return a->refStar < b->refStar ? -1 : (a->refStar > b->refStar);
+}
+
+/* Pick correspondences with the most votes, such that each star is used at
+ * most once. Returns the number of picked pairs, stored at the beginning of
+ * the pairs array. */
+static int pickPairs(
+  Pair_t *pairs,
+  const int *votes,
+  int star_n,
+  int ref_star_n)
+{
+  int pair_n = 0;
+  for (int i = 0; i < star_n; i++) {
+    for (int j = 0; j < ref_star_n; j++) {
+      int v = votes[i * ref_star_n + j];
+      if (v > 0) {
+        pairs[pair_n].star    = i;
+        pairs[pair_n].refStar = j;
+        pairs[pair_n].votes   = v;
+        pair_n++;
+      }
+    }
+  }
+  if (pair_n == 0) return 0;
+  qsort(pairs, pair_n, sizeof(Pair_t), comparePairs);
+
+  int min_votes = (int)(VOTE_RATIO * pairs[0].votes);
+  if (min_votes < 2) min_votes = 2;
+
+  char *used     = calloc(star_n, 1);
+  char *ref_used = calloc(ref_star_n, 1);
+  int n = 0;
+  for (int p = 0; p < pair_n && pairs[p].votes >= min_votes; p++) {
+    if (used[pairs[p].star] || ref_used[pairs[p].refStar]) continue;
+    used[pairs[p].star]        = 1;
+    ref_used[pairs[p].refStar] = 1;
+    pairs[n++] = pairs[p];
+  }
+  free(used);
+  free(ref_used);
+  return n;
+}
+
+/* ------------------------------------------------------------------------- */
+/* Fit linear transformation to pairs */
+static STransform_t fitPairs(
+  const SStarSet_t *ref_sset,
+  const SStarSet_t *sset,
+  const Pair_t *pairs,
+  int pair_n)
+{
+  SLinearFit_t fit;
+  SLinearFit_init(&fit);
+  for (int p = 0; p < pair_n; p++) {
+    SLinearFit_add(&fit,
+      sset->data[pairs[p].star].pos, ref_sset->data[pairs[p].refStar].pos);
+  }
+  return SLinearFit_transform(&fit);
+}
+
+/* Square of the distance (in sigmas) between stars of a pair after the
+ * transformation */
+static float pairDistSq(
+  const SStarSet_t *ref_sset,
+  const SStarSet_t *sset,
+  const STransform_t *tr,
+  const Pair_t *pair)
+{
+  const SStar_t *star = &sset->data[pair->star];
+  const SStar_t *ref  = &ref_sset->data[pair->refStar];
+  return SVec2f_lengthSq(STransform_apply(tr, star->pos) - ref->pos) /
+    (star->sigma * ref->sigma);
+}
+
+/* Fit transformation and iteratively reject the worst outlier, until all
+ * pairs agree with the transformation. */
+static STransform_t fitRobust(
+  const SAsterismAligner_t *aligner,
+  const SStarSet_t *sset,
+  Pair_t *pairs,
+  int pair_n)
+{
+  const SStarSet_t *ref_sset = &aligner->refSset;
+  float tol_sq = aligner->distTol * aligner->distTol;
+
+  while (1) {
+    STransform_t tr = fitPairs(ref_sset, sset, pairs, pair_n);
+    if (tr.type == STr_Drop || pair_n <= 2) return tr;
+
+    int   worst = -1;
+    float worst_dist = tol_sq;
+    for (int p = 0; p < pair_n; p++) {
+      float dist = pairDistSq(ref_sset, sset, &tr, &pairs[p]);
+      if (dist > worst_dist) {
+        worst      = p;
+        worst_dist = dist;
+      }
+    }
+    if (worst < 0) return tr;
+
+    pairs[worst] = pairs[--pair_n];
+  }
+}
+
+/* Match all stars using given transformation, and fit the transformation to
+ * all matched pairs. */
+static STransform_t refine(
+  const SAsterismAligner_t *aligner,
+  const SStarSet_t *sset,
+  const STransform_t *tr)
+{
+  const SStarSet_t *ref_sset = &aligner->refSset;
+  Pair_t *pairs  = malloc(sizeof(Pair_t) * (sset->length + 1));
+  char *ref_used = calloc(ref_sset->length + 1, 1);
+
+  int pair_n = 0;
+  for (size_t i = 0; i < sset->length; i++) {
+    int j = SStarIndex_nearest(&aligner->refIndex, ref_sset,
+      STransform_apply(tr, sset->data[i].pos), sset->data[i].sigma,
+      aligner->distTol, NULL);
+    if (j < 0 || ref_used[j]) continue;
+    ref_used[j] = 1;
+    pairs[pair_n].star    = i;
+    pairs[pair_n].refStar = j;
+    pairs[pair_n].votes   = 0;
+    pair_n++;
+  }
+
+  STransform_t result;
+  if (pair_n < aligner->minStarN) {
+    result.type  = STr_Drop;
+    result.rot   = SVec2f(1.0f, 0.0f);
+    result.shift = SVec2f(0.0f, 0.0f);
+  } else {
+    result = fitPairs(ref_sset, sset, pairs, pair_n);
+  }
+
+  free(pairs);
+  free(ref_used);
+  return result;
+}
+
+/* ========================================================================= */
+STransform_t SAsterismAligner_align(
+  const SAsterismAligner_t *aligner,
+  const SStarSet_t         *sset)
+{
+  STransform_t result = {
+    .type  = STr_Drop,
+    .rot   = { 1.0f, 0.0f },
+    .shift = { 0.0f, 0.0f }
+  };
+
+  int star_n     = minIntOpt(aligner->starN, sset->length);
+  int ref_star_n = minIntOpt(aligner->refStarN, aligner->refSset.length);
+  if (star_n < 3 || ref_star_n < 3 || aligner->refAsterismN == 0)
+    return result;
+
+  size_t ast_n;
+  SAsterism_t *asts = makeAsterisms(&ast_n, aligner->descTol, sset, star_n);
+
+  int *votes = calloc((size_t)star_n * ref_star_n, sizeof(int));
+  for (size_t a = 0; a < ast_n; a++)
+    voteAsterism(aligner, votes, ref_star_n, &asts[a]);
+  free(asts);
+
+  Pair_t *pairs = malloc(sizeof(Pair_t) * star_n * ref_star_n);
+  int pair_n = pickPairs(pairs, votes, star_n, ref_star_n);
+  free(votes);
+
+  if (pair_n >= 2) {
+    STransform_t tr = fitRobust(aligner, sset, pairs, pair_n);
+    if (tr.type != STr_Drop) result = refine(aligner, sset, &tr);
+  }
+
+  free(pairs);
+  return result;
+}
@@ -4,9 +4,20 @@
 
 /* Author: Piotr Polesiuk, 2022 */
 
+#define _POSIX_C_SOURCE 200809L
+
 #include "SCoarseAlign.h"
+#include "SCoarseAlign/SScaleRotTol.h"
+#include "SParallel.h"
 
 #include <math.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+/* Relative margin of the window of pair lengths, that makes sure that
+ * rounding errors do not exclude pairs accepted by respectScaleRotTol */
+#define LENGTH_MARGIN 1e-3f
 
 void SBrutAligner_init(SBrutAligner_t *aligner) {
   aligner->starN     = 30;
@@ -15,6 +26,15 @@ void SBrutAligner_init(SBrutAligner_t *aligner) {
   aligner->distTol   = 1.5f;
   aligner->scaleTol  = 0.1f;
   aligner->rotTol    = 3.0f;
+  aligner->threadN   = 1;
+  aligner->refPairs  = NULL;
+  aligner->refPairN  = 0;
+  SStarSet_init(&aligner->refSset);
+}
+
+void SBrutAligner_deinit(SBrutAligner_t *aligner) {
+  free(aligner->refPairs);
+  SStarSet_deinit(&aligner->refSset);
 }
 
 /* ========================================================================= */
@@ -23,9 +43,13 @@ static int minIntOpt(int a, int b) {
   else return a;
 }
 
+/* Rank of the transformation (lower is better). Since each star adds
+ * a non-negative value, computation is aborted as soon as the partial rank
+ * exceeds the bound, and the partial rank is returned. */
 static float rankTransform(
   int rank_star_n,
   float dist_tol,
+  float bound,
   const SStarSet_t *ref_sset,
   const STransform_t *tr,
   const SStarSet_t *sset)
@@ -44,27 +68,278 @@ static float rankTransform(
     }
 
     result += best_rank;
+    if (result > bound) break;
   }
   return result;
 }
 
 static int respectScaleRotTol(const SBrutAligner_t *aligner, SVec2f_t rot) {
-  float lsq = SVec2f_lengthSq(rot);
+  return SScaleRotTol_respect(aligner->scaleTol, aligner->rotTol, rot);
+}
+
+/* ========================================================================= */
+/* Table of pairs of reference stars sorted by their length */
+typedef struct PairTable {
+  size_t                length;
+  const SBrutRefPair_t *data;
+} PairTable_t;
+
+static int compareRefPairs(const void *p1, const void *p2) {
+  const SBrutRefPair_t *r1 = p1;
+  const SBrutRefPair_t *r2 = p2;
+  if (r1->lengthSq < r2->lengthSq) return -1;
+  if (r1->lengthSq > r2->lengthSq) return 1;
+  return 0;
+}
+
+/* Build sorted array of pairs of the first ref_star_n stars. Returns NULL
+ * when it cannot be allocated. */
+static SBrutRefPair_t *makePairs(
+  size_t *pair_n,
+  const SStarSet_t *ref_sset,
+  int ref_star_n)
+{
+  size_t n = ref_star_n > 1 ? (size_t)ref_star_n * (ref_star_n - 1) / 2 : 0;
+  *pair_n = 0;
+  if (n >= SIZE_MAX / sizeof(SBrutRefPair_t)) return NULL;
+  SBrutRefPair_t *pairs = malloc(sizeof(SBrutRefPair_t) * (n + 1));
+  if (pairs == NULL) return NULL;
+
+  for (int a = 0; a < ref_star_n; a++) {
+    for (int b = a + 1; b < ref_star_n; b++) {
+      SVec2f_t dir = ref_sset->data[b].pos - ref_sset->data[a].pos;
+      /* Such pairs are never matched */
+      if (dir[0] == 0.0f && dir[1] == 0.0f) continue;
+
+      SBrutRefPair_t *pair = &pairs[(*pair_n)++];
+      pair->lengthSq = SVec2f_lengthSq(dir);
+      pair->a        = a;
+      pair->b        = b;
+    }
+  }
+  qsort(pairs, *pair_n, sizeof(SBrutRefPair_t), compareRefPairs);
+  return pairs;
+}
+
+/* Index of the first pair not shorter than given squared length */
+static size_t lowerBound(const PairTable_t *table, float length_sq) {
+  size_t lo = 0;
+  size_t hi = table->length;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (table->data[mid].lengthSq < length_sq) lo = mid + 1;
+    else hi = mid;
+  }
+  return lo;
+}
+
+/* Range of pairs that may match pair of squared length length_sq within
+ * the scale tolerance. The range is slightly larger than necessary, so
+ * respectScaleRotTol should be checked for each pair. */
+static void findPairs(
+  const PairTable_t *table,
+  const SBrutAligner_t *aligner,
+  float length_sq,
+  size_t *begin,
+  size_t *end)
+{
   float tol = aligner->scaleTol + 1.0f;
   tol *= tol;
-  if (lsq > tol || 1.0f / lsq > tol) return 0;
+  *begin = lowerBound(table, length_sq / tol * (1.0f - LENGTH_MARGIN));
+  *end   = lowerBound(table, length_sq * tol * (1.0f + LENGTH_MARGIN));
+}
+
+/* ========================================================================= */
+/* State of the search shared by all threads */
+typedef struct Search {
+  const SBrutAligner_t *aligner;
+  const SStarSet_t     *ref_sset;
+  const SStarSet_t     *sset;
+  PairTable_t           table;
+  int                   star_n;
+  int                   ref_star_n;
+  int                   rank_star_n;
+
+  /* Fields below are protected by the lock */
+  pthread_mutex_t lock;
+  /* Next pair of input stars to process, encoded as a1 * star_n + b1 */
+  long long       next;
+  /* The best transformation found so far, and its rank */
+  STransform_t    result;
+  float           rank;
+  /* Position of the best hypothesis in the order of enumeration of all
+   * hypotheses, or -1 if there is no hypothesis yet */
+  long long       code;
+} Search_t;
 
-  /* Abort check, when rotation tolerance is lagre */
-  if (aligner->rotTol > 2.0f) return 1;
+/* Take the next pair of input stars to process. Returns 0 when there is no
+ * more work. The bound is set to the best rank found so far. */
+static int nextInputPair(Search_t *search, int *a1, int *b1, float *bound) {
+  long long star_n = search->star_n;
 
-  /* Normalize vector, and compute its distance to complex unit (no rotation)
-   * */
-  rot /= sqrtf(lsq);
-  rot[0] = 1.0f;
+  pthread_mutex_lock(&search->lock);
+  long long w = search->next;
+  /* Skip codes that do not represent pairs a1 < b1 */
+  while (w < star_n * star_n && w % star_n <= w / star_n) w++;
+  search->next = w + 1;
+  *bound = search->rank;
+  pthread_mutex_unlock(&search->lock);
 
-  lsq = SVec2f_lengthSq(rot);
-  tol = aligner->rotTol;
-  return lsq <= tol * tol;
+  *a1 = w / star_n;
+  *b1 = w % star_n;
+  return w < star_n * star_n;
+}
+
+/* Offer a hypothesis. Returns the new bound. */
+static float offer(
+  Search_t *search,
+  const STransform_t *tr,
+  float rank,
+  long long code)
+{
+  pthread_mutex_lock(&search->lock);
+  /* On ties of rank, the hypothesis that comes first in the order of
+   * enumeration wins. This makes the result independent of the order in
+   * which the hypotheses are checked. */
+  if (rank < search->rank ||
+      (rank == search->rank && search->code >= 0 && code < search->code))
+  {
+    search->rank   = rank;
+    search->result = *tr;
+    search->code   = code;
+  }
+  float bound = search->rank;
+  pthread_mutex_unlock(&search->lock);
+  return bound;
+}
+
+static void searchWorker(void *arg, int id) {
+  (void)id;
+  Search_t *search = arg;
+  const SBrutAligner_t *aligner  = search->aligner;
+  const SStarSet_t     *ref_sset = search->ref_sset;
+  const SStarSet_t     *sset     = search->sset;
+
+  int a1, b1;
+  float bound;
+  while (nextInputPair(search, &a1, &b1, &bound)) {
+    SVec2f_t pos1 = sset->data[a1].pos;
+    SVec2f_t dir1 = sset->data[b1].pos - pos1;
+    if (dir1[0] == 0.0f && dir1[1] == 0.0f) continue;
+
+    size_t begin, end;
+    findPairs(&search->table, aligner, SVec2f_lengthSq(dir1), &begin, &end);
+    for (size_t k = 0; k < 2 * (end - begin); k++) {
+      /* Each unordered pair is checked in both directions */
+      const SBrutRefPair_t *pair = &search->table.data[begin + k / 2];
+      int a2 = k % 2 ? pair->b : pair->a;
+      int b2 = k % 2 ? pair->a : pair->b;
+      SVec2f_t pos2 = ref_sset->data[a2].pos;
+      SVec2f_t dir2 = ref_sset->data[b2].pos - pos2;
+
+      SVec2f_t rot = SVec2f_complexDiv(dir2, dir1);
+      if (!respectScaleRotTol(aligner, rot)) continue;
+
+      STransform_t tr = {
+        .type  = STr_Linear,
+        .rot   = rot,
+        .shift = pos2 - SVec2f_complexMul(pos1, rot)
+      };
+
+      float rank = rankTransform(search->rank_star_n, aligner->distTol,
+        bound, ref_sset, &tr, sset);
+      /* Hypotheses with rank equal to the bound may still win a tie */
+      if (rank <= bound) {
+        long long code = (((long long)a1 * search->star_n + b1) *
+          search->ref_star_n + a2) * search->ref_star_n + b2;
+        bound = offer(search, &tr, rank, code);
+      }
+    }
+  }
+}
+
+/* ------------------------------------------------------------------------- */
+static STransform_t dropTransform(void) {
+  STransform_t tr = {
+    .type  = STr_Drop,
+    .rot   = SVec2f(1.0f, 0.0f),
+    .shift = SVec2f(0.0f, 0.0f)
+  };
+  return tr;
+}
+
+/* Search for the best matching of pairs of stars of sset to given pairs of
+ * the first ref_star_n reference stars */
+static STransform_t runSearch(
+  const SBrutAligner_t *aligner,
+  const SStarSet_t     *ref_sset,
+  int                   ref_star_n,
+  const PairTable_t    *table,
+  const SStarSet_t     *sset)
+{
+  Search_t search;
+  search.aligner     = aligner;
+  search.ref_sset    = ref_sset;
+  search.sset        = sset;
+  search.table       = *table;
+  search.star_n      = minIntOpt(aligner->starN, sset->length);
+  search.ref_star_n  = ref_star_n;
+  search.rank_star_n = minIntOpt(aligner->rankStarN, sset->length);
+  search.next        = 0;
+  search.rank        = search.rank_star_n;
+  search.code        = -1;
+  search.result      = dropTransform();
+  pthread_mutex_init(&search.lock, NULL);
+
+  /* Pairs of input stars are distributed dynamically among threads. All
+   * threads share the best rank, and use it to abort ranking of hopeless
+   * hypotheses. */
+  int thread_n = SParallel_threadN(aligner->threadN);
+  long long pair_n = (long long)search.star_n * (search.star_n - 1) / 2;
+  if (thread_n > pair_n) thread_n = pair_n > 1 ? pair_n : 1;
+  SParallel_run(thread_n, searchWorker, &search);
+
+  pthread_mutex_destroy(&search.lock);
+  return search.result;
+}
+
+/* ------------------------------------------------------------------------- */
+int SBrutAligner_setReference(
+  SBrutAligner_t   *aligner,
+  const SStarSet_t *ref_sset)
+{
+  SStarSet_deinit(&aligner->refSset);
+  SStarSet_clone_at(&aligner->refSset, ref_sset);
+
+  /* Only reference pairs of similar length to the input pair can respect
+   * the scale tolerance, so they are found in the table of pairs sorted by
+   * length, instead of checking all of them. */
+  free(aligner->refPairs);
+  int ref_star_n = minIntOpt(aligner->refStarN, ref_sset->length);
+  aligner->refPairs =
+    makePairs(&aligner->refPairN, &aligner->refSset, ref_star_n);
+  if (aligner->refPairs == NULL) {
+    SStarSet_deinit(&aligner->refSset);
+    SStarSet_init(&aligner->refSset);
+    return SPICA_ERROR;
+  }
+  return SPICA_OK;
+}
+
+STransform_t SBrutAligner_alignToReference(
+  const SBrutAligner_t *aligner,
+  const SStarSet_t     *sset)
+{
+  if (aligner->refPairs == NULL) return dropTransform();
+
+  PairTable_t table = {
+    .length = aligner->refPairN,
+    .data   = aligner->refPairs
+  };
+  /* All indices of pairs are below the length of the set, even when
+   * refStarN was changed after the table was built */
+  return runSearch(aligner, &aligner->refSset, aligner->refSset.length,
+    &table, sset);
 }
 
 STransform_t SBrutAligner_align(
@@ -72,46 +347,13 @@ STransform_t SBrutAligner_align(
   const SStarSet_t *ref_sset,
   const SStarSet_t *sset)
 {
-  int star_n = minIntOpt(aligner->starN, sset->length);
   int ref_star_n = minIntOpt(aligner->refStarN, ref_sset->length);
-  int rank_star_n = minIntOpt(aligner->rankStarN, sset->length);
-  STransform_t result = {
-    .type  = STr_Drop,
-    .rot   = { 1.0f, 0.0f },
-    .shift = { 0.0f, 0.0f }
-  };
-  float rank = rank_star_n;
-  for (int a1 = 0; a1 < star_n; a1++) {
-    for (int b1 = a1 + 1; b1 < star_n; b1++) {
-      SVec2f_t pos1 = sset->data[a1].pos;
-      SVec2f_t dir1 = sset->data[b1].pos - pos1;
-      if (dir1[0] == 0.0f && dir1[1] == 0.0f) continue;
-
-      for (int a2 = 0; a2 < ref_star_n; a2++) {
-        for (int b2 = 0; b2 < ref_star_n; b2++) {
-          if (b2 == a2) continue;
-          SVec2f_t pos2 = ref_sset->data[a2].pos;
-          SVec2f_t dir2 = ref_sset->data[b2].pos - pos2;
-          if (dir2[0] == 0.0f && dir2[1] == 0.0f) continue;
-
-          SVec2f_t rot = SVec2f_complexDiv(dir2, dir1);
-          if (!respectScaleRotTol(aligner, rot)) continue;
-
-          STransform_t tr = {
-            .type  = STr_Linear,
-            .rot   = rot,
-            .shift = pos2 - SVec2f_complexMul(pos1, rot)
-          };
-
-          float new_rank =
-            rankTransform(rank_star_n, aligner->distTol, ref_sset, &tr, sset);
-          if (new_rank < rank) {
-            rank   = new_rank;
-            result = tr;
-          }
-        }
-      }
-    }
-  }
-  return result;
+  PairTable_t table;
+  SBrutRefPair_t *pairs = makePairs(&table.length, ref_sset, ref_star_n);
+  if (pairs == NULL) return dropTransform();
+  table.data = pairs;
+
+  STransform_t tr = runSearch(aligner, ref_sset, ref_star_n, &table, sset);
+  free(pairs);
+  return tr;
 }
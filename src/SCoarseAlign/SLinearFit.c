@@ -0,0 +1,53 @@
+/* This file is part of Spica, released under MIT license.
+ * See LICENSE for details.
+ */
+
+/* Author: Piotr Polesiuk, 2022 */
+
+#include "SCoarseAlign/SLinearFit.h"
+
+void SLinearFit_init(SLinearFit_t *fit) {
+  fit->sx[0]  = fit->sx[1]  = 0.0;
+  fit->sy[0]  = fit->sy[1]  = 0.0;
+  fit->sxy[0] = fit->sxy[1] = 0.0;
+  fit->sx2 = 0.0;
+  fit->n   = 0;
+}
+
+void SLinearFit_add(SLinearFit_t *fit, SVec2f_t x, SVec2f_t y) {
+  fit->sx[0]  += x[0];
+  fit->sx[1]  += x[1];
+  fit->sy[0]  += y[0];
+  fit->sy[1]  += y[1];
+  /* conj(x)·y */
+  fit->sxy[0] += (double)x[0] * y[0] + (double)x[1] * y[1];
+  fit->sxy[1] += (double)x[0] * y[1] - (double)x[1] * y[0];
+  fit->sx2    += (double)x[0] * x[0] + (double)x[1] * x[1];
+  fit->n++;
+}
+
+STransform_t SLinearFit_transform(const SLinearFit_t *fit) {
+  STransform_t tr = {
+    .type  = STr_Drop,
+    .rot   = { 1.0f, 0.0f },
+    .shift = { 0.0f, 0.0f }
+  };
+  if (fit->n < 2) return tr;
+
+  double n   = fit->n;
+  double sx0 = fit->sx[0], sx1 = fit->sx[1];
+  double sy0 = fit->sy[0], sy1 = fit->sy[1];
+  double den = n * fit->sx2 - sx0 * sx0 - sx1 * sx1;
+  if (!(den > 0.0)) return tr;
+
+  /* rot = (n·sxy - conj(sx)·sy) / den */
+  double re = (n * fit->sxy[0] - (sx0 * sy0 + sx1 * sy1)) / den;
+  double im = (n * fit->sxy[1] - (sx0 * sy1 - sx1 * sy0)) / den;
+
+  tr.type     = STr_Linear;
+  tr.rot[0]   = re;
+  tr.rot[1]   = im;
+  tr.shift[0] = (sy0 - (re * sx0 - im * sx1)) / n;
+  tr.shift[1] = (sy1 - (re * sx1 + im * sx0)) / n;
+  return tr;
+}
@@ -0,0 +1,34 @@
+/* This file is part of Spica, released under MIT license.
+ * See LICENSE for details.
+ */
+
+/* Fitting of STr_Linear transformation to pairs of corresponding points */
+
+/* Author: Piotr Polesiuk, 2022 */
+
+#ifndef __SLINEAR_FIT_H__
+#define __SLINEAR_FIT_H__
+
+#include "STransform.h"
+
+/** Sums of complex linear regression y = rot·x + shift. They are kept in
+ * double precision, so positions need not to be centered. */
+typedef struct SLinearFit {
+  double sx[2];
+  double sy[2];
+  double sxy[2];
+  double sx2;
+  int    n;
+} SLinearFit_t;
+
+/** Initialize empty regression */
+void SLinearFit_init(SLinearFit_t *fit);
+
+/** Add pair of corresponding points: \p x should be transformed to \p y */
+void SLinearFit_add(SLinearFit_t *fit, SVec2f_t x, SVec2f_t y);
+
+/** Transformation that fits best to all added pairs, or STr_Drop when there
+ * are less than two distinct points. */
+STransform_t SLinearFit_transform(const SLinearFit_t *fit);
+
+#endif /* __SLINEAR_FIT_H__ */
@@ -0,0 +1,160 @@
+/* This file is part of Spica, released under MIT license.
+ * See LICENSE for details.
+ */
+
+/* Author: Piotr Polesiuk, 2022 */
+
+#include "SCoarseAlign.h"
+#include "SFFT.h"
+
+#include <math.h>
+#include <stdlib.h>
+
+#define PI_F 3.14159265358979f
+
+void SPhaseCorrAligner_init(SPhaseCorrAligner_t *aligner) {
+  aligner->scale       = 4;
+  aligner->minPeak     = 0.05f;
+  aligner->fftWidth    = 0;
+  aligner->fftHeight   = 0;
+  aligner->refSpectrum = NULL;
+}
+
+void SPhaseCorrAligner_deinit(SPhaseCorrAligner_t *aligner) {
+  free(aligner->refSpectrum);
+}
+
+/* ========================================================================= */
+static float hann(unsigned i, unsigned n) {
+  return 0.5f - 0.5f * cosf(2.0f * PI_F * (i + 0.5f) / n);
+}
+
+/* Spectrum of the scaled-down, windowed, gray-scale image with zero mean.
+ * The image is cropped or padded with zeros to the size of the FFT. */
+static SVec2f_t *spectrum(
+  const SPhaseCorrAligner_t *aligner,
+  const SImage_t *image)
+{
+  unsigned w = aligner->fftWidth;
+  unsigned h = aligner->fftHeight;
+  SVec2f_t *buf = calloc((size_t)w * h, sizeof(SVec2f_t));
+
+  SImage_t scaled;
+  SImage_scaleDown_at(&scaled, image, aligner->scale);
+  unsigned sw = scaled.width  < w ? scaled.width  : w;
+  unsigned sh = scaled.height < h ? scaled.height : h;
+
+  /* Pixels without weight have no value */
+  double sum = 0.0;
+  size_t n   = 0;
+  for (unsigned y = 0; y < sh; y++) {
+    for (unsigned x = 0; x < sw; x++) {
+      SVec2f_t pix = SImage_pixelGray(&scaled, x, y);
+      if (pix[1] > 0.0f) {
+        float v = pix[0] / pix[1];
+        buf[(size_t)y * w + x] = SVec2f(v, 1.0f);
+        sum += v;
+        n++;
+      }
+    }
+  }
+  float mean = n > 0 ? sum / n : 0.0f;
+
+  for (unsigned y = 0; y < sh; y++) {
+    float wy = hann(y, sh);
+    for (unsigned x = 0; x < sw; x++) {
+      SVec2f_t *p = &buf[(size_t)y * w + x];
+      float v = (*p)[1] > 0.0f ? (*p)[0] - mean : 0.0f;
+      *p = SVec2f(v * wy * hann(x, sw), 0.0f);
+    }
+  }
+  SImage_deinit(&scaled);
+
+  SFFT_2d(buf, w, h, 0);
+  return buf;
+}
+
+/* ========================================================================= */
+void SPhaseCorrAligner_setReference(
+  SPhaseCorrAligner_t *aligner,
+  const SImage_t      *image)
+{
+  free(aligner->refSpectrum);
+  aligner->refSpectrum = NULL;
+  aligner->fftWidth    = 0;
+  aligner->fftHeight   = 0;
+  if (image->format == SFmt_Invalid || aligner->scale == 0) return;
+
+  unsigned scale = aligner->scale;
+  aligner->fftWidth  = SFFT_size((image->width  + scale - 1) / scale);
+  aligner->fftHeight = SFFT_size((image->height + scale - 1) / scale);
+  aligner->refSpectrum = spectrum(aligner, image);
+
+  size_t n = (size_t)aligner->fftWidth * aligner->fftHeight;
+  for (size_t i = 0; i < n; i++)
+    aligner->refSpectrum[i] = SVec2f_complexConj(aligner->refSpectrum[i]);
+}
+
+/* ------------------------------------------------------------------------- */
+/* Sub-pixel offset of the peak of a parabola that goes through three
+ * points: (-1, l), (0, c), and (1, r). */
+static float parabolaPeak(float l, float c, float r) {
+  float den = l - 2.0f * c + r;
+  if (!(den < 0.0f)) return 0.0f;
+  float d = 0.5f * (l - r) / den;
+  return d < -0.5f ? -0.5f : d > 0.5f ? 0.5f : d;
+}
+
+/* Signed shift that corresponds to index i of cyclic array of size n */
+static float cyclicShift(float i, unsigned n) {
+  return i > 0.5f * n ? i - n : i;
+}
+
+STransform_t SPhaseCorrAligner_align(
+  const SPhaseCorrAligner_t *aligner,
+  const SImage_t            *image)
+{
+  STransform_t result = {
+    .type  = STr_Drop,
+    .rot   = { 1.0f, 0.0f },
+    .shift = { 0.0f, 0.0f }
+  };
+  if (aligner->refSpectrum == NULL || image->format == SFmt_Invalid)
+    return result;
+
+  unsigned w = aligner->fftWidth;
+  unsigned h = aligner->fftHeight;
+  size_t   n = (size_t)w * h;
+  SVec2f_t *buf = spectrum(aligner, image);
+
+  /* Normalized cross-power spectrum */
+  for (size_t i = 0; i < n; i++) {
+    SVec2f_t c = SVec2f_complexMul(buf[i], aligner->refSpectrum[i]);
+    float len = sqrtf(SVec2f_lengthSq(c));
+    buf[i] = len > 0.0f ? c / len : SVec2f(0.0f, 0.0f);
+  }
+  SFFT_2d(buf, w, h, 1);
+
+  size_t best = 0;
+  for (size_t i = 1; i < n; i++) {
+    if (buf[i][0] > buf[best][0]) best = i;
+  }
+
+  float peak = buf[best][0];
+  if (peak >= aligner->minPeak) {
+    unsigned px = best % w;
+    unsigned py = best / w;
+    float dx = parabolaPeak(
+      buf[py * w + (px + w - 1) % w][0], peak, buf[py * w + (px + 1) % w][0]);
+    float dy = parabolaPeak(
+      buf[(py + h - 1) % h * w + px][0], peak, buf[(py + 1) % h * w + px][0]);
+
+    /* The peak is at the shift from the reference to the image */
+    result.type  = STr_Shift;
+    result.shift = -(float)aligner->scale *
+      SVec2f(cyclicShift(px + dx, w), cyclicShift(py + dy, h));
+  }
+
+  free(buf);
+  return result;
+}
@@ -0,0 +1,245 @@
+/* This file is part of Spica, released under MIT license.
+ * See LICENSE for details.
+ */
+
+/* Author: Piotr Polesiuk, 2022 */
+
+#include "SCoarseAlign.h"
+#include "SCoarseAlign/SLinearFit.h"
+#include "SCoarseAlign/SScaleRotTol.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+/* Number of refinement steps of the final transformation */
+#define REFINE_STEPS 2
+
+void SRansacAligner_init(SRansacAligner_t *aligner) {
+  aligner->starN      = 30;
+  aligner->refStarN   = 40;
+  aligner->rankStarN  = 50;
+  aligner->rankTol    = 8;
+  aligner->distTol    = 1.5f;
+  aligner->scaleTol   = 0.1f;
+  aligner->rotTol     = 3.0f;
+  aligner->confidence = 0.999f;
+  aligner->maxIter    = 100000;
+  aligner->minStarN   = 4;
+  aligner->seed       = 1;
+}
+
+/* ========================================================================= */
+static int minIntOpt(int a, int b) {
+  if (a < 0 || b < a) return b;
+  else return a;
+}
+
+/* Xorshift generator. The state must be non-zero. */
+static uint32_t nextRandom(uint32_t *state) {
+  uint32_t x = *state;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  return *state = x;
+}
+
+/* Random integer from [lo, hi] */
+static int randomRange(uint32_t *state, int lo, int hi) {
+  uint64_t r = nextRandom(state);
+  return lo + (int)((r * (uint64_t)(hi - lo + 1)) >> 32);
+}
+
+/* ------------------------------------------------------------------------- */
+/* Indices of stars sorted by brightness (brightest first) */
+typedef struct Ranked {
+  float brightness;
+  int   index;
+} Ranked_t;
+
+static int compareRanked(const void *p1, const void *p2) {
+  const Ranked_t *r1 = p1;
+  const Ranked_t *r2 = p2;
+  if (r1->brightness > r2->brightness) return -1;
+  if (r1->brightness < r2->brightness) return 1;
+  return (r1->index > r2->index) - (r1->index < r2->index);
+}
+
+static int *brightnessOrder(const SStarSet_t *sset) {
+  Ranked_t *ranked = malloc(sizeof(Ranked_t) * (sset->length + 1));
+  for (size_t i = 0; i < sset->length; i++) {
+    ranked[i].brightness = sset->data[i].brightness;
+    ranked[i].index      = i;
+  }
+  qsort(ranked, sset->length, sizeof(Ranked_t), compareRanked);
+
+  int *order = malloc(sizeof(int) * (sset->length + 1));
+  for (size_t i = 0; i < sset->length; i++) order[i] = ranked[i].index;
+  free(ranked);
+  return order;
+}
+
+/* ------------------------------------------------------------------------- */
+static int respectScaleRotTol(const SRansacAligner_t *aligner, SVec2f_t rot) {
+  return SScaleRotTol_respect(aligner->scaleTol, aligner->rotTol, rot);
+}
+
+/* ========================================================================= */
+typedef struct Ransac {
+  const SRansacAligner_t *aligner;
+  const SStarSet_t       *ref_sset;
+  const SStarIndex_t     *ref_index;
+  const SStarSet_t       *sset;
+  /* Input stars used to count the support (brightest first) */
+  const int              *order;
+  int                     rank_star_n;
+} Ransac_t;
+
+/* Support of the transformation. Counting is aborted when the support
+ * cannot reach min_support. */
+static int support(const Ransac_t *r, const STransform_t *tr, int min_support)
+{
+  int result = 0;
+  for (int k = 0; k < r->rank_star_n; k++) {
+    if (result + (r->rank_star_n - k) < min_support) break;
+
+    const SStar_t *star = &r->sset->data[r->order[k]];
+    int j = SStarIndex_nearest(r->ref_index, r->ref_sset,
+      STransform_apply(tr, star->pos), star->sigma, r->aligner->distTol,
+      NULL);
+    if (j >= 0) result++;
+  }
+  return result;
+}
+
+/* Fit the transformation to all supporting stars */
+static STransform_t refine(const Ransac_t *r, const STransform_t *tr) {
+  SLinearFit_t fit;
+  SLinearFit_init(&fit);
+  for (int k = 0; k < r->rank_star_n; k++) {
+    const SStar_t *star = &r->sset->data[r->order[k]];
+    int j = SStarIndex_nearest(r->ref_index, r->ref_sset,
+      STransform_apply(tr, star->pos), star->sigma, r->aligner->distTol,
+      NULL);
+    if (j >= 0) SLinearFit_add(&fit, star->pos, r->ref_sset->data[j].pos);
+  }
+
+  STransform_t result = SLinearFit_transform(&fit);
+  if (fit.n < r->aligner->minStarN) result.type = STr_Drop;
+  return result;
+}
+
+/* Number of iterations required to draw a correct sample with given
+ * confidence, when the fraction of supporting stars is ratio. A sample is
+ * correct, when both sampled reference stars correspond to the input ones,
+ * and each of them is drawn from the window of 2·rankTol+1 stars. */
+static double requiredIter(const SRansacAligner_t *aligner, double ratio) {
+  double p = ratio / (2 * aligner->rankTol + 1);
+  p *= p;
+  if (p >= 1.0) return 1.0;
+  if (p <= 0.0) return INFINITY;
+  return log(1.0 - aligner->confidence) / log(1.0 - p);
+}
+
+/* ------------------------------------------------------------------------- */
+STransform_t SRansacAligner_alignIndexed(
+  const SRansacAligner_t *aligner,
+  const SStarSet_t *ref_sset,
+  const SStarIndex_t *ref_index,
+  const SStarSet_t *sset)
+{
+  STransform_t result = {
+    .type  = STr_Drop,
+    .rot   = { 1.0f, 0.0f },
+    .shift = { 0.0f, 0.0f }
+  };
+
+  int star_n     = minIntOpt(aligner->starN, sset->length);
+  int ref_star_n = minIntOpt(aligner->refStarN, ref_sset->length);
+  if (star_n < 2 || ref_star_n < 2 || aligner->rankTol < 0) return result;
+
+  int *order     = brightnessOrder(sset);
+  int *ref_order = brightnessOrder(ref_sset);
+
+  Ransac_t r = {
+    .aligner     = aligner,
+    .ref_sset    = ref_sset,
+    .ref_index   = ref_index,
+    .sset        = sset,
+    .order       = order,
+    .rank_star_n = minIntOpt(aligner->rankStarN, sset->length)
+  };
+
+  uint32_t state = aligner->seed ? aligner->seed : 1;
+  int    best_support = aligner->minStarN > 2 ? aligner->minStarN - 1 : 2;
+  double max_iter     = aligner->maxIter;
+
+  for (int iter = 0; iter < max_iter; iter++) {
+    /* Sample two distinct input stars, and two distinct reference stars of
+     * similar brightness rank */
+    int i1 = randomRange(&state, 0, star_n - 1);
+    int i2 = randomRange(&state, 0, star_n - 2);
+    if (i2 >= i1) i2++;
+
+    int lo1 = i1 - aligner->rankTol, hi1 = i1 + aligner->rankTol;
+    int lo2 = i2 - aligner->rankTol, hi2 = i2 + aligner->rankTol;
+    if (lo1 < 0) lo1 = 0;
+    if (lo2 < 0) lo2 = 0;
+    if (hi1 >= ref_star_n) hi1 = ref_star_n - 1;
+    if (hi2 >= ref_star_n) hi2 = ref_star_n - 1;
+    if (lo1 > hi1 || lo2 > hi2) continue;
+
+    int j1 = randomRange(&state, lo1, hi1);
+    int j2 = randomRange(&state, lo2, hi2);
+    if (j1 == j2) continue;
+
+    SVec2f_t pos1 = sset->data[order[i1]].pos;
+    SVec2f_t dir1 = sset->data[order[i2]].pos - pos1;
+    SVec2f_t pos2 = ref_sset->data[ref_order[j1]].pos;
+    SVec2f_t dir2 = ref_sset->data[ref_order[j2]].pos - pos2;
+    if (dir1[0] == 0.0f && dir1[1] == 0.0f) continue;
+
+    SVec2f_t rot = SVec2f_complexDiv(dir2, dir1);
+    if (!respectScaleRotTol(aligner, rot)) continue;
+
+    STransform_t tr = {
+      .type  = STr_Linear,
+      .rot   = rot,
+      .shift = pos2 - SVec2f_complexMul(pos1, rot)
+    };
+
+    int s = support(&r, &tr, best_support + 1);
+    if (s > best_support) {
+      best_support = s;
+      result       = tr;
+
+      /* Adaptive stopping criterion */
+      double req = requiredIter(aligner, (double)s / r.rank_star_n);
+      if (req < max_iter) max_iter = req;
+    }
+  }
+
+  for (int step = 0; step < REFINE_STEPS && result.type != STr_Drop; step++)
+    result = refine(&r, &result);
+
+  free(order);
+  free(ref_order);
+  return result;
+}
+
+/* ------------------------------------------------------------------------- */
+STransform_t SRansacAligner_align(
+  const SRansacAligner_t *aligner,
+  const SStarSet_t *ref_sset,
+  const SStarSet_t *sset)
+{
+  SStarIndex_t ref_index;
+  SStarIndex_init(&ref_index);
+  SStarIndex_build(&ref_index, ref_sset);
+
+  STransform_t tr =
+    SRansacAligner_alignIndexed(aligner, ref_sset, &ref_index, sset);
+
+  SStarIndex_deinit(&ref_index);
+  return tr;
+}
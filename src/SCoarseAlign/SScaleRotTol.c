@@ -0,0 +1,25 @@
+/* This file is part of Spica, released under MIT license.
+ * See LICENSE for details.
+ */
+
+/* Author: Piotr Polesiuk, 2022 */
+
+#include "SCoarseAlign/SScaleRotTol.h"
+
+#include <math.h>
+
+int SScaleRotTol_respect(float scaleTol, float rotTol, SVec2f_t rot) {
+  float lsq = SVec2f_lengthSq(rot);
+  float tol = scaleTol + 1.0f;
+  tol *= tol;
+  if (lsq > tol || 1.0f / lsq > tol) return 0;
+
+  /* Abort check, when rotation tolerance is large */
+  if (rotTol > 2.0f) return 1;
+
+  /* Normalize vector, and compute its distance to complex unit (no
+   * rotation) */
+  rot /= sqrtf(lsq);
+  rot[0] -= 1.0f;
+  return SVec2f_lengthSq(rot) <= rotTol * rotTol;
+}
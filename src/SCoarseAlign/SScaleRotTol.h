@@ -0,0 +1,21 @@
+/* This file is part of Spica, released under MIT license.
+ * See LICENSE for details.
+ */
+
+/* Scale and rotation tolerance of aligners */
+
+/* Author: Piotr Polesiuk, 2022 */
+
+#ifndef __SSCALE_ROT_TOL_H__
+#define __SSCALE_ROT_TOL_H__
+
+#include "SVec.h"
+
+/** Check if complex multiplier \p rot (scaling and rotation) respects given
+ * tolerances. Its length should be in [1/(1+scaleTol), 1+scaleTol], and
+ * the distance between the normalized \p rot and the identity (complex unit)
+ * should be at most \p rotTol. Every rotation is allowed when \p rotTol is
+ * greater than 2. */
+int SScaleRotTol_respect(float scaleTol, float rotTol, SVec2f_t rot);
+
+#endif /* __SSCALE_ROT_TOL_H__ */
@@ -13,34 +13,40 @@ void SSmallChangeAligner_init(SSmallChangeAligner_t *aligner) {
 
 static int closestStarIndex(
   const SSmallChangeAligner_t *aligner,
-  const SStarSet_t *ref_sset,
+  const SStarSet_t   *ref_sset,
+  const SStarIndex_t *ref_index,
   SVec2f_t pos,
   float    sigma)
 {
   if (ref_sset->length == 0) return -1;
 
-  int   best_idx  = 0;
-  float best_dist =
-    SVec2f_lengthSq(pos - ref_sset->data[0].pos) /
-      (sigma * ref_sset->data[0].sigma);
+  return SStarIndex_nearest(
+    ref_index, ref_sset, pos, sigma, aligner->distThreshold, NULL);
+}
+
+STransform_t SSmallChangeAligner_align(
+  const SSmallChangeAligner_t *aligner,
+  const SStarSet_t *ref_sset,
+  const STransform_t *prev_tr,
+  const SStarSet_t *sset)
+{
+  if (prev_tr->type == STr_Drop) return *prev_tr;
+
+  SStarIndex_t ref_index;
+  SStarIndex_init(&ref_index);
+  SStarIndex_build(&ref_index, ref_sset);
 
-  for (size_t i = 0; i < ref_sset->length; i++) {
-    float dist =
-      SVec2f_lengthSq(pos - ref_sset->data[i].pos) /
-        (sigma * ref_sset->data[i].sigma);
+  STransform_t tr = SSmallChangeAligner_alignIndexed(
+    aligner, ref_sset, &ref_index, prev_tr, sset);
 
-    if (dist < best_dist) {
-      best_idx  = i;
-      best_dist = dist;
-    }
-  }
-  if (best_dist > aligner->distThreshold * aligner->distThreshold) return -1;
-  return best_idx;
+  SStarIndex_deinit(&ref_index);
+  return tr;
 }
 
-STransform_t SSmallChangeAligner_align(
+STransform_t SSmallChangeAligner_alignIndexed(
   const SSmallChangeAligner_t *aligner,
   const SStarSet_t *ref_sset,
+  const SStarIndex_t *ref_index,
   const STransform_t *prev_tr,
   const SStarSet_t *sset)
 {
@@ -54,7 +60,7 @@ STransform_t SSmallChangeAligner_align(
 
   for (size_t i = 0; i < sset->length; i++) {
     SVec2f_t x = sset->data[i].pos;
-    int idx = closestStarIndex(aligner, ref_sset,
+    int idx = closestStarIndex(aligner, ref_sset, ref_index,
       STransform_apply(prev_tr, x), sset->data[i].sigma);
 
     if (idx == -1) continue;
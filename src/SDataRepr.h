@@ -13,6 +13,18 @@
 static uint16_t SLittleEndian16(uint16_t x) __attribute__((unused));
 /** Convert 32-bit number to/from little-endian */
 static uint32_t SLittleEndian32(uint32_t x) __attribute__((unused));
+/** Convert 64-bit number to/from little-endian */
+static uint64_t SLittleEndian64(uint64_t x) __attribute__((unused));
+/** Convert 16-bit number to/from big-endian */
+static uint16_t SBigEndian16(uint16_t x) __attribute__((unused));
+/** Convert 32-bit number to/from big-endian */
+static uint32_t SBigEndian32(uint32_t x) __attribute__((unused));
+/** Convert 64-bit number to/from big-endian */
+static uint64_t SBigEndian64(uint64_t x) __attribute__((unused));
+/** Little-endian bits of 32-bit float */
+static uint32_t SLittleEndianFromFloat(float x) __attribute__((unused));
+/** Float from its little-endian bits */
+static float SLittleEndianToFloat(uint32_t bits) __attribute__((unused));
 
 /* ========================================================================= */
 
@@ -26,8 +38,41 @@ static uint16_t SLittleEndian16(uint16_t x) {
 static uint32_t SLittleEndian32(uint32_t x) {
   return x;
 }
+
+static uint64_t SLittleEndian64(uint64_t x) {
+  return x;
+}
+
+static uint16_t SBigEndian16(uint16_t x) {
+  return __builtin_bswap16(x);
+}
+
+static uint32_t SBigEndian32(uint32_t x) {
+  return __builtin_bswap32(x);
+}
+
+static uint64_t SBigEndian64(uint64_t x) {
+  return __builtin_bswap64(x);
+}
 #else
 #  error unsupported endianness
 #endif
 
+/* Floats are converted by a union, as type punning through unions is
+ * allowed in C */
+typedef union SFloatBits {
+  float    f;
+  uint32_t u;
+} SFloatBits_t;
+
+static uint32_t SLittleEndianFromFloat(float x) {
+  SFloatBits_t v = { .f = x };
+  return SLittleEndian32(v.u);
+}
+
+static float SLittleEndianToFloat(uint32_t bits) {
+  SFloatBits_t v = { .u = SLittleEndian32(bits) };
+  return v.f;
+}
+
 #endif /* __SPICA_DATA_REPR_H__ */
@@ -0,0 +1,84 @@
+/* This file is part of Spica, released under MIT license.
+ * See LICENSE for details.
+ */
+
+/* Author: Piotr Polesiuk, 2022 */
+
+#include "SFFT.h"
+
+#include <math.h>
+#include <stdlib.h>
+
+#define PI 3.14159265358979323846
+
+/* ========================================================================= */
+unsigned SFFT_size(unsigned n) {
+  unsigned size = 1;
+  while (size < n) size *= 2;
+  return size;
+}
+
+/* ========================================================================= */
+/* Twiddle factors exp(±2πik/n) for k < n/2 */
+static SVec2f_t *twiddles(unsigned n, int inverse) {
+  SVec2f_t *tw = malloc(sizeof(SVec2f_t) * (n / 2 + 1));
+  double sign = inverse ? 1.0 : -1.0;
+  for (unsigned k = 0; k < n / 2; k++) {
+    double a = sign * 2.0 * PI * k / n;
+    tw[k] = SVec2f(cos(a), sin(a));
+  }
+  return tw;
+}
+
+/* In-place iterative FFT of contiguous array of length n */
+static void fft1d(SVec2f_t *x, unsigned n, const SVec2f_t *tw) {
+  /* Bit-reversal permutation */
+  for (unsigned i = 1, j = 0; i < n; i++) {
+    unsigned bit = n >> 1;
+    for (; j & bit; bit >>= 1) j ^= bit;
+    j ^= bit;
+    if (i < j) {
+      SVec2f_t t = x[i];
+      x[i] = x[j];
+      x[j] = t;
+    }
+  }
+
+  for (unsigned len = 2; len <= n; len *= 2) {
+    unsigned half = len / 2;
+    unsigned step = n / len;
+    for (unsigned i = 0; i < n; i += len) {
+      for (unsigned k = 0; k < half; k++) {
+        SVec2f_t u = x[i + k];
+        SVec2f_t v = SVec2f_complexMul(x[i + k + half], tw[k * step]);
+        x[i + k]        = u + v;
+        x[i + k + half] = u - v;
+      }
+    }
+  }
+}
+
+/* ------------------------------------------------------------------------- */
+void SFFT_2d(SVec2f_t *data, unsigned width, unsigned height, int inverse) {
+  SVec2f_t *tw_x = twiddles(width, inverse);
+  SVec2f_t *tw_y = twiddles(height, inverse);
+  SVec2f_t *col  = malloc(sizeof(SVec2f_t) * height);
+
+  for (unsigned y = 0; y < height; y++)
+    fft1d(data + (size_t)y * width, width, tw_x);
+
+  for (unsigned x = 0; x < width; x++) {
+    for (unsigned y = 0; y < height; y++) col[y] = data[(size_t)y * width + x];
+    fft1d(col, height, tw_y);
+    for (unsigned y = 0; y < height; y++) data[(size_t)y * width + x] = col[y];
+  }
+
+  if (inverse) {
+    float norm = 1.0f / ((float)width * height);
+    for (size_t i = 0; i < (size_t)width * height; i++) data[i] *= norm;
+  }
+
+  free(tw_x);
+  free(tw_y);
+  free(col);
+}
@@ -0,0 +1,23 @@
+/* This file is part of Spica, released under MIT license.
+ * See LICENSE for details.
+ */
+
+/* Radix-2 fast Fourier transform */
+
+/* Author: Piotr Polesiuk, 2022 */
+
+#ifndef __SPICA_FFT_H__
+#define __SPICA_FFT_H__
+
+#include "SVec.h"
+
+/** The smallest power of two not less than \p n */
+unsigned SFFT_size(unsigned n);
+
+/** In-place two-dimensional FFT of \p width x \p height array of complex
+ * numbers, stored in row-major order. Both dimensions must be powers of two.
+ * When \p inverse is non-zero, the inverse transform is computed, including
+ * division by the number of elements. */
+void SFFT_2d(SVec2f_t *data, unsigned width, unsigned height, int inverse);
+
+#endif /* __SPICA_FFT_H__ */
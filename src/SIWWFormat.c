@@ -0,0 +1,252 @@
+/* This file is part of Spica, released under MIT license.
+ * See LICENSE for details.
+ */
+
+/* Author: Piotr Polesiuk, 2022 */
+
+#include "SIWWFormat.h"
+
+#include "SDataRepr.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+
+#define MAX_SUPPORTED_FORMAT SFmt_SeparateRGB
+
+/* Higher levels of deflate are several times slower, and they make files
+ * only a few percent smaller */
+#define DEFLATE_LEVEL Z_BEST_SPEED
+
+size_t SIWWFormat_pixelSize(SImageFormat_t format) {
+  return format == SFmt_RGB ? sizeof(SVec4f_t) : sizeof(SVec2f_t);
+}
+
+size_t SIWWFormat_planeN(SImageFormat_t format) {
+  return format == SFmt_SeparateRGB ? 3 : 1;
+}
+
+/* ========================================================================= */
+int SIWWFormat_parse(
+  SIWWFormat_t *fmt, const void *data, size_t len, size_t file_size)
+{
+  SIWW_header_t header;
+  if (len < sizeof(SIWW_header_t)) return 0;
+  memcpy(&header, data, sizeof(SIWW_header_t));
+
+  header.version     = SLittleEndian32(header.version);
+  header.header_size = SLittleEndian16(header.header_size);
+  header.format      = SLittleEndian16(header.format);
+  header.width       = SLittleEndian16(header.width);
+  header.height      = SLittleEndian16(header.height);
+
+  if (memcmp(SIWW_MAGIC, header.magic, 8) != 0
+    || header.header_size < sizeof(SIWW_header_t)
+    || header.header_size > file_size
+    || header.format == SFmt_Invalid
+    || header.format > MAX_SUPPORTED_FORMAT)
+  {
+    return 0;
+  }
+
+  fmt->format     = header.format;
+  fmt->width      = header.width;
+  fmt->height     = header.height;
+  fmt->version    = header.version;
+  fmt->headerSize = header.header_size;
+
+  size_t data_size = (size_t)fmt->width * fmt->height *
+    SIWWFormat_pixelSize(fmt->format) * SIWWFormat_planeN(fmt->format);
+  switch (header.version) {
+  case SIWW_VERSION:
+    return data_size <= file_size - header.header_size;
+  case SIWW_TILED_VERSION:
+    break;
+  default:
+    return 0;
+  }
+
+  SIWW_tiling_t tiling;
+  if (header.header_size < SIWW_TILED_HEADER_SIZE
+    || len < SIWW_TILED_HEADER_SIZE)
+  {
+    return 0;
+  }
+  memcpy(&tiling, (const char *)data + sizeof(SIWW_header_t),
+    sizeof(SIWW_tiling_t));
+  tiling.tile_width  = SLittleEndian16(tiling.tile_width);
+  tiling.tile_height = SLittleEndian16(tiling.tile_height);
+  tiling.compression = SLittleEndian16(tiling.compression);
+  if (tiling.tile_width == 0 || tiling.tile_height == 0
+    || tiling.compression > SIWW_COMPRESSION_SHUFFLE)
+  {
+    return 0;
+  }
+
+  SIWWFormat_setTiling(fmt,
+    tiling.tile_width, tiling.tile_height, tiling.compression);
+  return (fmt->tileN + 1) * sizeof(uint64_t) <=
+    file_size - header.header_size;
+}
+
+void SIWWFormat_setTiling(SIWWFormat_t *fmt,
+  unsigned tile_width, unsigned tile_height, int compression)
+{
+  fmt->tileWidth   = tile_width;
+  fmt->tileHeight  = tile_height;
+  fmt->compression = compression;
+  fmt->tileCols    = (fmt->width + tile_width - 1) / tile_width;
+  fmt->tileN       = (size_t)fmt->tileCols *
+    ((fmt->height + tile_height - 1) / tile_height);
+}
+
+int SIWWFormat_write(const SIWWFormat_t *fmt, FILE *file) {
+  int tiled = fmt->version == SIWW_TILED_VERSION;
+
+  SIWW_header_t header = { .magic = SIWW_MAGIC };
+  header.version     = SLittleEndian32(fmt->version);
+  header.header_size = SLittleEndian16(
+    tiled ? SIWW_TILED_HEADER_SIZE : sizeof(SIWW_header_t));
+  header.format      = SLittleEndian16(fmt->format);
+  header.width       = SLittleEndian16(fmt->width);
+  header.height      = SLittleEndian16(fmt->height);
+  if (fwrite(&header, sizeof(SIWW_header_t), 1, file) != 1) return 0;
+  if (!tiled) return 1;
+
+  SIWW_tiling_t tiling;
+  tiling.tile_width  = SLittleEndian16(fmt->tileWidth);
+  tiling.tile_height = SLittleEndian16(fmt->tileHeight);
+  tiling.compression = SLittleEndian16(fmt->compression);
+  tiling.reserved    = 0;
+  return fwrite(&tiling, sizeof(SIWW_tiling_t), 1, file) == 1;
+}
+
+/* ========================================================================= */
+SIWWRect_t SIWWFormat_tileRect(const SIWWFormat_t *fmt, size_t tile) {
+  SIWWRect_t r;
+  r.x0 = (tile % fmt->tileCols) * fmt->tileWidth;
+  r.y0 = (tile / fmt->tileCols) * fmt->tileHeight;
+  r.x1 = r.x0 + fmt->tileWidth  < fmt->width  ?
+    r.x0 + fmt->tileWidth  : fmt->width;
+  r.y1 = r.y0 + fmt->tileHeight < fmt->height ?
+    r.y0 + fmt->tileHeight : fmt->height;
+  return r;
+}
+
+size_t SIWWFormat_tileDataSize(const SIWWFormat_t *fmt, SIWWRect_t r) {
+  return (size_t)(r.x1 - r.x0) * (r.y1 - r.y0) *
+    SIWWFormat_pixelSize(fmt->format) * SIWWFormat_planeN(fmt->format);
+}
+
+/* ------------------------------------------------------------------------- */
+void SIWWFormat_scatterTile(
+  SImage_t *image, long x, long y, SIWWRect_t r, const unsigned char *data)
+{
+  size_t px = SIWWFormat_pixelSize(image->format);
+  size_t plane_size = (size_t)image->width * image->height * px;
+  size_t src_plane  = (size_t)(r.x1 - r.x0) * (r.y1 - r.y0) * px;
+  size_t stride     = r.x1 - r.x0;
+
+  long x0 = (long)r.x0 > x ? (long)r.x0 : x;
+  long x1 = (long)r.x1 < x + (long)image->width ?
+    (long)r.x1 : x + (long)image->width;
+  long y0 = (long)r.y0 > y ? (long)r.y0 : y;
+  long y1 = (long)r.y1 < y + (long)image->height ?
+    (long)r.y1 : y + (long)image->height;
+  if (x0 >= x1 || y0 >= y1) return;
+
+  for (size_t p = 0; p < SIWWFormat_planeN(image->format); p++) {
+    unsigned char *dst = (unsigned char *)image->data + p * plane_size;
+    const unsigned char *src = data + p * src_plane;
+    for (long v = y0; v < y1; v++) {
+      memcpy(
+        dst + ((v - y) * (size_t)image->width + (x0 - x)) * px,
+        src + ((v - r.y0) * stride + (x0 - r.x0)) * px,
+        (x1 - x0) * px);
+    }
+  }
+}
+
+void SIWWFormat_gatherTile(
+  const SImage_t *image, long x, long y, SIWWRect_t r, unsigned char *data)
+{
+  size_t px = SIWWFormat_pixelSize(image->format);
+  size_t plane_size = (size_t)image->width * image->height * px;
+  size_t row_size   = (r.x1 - r.x0) * px;
+
+  for (size_t p = 0; p < SIWWFormat_planeN(image->format); p++) {
+    const unsigned char *src =
+      (const unsigned char *)image->data + p * plane_size;
+    for (unsigned v = r.y0; v < r.y1; v++) {
+      memcpy(data,
+        src + ((v - y) * (size_t)image->width + (r.x0 - x)) * px,
+        row_size);
+      data += row_size;
+    }
+  }
+}
+
+/* ------------------------------------------------------------------------- */
+/* Byte shuffling: k-th bytes of all floats are grouped together. Exponents
+ * and high bits of mantissas of neighbouring pixels are similar, so
+ * shuffled data compresses much better. */
+static void shuffle(unsigned char *dst, const unsigned char *src, size_t n) {
+  size_t m = n / 4;
+  for (size_t i = 0; i < m; i++) {
+    for (int k = 0; k < 4; k++) dst[k * m + i] = src[4 * i + k];
+  }
+}
+
+static void unshuffle(unsigned char *dst, const unsigned char *src, size_t n)
+{
+  size_t m = n / 4;
+  for (size_t i = 0; i < m; i++) {
+    for (int k = 0; k < 4; k++) dst[4 * i + k] = src[k * m + i];
+  }
+}
+
+void SIWWFormat_compressTile(
+  const SIWWFormat_t *fmt, unsigned char **data, size_t *size)
+{
+  if (fmt->compression != SIWW_COMPRESSION_SHUFFLE) return;
+
+  size_t raw_size = *size;
+  unsigned char *shuffled = malloc(raw_size + 1);
+  uLongf len = compressBound(raw_size);
+  unsigned char *compressed = malloc(len + 1);
+  if (shuffled != NULL && compressed != NULL) {
+    shuffle(shuffled, *data, raw_size);
+    /* Tiles that do not shrink are stored uncompressed. Readers recognize
+     * them by their size */
+    if (compress2(compressed, &len, shuffled, raw_size,
+          DEFLATE_LEVEL) == Z_OK && len < raw_size)
+    {
+      free(*data);
+      *data = compressed;
+      *size = len;
+      compressed = NULL;
+    }
+  }
+  free(shuffled);
+  free(compressed);
+}
+
+int SIWWFormat_decodeTile(
+  const SIWWFormat_t *fmt, SIWWRect_t r,
+  const unsigned char *stored, size_t size, unsigned char *raw)
+{
+  size_t raw_size = SIWWFormat_tileDataSize(fmt, r);
+  if (size == raw_size) {
+    memcpy(raw, stored, raw_size);
+    return 1;
+  }
+  if (fmt->compression != SIWW_COMPRESSION_SHUFFLE) return 0;
+
+  unsigned char *buf = malloc(raw_size + 1);
+  uLongf len = raw_size;
+  int ok = buf != NULL
+    && uncompress(buf, &len, stored, size) == Z_OK && len == raw_size;
+  if (ok) unshuffle(raw, buf, raw_size);
+  free(buf);
+  return ok;
+}
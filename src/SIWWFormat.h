@@ -0,0 +1,117 @@
+/* This file is part of Spica, released under MIT license.
+ * See LICENSE for details.
+ */
+
+/* Layout of SIWW files, shared by whole-image IO and SIWWStream */
+
+/* Author: Piotr Polesiuk, 2022 */
+
+#ifndef __SPICA_SIWW_FORMAT_H__
+#define __SPICA_SIWW_FORMAT_H__
+
+#include "SImage.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define SIWW_MAGIC         "SPICAIWW"
+#define SIWW_VERSION       1
+#define SIWW_TILED_VERSION 2
+
+#define SIWW_DEFAULT_TILE_SIZE 256
+
+/* Compression of tiles of version 2 files */
+#define SIWW_COMPRESSION_NONE    0
+#define SIWW_COMPRESSION_SHUFFLE 1
+
+typedef struct SIWW_header {
+  char     magic[8];
+  uint32_t version;
+  uint16_t header_size;
+  uint16_t format;
+  uint16_t width;
+  uint16_t height;
+} SIWW_header_t;
+
+/* Extension of the header in version 2 */
+typedef struct SIWW_tiling {
+  uint16_t tile_width;
+  uint16_t tile_height;
+  uint16_t compression;
+  uint16_t reserved;
+} SIWW_tiling_t;
+
+/** Size of the header of version 2 files */
+#define SIWW_TILED_HEADER_SIZE (sizeof(SIWW_header_t) + sizeof(SIWW_tiling_t))
+
+/** Parsed header of SIWW file */
+typedef struct SIWWFormat {
+  SImageFormat_t format;
+  unsigned       width;
+  unsigned       height;
+  int            version;
+  size_t         headerSize;
+  /** Tiling of version 2 files */
+  unsigned       tileWidth;
+  unsigned       tileHeight;
+  int            compression;
+  /** Number of tiles in a row, and in total */
+  unsigned       tileCols;
+  size_t         tileN;
+} SIWWFormat_t;
+
+/** Rectangle of a tile, clipped to the image. Upper bounds are exclusive */
+typedef struct SIWWRect {
+  unsigned x0, y0, x1, y1;
+} SIWWRect_t;
+
+/** Size of a pixel of a single plane */
+size_t SIWWFormat_pixelSize(SImageFormat_t format);
+
+/** Number of planes (3 for SFmt_SeparateRGB, 1 otherwise) */
+size_t SIWWFormat_planeN(SImageFormat_t format);
+
+/** Parse \p len bytes of the header of a file of given size. Returns 0 if
+ * the header is invalid, or the file is too short. */
+int SIWWFormat_parse(
+  SIWWFormat_t *fmt, const void *header, size_t len, size_t file_size);
+
+/** Set the tiling of version 2 format, and compute the number of tiles */
+void SIWWFormat_setTiling(SIWWFormat_t *fmt,
+  unsigned tile_width, unsigned tile_height, int compression);
+
+/** Write the header (including tiling of version 2 files). Returns 0 on
+ * error. */
+int SIWWFormat_write(const SIWWFormat_t *fmt, FILE *file);
+
+/** Rectangle of the tile */
+SIWWRect_t SIWWFormat_tileRect(const SIWWFormat_t *fmt, size_t tile);
+
+/** Size of uncompressed data of the tile */
+size_t SIWWFormat_tileDataSize(const SIWWFormat_t *fmt, SIWWRect_t r);
+
+/** Copy the part of the tile \p r that intersects the image into the image,
+ * which is placed at (x, y) in coordinates of the file. The data of the
+ * tile is organized as in version 1 files. */
+void SIWWFormat_scatterTile(
+  SImage_t *image, long x, long y, SIWWRect_t r, const unsigned char *data);
+
+/** Copy the tile \p r from the image placed at (x, y), which must contain
+ * the whole tile. */
+void SIWWFormat_gatherTile(
+  const SImage_t *image, long x, long y, SIWWRect_t r, unsigned char *data);
+
+/** Compress data of the tile, when the file is compressed, and it helps.
+ * On success, \p data is freed and replaced by the compressed data, and
+ * \p size is updated. */
+void SIWWFormat_compressTile(
+  const SIWWFormat_t *fmt, unsigned char **data, size_t *size);
+
+/** Decode stored data of the tile into \p raw buffer of
+ * SIWWFormat_tileDataSize bytes. Returns 0 on error. */
+int SIWWFormat_decodeTile(
+  const SIWWFormat_t *fmt, SIWWRect_t r,
+  const unsigned char *stored, size_t size, unsigned char *raw);
+
+#endif /* __SPICA_SIWW_FORMAT_H__ */
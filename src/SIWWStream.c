@@ -0,0 +1,481 @@
+/* This file is part of Spica, released under MIT license.
+ * See LICENSE for details.
+ */
+
+/* Author: Piotr Polesiuk, 2022 */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "SIWWStream.h"
+
+#include "SDataRepr.h"
+#include "SIWWFormat.h"
+#include "SParallel.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+struct SIWWStreamState {
+  FILE        *file;
+  size_t       fileSize;
+  int          writing;
+  /** Set on the first write error */
+  int          failed;
+  SIWWFormat_t fmt;
+  /** Offsets of tiles (version 2 files) */
+  uint64_t    *index;
+  /** Offset of the next written tile */
+  uint64_t     offset;
+  /** Decoded (when reading) or buffered (when writing) row of tiles */
+  SImage_t     tileRow;
+  /** Index of the row of tiles stored in tileRow, or -1 */
+  long         tileRowIdx;
+};
+
+void SIWWStream_init(SIWWStream_t *stream) {
+  stream->version    = 2;
+  stream->tileWidth  = 256;
+  stream->tileHeight = 32;
+  stream->compress   = 1;
+  stream->format     = SFmt_Invalid;
+  stream->width      = 0;
+  stream->height     = 0;
+  stream->row        = 0;
+  stream->state      = NULL;
+}
+
+/* ========================================================================= */
+static size_t rowSize(const SIWWFormat_t *fmt) {
+  return (size_t)fmt->width * SIWWFormat_pixelSize(fmt->format);
+}
+
+/* Pointer to the row y of the plane p of the image */
+static unsigned char *imageRow(const SImage_t *image, size_t p, unsigned y) {
+  size_t px = SIWWFormat_pixelSize(image->format);
+  return (unsigned char *)image->data +
+    (p * image->height + y) * (size_t)image->width * px;
+}
+
+/* Offset of the row y of the plane p of version 1 file */
+static off_t plainRowOffset(const SIWWFormat_t *fmt, size_t p, unsigned y) {
+  return fmt->headerSize + (p * fmt->height + y) * rowSize(fmt);
+}
+
+static unsigned tileRowN(const SIWWFormat_t *fmt) {
+  return (fmt->height + fmt->tileHeight - 1) / fmt->tileHeight;
+}
+
+static void freeState(SIWWStream_t *stream) {
+  SIWWStreamState_t *st = stream->state;
+  if (st->file != NULL) fclose(st->file);
+  SImage_deinit(&st->tileRow);
+  free(st->index);
+  free(st);
+  stream->state = NULL;
+}
+
+static SIWWStreamState_t *allocState(void) {
+  SIWWStreamState_t *st = malloc(sizeof(SIWWStreamState_t));
+  if (st == NULL) return NULL;
+  st->file       = NULL;
+  st->fileSize   = 0;
+  st->writing    = 0;
+  st->failed     = 0;
+  st->index      = NULL;
+  st->offset     = 0;
+  st->tileRowIdx = -1;
+  SImage_init(&st->tileRow, 0, 0, SFmt_Invalid);
+  return st;
+}
+
+/* ========================================================================= */
+int SIWWStream_openRead(SIWWStream_t *stream, const char *fname) {
+  if (stream->state != NULL) return SPICA_ERROR;
+
+  SIWWStreamState_t *st = allocState();
+  if (st == NULL) return SPICA_ERROR;
+  stream->state = st;
+
+  do {
+    st->file = fopen(fname, "rb");
+    if (st->file == NULL) break;
+
+    struct stat sb;
+    if (fstat(fileno(st->file), &sb) != 0) break;
+    st->fileSize = sb.st_size;
+
+    unsigned char header[SIWW_TILED_HEADER_SIZE];
+    size_t len = fread(header, 1, sizeof(header), st->file);
+    if (!SIWWFormat_parse(&st->fmt, header, len, st->fileSize)) break;
+
+    if (st->fmt.version == SIWW_TILED_VERSION) {
+      size_t n = st->fmt.tileN + 1;
+      st->index = malloc(sizeof(uint64_t) * n);
+      if (st->index == NULL) break;
+      if (fseeko(st->file, st->fmt.headerSize, SEEK_SET) != 0) break;
+      if (fread(st->index, sizeof(uint64_t), n, st->file) != n) break;
+      for (size_t i = 0; i < n; i++)
+        st->index[i] = SLittleEndian64(st->index[i]);
+
+      SImage_init(&st->tileRow,
+        st->fmt.width, st->fmt.tileHeight, st->fmt.format);
+      if (st->tileRow.format == SFmt_Invalid) break;
+    }
+
+    stream->format = st->fmt.format;
+    stream->width  = st->fmt.width;
+    stream->height = st->fmt.height;
+    stream->row    = 0;
+    return SPICA_OK;
+  } while (0);
+
+  freeState(stream);
+  return SPICA_ERROR;
+}
+
+/* ------------------------------------------------------------------------- */
+/* Row of tiles being decoded or encoded */
+typedef struct TileRow {
+  SIWWStreamState_t *st;
+  size_t             first;
+  unsigned char    **data;
+  size_t            *size;
+  char              *failed;
+} TileRow_t;
+
+static void decodeTile(void *arg, size_t i) {
+  TileRow_t *tr = arg;
+  const SIWWFormat_t *fmt = &tr->st->fmt;
+  SIWWRect_t r = SIWWFormat_tileRect(fmt, tr->first + i);
+  size_t raw_size = SIWWFormat_tileDataSize(fmt, r);
+
+  unsigned char *raw = malloc(raw_size + 1);
+  if (raw == NULL ||
+      !SIWWFormat_decodeTile(fmt, r, tr->data[i], tr->size[i], raw))
+  {
+    tr->failed[i] = 1;
+  } else {
+    SIWWFormat_scatterTile(&tr->st->tileRow,
+      0, (long)r.y0 - r.y0 % fmt->tileHeight, r, raw);
+  }
+  free(raw);
+}
+
+/* Allocate buffers for all tiles of a row */
+static int allocTileRow(TileRow_t *tr, SIWWStreamState_t *st, unsigned y) {
+  size_t n = st->fmt.tileCols;
+  tr->st     = st;
+  tr->first  = (size_t)y * n;
+  tr->data   = calloc(n + 1, sizeof(unsigned char *));
+  tr->size   = calloc(n + 1, sizeof(size_t));
+  tr->failed = calloc(n + 1, 1);
+  return tr->data != NULL && tr->size != NULL && tr->failed != NULL;
+}
+
+static int freeTileRow(TileRow_t *tr) {
+  int ok = tr->failed != NULL;
+  for (size_t i = 0; i < tr->st->fmt.tileCols; i++) {
+    if (tr->data != NULL) free(tr->data[i]);
+    if (tr->failed != NULL && tr->failed[i]) ok = 0;
+  }
+  free(tr->data);
+  free(tr->size);
+  free(tr->failed);
+  return ok;
+}
+
+/* Read the row of tiles into tileRow. Tiles are read sequentially, and
+ * decompressed in parallel. */
+static int loadTileRow(SIWWStreamState_t *st, unsigned y) {
+  if (st->tileRowIdx == (long)y) return 1;
+  st->tileRowIdx = -1;
+
+  TileRow_t tr;
+  int ok = allocTileRow(&tr, st, y);
+  for (size_t i = 0; ok && i < st->fmt.tileCols; i++) {
+    uint64_t begin = st->index[tr.first + i];
+    uint64_t end   = st->index[tr.first + i + 1];
+    ok = begin <= end && end <= st->fileSize
+      && fseeko(st->file, begin, SEEK_SET) == 0;
+    if (!ok) break;
+
+    tr.size[i] = end - begin;
+    tr.data[i] = malloc(tr.size[i] + 1);
+    ok = tr.data[i] != NULL
+      && fread(tr.data[i], 1, tr.size[i], st->file) == tr.size[i];
+  }
+  if (ok) SParallel_for(0, st->fmt.tileCols, decodeTile, &tr);
+
+  ok = freeTileRow(&tr) && ok;
+  if (ok) st->tileRowIdx = y;
+  return ok;
+}
+
+static int readTiledRows(
+  SIWWStreamState_t *st, SImage_t *band, unsigned y0, unsigned y1)
+{
+  const SIWWFormat_t *fmt = &st->fmt;
+  size_t planes = SIWWFormat_planeN(fmt->format);
+  unsigned y = y0;
+  while (y < y1) {
+    unsigned tile_row = y / fmt->tileHeight;
+    unsigned base     = tile_row * fmt->tileHeight;
+    unsigned end = base + fmt->tileHeight < y1 ? base + fmt->tileHeight : y1;
+    if (!loadTileRow(st, tile_row)) return 0;
+
+    for (size_t p = 0; p < planes; p++) {
+      memcpy(imageRow(band, p, y - y0), imageRow(&st->tileRow, p, y - base),
+        (end - y) * rowSize(fmt));
+    }
+    y = end;
+  }
+  return 1;
+}
+
+static int readPlainRows(
+  SIWWStreamState_t *st, SImage_t *band, unsigned y0, unsigned y1)
+{
+  const SIWWFormat_t *fmt = &st->fmt;
+  for (size_t p = 0; p < SIWWFormat_planeN(fmt->format); p++) {
+    size_t n = y1 - y0;
+    if (fseeko(st->file, plainRowOffset(fmt, p, y0), SEEK_SET) != 0 ||
+        fread(imageRow(band, p, 0), rowSize(fmt), n, st->file) != n)
+      return 0;
+  }
+  return 1;
+}
+
+int SIWWStream_read(SIWWStream_t *stream, SImage_t *band) {
+  SIWWStreamState_t *st = stream->state;
+  if (st == NULL || st->writing || band->format != stream->format
+    || band->width != stream->width)
+  {
+    return SPICA_ERROR;
+  }
+
+  unsigned y0 = stream->row;
+  unsigned y1 = y0 + band->height < stream->height ?
+    y0 + band->height : stream->height;
+  /* Rows out of the image have no data */
+  if (y1 - y0 < band->height) SImage_clear(band);
+
+  int ok = st->fmt.version == SIWW_VERSION ?
+    readPlainRows(st, band, y0, y1) : readTiledRows(st, band, y0, y1);
+  stream->row = y1;
+  return ok ? SPICA_OK : SPICA_ERROR;
+}
+
+int SIWWStream_seek(SIWWStream_t *stream, unsigned row) {
+  if (stream->state == NULL || stream->state->writing) return SPICA_ERROR;
+  stream->row = row < stream->height ? row : stream->height;
+  return SPICA_OK;
+}
+
+/* ========================================================================= */
+int SIWWStream_openWrite(
+  SIWWStream_t  *stream,
+  const char    *fname,
+  SImageFormat_t format,
+  unsigned       width,
+  unsigned       height)
+{
+  if (stream->state != NULL || format == SFmt_Invalid
+    || format > SFmt_SeparateRGB
+    || width  == 0 || width  > UINT16_MAX
+    || height == 0 || height > UINT16_MAX)
+  {
+    return SPICA_ERROR;
+  }
+  int tiled = stream->version == SIWW_TILED_VERSION;
+  if (!tiled && stream->version != SIWW_VERSION) return SPICA_ERROR;
+  if (tiled && (stream->tileWidth  == 0 || stream->tileWidth  > UINT16_MAX
+             || stream->tileHeight == 0 || stream->tileHeight > UINT16_MAX))
+  {
+    return SPICA_ERROR;
+  }
+
+  SIWWStreamState_t *st = allocState();
+  if (st == NULL) return SPICA_ERROR;
+  stream->state = st;
+  st->writing   = 1;
+
+  SIWWFormat_t *fmt = &st->fmt;
+  fmt->format     = format;
+  fmt->width      = width;
+  fmt->height     = height;
+  fmt->version    = stream->version;
+  fmt->headerSize = tiled ? SIWW_TILED_HEADER_SIZE : sizeof(SIWW_header_t);
+
+  do {
+    if (tiled) {
+      SIWWFormat_setTiling(fmt, stream->tileWidth, stream->tileHeight,
+        stream->compress ? SIWW_COMPRESSION_SHUFFLE : SIWW_COMPRESSION_NONE);
+      st->index = calloc(fmt->tileN + 1, sizeof(uint64_t));
+      if (st->index == NULL) break;
+      SImage_init(&st->tileRow, width, fmt->tileHeight, format);
+      if (st->tileRow.format == SFmt_Invalid) break;
+      SImage_clear(&st->tileRow);
+      st->tileRowIdx = 0;
+    }
+
+    st->file = fopen(fname, "wb");
+    if (st->file == NULL) break;
+    if (!SIWWFormat_write(fmt, st->file)) break;
+
+    /* Space for the index of tiles, written when the stream is closed */
+    if (tiled) {
+      size_t n = fmt->tileN + 1;
+      if (fwrite(st->index, sizeof(uint64_t), n, st->file) != n) break;
+      st->offset = fmt->headerSize + sizeof(uint64_t) * n;
+    }
+
+    stream->format = format;
+    stream->width  = width;
+    stream->height = height;
+    stream->row    = 0;
+    return SPICA_OK;
+  } while (0);
+
+  freeState(stream);
+  return SPICA_ERROR;
+}
+
+/* ------------------------------------------------------------------------- */
+static void encodeTile(void *arg, size_t i) {
+  TileRow_t *tr = arg;
+  const SIWWFormat_t *fmt = &tr->st->fmt;
+  SIWWRect_t r = SIWWFormat_tileRect(fmt, tr->first + i);
+
+  tr->size[i] = SIWWFormat_tileDataSize(fmt, r);
+  tr->data[i] = malloc(tr->size[i] + 1);
+  if (tr->data[i] == NULL) {
+    tr->failed[i] = 1;
+    return;
+  }
+  SIWWFormat_gatherTile(&tr->st->tileRow,
+    0, (long)r.y0 - r.y0 % fmt->tileHeight, r, tr->data[i]);
+  SIWWFormat_compressTile(fmt, &tr->data[i], &tr->size[i]);
+}
+
+/* Compress tiles of the buffered row in parallel, and write them */
+static int flushTileRow(SIWWStreamState_t *st) {
+  TileRow_t tr;
+  int ok = allocTileRow(&tr, st, st->tileRowIdx);
+  if (ok) SParallel_for(0, st->fmt.tileCols, encodeTile, &tr);
+  for (size_t i = 0; ok && i < st->fmt.tileCols; i++) {
+    ok = !tr.failed[i]
+      && fwrite(tr.data[i], 1, tr.size[i], st->file) == tr.size[i];
+    st->index[tr.first + i] = st->offset;
+    st->offset += tr.size[i];
+  }
+  ok = freeTileRow(&tr) && ok;
+
+  st->tileRowIdx++;
+  SImage_clear(&st->tileRow);
+  return ok;
+}
+
+static int writeTiledRows(
+  SIWWStreamState_t *st, const SImage_t *band, unsigned y0, unsigned y1)
+{
+  const SIWWFormat_t *fmt = &st->fmt;
+  size_t planes = SIWWFormat_planeN(fmt->format);
+  unsigned y = y0;
+  while (y < y1) {
+    unsigned base = st->tileRowIdx * fmt->tileHeight;
+    unsigned next = base + fmt->tileHeight;
+    unsigned end  = next < y1 ? next : y1;
+
+    for (size_t p = 0; p < planes; p++) {
+      memcpy(imageRow(&st->tileRow, p, y - base), imageRow(band, p, y - y0),
+        (end - y) * rowSize(fmt));
+    }
+    y = end;
+    if (y == next || y == fmt->height) {
+      if (!flushTileRow(st)) return 0;
+    }
+  }
+  return 1;
+}
+
+static int writePlainRows(
+  SIWWStreamState_t *st, const SImage_t *band, unsigned y0, unsigned y1)
+{
+  const SIWWFormat_t *fmt = &st->fmt;
+  for (size_t p = 0; p < SIWWFormat_planeN(fmt->format); p++) {
+    size_t n = y1 - y0;
+    if (fseeko(st->file, plainRowOffset(fmt, p, y0), SEEK_SET) != 0 ||
+        fwrite(imageRow(band, p, 0), rowSize(fmt), n, st->file) != n)
+      return 0;
+  }
+  return 1;
+}
+
+int SIWWStream_write(SIWWStream_t *stream, const SImage_t *band) {
+  SIWWStreamState_t *st = stream->state;
+  if (st == NULL || !st->writing || band->format != stream->format
+    || band->width != stream->width)
+  {
+    return SPICA_ERROR;
+  }
+
+  unsigned y0 = stream->row;
+  unsigned y1 = y0 + band->height < stream->height ?
+    y0 + band->height : stream->height;
+
+  int ok = st->fmt.version == SIWW_VERSION ?
+    writePlainRows(st, band, y0, y1) : writeTiledRows(st, band, y0, y1);
+  if (!ok) st->failed = 1;
+  stream->row = y1;
+  return ok ? SPICA_OK : SPICA_ERROR;
+}
+
+/* ------------------------------------------------------------------------- */
+/* Write rows that were not written, and the index of tiles */
+static int completeFile(SIWWStream_t *stream) {
+  SIWWStreamState_t *st  = stream->state;
+  const SIWWFormat_t *fmt = &st->fmt;
+
+  if (fmt->version == SIWW_TILED_VERSION) {
+    while (st->tileRowIdx < (long)tileRowN(fmt)) {
+      if (!flushTileRow(st)) return 0;
+    }
+    st->index[fmt->tileN] = st->offset;
+    for (size_t i = 0; i <= fmt->tileN; i++)
+      st->index[i] = SLittleEndian64(st->index[i]);
+    size_t n = fmt->tileN + 1;
+    return fseeko(st->file, fmt->headerSize, SEEK_SET) == 0
+      && fwrite(st->index, sizeof(uint64_t), n, st->file) == n;
+  }
+
+  if (stream->row < fmt->height) {
+    SImage_t band;
+    SImage_init(&band, fmt->width, 1, fmt->format);
+    if (band.format == SFmt_Invalid) return 0;
+    SImage_clear(&band);
+    int ok = 1;
+    for (unsigned y = stream->row; ok && y < fmt->height; y++)
+      ok = writePlainRows(st, &band, y, y + 1);
+    SImage_deinit(&band);
+    return ok;
+  }
+  return 1;
+}
+
+int SIWWStream_close(SIWWStream_t *stream) {
+  SIWWStreamState_t *st = stream->state;
+  if (st == NULL) return SPICA_OK;
+
+  int ok = 1;
+  if (st->writing) {
+    ok = !st->failed && completeFile(stream);
+    ok = fclose(st->file) == 0 && ok;
+    st->file = NULL;
+  }
+  freeState(stream);
+  return ok ? SPICA_OK : SPICA_ERROR;
+}
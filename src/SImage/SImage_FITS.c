@@ -0,0 +1,530 @@
+/* This file is part of Spica, released under MIT license.
+ * See LICENSE for details.
+ */
+
+/* Author: Piotr Polesiuk, 2022 */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "SImage.h"
+#include "SImage_limits.h"
+
+#include "SDataRepr.h"
+
+#include <assert.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define FITS_BLOCK     2880
+#define FITS_CARD      80
+#define FITS_MAX_AXES  3
+#define FITS_MAX_HDUS  16
+#define WEIGHT_EXTNAME "WEIGHT"
+
+/* ========================================================================= */
+/* Header-data unit */
+typedef struct Hdu {
+  int         bitpix;
+  int         naxis;
+  size_t      axis[FITS_MAX_AXES];
+  double      bzero;
+  double      bscale;
+  int         isWeight;
+  /* Data of the unit, within mapped file */
+  const unsigned char *data;
+  size_t      dataSize;
+} Hdu_t;
+
+static size_t roundToBlock(size_t size) {
+  return (size + FITS_BLOCK - 1) / FITS_BLOCK * FITS_BLOCK;
+}
+
+/* Number of pixels of a single plane */
+static size_t planeSize(const Hdu_t *hdu) {
+  return hdu->axis[0] * hdu->axis[1];
+}
+
+static size_t planeN(const Hdu_t *hdu) {
+  return hdu->naxis == 3 ? hdu->axis[2] : 1;
+}
+
+/* Product a·b, or 0 when it does not fit in size_t */
+static int mulSize(size_t *result, size_t a, size_t b) {
+  if (b != 0 && a > SIZE_MAX / b) return 0;
+  *result = a * b;
+  return 1;
+}
+
+/* Value of a card, as a null-terminated string without the comment */
+static void cardValue(char *value, const char *card) {
+  size_t len = 0;
+  size_t i   = 10;
+  if (card[i] == '\'') {
+    /* String value. Trailing spaces are not significant */
+    for (i++; i < FITS_CARD && card[i] != '\''; i++) value[len++] = card[i];
+    while (len > 0 && value[len-1] == ' ') len--;
+  } else {
+    for (; i < FITS_CARD && card[i] != '/'; i++) value[len++] = card[i];
+  }
+  value[len] = '\0';
+}
+
+/* Parse the header of the HDU that begins at given offset of the file.
+ * Returns the offset of the next HDU, or 0 on error. */
+static size_t parseHdu(
+  Hdu_t *hdu, const unsigned char *file, size_t size, size_t offset)
+{
+  hdu->bitpix   = 0;
+  hdu->naxis    = -1;
+  hdu->bzero    = 0.0;
+  hdu->bscale   = 1.0;
+  hdu->isWeight = 0;
+  for (int i = 0; i < FITS_MAX_AXES; i++) hdu->axis[i] = 1;
+
+  /* Product of lengths of axes beyond FITS_MAX_AXES */
+  size_t extra = 1;
+  long pcount = 0;
+  long gcount = 1;
+  int  ended  = 0;
+  int  mandatory = 0;
+
+  for (; offset + FITS_CARD <= size && !ended; offset += FITS_CARD) {
+    const char *card = (const char *)file + offset;
+    char value[FITS_CARD + 1];
+    cardValue(value, card);
+
+    if (memcmp(card, "END     ", 8) == 0) {
+      ended = 1;
+    } else if (memcmp(card, "SIMPLE  ", 8) == 0 ||
+               memcmp(card, "XTENSION", 8) == 0) {
+      mandatory = 1;
+      if (card[0] == 'X' && strcmp(value, "IMAGE") != 0) mandatory = 2;
+    } else if (memcmp(card, "BITPIX  ", 8) == 0) {
+      hdu->bitpix = atoi(value);
+    } else if (memcmp(card, "NAXIS   ", 8) == 0) {
+      hdu->naxis = atoi(value);
+    } else if (memcmp(card, "NAXIS", 5) == 0 &&
+               card[5] >= '1' && card[5] <= '9' && card[6] == ' ') {
+      long n = atol(value);
+      int  k = card[5] - '1';
+      if (n < 0 || (unsigned long)n > SIZE_MAX) return 0;
+      /* Lengths of axes of images must fit in SImage_t */
+      if (mandatory == 1 && (n == 0 || n > MAX_IMAGE_SIZE)) return 0;
+      if (k < FITS_MAX_AXES) hdu->axis[k] = n;
+      else if (!mulSize(&extra, extra, n)) return 0;
+    } else if (memcmp(card, "PCOUNT  ", 8) == 0) {
+      pcount = atol(value);
+    } else if (memcmp(card, "GCOUNT  ", 8) == 0) {
+      gcount = atol(value);
+    } else if (memcmp(card, "BZERO   ", 8) == 0) {
+      hdu->bzero = atof(value);
+    } else if (memcmp(card, "BSCALE  ", 8) == 0) {
+      hdu->bscale = atof(value);
+    } else if (memcmp(card, "EXTNAME ", 8) == 0) {
+      hdu->isWeight = strcmp(value, WEIGHT_EXTNAME) == 0;
+    }
+  }
+  if (!ended || !mandatory || hdu->naxis < 0 || pcount < 0 || gcount < 0)
+    return 0;
+
+  switch (hdu->bitpix) {
+  case 8: case 16: case 32: case 64: case -32: case -64:
+    break;
+  default:
+    return 0;
+  }
+
+  /* The header of a truncated file need not be padded to a full block */
+  offset = roundToBlock(offset);
+  if (offset > size) return 0;
+
+  size_t dataSize = 0;
+  if (hdu->naxis > 0) {
+    dataSize = 1;
+    for (int i = 0; i < hdu->naxis && i < FITS_MAX_AXES; i++)
+      if (!mulSize(&dataSize, dataSize, hdu->axis[i])) return 0;
+    if (!mulSize(&dataSize, dataSize, extra) ||
+        (unsigned long)pcount > SIZE_MAX - dataSize ||
+        !mulSize(&dataSize, dataSize + pcount, gcount) ||
+        !mulSize(&dataSize, dataSize, abs(hdu->bitpix) / 8))
+      return 0;
+  }
+  if (dataSize > size - offset) return 0;
+
+  hdu->data     = file + offset;
+  hdu->dataSize = dataSize;
+  /* Only image extensions with 2 or 3 axes contain pixels */
+  if (mandatory == 2 || hdu->naxis < 2 || hdu->naxis > FITS_MAX_AXES
+    || extra != 1)
+    hdu->dataSize = 0;
+  return roundToBlock(offset + dataSize);
+}
+
+/* ========================================================================= */
+/* Convert n big-endian numbers of the plane to floats a·x + b, and store
+ * them every stride floats. Numbers are read by memcpy, since the data of
+ * the file need not be aligned. Simple loops like these are vectorized by
+ * the compiler, together with byte swapping. */
+static void readPlane(
+  const Hdu_t *hdu, size_t plane, float *dst, size_t stride,
+  float a, float b)
+{
+  size_t n = planeSize(hdu);
+  const unsigned char *src =
+    hdu->data + plane * n * (abs(hdu->bitpix) / 8);
+
+  switch (hdu->bitpix) {
+  case 8:
+    for (size_t i = 0; i < n; i++) dst[i * stride] = a * src[i] + b;
+    break;
+  case 16:
+    for (size_t i = 0; i < n; i++) {
+      uint16_t x;
+      memcpy(&x, src + 2*i, 2);
+      dst[i * stride] = a * (int16_t)SBigEndian16(x) + b;
+    }
+    break;
+  case 32:
+    for (size_t i = 0; i < n; i++) {
+      uint32_t x;
+      memcpy(&x, src + 4*i, 4);
+      dst[i * stride] = a * (float)(int32_t)SBigEndian32(x) + b;
+    }
+    break;
+  case 64:
+    for (size_t i = 0; i < n; i++) {
+      uint64_t x;
+      memcpy(&x, src + 8*i, 8);
+      dst[i * stride] = a * (float)(int64_t)SBigEndian64(x) + b;
+    }
+    break;
+  case -32:
+    for (size_t i = 0; i < n; i++) {
+      uint32_t x;
+      float    v;
+      memcpy(&x, src + 4*i, 4);
+      x = SBigEndian32(x);
+      memcpy(&v, &x, 4);
+      dst[i * stride] = a * v + b;
+    }
+    break;
+  case -64:
+    for (size_t i = 0; i < n; i++) {
+      uint64_t x;
+      double   v;
+      memcpy(&x, src + 8*i, 8);
+      x = SBigEndian64(x);
+      memcpy(&v, &x, 8);
+      dst[i * stride] = a * v + b;
+    }
+    break;
+  }
+}
+
+/* Read pixel values. Integer data is scaled as in PNG files, i.e.,
+ * unsigned 16-bit value x becomes (x + 0.5) / 65536. */
+static void readValues(const Hdu_t *hdu, size_t plane, float *dst,
+  size_t stride)
+{
+  float norm = 1.0f;
+  float off  = 0.0f;
+  if (hdu->bitpix > 0) {
+    norm = 1.0f / ((float)(1ULL << (hdu->bitpix - 1)) * 2.0f);
+    off  = 0.5f;
+  }
+  readPlane(hdu, plane, dst, stride,
+    hdu->bscale * norm, (hdu->bzero + off) * norm);
+}
+
+/* Read weights, that are stored without any normalization */
+static void readWeights(const Hdu_t *hdu, size_t plane, float *dst,
+  size_t stride)
+{
+  readPlane(hdu, plane, dst, stride, hdu->bscale, hdu->bzero);
+}
+
+/* ------------------------------------------------------------------------- */
+static void loadGray(SImage_t *image, const Hdu_t *hdu, const Hdu_t *whdu) {
+  size_t n = planeSize(hdu);
+  float *data = (float *)image->data_gray;
+  readValues(hdu, 0, data, 2);
+  if (whdu == NULL) {
+    for (size_t i = 0; i < n; i++) data[2*i + 1] = 1.0f;
+  } else {
+    readWeights(whdu, 0, data + 1, 2);
+    for (size_t i = 0; i < n; i++) data[2*i] *= data[2*i + 1];
+  }
+}
+
+static void loadRGB(SImage_t *image, const Hdu_t *hdu, const Hdu_t *whdu) {
+  size_t n = planeSize(hdu);
+  float *data = (float *)image->data_rgb;
+  for (int c = 0; c < 3; c++) readValues(hdu, c, data + c, 4);
+  if (whdu == NULL) {
+    for (size_t i = 0; i < n; i++) data[4*i + 3] = 1.0f;
+  } else {
+    readWeights(whdu, 0, data + 3, 4);
+    for (size_t i = 0; i < n; i++) {
+      SVec4f_t pix = image->data_rgb[i];
+      float w = pix[3];
+      pix *= w;
+      pix[3] = w;
+      image->data_rgb[i] = pix;
+    }
+  }
+}
+
+/* Color image with separate weights of channels */
+static void loadSeparateRGB(
+  SImage_t *image, const Hdu_t *hdu, const Hdu_t *whdu)
+{
+  size_t n = planeSize(hdu);
+  for (int c = 0; c < 3; c++) {
+    float *data = (float *)(image->data_red + c * n);
+    readValues(hdu, c, data, 2);
+    readWeights(whdu, c, data + 1, 2);
+    for (size_t i = 0; i < n; i++) data[2*i] *= data[2*i + 1];
+  }
+}
+
+/* ------------------------------------------------------------------------- */
+/* Weights match the image, when they have the same width and height, and
+ * either a single plane, or one plane per channel */
+static int weightsMatch(const Hdu_t *hdu, const Hdu_t *whdu) {
+  return whdu->dataSize > 0
+    && whdu->axis[0] == hdu->axis[0]
+    && whdu->axis[1] == hdu->axis[1]
+    && (planeN(whdu) == 1 || planeN(whdu) == planeN(hdu));
+}
+
+/* Load the image into initialized image, reusing its buffer if possible */
+static int loadMapped(
+  SImage_t *image, const unsigned char *file, size_t size)
+{
+  Hdu_t hdus[FITS_MAX_HDUS];
+  int   hdu_n  = 0;
+  size_t offset = 0;
+  while (hdu_n < FITS_MAX_HDUS && offset < size) {
+    offset = parseHdu(&hdus[hdu_n], file, size, offset);
+    if (offset == 0) break;
+    hdu_n++;
+  }
+
+  /* Pixels are stored in the primary HDU, or in the first image extension
+   * when the primary HDU is empty */
+  const Hdu_t *hdu  = NULL;
+  const Hdu_t *whdu = NULL;
+  for (int i = 0; i < hdu_n; i++) {
+    if (hdus[i].dataSize == 0) continue;
+    if (hdu == NULL && !hdus[i].isWeight) hdu = &hdus[i];
+    else if (hdu != NULL && hdus[i].isWeight && whdu == NULL) whdu = &hdus[i];
+  }
+  if (hdu == NULL) return 0;
+  if (whdu != NULL && !weightsMatch(hdu, whdu)) whdu = NULL;
+
+  size_t plane_n = planeN(hdu);
+  if (plane_n != 1 && plane_n != 3) return 0;
+
+  SImageFormat_t format = SFmt_Gray;
+  if (plane_n == 3) {
+    format = whdu != NULL && planeN(whdu) == 3 ? SFmt_SeparateRGB : SFmt_RGB;
+  }
+
+  SImage_reinit(image, hdu->axis[0], hdu->axis[1], format);
+  switch (image->format) {
+  case SFmt_Invalid:
+    return 0;
+  case SFmt_Gray:
+    loadGray(image, hdu, whdu);
+    return 1;
+  case SFmt_RGB:
+    loadRGB(image, hdu, whdu);
+    return 1;
+  case SFmt_SeparateRGB:
+    loadSeparateRGB(image, hdu, whdu);
+    return 1;
+  }
+  assert(0 && "Impossible case");
+  return 0;
+}
+
+int SImage_loadFITS_at(SImage_t *image, const char *fname) {
+  SImage_init(image, 0, 0, SFmt_Invalid);
+  return SImage_loadFITS_into(image, fname);
+}
+
+int SImage_loadFITS_into(SImage_t *image, const char *fname) {
+  int ok = 0;
+  int fd = open(fname, O_RDONLY);
+  if (fd >= 0) {
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+      size_t size = st.st_size;
+      void *file = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (file != MAP_FAILED) {
+        ok = loadMapped(image, file, size);
+        munmap(file, size);
+      }
+    }
+    close(fd);
+  }
+
+  if (!ok) {
+    SImage_deinit(image);
+    SImage_init(image, 0, 0, SFmt_Invalid);
+  }
+  return ok ? SPICA_OK : SPICA_ERROR;
+}
+
+SImage_t *SImage_loadFITS(const char *fname) {
+  SImage_t *image = malloc(sizeof(SImage_t));
+  if (image == NULL) return NULL;
+
+  SImage_loadFITS_at(image, fname);
+  return image;
+}
+
+/* ========================================================================= */
+/* Header under construction. It is filled with spaces in advance */
+typedef struct Header {
+  char   data[FITS_BLOCK * 2];
+  size_t length;
+} Header_t;
+
+/* Fixed-format card: strings begin at the 11th column, and other values
+ * are right-justified to the 30th column */
+static void addCard(Header_t *header, const char *key, const char *value) {
+  char card[FITS_CARD + 1];
+  if (value[0] == '\'')
+    snprintf(card, sizeof(card), "%-8s= %s", key, value);
+  else
+    snprintf(card, sizeof(card), "%-8s= %20s", key, value);
+  memcpy(header->data + header->length, card, strlen(card));
+  header->length += FITS_CARD;
+}
+
+static void addIntCard(Header_t *header, const char *key, long value) {
+  char str[32];
+  snprintf(str, sizeof(str), "%ld", value);
+  addCard(header, key, str);
+}
+
+/* Write the header, padded with spaces to the full block */
+static int writeHeader(Header_t *header, FILE *file) {
+  memcpy(header->data + header->length, "END", 3);
+  header->length = roundToBlock(header->length + FITS_CARD);
+  return fwrite(header->data, 1, header->length, file) == header->length;
+}
+
+static void imageHeader(
+  Header_t *header, const char *first, const SImage_t *image, int plane_n)
+{
+  header->length = 0;
+  memset(header->data, ' ', sizeof(header->data));
+  if (first != NULL) addCard(header, "XTENSION", first);
+  else addCard(header, "SIMPLE", "T");
+  addIntCard(header, "BITPIX", -32);
+  addIntCard(header, "NAXIS", plane_n > 1 ? 3 : 2);
+  addIntCard(header, "NAXIS1", image->width);
+  addIntCard(header, "NAXIS2", image->height);
+  if (plane_n > 1) addIntCard(header, "NAXIS3", plane_n);
+}
+
+/* ------------------------------------------------------------------------- */
+/* Value of channel c (or the weight, when c is negative) of pixel i */
+static float pixelComponent(const SImage_t *image, int c, size_t i) {
+  size_t n = (size_t)image->width * image->height;
+  float v = 0.0f;
+  float w = 0.0f;
+
+  switch (image->format) {
+  case SFmt_Invalid:
+    break;
+  case SFmt_Gray:
+    v = image->data_gray[i][0];
+    w = image->data_gray[i][1];
+    break;
+  case SFmt_RGB:
+    v = image->data_rgb[i][c < 0 ? 0 : c];
+    w = image->data_rgb[i][3];
+    break;
+  case SFmt_SeparateRGB:
+    v = image->data_red[(c < 0 ? -c - 1 : c) * n + i][0];
+    w = image->data_red[(c < 0 ? -c - 1 : c) * n + i][1];
+    break;
+  }
+  if (c < 0) return w;
+  return w == 0.0f ? 0.0f : v / w;
+}
+
+/* Write planes of float32 data, padded with zeros to the full block */
+static int writePlanes(
+  const SImage_t *image, FILE *file, const int *channels, int plane_n)
+{
+  size_t n = (size_t)image->width * image->height;
+  uint32_t *row = malloc(sizeof(uint32_t) * (image->width + 1));
+  if (row == NULL) return 0;
+
+  int ok = 1;
+  for (int p = 0; p < plane_n && ok; p++) {
+    for (size_t i = 0; i < n && ok; i += image->width) {
+      for (unsigned x = 0; x < image->width; x++) {
+        float v = pixelComponent(image, channels[p], i + x);
+        memcpy(&row[x], &v, 4);
+        row[x] = SBigEndian32(row[x]);
+      }
+      ok = fwrite(row, 4, image->width, file) == image->width;
+    }
+  }
+  free(row);
+
+  size_t size = n * plane_n * 4;
+  static const char zeros[FITS_BLOCK];
+  size_t pad = roundToBlock(size) - size;
+  if (ok && pad > 0) ok = fwrite(zeros, 1, pad, file) == pad;
+  return ok;
+}
+
+int SImage_saveFITS(const SImage_t *image, const char *fname) {
+  if (image->format == SFmt_Invalid) return SPICA_ERROR;
+
+  static const int valueChannels[3]  = { 0, 1, 2 };
+  static const int weightChannels[3] = { -1, -2, -3 };
+  int plane_n  = image->format == SFmt_Gray ? 1 : 3;
+  int weight_n = image->format == SFmt_SeparateRGB ? 3 : 1;
+
+  FILE *file = fopen(fname, "wb");
+  if (!file) return SPICA_ERROR;
+
+  int status = SPICA_ERROR;
+  Header_t header;
+
+  do {
+    /* Primary HDU with normalized values */
+    imageHeader(&header, NULL, image, plane_n);
+    addCard(&header, "EXTEND", "T");
+    if (!writeHeader(&header, file)) break;
+    if (!writePlanes(image, file, valueChannels, plane_n)) break;
+
+    /* Image extension with weights */
+    imageHeader(&header, "'IMAGE   '", image, weight_n);
+    addIntCard(&header, "PCOUNT", 0);
+    addIntCard(&header, "GCOUNT", 1);
+    addCard(&header, "EXTNAME", "'" WEIGHT_EXTNAME "  '");
+    if (!writeHeader(&header, file)) break;
+    if (!writePlanes(image, file, weightChannels, weight_n)) break;
+
+    /* Done */
+    status = SPICA_OK;
+  } while (0);
+
+  if (fclose(file) != 0) status = SPICA_ERROR;
+
+  return status;
+}
@@ -4,66 +4,176 @@
 
 /* Author: Piotr Polesiuk, 2022 */
 
+#define _POSIX_C_SOURCE 200809L
+
 #include "SImage.h"
+#include "SImage_binner.h"
 
 #include "SDataRepr.h"
+#include "SIWWFormat.h"
+#include "SIWWStream.h"
+#include "SParallel.h"
 
+#include <fcntl.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
-#define SIWW_MAGIC   "SPICAIWW"
-#define SIWW_VERSION 1
+/* ========================================================================= */
+/* Region of mapped file being loaded into an image */
+typedef struct Region {
+  const SIWWFormat_t  *fmt;
+  const unsigned char *file;
+  size_t               size;
+  SImage_t            *image;
+  int                  x, y;
+  /* Indices of tiles that intersect the region */
+  size_t              *tiles;
+  /* Non-zero for tiles that could not be decoded */
+  char                *failed;
+} Region_t;
 
-#define MAX_SUPPORTED_FORMAT SFmt_SeparateRGB
+static void loadTile(void *arg, size_t i) {
+  const Region_t     *reg = arg;
+  const SIWWFormat_t *fmt = reg->fmt;
+  size_t tile = reg->tiles[i];
+  SIWWRect_t r = SIWWFormat_tileRect(fmt, tile);
 
-typedef struct SIWW_header {
-  char     magic[8];
-  uint32_t version;
-  uint16_t header_size;
-  uint16_t format;
-  uint16_t width;
-  uint16_t height;
-} SIWW_header_t;
+  const unsigned char *index = reg->file + fmt->headerSize;
+  uint64_t begin, end;
+  memcpy(&begin, index + tile * sizeof(uint64_t), sizeof(uint64_t));
+  memcpy(&end, index + (tile + 1) * sizeof(uint64_t), sizeof(uint64_t));
+  begin = SLittleEndian64(begin);
+  end   = SLittleEndian64(end);
+  if (begin > end || end > reg->size) {
+    reg->failed[i] = 1;
+    return;
+  }
 
-int SImage_loadSIWW_at(SImage_t *image, const char *fname) {
-  SImage_init(image, 0, 0, SFmt_Invalid);
+  size_t stored   = end - begin;
+  size_t raw_size = SIWWFormat_tileDataSize(fmt, r);
+  const unsigned char *src = reg->file + begin;
 
-  FILE *file = fopen(fname, "rb");
-  if (!file) return SPICA_ERROR;
+  /* Uncompressed tiles are copied directly from the mapped file */
+  if (stored == raw_size) {
+    SIWWFormat_scatterTile(reg->image, reg->x, reg->y, r, src);
+    return;
+  }
 
-  do {
-    SIWW_header_t header;
-    if (fread(&header, sizeof(SIWW_header_t), 1, file) != 1) break;
-
-    header.version     = SLittleEndian32(header.version);
-    header.header_size = SLittleEndian16(header.header_size);
-    header.format      = SLittleEndian16(header.format);
-    header.width       = SLittleEndian16(header.width);
-    header.height      = SLittleEndian16(header.height);
-
-    if (memcmp(SIWW_MAGIC, header.magic, 8) != 0
-      || header.header_size < sizeof(SIWW_header_t)
-      || header.format >= MAX_SUPPORTED_FORMAT)
-    {
-      break;
+  unsigned char *data = malloc(raw_size + 1);
+  if (data == NULL || !SIWWFormat_decodeTile(fmt, r, src, stored, data))
+    reg->failed[i] = 1;
+  else
+    SIWWFormat_scatterTile(reg->image, reg->x, reg->y, r, data);
+  free(data);
+}
+
+/* Load the region of version 2 file. Only tiles that intersect the region
+ * are read, and they are decompressed in parallel */
+static int loadTiledRegion(Region_t *reg) {
+  const SIWWFormat_t *fmt   = reg->fmt;
+  SImage_t           *image = reg->image;
+
+  size_t n = 0;
+  reg->tiles  = malloc(sizeof(size_t) * (fmt->tileN + 1));
+  reg->failed = calloc(fmt->tileN + 1, 1);
+  if (reg->tiles == NULL || reg->failed == NULL) {
+    free(reg->tiles);
+    free(reg->failed);
+    return 0;
+  }
+
+  for (size_t t = 0; t < fmt->tileN; t++) {
+    SIWWRect_t r = SIWWFormat_tileRect(fmt, t);
+    if ((long)r.x1 > reg->x && (long)r.x0 < reg->x + (long)image->width &&
+        (long)r.y1 > reg->y && (long)r.y0 < reg->y + (long)image->height)
+      reg->tiles[n++] = t;
+  }
+
+  SParallel_for(n > 1 ? 0 : 1, n, loadTile, reg);
+
+  int ok = 1;
+  for (size_t i = 0; i < n; i++) ok = ok && !reg->failed[i];
+  free(reg->tiles);
+  free(reg->failed);
+  return ok;
+}
+
+/* Load the region of version 1 file. It is treated as a single tile */
+static int loadPlainRegion(Region_t *reg) {
+  const SIWWFormat_t *fmt = reg->fmt;
+  SIWWRect_t r = { 0, 0, fmt->width, fmt->height };
+  SIWWFormat_scatterTile(reg->image, reg->x, reg->y, r,
+    reg->file + fmt->headerSize);
+  return 1;
+}
+
+/* ------------------------------------------------------------------------- */
+/* Load the region into initialized image, reusing its buffer if possible */
+static int loadRegion(
+  SImage_t *image, const char *fname,
+  int x, int y, unsigned width, unsigned height, int whole)
+{
+  int fd = open(fname, O_RDONLY);
+  struct stat st;
+  void *file = MAP_FAILED;
+  size_t size = 0;
+  if (fd >= 0) {
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+      size = st.st_size;
+      file = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
     }
+    close(fd);
+  }
 
-    if (fseek(file, header.header_size, SEEK_SET)) break;
+  int ok = 0;
+  SIWWFormat_t fmt;
+  if (file != MAP_FAILED && SIWWFormat_parse(&fmt, file, size, size)) {
+    if (whole) {
+      width  = fmt.width;
+      height = fmt.height;
+    }
+    SImage_reinit(image, width, height, fmt.format);
+    ok = image->format != SFmt_Invalid;
+  }
 
-    SImage_init(image, header.width, header.height, header.format);
-    if (image->format == SFmt_Invalid) break;
+  if (ok) {
+    Region_t reg = {
+      .fmt   = &fmt,
+      .file  = file,
+      .size  = size,
+      .image = image,
+      .x     = x,
+      .y     = y
+    };
+    /* Pixels out of the image have no data */
+    if (x < 0 || y < 0 ||
+        (long)x + width > fmt.width || (long)y + height > fmt.height)
+      SImage_clear(image);
 
-#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
-    fread(image->data, 1, SImage_dataSize(image), file);
-#else
-#  error unsupported endianness
-#endif
-  } while (0);
+    ok = fmt.version == SIWW_VERSION ?
+      loadPlainRegion(&reg) : loadTiledRegion(&reg);
+  }
 
-  fclose(file);
-  return (image->format ? SPICA_OK : SPICA_ERROR);
+  if (file != MAP_FAILED) munmap(file, size);
+  if (!ok) {
+    SImage_deinit(image);
+    SImage_init(image, 0, 0, SFmt_Invalid);
+  }
+  return ok ? SPICA_OK : SPICA_ERROR;
+}
+
+int SImage_loadSIWW_at(SImage_t *image, const char *fname) {
+  SImage_init(image, 0, 0, SFmt_Invalid);
+  return loadRegion(image, fname, 0, 0, 0, 0, 1);
+}
+
+int SImage_loadSIWW_into(SImage_t *image, const char *fname) {
+  return loadRegion(image, fname, 0, 0, 0, 0, 1);
 }
 
 SImage_t *SImage_loadSIWW(const char *fname) {
@@ -74,6 +184,83 @@ SImage_t *SImage_loadSIWW(const char *fname) {
   return image;
 }
 
+int SImage_loadSIWWRegion(
+  SImage_t   *image,
+  const char *fname,
+  int         x,
+  int         y,
+  unsigned    width,
+  unsigned    height)
+{
+  SImage_init(image, 0, 0, SFmt_Invalid);
+  return loadRegion(image, fname, x, y, width, height, 0);
+}
+
+/* ------------------------------------------------------------------------- */
+/* Number of rows read at once by SImage_loadSIWWGray_into */
+#define GRAY_BAND_HEIGHT 64
+
+static void grayRow(SVec2f_t *dst, const SImage_t *band, unsigned y) {
+  switch (band->format) {
+  case SFmt_Invalid:
+    return;
+  case SFmt_Gray:
+    memcpy(dst, SImage_row(band, y), sizeof(SVec2f_t) * band->width);
+    return;
+  case SFmt_RGB:
+    SImage_grayRowRGB(dst, SImage_row(band, y), band->width);
+    return;
+  case SFmt_SeparateRGB:
+    SImage_grayRowSeparateRGB(dst,
+      SImage_rowRed(band, y), SImage_rowGreen(band, y),
+      SImage_rowBlue(band, y), band->width);
+    return;
+  }
+}
+
+int SImage_loadSIWWGray_into(
+  SImage_t       *gray,
+  SImage_t       *binned,
+  unsigned        factor,
+  SImageFormat_t *format,
+  const char     *fname)
+{
+  SIWWStream_t stream;
+  SIWWStream_init(&stream);
+  SImage_binner_t binner = {
+    .gray   = gray,
+    .binned = factor > 0 ? binned : NULL,
+    .factor = factor
+  };
+  SImage_t band;
+  SImage_init(&band, 0, 0, SFmt_Invalid);
+
+  /* The file is read by bands of rows, so the whole image in the format of
+   * the file is never stored in memory */
+  int ok = SIWWStream_openRead(&stream, fname) == SPICA_OK
+    && SImage_binnerStart(&binner, gray, binned, factor,
+         stream.width, stream.height);
+  if (ok) {
+    SImage_init(&band, stream.width, GRAY_BAND_HEIGHT, stream.format);
+    ok = band.format != SFmt_Invalid;
+  }
+  while (ok && stream.row < stream.height) {
+    unsigned y0 = stream.row;
+    ok = SIWWStream_read(&stream, &band) == SPICA_OK;
+    for (unsigned y = y0; ok && y < stream.row; y++) {
+      grayRow(SImage_binnerRow(&binner, y), &band, y - y0);
+      SImage_binnerAddRow(&binner, y);
+    }
+  }
+
+  if (format != NULL) *format = ok ? stream.format : SFmt_Invalid;
+  SImage_deinit(&band);
+  SIWWStream_close(&stream);
+  SImage_binnerFinish(&binner, ok);
+  return ok ? SPICA_OK : SPICA_ERROR;
+}
+
+/* ========================================================================= */
 int SImage_saveSIWW(const SImage_t *image, const char *fname) {
   FILE *file = fopen(fname, "wb");
   if (!file) return SPICA_ERROR;
@@ -82,13 +269,13 @@ int SImage_saveSIWW(const SImage_t *image, const char *fname) {
 
   do {
     /* Write header */
-    SIWW_header_t header = { .magic = SIWW_MAGIC };
-    header.version     = SLittleEndian32(SIWW_VERSION);
-    header.header_size = SLittleEndian16(sizeof(SIWW_header_t));
-    header.format      = SLittleEndian16(image->format);
-    header.width       = SLittleEndian16(image->width);
-    header.height      = SLittleEndian16(image->height);
-    if (fwrite(&header, sizeof(SIWW_header_t), 1, file) != 1) break;
+    SIWWFormat_t fmt = {
+      .format  = image->format,
+      .width   = image->width,
+      .height  = image->height,
+      .version = SIWW_VERSION
+    };
+    if (!SIWWFormat_write(&fmt, file)) break;
 
 #if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
     size_t dataSize = SImage_dataSize(image);
@@ -105,3 +292,100 @@ int SImage_saveSIWW(const SImage_t *image, const char *fname) {
 
   return status;
 }
+
+/* ------------------------------------------------------------------------- */
+/* Tiles of the image being saved */
+typedef struct Tiles {
+  const SImage_t     *image;
+  const SIWWFormat_t *fmt;
+  /* Stored data of tiles, and its size */
+  unsigned char     **data;
+  size_t             *size;
+} Tiles_t;
+
+static void encodeTile(void *arg, size_t tile) {
+  Tiles_t *tiles = arg;
+  SIWWRect_t r = SIWWFormat_tileRect(tiles->fmt, tile);
+
+  tiles->size[tile] = SIWWFormat_tileDataSize(tiles->fmt, r);
+  tiles->data[tile] = malloc(tiles->size[tile] + 1);
+  if (tiles->data[tile] == NULL) return;
+
+  SIWWFormat_gatherTile(tiles->image, 0, 0, r, tiles->data[tile]);
+  SIWWFormat_compressTile(tiles->fmt, &tiles->data[tile], &tiles->size[tile]);
+}
+
+int SImage_saveSIWWTiled(
+  const SImage_t *image,
+  const char     *fname,
+  unsigned        tileWidth,
+  unsigned        tileHeight,
+  int             compress)
+{
+  if (tileWidth  == 0) tileWidth  = SIWW_DEFAULT_TILE_SIZE;
+  if (tileHeight == 0) tileHeight = SIWW_DEFAULT_TILE_SIZE;
+  if (image->width > UINT16_MAX || image->height > UINT16_MAX
+    || tileWidth > UINT16_MAX || tileHeight > UINT16_MAX)
+  {
+    return SPICA_ERROR;
+  }
+
+  SIWWFormat_t fmt = {
+    .format  = image->format,
+    .width   = image->width,
+    .height  = image->height,
+    .version = SIWW_TILED_VERSION
+  };
+  SIWWFormat_setTiling(&fmt, tileWidth, tileHeight,
+    compress ? SIWW_COMPRESSION_SHUFFLE : SIWW_COMPRESSION_NONE);
+  size_t tile_n = image->format == SFmt_Invalid ? 0 : fmt.tileN;
+
+  Tiles_t tiles = { .image = image, .fmt = &fmt };
+  tiles.data = calloc(tile_n + 1, sizeof(unsigned char *));
+  tiles.size = calloc(tile_n + 1, sizeof(size_t));
+  uint64_t *index = malloc(sizeof(uint64_t) * (tile_n + 1));
+  FILE *file = NULL;
+  int status = SPICA_ERROR;
+
+  do {
+    if (tiles.data == NULL || tiles.size == NULL || index == NULL) break;
+
+    SParallel_for(0, tile_n, encodeTile, &tiles);
+
+    uint64_t offset =
+      SIWW_TILED_HEADER_SIZE + sizeof(uint64_t) * (tile_n + 1);
+    int ok = 1;
+    for (size_t t = 0; t < tile_n; t++) {
+      ok = ok && tiles.data[t] != NULL;
+      index[t] = SLittleEndian64(offset);
+      offset += tiles.size[t];
+    }
+    index[tile_n] = SLittleEndian64(offset);
+    if (!ok) break;
+
+    file = fopen(fname, "wb");
+    if (!file) break;
+
+    /* Write header, index, and tiles */
+    if (!SIWWFormat_write(&fmt, file)) break;
+    if (fwrite(index, sizeof(uint64_t), tile_n + 1, file) != tile_n + 1)
+      break;
+    for (size_t t = 0; t < tile_n && ok; t++)
+      ok = fwrite(tiles.data[t], 1, tiles.size[t], file) == tiles.size[t];
+    if (!ok) break;
+
+    /* Done */
+    status = SPICA_OK;
+  } while (0);
+
+  if (file != NULL && fclose(file) != 0) status = SPICA_ERROR;
+
+  if (tiles.data != NULL) {
+    for (size_t t = 0; t < tile_n; t++) free(tiles.data[t]);
+  }
+  free(tiles.data);
+  free(tiles.size);
+  free(index);
+
+  return status;
+}
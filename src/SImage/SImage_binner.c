@@ -0,0 +1,98 @@
+/* This file is part of Spica, released under MIT license.
+ * See LICENSE for details.
+ */
+
+/* Author: Piotr Polesiuk, 2022 */
+
+#include "SImage_binner.h"
+
+#include <stdlib.h>
+
+static void reset(SImage_t *image) {
+  if (image == NULL) return;
+  SImage_deinit(image);
+  SImage_init(image, 0, 0, SFmt_Invalid);
+}
+
+int SImage_binnerStart(
+  SImage_binner_t *binner,
+  SImage_t        *gray,
+  SImage_t        *binned,
+  unsigned         factor,
+  unsigned         width,
+  unsigned         height)
+{
+  binner->gray   = gray;
+  binner->binned = factor > 0 ? binned : NULL;
+  binner->factor = factor;
+  binner->width  = width;
+  binner->row    = NULL;
+
+  if (gray != NULL) {
+    SImage_reinit(gray, width, height, SFmt_Gray);
+    if (gray->format == SFmt_Invalid) return 0;
+  } else {
+    binner->row = malloc(sizeof(SVec2f_t) * (width + 1));
+    if (binner->row == NULL) return 0;
+  }
+
+  if (binner->binned != NULL) {
+    SImage_reinit(binner->binned,
+      (width + factor - 1) / factor, (height + factor - 1) / factor,
+      SFmt_Gray);
+    if (binner->binned->format == SFmt_Invalid) return 0;
+    SImage_clear(binner->binned);
+  }
+  return 1;
+}
+
+SVec2f_t *SImage_binnerRow(SImage_binner_t *binner, unsigned y) {
+  return binner->gray != NULL ? SImage_row(binner->gray, y) : binner->row;
+}
+
+/* Pixels are added in the same order as by SImage_scaleDown, so the binned
+ * image is exactly the same */
+void SImage_binnerAddRow(SImage_binner_t *binner, unsigned y) {
+  if (binner->binned == NULL) return;
+
+  const SVec2f_t *src = SImage_binnerRow(binner, y);
+  SVec2f_t *dst    = SImage_row(binner->binned, y / binner->factor);
+  unsigned  factor = binner->factor;
+  for (unsigned x = 0, bx = 0; x < binner->width; bx++) {
+    unsigned end = x + factor < binner->width ? x + factor : binner->width;
+    SVec2f_t v = dst[bx];
+    for (; x < end; x++) v += src[x];
+    dst[bx] = v;
+  }
+}
+
+void SImage_binnerFinish(SImage_binner_t *binner, int ok) {
+  free(binner->row);
+  binner->row = NULL;
+  if (!ok) {
+    reset(binner->gray);
+    reset(binner->binned);
+  }
+}
+
+/* ========================================================================= */
+void SImage_grayRowRGB(SVec2f_t *dst, const SVec4f_t *src, unsigned width) {
+  SVec4f_t weight = { 1.0f/3.0f, 1.0f/3.0f, 1.0f/3.0f, 1.0f };
+  for (unsigned x = 0; x < width; x++) {
+    SVec4f_t spix = src[x] * weight;
+    SVec2f_t dpix = { spix[0] + spix[1] + spix[2], spix[3] };
+    dst[x] = dpix;
+  }
+}
+
+void SImage_grayRowSeparateRGB(
+  SVec2f_t       *dst,
+  const SVec2f_t *red,
+  const SVec2f_t *green,
+  const SVec2f_t *blue,
+  unsigned        width)
+{
+  for (unsigned x = 0; x < width; x++) {
+    dst[x] = (red[x] + green[x] + blue[x]) / 3.0f;
+  }
+}
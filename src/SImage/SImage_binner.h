@@ -0,0 +1,55 @@
+/* This file is part of Spica, released under MIT license.
+ * See LICENSE for details.
+ */
+
+/* Conversion of decoded rows to gray-scale, and binning them on the fly */
+
+/* Author: Piotr Polesiuk, 2022 */
+
+#ifndef __SIMAGE_BINNER_H__
+#define __SIMAGE_BINNER_H__
+
+#include "SImage.h"
+
+typedef struct SImage_binner {
+  SImage_t *gray;   /** Gray-scale image, or NULL */
+  SImage_t *binned; /** Binned image, or NULL */
+  unsigned  factor; /** Binning factor */
+  unsigned  width;  /** Width of rows */
+  SVec2f_t *row;    /** Temporary row, used when gray is NULL */
+} SImage_binner_t;
+
+/** Prepare images of given size, reusing their buffers (see
+ * SImage_reinit). Binned image is cleared. Returns 0 on error. */
+int SImage_binnerStart(
+  SImage_binner_t *binner,
+  SImage_t        *gray,
+  SImage_t        *binned,
+  unsigned         factor,
+  unsigned         width,
+  unsigned         height);
+
+/** Buffer for gray-scale row y, to be filled by the decoder */
+SVec2f_t *SImage_binnerRow(SImage_binner_t *binner, unsigned y);
+
+/** Add the row y, filled by the decoder, to the binned image */
+void SImage_binnerAddRow(SImage_binner_t *binner, unsigned y);
+
+/** Free resources. On error (ok == 0) images are reset to SFmt_Invalid
+ * images. */
+void SImage_binnerFinish(SImage_binner_t *binner, int ok);
+
+/** Convert a row of RGB pixels to gray-scale. SImage_toFormat converts
+ * whole images by this function */
+void SImage_grayRowRGB(SVec2f_t *dst, const SVec4f_t *src, unsigned width);
+
+/** Convert a row of separate RGB planes to gray-scale. SImage_toFormat
+ * converts whole images by this function */
+void SImage_grayRowSeparateRGB(
+  SVec2f_t       *dst,
+  const SVec2f_t *red,
+  const SVec2f_t *green,
+  const SVec2f_t *blue,
+  unsigned        width);
+
+#endif /* __SIMAGE_BINNER_H__ */
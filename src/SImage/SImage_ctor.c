@@ -5,11 +5,10 @@
 /* Author: Piotr Polesiuk, 2022 */
 
 #include "SImage.h"
+#include "SImage_limits.h"
 
 #include <stdlib.h>
 
-#define MAX_IMAGE_SIZE 65535
-
 void SImage_init(
   SImage_t      *image,
   unsigned       width,
@@ -54,6 +53,41 @@ void SImage_deinit(SImage_t *image) {
   if (image->data) free(image->data);
 }
 
+static size_t dataSize(
+  unsigned       width,
+  unsigned       height,
+  SImageFormat_t format)
+{
+  switch (format) {
+  case SFmt_Invalid:     return 0;
+  case SFmt_Gray:        return width * height * sizeof(SVec2f_t);
+  case SFmt_RGB:         return width * height * sizeof(SVec4f_t);
+  case SFmt_SeparateRGB: return width * height * sizeof(SVec2f_t) * 3;
+  }
+  return 0;
+}
+
+void SImage_reinit(
+  SImage_t      *image,
+  unsigned       width,
+  unsigned       height,
+  SImageFormat_t format)
+{
+  /* The buffer is reused, when it has exactly the required size */
+  if (image->format != SFmt_Invalid && format != SFmt_Invalid
+    && width <= MAX_IMAGE_SIZE && height <= MAX_IMAGE_SIZE
+    && dataSize(width, height, format) == SImage_dataSize(image))
+  {
+    image->width  = width;
+    image->height = height;
+    image->format = format;
+    return;
+  }
+
+  SImage_deinit(image);
+  SImage_init(image, width, height, format);
+}
+
 SImage_t *SImage_alloc(
   unsigned       width,
   unsigned       height,
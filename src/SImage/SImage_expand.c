@@ -0,0 +1,113 @@
+/* This file is part of Spica, released under MIT license.
+ * See LICENSE for details.
+ */
+
+/* Author: Piotr Polesiuk, 2022 */
+
+#include "SImage.h"
+#include "SImage_limits.h"
+
+#include <math.h>
+#include <string.h>
+
+/* Replace the image by a window of given size, whose top-left corner is at
+ * (x, y) in coordinates of the image. Pixels of the window outside the
+ * image have no data. */
+static int moveWindow(
+  SImage_t *image, long x, long y, unsigned width, unsigned height)
+{
+  SImage_t result;
+  SImage_init(&result, width, height, image->format);
+  if (result.format == SFmt_Invalid) return SPICA_ERROR;
+  SImage_clear(&result);
+
+  size_t px = image->format == SFmt_RGB ? sizeof(SVec4f_t) : sizeof(SVec2f_t);
+  size_t plane_n = image->format == SFmt_SeparateRGB ? 3 : 1;
+  size_t src_plane = (size_t)image->width * image->height * px;
+  size_t dst_plane = (size_t)width * height * px;
+
+  /* Intersection of the window and the image, in coordinates of the
+   * image */
+  long x0 = x > 0 ? x : 0;
+  long y0 = y > 0 ? y : 0;
+  long x1 = x + (long)width  < (long)image->width  ?
+    x + (long)width  : (long)image->width;
+  long y1 = y + (long)height < (long)image->height ?
+    y + (long)height : (long)image->height;
+
+  for (size_t p = 0; x0 < x1 && p < plane_n; p++) {
+    const unsigned char *src =
+      (const unsigned char *)image->data + p * src_plane;
+    unsigned char *dst = (unsigned char *)result.data + p * dst_plane;
+    for (long v = y0; v < y1; v++) {
+      memcpy(
+        dst + ((v - y) * (size_t)width + (x0 - x)) * px,
+        src + (v * (size_t)image->width + x0) * px,
+        (x1 - x0) * px);
+    }
+  }
+
+  SImage_deinit(image);
+  *image = result;
+  return SPICA_OK;
+}
+
+/* ========================================================================= */
+int SImage_expand(
+  SImage_t      *image,
+  int           *x_origin,
+  int           *y_origin,
+  SBoundingBox_t bb)
+{
+  if (image->format == SFmt_Invalid) return SPICA_ERROR;
+  if (SBoundingBox_isEmpty(bb)) return SPICA_OK;
+
+  long w = image->width;
+  long h = image->height;
+
+  /* Pixels covered by the bounding box, in coordinates of the image */
+  long min_x = (long)floorf(bb.minX) - *x_origin;
+  long min_y = (long)floorf(bb.minY) - *y_origin;
+  long max_x = (long)ceilf(bb.maxX)  - *x_origin;
+  long max_y = (long)ceilf(bb.maxY)  - *y_origin;
+
+  long left   = min_x < 0  ? -min_x       : 0;
+  long top    = min_y < 0  ? -min_y       : 0;
+  long right  = max_x >= w ? max_x - w + 1 : 0;
+  long bottom = max_y >= h ? max_y - h + 1 : 0;
+  if (left == 0 && top == 0 && right == 0 && bottom == 0) return SPICA_OK;
+
+  /* Geometric growth, unless the image would be too large */
+  long grow_w = w / 2;
+  long grow_h = h / 2;
+  if (w + 2 * grow_w + left + right <= MAX_IMAGE_SIZE) {
+    if (left   > 0 && left   < grow_w) left   = grow_w;
+    if (right  > 0 && right  < grow_w) right  = grow_w;
+  }
+  if (h + 2 * grow_h + top + bottom <= MAX_IMAGE_SIZE) {
+    if (top    > 0 && top    < grow_h) top    = grow_h;
+    if (bottom > 0 && bottom < grow_h) bottom = grow_h;
+  }
+  if (w + left + right > MAX_IMAGE_SIZE || h + top + bottom > MAX_IMAGE_SIZE)
+    return SPICA_ERROR;
+
+  if (moveWindow(image, -left, -top, w + left + right, h + top + bottom)
+      != SPICA_OK)
+    return SPICA_ERROR;
+
+  *x_origin -= left;
+  *y_origin -= top;
+  return SPICA_OK;
+}
+
+int SImage_crop(
+  SImage_t *image,
+  int       x,
+  int       y,
+  unsigned  width,
+  unsigned  height)
+{
+  if (image->format == SFmt_Invalid || width == 0 || height == 0)
+    return SPICA_ERROR;
+  return moveWindow(image, x, y, width, height);
+}
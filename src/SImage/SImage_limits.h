@@ -0,0 +1,16 @@
+/* This file is part of Spica, released under MIT license.
+ * See LICENSE for details.
+ */
+
+/* Limits of images, shared by functions that create and resize them */
+
+/* Author: Piotr Polesiuk, 2022 */
+
+#ifndef __SIMAGE_LIMITS_H__
+#define __SIMAGE_LIMITS_H__
+
+/** Maximal width and height of an image. Larger images are rejected by
+ * SImage_init */
+#define MAX_IMAGE_SIZE 65535
+
+#endif /* __SIMAGE_LIMITS_H__ */
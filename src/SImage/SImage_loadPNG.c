@@ -5,6 +5,7 @@
 /* Author: Piotr Polesiuk, 2022 */
 
 #include "SImage.h"
+#include "SImage_binner.h"
 
 #include <stdint.h>
 #include <stdlib.h>
@@ -64,14 +65,26 @@ static void readFilter_RGB16(void *tgt, const png_byte *src, unsigned width) {
   }
 }
 
-int SImage_loadPNG_at(SImage_t *image, const char *fname) {
+/* ========================================================================= */
+/* Receiver of decoded rows */
+typedef struct RowSink {
+  /* Called before decoding rows. Returns 0 on error */
+  int  (*start)(void *arg, unsigned width, unsigned height,
+          SImageFormat_t format);
+  /* Buffer for the row y, to be filled in the given format */
+  void *(*row)(void *arg, unsigned y);
+  /* Called after the row y is filled. It may be NULL */
+  void (*done)(void *arg, unsigned y);
+} RowSink_t;
+
+/* Decode PNG file row by row. Returns 0 on error */
+static int readPNG(const char *fname, const RowSink_t *sink, void *arg) {
   png_byte header[8];
   FILE       *fp       = NULL;
   png_structp png_ptr  = NULL;
   png_infop   info_ptr = NULL;
   png_bytep   row      = NULL;
-
-  SImage_init(image, 0, 0, SFmt_Invalid);
+  int         ok       = 0;
 
   do {
     /* Open file */
@@ -82,8 +95,6 @@ int SImage_loadPNG_at(SImage_t *image, const char *fname) {
     if (fread(header, sizeof(png_byte), 8, fp) != 8
       || png_sig_cmp(header, 0, 8))
     {
-      SImage_deinit(image);
-      SImage_init(image, 0, 0, SFmt_Invalid);
       break;
     }
 
@@ -135,15 +146,18 @@ int SImage_loadPNG_at(SImage_t *image, const char *fname) {
     /* If no memory for a single row */
     if (row == NULL) break;
 
-    /* Allocate image */
-    SImage_init(image, width, height, format);
-    if (image->format == SFmt_Invalid) break;
+    /* Prepare the receiver, e.g., allocate image */
+    if (!sink->start(arg, width, height, format)) break;
 
     /* Read image data */
     for (unsigned y = 0; y < height; y++) {
       png_read_row(png_ptr, row, NULL);
-      filter(SImage_row(image, y), row, width);
+      filter(sink->row(arg, y), row, width);
+      if (sink->done != NULL) sink->done(arg, y);
     }
+
+    /* Done */
+    ok = 1;
   } while (0);
 
   /* Free resources */
@@ -152,7 +166,98 @@ int SImage_loadPNG_at(SImage_t *image, const char *fname) {
   if (png_ptr  != NULL) png_destroy_read_struct(&png_ptr, NULL, NULL);
   if (fp != NULL)       fclose(fp);
 
-  return (image->format ? SPICA_OK : SPICA_ERROR);
+  return ok;
+}
+
+/* ------------------------------------------------------------------------- */
+static int imageStart(
+  void *arg, unsigned width, unsigned height, SImageFormat_t format)
+{
+  /* Allocate image, or reuse the buffer of the previous one */
+  SImage_t *image = arg;
+  SImage_reinit(image, width, height, format);
+  return image->format != SFmt_Invalid;
+}
+
+static void *imageRow(void *arg, unsigned y) {
+  return SImage_row(arg, y);
+}
+
+int SImage_loadPNG_at(SImage_t *image, const char *fname) {
+  SImage_init(image, 0, 0, SFmt_Invalid);
+  return SImage_loadPNG_into(image, fname);
+}
+
+int SImage_loadPNG_into(SImage_t *image, const char *fname) {
+  static const RowSink_t sink = { imageStart, imageRow, NULL };
+  if (readPNG(fname, &sink, image)) return SPICA_OK;
+
+  SImage_deinit(image);
+  SImage_init(image, 0, 0, SFmt_Invalid);
+  return SPICA_ERROR;
+}
+
+/* ------------------------------------------------------------------------- */
+/* Gray-scale image being decoded */
+typedef struct GrayLoad {
+  SImage_binner_t binner;
+  SImageFormat_t  format;
+  /* Decoded row of RGB image */
+  SVec4f_t       *rgb;
+} GrayLoad_t;
+
+static int grayStart(
+  void *arg, unsigned width, unsigned height, SImageFormat_t format)
+{
+  GrayLoad_t *load = arg;
+  load->format = format;
+  if (format == SFmt_RGB) {
+    load->rgb = malloc(sizeof(SVec4f_t) * (width + 1));
+    if (load->rgb == NULL) return 0;
+  }
+  return SImage_binnerStart(&load->binner,
+    load->binner.gray, load->binner.binned, load->binner.factor,
+    width, height);
+}
+
+static void *grayRow(void *arg, unsigned y) {
+  GrayLoad_t *load = arg;
+  if (load->format == SFmt_RGB) return load->rgb;
+  return SImage_binnerRow(&load->binner, y);
+}
+
+static void grayDone(void *arg, unsigned y) {
+  GrayLoad_t *load = arg;
+  if (load->format == SFmt_RGB) {
+    SImage_grayRowRGB(SImage_binnerRow(&load->binner, y), load->rgb,
+      load->binner.width);
+  }
+  SImage_binnerAddRow(&load->binner, y);
+}
+
+int SImage_loadPNGGray_into(
+  SImage_t       *gray,
+  SImage_t       *binned,
+  unsigned        factor,
+  SImageFormat_t *format,
+  const char     *fname)
+{
+  static const RowSink_t sink = { grayStart, grayRow, grayDone };
+  GrayLoad_t load = {
+    .binner = {
+      .gray   = gray,
+      .binned = factor > 0 ? binned : NULL,
+      .factor = factor
+    },
+    .format = SFmt_Invalid,
+    .rgb    = NULL
+  };
+
+  int ok = readPNG(fname, &sink, &load);
+  free(load.rgb);
+  SImage_binnerFinish(&load.binner, ok);
+  if (format != NULL) *format = ok ? load.format : SFmt_Invalid;
+  return ok ? SPICA_OK : SPICA_ERROR;
 }
 
 SImage_t *SImage_loadPNG(const char *fname) {
@@ -7,90 +7,206 @@
 #include "SImage.h"
 #include "SImage_frame.h"
 
+#include <stdlib.h>
+
 typedef SVec2f_t (*subpixelGray_t)(const SImage_t *, SVec2f_t);
 typedef SVec4f_t (*subpixelRGB_t)(const SImage_t *, SVec2f_t);
 
+/* Mapping from pixels of the target image to positions in the source
+ * image: post(remap(pre(p))). The remapping grid is optional. */
+typedef struct Sampler {
+  STransform_t    pre;
+  const SRemap_t *remap;
+  STransform_t    post;
+} Sampler_t;
+
+/* Positions in the source image of pixels of a row of the frame */
+static void transformRow(
+  SVec2f_t             *row,
+  const SImage_frame_t *f,
+  int                   y,
+  const Sampler_t      *sampler)
+{
+  size_t n = f->max_x - f->min_x;
+  for (int x = f->min_x; x < f->max_x; x++)
+    row[x - f->min_x] = SVec2f(x, y);
+  STransform_applyBatch(&sampler->pre, row, row, n);
+  if (sampler->remap != NULL) {
+    SRemap_apply(sampler->remap, row, row, n);
+    STransform_applyBatch(&sampler->post, row, row, n);
+  }
+}
+
 static void stackTrGray(
-  SImage_t           *tgt,
-  SVec2f_t           *tgt_data,
-  const SImage_t     *src,
-  subpixelGray_t      subpixel,
-  const STransform_t *tr,
-  const STransform_t *tr_inv)
+  const SImage_frame_t *f,
+  SVec2f_t             *tgt_data,
+  const SImage_t       *src,
+  subpixelGray_t        subpixel,
+  const Sampler_t      *sampler)
 {
-  SImage_frame_t f = SImage_setFrameTr(tgt, src, tr);
-  for (int y = f.min_y; y < f.max_y; y++) {
-    for (int x = f.min_x; x < f.max_x; x++) {
-      tgt_data[y * f.tgt_w + x] +=
-        subpixel(src, STransform_apply(tr_inv, SVec2f(x, y)));
+  SVec2f_t *row = malloc(sizeof(SVec2f_t) * (f->max_x - f->min_x));
+  for (int y = f->min_y; y < f->max_y; y++) {
+    transformRow(row, f, y, sampler);
+    for (int x = f->min_x; x < f->max_x; x++) {
+      tgt_data[y * f->tgt_w + x] += subpixel(src, row[x - f->min_x]);
     }
   }
+  free(row);
 }
 
 static void stackTrRGB(
-  SImage_t           *tgt,
-  SVec4f_t           *tgt_data,
-  const SImage_t     *src,
-  subpixelRGB_t       subpixel,
-  const STransform_t *tr,
-  const STransform_t *tr_inv)
+  const SImage_frame_t *f,
+  SVec4f_t             *tgt_data,
+  const SImage_t       *src,
+  subpixelRGB_t         subpixel,
+  const Sampler_t      *sampler)
 {
-  SImage_frame_t f = SImage_setFrameTr(tgt, src, tr);
-  for (int y = f.min_y; y < f.max_y; y++) {
-    for (int x = f.min_x; x < f.max_x; x++) {
-      tgt_data[y * f.tgt_w + x] +=
-        subpixel(src, STransform_apply(tr_inv, SVec2f(x, y)));
+  SVec2f_t *row = malloc(sizeof(SVec2f_t) * (f->max_x - f->min_x));
+  for (int y = f->min_y; y < f->max_y; y++) {
+    transformRow(row, f, y, sampler);
+    for (int x = f->min_x; x < f->max_x; x++) {
+      tgt_data[y * f->tgt_w + x] += subpixel(src, row[x - f->min_x]);
     }
   }
+  free(row);
 }
 
 static void stackTrMain(
-  SImage_t           *tgt,
-  const STransform_t *tr,
-  const STransform_t *tr_inv,
-  const SImage_t     *src)
+  SImage_t        *tgt,
+  SImage_frame_t   f,
+  const Sampler_t *sampler,
+  const SImage_t  *src)
 {
-  if (src->format == SFmt_Invalid || tr->type == STr_Drop) return;
+  if (src->format == SFmt_Invalid || f.min_x >= f.max_x) return;
 
   switch (tgt->format) {
   case SFmt_Invalid:
     return;
   case SFmt_Gray:
-    stackTrGray(tgt, tgt->data_gray, src, SImage_subpixelGray, tr, tr_inv);
+    stackTrGray(&f, tgt->data_gray, src, SImage_subpixelGray, sampler);
     return;
   case SFmt_RGB:
-    stackTrRGB(tgt, tgt->data_rgb, src, SImage_subpixelRGB, tr, tr_inv);
+    stackTrRGB(&f, tgt->data_rgb, src, SImage_subpixelRGB, sampler);
     return;
   case SFmt_SeparateRGB:
-    stackTrGray(tgt, SImage_dataRed(tgt),
-      src, SImage_subpixelRed,   tr, tr_inv);
-    stackTrGray(tgt, SImage_dataGreen(tgt),
-      src, SImage_subpixelGreen, tr, tr_inv);
-    stackTrGray(tgt, SImage_dataBlue(tgt),
-      src, SImage_subpixelBlue,  tr, tr_inv);
+    stackTrGray(&f, SImage_dataRed(tgt),
+      src, SImage_subpixelRed,   sampler);
+    stackTrGray(&f, SImage_dataGreen(tgt),
+      src, SImage_subpixelGreen, sampler);
+    stackTrGray(&f, SImage_dataBlue(tgt),
+      src, SImage_subpixelBlue,  sampler);
     return;
   }
 }
 
+/* ------------------------------------------------------------------------- */
+static int isDistorted(const STransform_t *tr) {
+  return tr->type == STr_Polynomial && tr->poly.order >= 2;
+}
+
+static const float identityMatrix[9] = {
+  1.0f, 0.0f, 0.0f,
+  0.0f, 1.0f, 0.0f,
+  0.0f, 0.0f, 1.0f
+};
+
+/* The affine transformation applied after the distortion */
+static STransform_t affinePart(const STransform_t *tr) {
+  return STransform_matrix(STr_Affine, &tr->mat[0][0]);
+}
+
+/* The distortion alone */
+static STransform_t distortionPart(const STransform_t *tr) {
+  STransform_t dist = STransform_matrix(STr_Polynomial, identityMatrix);
+  dist.poly = tr->poly;
+  return dist;
+}
+
 /* ========================================================================= */
-void SImage_stackTr(
+void SImage_stackTrRemap(
   SImage_t           *tgt,
   const STransform_t *tr,
-  const SImage_t     *src)
+  const SImage_t     *src,
+  SRemap_t           *remap)
 {
   if (tr->type == STr_Drop) return;
 
-  STransform_t tr_inv = STransform_inverse(tr);
-  stackTrMain(tgt, tr, &tr_inv, src);
+  SImage_frame_t f = SImage_setFrameTr(tgt, src, tr);
+  Sampler_t sampler = { .remap = NULL };
+  if (!isDistorted(tr)) {
+    sampler.pre = STransform_inverse(tr);
+    stackTrMain(tgt, f, &sampler, src);
+    return;
+  }
+
+  /* The source is distorted: target pixels are mapped by the inverse of the
+   * affine part, then by the inverse of the distortion */
+  STransform_t affine = affinePart(tr);
+  STransform_t dist   = distortionPart(tr);
+
+  SRemap_t tmp_remap;
+  if (remap == NULL) {
+    SRemap_init(&tmp_remap);
+    remap = &tmp_remap;
+  }
+  SRemap_prepare(remap, &tr->poly, 1,
+    STransform_boundingBox(&dist, SImage_boundingBox(src)));
+
+  sampler.pre   = STransform_inverse(&affine);
+  sampler.remap = remap;
+  sampler.post.type = STr_Identity;
+  stackTrMain(tgt, f, &sampler, src);
+
+  if (remap == &tmp_remap) SRemap_deinit(&tmp_remap);
 }
 
-void SImage_stackTrInv(
+void SImage_stackTrInvRemap(
   SImage_t           *tgt,
   const STransform_t *tr,
-  const SImage_t     *src)
+  const SImage_t     *src,
+  SRemap_t           *remap)
 {
   if (tr->type == STr_Drop) return;
 
-  STransform_t tr_inv = STransform_inverse(tr);
-  stackTrMain(tgt, &tr_inv, tr, src);
+  Sampler_t sampler = { .remap = NULL };
+  if (!isDistorted(tr)) {
+    STransform_t tr_inv = STransform_inverse(tr);
+    sampler.pre = *tr;
+    stackTrMain(tgt, SImage_setFrameTr(tgt, src, &tr_inv), &sampler, src);
+    return;
+  }
+
+  /* Target pixels are distorted, and then mapped by the affine part. The
+   * inverse is only approximated, so the whole target image is used as the
+   * frame. */
+  SRemap_t tmp_remap;
+  if (remap == NULL) {
+    SRemap_init(&tmp_remap);
+    remap = &tmp_remap;
+  }
+  SRemap_prepare(remap, &tr->poly, 0, SImage_boundingBox(tgt));
+
+  sampler.pre.type = STr_Identity;
+  sampler.remap = remap;
+  sampler.post  = affinePart(tr);
+  stackTrMain(tgt, SImage_setFrame(tgt, tgt, 0, 0), &sampler, src);
+
+  if (remap == &tmp_remap) SRemap_deinit(&tmp_remap);
+}
+
+/* ========================================================================= */
+void SImage_stackTr(
+  SImage_t           *tgt,
+  const STransform_t *tr,
+  const SImage_t     *src)
+{
+  SImage_stackTrRemap(tgt, tr, src, NULL);
+}
+
+void SImage_stackTrInv(
+  SImage_t           *tgt,
+  const STransform_t *tr,
+  const SImage_t     *src)
+{
+  SImage_stackTrInvRemap(tgt, tr, src, NULL);
 }
@@ -5,12 +5,17 @@
 /* Author: Piotr Polesiuk, 2022 */
 
 #include "SImage.h"
+#include "SImage_binner.h"
 
 #include <assert.h>
 #include <stdlib.h>
 #include <string.h>
 
-static void convert_RGB_to_Gray(
+/* Conversion of RGB and SeparateRGB images to gray-scale is shared with
+ * decoders that produce gray-scale images directly (see SImage_binner.h),
+ * so both give identical results */
+
+static void convert_RGB_to_channel(
   unsigned size, SVec2f_t *dst, const SVec4f_t *src, SVec4f_t weight)
 {
   for (unsigned i = 0; i < size; i++) {
@@ -20,16 +25,6 @@ static void convert_RGB_to_Gray(
   }
 }
 
-static void convert_SeparateRGB_to_Gray(
-  unsigned size,
-  SVec2f_t *dst,
-  const SVec2f_t *red, const SVec2f_t *green, const SVec2f_t *blue)
-{
-  for (unsigned i = 0; i < size; i++) {
-    dst[i] = (red[i] + green[i] + blue[i]) / 3.0f;
-  }
-}
-
 static void convert_Gray_to_RGB(
   unsigned size, SVec4f_t *dst, const SVec2f_t *src)
 {
@@ -67,19 +62,18 @@ static void convertToGray(SImage_t *dst, const SImage_t *src) {
     memcpy(dst->data, src->data, SImage_dataSize(src));
     break;
   case SFmt_RGB:
-    convert_RGB_to_Gray(
-      src->width * src->height,
+    SImage_grayRowRGB(
       dst->data_gray,
       src->data_rgb,
-      SVec4f(1.0f/3.0f, 1.0f/3.0f, 1.0f/3.0f, 1.0f));
+      src->width * src->height);
     break;
   case SFmt_SeparateRGB:
-    convert_SeparateRGB_to_Gray(
-      src->width * src->height,
+    SImage_grayRowSeparateRGB(
       dst->data_gray,
       SImage_dataRed(src),
       SImage_dataGreen(src),
-      SImage_dataBlue(src));
+      SImage_dataBlue(src),
+      src->width * src->height);
     break;
   }
 }
@@ -120,17 +114,17 @@ static void convertToSeparateRGB(SImage_t *dst, const SImage_t *src) {
     memcpy(SImage_dataBlue(dst),  src->data, SImage_dataSize(src));
     break;
   case SFmt_RGB:
-    convert_RGB_to_Gray(
+    convert_RGB_to_channel(
       src->width * src->height,
       SImage_dataRed(dst),
       src->data_rgb,
       SVec4f(1.0f, 0.0f, 0.0f, 1.0f));
-    convert_RGB_to_Gray(
+    convert_RGB_to_channel(
       src->width * src->height,
       SImage_dataGreen(dst),
       src->data_rgb,
       SVec4f(0.0f, 1.0f, 0.0f, 1.0f));
-    convert_RGB_to_Gray(
+    convert_RGB_to_channel(
       src->width * src->height,
       SImage_dataBlue(dst),
       src->data_rgb,
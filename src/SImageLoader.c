@@ -0,0 +1,331 @@
+/* This file is part of Spica, released under MIT license.
+ * See LICENSE for details.
+ */
+
+/* Author: Piotr Polesiuk, 2022 */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "SImageLoader.h"
+#include "SParallel.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define PNG_SIGNATURE  "\x89PNG"
+#define SIWW_SIGNATURE "SPICAIWW"
+#define FITS_SIGNATURE "SIMPLE  "
+
+typedef enum SlotState {
+  /** Available for decoding */
+  Slot_Free,
+  /** Decoded by a worker thread */
+  Slot_Decoding,
+  /** Decoded, waiting for the caller */
+  Slot_Ready,
+  /** Returned to the caller */
+  Slot_Held
+} SlotState_t;
+
+typedef struct Slot {
+  /** Decoded image. Its buffer is reused by the next frames */
+  SImage_t       image;
+  /** Binned gray-scale image, when the loader bins frames */
+  SImage_t       binned;
+  /** Format of the file */
+  SImageFormat_t format;
+  size_t         index;
+  SlotState_t    state;
+} Slot_t;
+
+struct SImageLoaderState {
+  pthread_mutex_t    mutex;
+  /** Signaled on every change of the state of slots */
+  pthread_cond_t     cond;
+  const char *const *fnames;
+  size_t             n;
+  /** The next frame to be decoded */
+  size_t             nextDecode;
+  /** The next frame to be returned to the caller */
+  size_t             nextReturn;
+  int                stop;
+  int                gray;
+  unsigned           binning;
+  int                slotN;
+  Slot_t            *slots;
+  int                threadN;
+  pthread_t         *threads;
+};
+
+void SImageLoader_init(SImageLoader_t *loader) {
+  loader->threadN     = 0;
+  loader->queueLength = 4;
+  loader->gray        = 0;
+  loader->binning     = 0;
+  loader->state       = NULL;
+}
+
+/* ========================================================================= */
+typedef enum FileType {
+  File_Unknown,
+  File_PNG,
+  File_SIWW,
+  File_FITS
+} FileType_t;
+
+/* Recognize the type of the file by its signature */
+static FileType_t fileType(const char *fname) {
+  char sig[8];
+  FILE *file = fopen(fname, "rb");
+  size_t len = file ? fread(sig, 1, sizeof(sig), file) : 0;
+  if (file) fclose(file);
+
+  if (len >= 4 && memcmp(sig, PNG_SIGNATURE, 4) == 0) return File_PNG;
+  if (len == 8 && memcmp(sig, SIWW_SIGNATURE, 8) == 0) return File_SIWW;
+  if (len == 8 && memcmp(sig, FITS_SIGNATURE, 8) == 0) return File_FITS;
+  return File_Unknown;
+}
+
+/* Load PNG, SIWW, or FITS image. The image is loaded into the buffer of the
+ * previous frame, when it has the same size */
+static void loadImage(SImage_t *image, FileType_t type, const char *fname) {
+  switch (type) {
+  case File_PNG:
+    SImage_loadPNG_into(image, fname);
+    return;
+  case File_SIWW:
+    SImage_loadSIWW_into(image, fname);
+    return;
+  case File_FITS:
+    SImage_loadFITS_into(image, fname);
+    return;
+  case File_Unknown:
+    break;
+  }
+  SImage_deinit(image);
+  SImage_init(image, 0, 0, SFmt_Invalid);
+}
+
+/* Load the image as a gray-scale image, and bin it. PNG and SIWW files are
+ * converted while decoding. Other files are converted afterwards */
+static void loadGray(
+  SImage_t *image, SImage_t *binned, unsigned binning,
+  SImageFormat_t *format, FileType_t type, const char *fname)
+{
+  switch (type) {
+  case File_PNG:
+    SImage_loadPNGGray_into(image, binned, binning, format, fname);
+    return;
+  case File_SIWW:
+    SImage_loadSIWWGray_into(image, binned, binning, format, fname);
+    return;
+  case File_FITS:
+  case File_Unknown:
+    break;
+  }
+
+  loadImage(image, type, fname);
+  *format = image->format;
+  if (image->format != SFmt_Invalid && image->format != SFmt_Gray) {
+    SImage_t gray;
+    SImage_toFormat_at(&gray, image, SFmt_Gray);
+    SImage_deinit(image);
+    *image = gray;
+  }
+  if (binning > 0) {
+    SImage_deinit(binned);
+    if (image->format == SFmt_Invalid) SImage_init(binned, 0, 0, SFmt_Invalid);
+    else SImage_scaleDown_at(binned, image, binning);
+  }
+}
+
+static void loadSlot(const SImageLoaderState_t *st, Slot_t *slot) {
+  const char *fname = st->fnames[slot->index];
+  FileType_t  type  = fileType(fname);
+  if (st->gray) {
+    loadGray(&slot->image, &slot->binned, st->binning, &slot->format,
+      type, fname);
+  } else {
+    loadImage(&slot->image, type, fname);
+    slot->format = slot->image.format;
+  }
+}
+
+static Slot_t *freeSlot(SImageLoaderState_t *st) {
+  for (int i = 0; i < st->slotN; i++) {
+    if (st->slots[i].state == Slot_Free) return &st->slots[i];
+  }
+  return NULL;
+}
+
+/* Frames are assigned to workers in order, so the frame awaited by the
+ * caller is always being decoded, or ready. */
+static void *worker(void *arg) {
+  SImageLoaderState_t *st = arg;
+
+  pthread_mutex_lock(&st->mutex);
+  while (!st->stop && st->nextDecode < st->n) {
+    Slot_t *slot = freeSlot(st);
+    if (slot == NULL) {
+      pthread_cond_wait(&st->cond, &st->mutex);
+      continue;
+    }
+
+    slot->state = Slot_Decoding;
+    slot->index = st->nextDecode++;
+    pthread_mutex_unlock(&st->mutex);
+
+    loadSlot(st, slot);
+
+    pthread_mutex_lock(&st->mutex);
+    slot->state = Slot_Ready;
+    pthread_cond_broadcast(&st->cond);
+  }
+  pthread_mutex_unlock(&st->mutex);
+  return NULL;
+}
+
+/* ========================================================================= */
+static void stopLoader(SImageLoader_t *loader) {
+  SImageLoaderState_t *st = loader->state;
+  if (st == NULL) return;
+
+  pthread_mutex_lock(&st->mutex);
+  st->stop = 1;
+  pthread_cond_broadcast(&st->cond);
+  pthread_mutex_unlock(&st->mutex);
+
+  for (int i = 0; i < st->threadN; i++) pthread_join(st->threads[i], NULL);
+
+  for (int i = 0; i < st->slotN; i++) {
+    SImage_deinit(&st->slots[i].image);
+    SImage_deinit(&st->slots[i].binned);
+  }
+  pthread_cond_destroy(&st->cond);
+  pthread_mutex_destroy(&st->mutex);
+  free(st->threads);
+  free(st->slots);
+  free(st);
+  loader->state = NULL;
+}
+
+void SImageLoader_deinit(SImageLoader_t *loader) {
+  stopLoader(loader);
+}
+
+int SImageLoader_start(
+  SImageLoader_t    *loader,
+  const char *const *fnames,
+  size_t             n)
+{
+  stopLoader(loader);
+
+  SImageLoaderState_t *st = malloc(sizeof(SImageLoaderState_t));
+  if (st == NULL) return SPICA_ERROR;
+
+  st->fnames     = fnames;
+  st->n          = n;
+  st->nextDecode = 0;
+  st->nextReturn = 0;
+  st->stop       = 0;
+  st->gray       = loader->gray;
+  st->binning    = loader->gray ? loader->binning : 0;
+  st->slotN      = loader->queueLength > 0 ? loader->queueLength : 1;
+  st->threadN    = SParallel_threadN(loader->threadN);
+  if ((size_t)st->threadN > n) st->threadN = n;
+  st->slots   = malloc(sizeof(Slot_t) * st->slotN);
+  st->threads = malloc(sizeof(pthread_t) * (st->threadN + 1));
+  if (st->slots == NULL || st->threads == NULL) {
+    free(st->slots);
+    free(st->threads);
+    free(st);
+    return SPICA_ERROR;
+  }
+  for (int i = 0; i < st->slotN; i++) {
+    st->slots[i].state = Slot_Free;
+    SImage_init(&st->slots[i].image, 0, 0, SFmt_Invalid);
+    SImage_init(&st->slots[i].binned, 0, 0, SFmt_Invalid);
+  }
+
+  pthread_mutex_init(&st->mutex, NULL);
+  pthread_cond_init(&st->cond, NULL);
+  loader->state = st;
+
+  int started = 0;
+  for (int i = 0; i < st->threadN; i++) {
+    if (pthread_create(&st->threads[started], NULL, worker, st) == 0)
+      started++;
+  }
+  st->threadN = started;
+  if (started == 0 && n > 0) {
+    stopLoader(loader);
+    return SPICA_ERROR;
+  }
+  return SPICA_OK;
+}
+
+/* ========================================================================= */
+SImage_t *SImageLoader_next(SImageLoader_t *loader, size_t *index) {
+  SImageLoaderState_t *st = loader->state;
+  if (st == NULL) return NULL;
+
+  pthread_mutex_lock(&st->mutex);
+  Slot_t *result = NULL;
+  while (st->nextReturn < st->n) {
+    int held_n = 0;
+    for (int i = 0; i < st->slotN; i++) {
+      Slot_t *slot = &st->slots[i];
+      held_n += slot->state == Slot_Held;
+      if (slot->state == Slot_Ready && slot->index == st->nextReturn) {
+        result = slot;
+        break;
+      }
+    }
+    /* Only the caller can free a slot for the next frame, so waiting would
+     * never end */
+    if (result != NULL || held_n == st->slotN) break;
+    pthread_cond_wait(&st->cond, &st->mutex);
+  }
+  if (result != NULL) {
+    result->state = Slot_Held;
+    st->nextReturn++;
+  }
+  pthread_mutex_unlock(&st->mutex);
+
+  if (result == NULL) return NULL;
+  if (index != NULL) *index = result->index;
+  return &result->image;
+}
+
+void SImageLoader_release(SImageLoader_t *loader, SImage_t *image) {
+  SImageLoaderState_t *st = loader->state;
+  if (st == NULL || image == NULL) return;
+
+  /* The image is the first field of its slot. Its buffer is kept for the
+   * next frame decoded in this slot */
+  Slot_t *slot = (Slot_t *)image;
+
+  pthread_mutex_lock(&st->mutex);
+  slot->state = Slot_Free;
+  pthread_cond_broadcast(&st->cond);
+  pthread_mutex_unlock(&st->mutex);
+}
+
+/* ------------------------------------------------------------------------- */
+const SImage_t *SImageLoader_binned(
+  const SImageLoader_t *loader,
+  const SImage_t       *image)
+{
+  if (loader->state == NULL || loader->state->binning == 0) return NULL;
+  return &((const Slot_t *)image)->binned;
+}
+
+SImageFormat_t SImageLoader_fileFormat(
+  const SImageLoader_t *loader,
+  const SImage_t       *image)
+{
+  if (loader->state == NULL) return SFmt_Invalid;
+  return ((const Slot_t *)image)->format;
+}
@@ -0,0 +1,58 @@
+/* This file is part of Spica, released under MIT license.
+ * See LICENSE for details.
+ */
+
+/* Author: Piotr Polesiuk, 2022 */
+
+#include "SLinAlg.h"
+
+#include <math.h>
+
+int SLinAlg_solve(int n, double *a, double *b) {
+  /* The scale of the matrix, used to detect singular matrices */
+  double scale = 0.0;
+  for (int i = 0; i < n * n; i++) {
+    if (fabs(a[i]) > scale) scale = fabs(a[i]);
+  }
+  if (scale == 0.0) return 0;
+
+  for (int k = 0; k < n; k++) {
+    /* Find pivot */
+    int p = k;
+    for (int i = k + 1; i < n; i++) {
+      if (fabs(a[i*n + k]) > fabs(a[p*n + k])) p = i;
+    }
+    if (fabs(a[p*n + k]) <= scale * 1e-12) return 0;
+
+    /* Swap rows */
+    if (p != k) {
+      for (int j = k; j < n; j++) {
+        double t = a[k*n + j];
+        a[k*n + j] = a[p*n + j];
+        a[p*n + j] = t;
+      }
+      double t = b[k];
+      b[k] = b[p];
+      b[p] = t;
+    }
+
+    /* Eliminate */
+    for (int i = k + 1; i < n; i++) {
+      double f = a[i*n + k] / a[k*n + k];
+      for (int j = k; j < n; j++) {
+        a[i*n + j] -= f * a[k*n + j];
+      }
+      b[i] -= f * b[k];
+    }
+  }
+
+  /* Back substitution */
+  for (int k = n - 1; k >= 0; k--) {
+    double v = b[k];
+    for (int j = k + 1; j < n; j++) {
+      v -= a[k*n + j] * b[j];
+    }
+    b[k] = v / a[k*n + k];
+  }
+  return 1;
+}
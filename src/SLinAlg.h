@@ -0,0 +1,18 @@
+/* This file is part of Spica, released under MIT license.
+ * See LICENSE for details.
+ */
+
+/* Small dense linear systems, used by fitting procedures */
+
+/* Author: Piotr Polesiuk, 2022 */
+
+#ifndef __SPICA_LIN_ALG_H__
+#define __SPICA_LIN_ALG_H__
+
+/** Solve linear system a·x = b of size n, using Gaussian elimination with
+ * partial pivoting. Matrix a is stored in row-major order, and it is
+ * destroyed by this function. The solution is stored in b. Returns 0 when
+ * the matrix is singular (or very close to singular), and 1 otherwise. */
+int SLinAlg_solve(int n, double *a, double *b);
+
+#endif /* __SPICA_LIN_ALG_H__ */
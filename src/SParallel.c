@@ -0,0 +1,100 @@
+/* This file is part of Spica, released under MIT license.
+ * See LICENSE for details.
+ */
+
+/* Author: Piotr Polesiuk, 2022 */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "SParallel.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+/* ========================================================================= */
+int SParallel_threadN(int thread_n) {
+  if (thread_n > 0) return thread_n;
+
+  long n = sysconf(_SC_NPROCESSORS_ONLN);
+  return n > 0 ? (int)n : 1;
+}
+
+/* ========================================================================= */
+typedef struct Task {
+  void (*body)(void *arg, int id);
+  void *arg;
+  int   id;
+} Task_t;
+
+static void *runTask(void *p) {
+  Task_t *task = p;
+  task->body(task->arg, task->id);
+  return NULL;
+}
+
+void SParallel_run(int thread_n, void (*body)(void *arg, int id), void *arg) {
+  if (thread_n <= 1) {
+    body(arg, 0);
+    return;
+  }
+
+  pthread_t *threads = malloc(sizeof(pthread_t) * thread_n);
+  Task_t    *tasks   = malloc(sizeof(Task_t) * thread_n);
+  char      *started = malloc(thread_n);
+
+  for (int i = 1; i < thread_n; i++) {
+    tasks[i].body = body;
+    tasks[i].arg  = arg;
+    tasks[i].id   = i;
+    started[i] = pthread_create(&threads[i], NULL, runTask, &tasks[i]) == 0;
+  }
+
+  body(arg, 0);
+
+  for (int i = 1; i < thread_n; i++) {
+    if (started[i]) pthread_join(threads[i], NULL);
+    else body(arg, i);
+  }
+
+  free(threads);
+  free(tasks);
+  free(started);
+}
+
+/* ========================================================================= */
+typedef struct Loop {
+  void          (*body)(void *arg, size_t i);
+  void           *arg;
+  size_t          n;
+  size_t          next;
+  pthread_mutex_t lock;
+} Loop_t;
+
+static void runLoop(void *p, int id) {
+  (void)id;
+  Loop_t *loop = p;
+  while (1) {
+    pthread_mutex_lock(&loop->lock);
+    size_t i = loop->next;
+    if (i < loop->n) loop->next++;
+    pthread_mutex_unlock(&loop->lock);
+
+    if (i >= loop->n) return;
+    loop->body(loop->arg, i);
+  }
+}
+
+void SParallel_for(
+  int thread_n, size_t n, void (*body)(void *arg, size_t i), void *arg)
+{
+  if (thread_n <= 1 || n <= 1) {
+    for (size_t i = 0; i < n; i++) body(arg, i);
+    return;
+  }
+
+  Loop_t loop = { .body = body, .arg = arg, .n = n, .next = 0 };
+  pthread_mutex_init(&loop.lock, NULL);
+  SParallel_run((size_t)thread_n < n ? thread_n : (int)n, runLoop, &loop);
+  pthread_mutex_destroy(&loop.lock);
+}
@@ -0,0 +1,32 @@
+/* This file is part of Spica, released under MIT license.
+ * See LICENSE for details.
+ */
+
+/* Simple fork-join parallelism on top of POSIX threads */
+
+/* Author: Piotr Polesiuk, 2022 */
+
+#ifndef __SPICA_PARALLEL_H__
+#define __SPICA_PARALLEL_H__
+
+#include <stddef.h>
+
+/** Number of threads that should be used, when the user requested
+ * \p thread_n threads. Non-positive values mean one thread per online
+ * processor. The result is always at least 1. */
+int SParallel_threadN(int thread_n);
+
+/** Run \p body(arg, id) for id = 0, ..., thread_n - 1 in parallel, and wait
+ * for all of them. The call with id = 0 is run on the calling thread. When
+ * a thread cannot be created, its share of work is run on the calling
+ * thread after the others, so the body should not wait for other
+ * threads. */
+void SParallel_run(int thread_n, void (*body)(void *arg, int id), void *arg);
+
+/** Run \p body(arg, i) for i = 0, ..., n - 1 on \p thread_n threads. Items
+ * are distributed dynamically, one by one, so they may take different
+ * time. */
+void SParallel_for(
+  int thread_n, size_t n, void (*body)(void *arg, size_t i), void *arg);
+
+#endif /* __SPICA_PARALLEL_H__ */
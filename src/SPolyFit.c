@@ -0,0 +1,122 @@
+/* This file is part of Spica, released under MIT license.
+ * See LICENSE for details.
+ */
+
+/* Author: Piotr Polesiuk, 2022 */
+
+#include "SPolyFit.h"
+#include "SLinAlg.h"
+
+#include <math.h>
+#include <string.h>
+
+#define MONOMIAL_MAX_N \
+  ((STRANSFORM_POLY_MAX_ORDER + 1) * (STRANSFORM_POLY_MAX_ORDER + 2) / 2)
+
+int SPolyFit_monomialN(int order) {
+  return (order + 1) * (order + 2) / 2;
+}
+
+void SPolyFit_monomials(int order, double u, double v, double *result) {
+  double pu[STRANSFORM_POLY_MAX_ORDER + 1];
+  double pv[STRANSFORM_POLY_MAX_ORDER + 1];
+  pu[0] = pv[0] = 1.0;
+  for (int k = 1; k <= order; k++) {
+    pu[k] = pu[k-1] * u;
+    pv[k] = pv[k-1] * v;
+  }
+
+  int k = 0;
+  for (int d = 0; d <= order; d++) {
+    for (int j = 0; j <= d; j++) result[k++] = pu[d-j] * pv[j];
+  }
+}
+
+/* ========================================================================= */
+static STransform_t dropTransform(void) {
+  STransform_t tr = {
+    .type  = STr_Drop,
+    .rot   = { 1.0f, 0.0f },
+    .shift = { 0.0f, 0.0f }
+  };
+  return tr;
+}
+
+STransform_t SPolyFit_fitIn(
+  int order, SVec2f_t center, float scale,
+  const SVec2f_t *x, const SVec2f_t *y, size_t n)
+{
+  if (order < 2) order = 2;
+  if (order > STRANSFORM_POLY_MAX_ORDER) order = STRANSFORM_POLY_MAX_ORDER;
+
+  int m = SPolyFit_monomialN(order);
+  if (n < (size_t)m) return dropTransform();
+
+  /* Normal equations of both coordinates share the matrix */
+  double a[MONOMIAL_MAX_N * MONOMIAL_MAX_N] = { 0.0 };
+  double b[2][MONOMIAL_MAX_N] = { { 0.0 } };
+  for (size_t i = 0; i < n; i++) {
+    double phi[MONOMIAL_MAX_N];
+    SPolyFit_monomials(order,
+      (x[i][0] - center[0]) * scale, (x[i][1] - center[1]) * scale, phi);
+    for (int j = 0; j < m; j++) {
+      for (int k = 0; k < m; k++) a[m*j + k] += phi[j] * phi[k];
+      b[0][j] += phi[j] * y[i][0];
+      b[1][j] += phi[j] * y[i][1];
+    }
+  }
+
+  for (int r = 0; r < 2; r++) {
+    double ac[MONOMIAL_MAX_N * MONOMIAL_MAX_N];
+    memcpy(ac, a, sizeof(double) * m * m);
+    if (!SLinAlg_solve(m, ac, b[r])) return dropTransform();
+  }
+
+  /* The polynomial q is split into the affine transformation A·p + t made
+   * of terms of degree at most one, and the distortion: q = A·(p + dist),
+   * so coefficients of the distortion are A⁻¹ times coefficients of q. */
+  double a00 = b[0][1] * scale, a01 = b[0][2] * scale;
+  double a10 = b[1][1] * scale, a11 = b[1][2] * scale;
+  double det = a00 * a11 - a01 * a10;
+  if (det == 0.0) return dropTransform();
+
+  float mat[3][3] = {
+    { a00, a01, b[0][0] - a00 * center[0] - a01 * center[1] },
+    { a10, a11, b[1][0] - a10 * center[0] - a11 * center[1] },
+    { 0.0f, 0.0f, 1.0f }
+  };
+  STransform_t tr = STransform_matrix(STr_Polynomial, &mat[0][0]);
+  tr.poly.order  = order;
+  tr.poly.center = center;
+  tr.poly.scale  = scale;
+  for (int k = 3; k < m; k++) {
+    tr.poly.coef[k - 3] = SVec2f(
+      ( a11 * b[0][k] - a01 * b[1][k]) / det,
+      (-a10 * b[0][k] + a00 * b[1][k]) / det);
+  }
+  return tr;
+}
+
+STransform_t SPolyFit_fit(
+  int order, const SVec2f_t *x, const SVec2f_t *y, size_t n)
+{
+  if (n == 0) return dropTransform();
+
+  double cx = 0.0, cy = 0.0;
+  for (size_t i = 0; i < n; i++) {
+    cx += x[i][0];
+    cy += x[i][1];
+  }
+  cx /= n;
+  cy /= n;
+
+  double d2 = 0.0;
+  for (size_t i = 0; i < n; i++) {
+    double dx = x[i][0] - cx;
+    double dy = x[i][1] - cy;
+    d2 += dx * dx + dy * dy;
+  }
+  if (d2 == 0.0) return dropTransform();
+
+  return SPolyFit_fitIn(order, SVec2f(cx, cy), 1.0 / sqrt(d2 / n), x, y, n);
+}
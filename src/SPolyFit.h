@@ -0,0 +1,34 @@
+/* This file is part of Spica, released under MIT license.
+ * See LICENSE for details.
+ */
+
+/* Fitting of STr_Polynomial transformation to pairs of corresponding points */
+
+/* Author: Piotr Polesiuk, 2022 */
+
+#ifndef __SPICA_POLY_FIT_H__
+#define __SPICA_POLY_FIT_H__
+
+#include "STransform.h"
+
+/** Number of all monomials of degree at most order */
+int SPolyFit_monomialN(int order);
+
+/** Values of all monomials u^(d-j)·v^j of degree d at most order, sorted by
+ * d, then by j. */
+void SPolyFit_monomials(int order, double u, double v, double *result);
+
+/** Fit polynomial transformation of given order that maps points x to
+ * points y. The distortion is centered at the mean of x, and its unit of
+ * length is the RMS distance of x from the mean. Returns STr_Drop, when
+ * there are too few points, or they are in a degenerate configuration. */
+STransform_t SPolyFit_fit(
+  int order, const SVec2f_t *x, const SVec2f_t *y, size_t n);
+
+/** The same as SPolyFit_fit, but the center and the scale of the distortion
+ * are given. */
+STransform_t SPolyFit_fitIn(
+  int order, SVec2f_t center, float scale,
+  const SVec2f_t *x, const SVec2f_t *y, size_t n);
+
+#endif /* __SPICA_POLY_FIT_H__ */
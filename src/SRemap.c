@@ -0,0 +1,107 @@
+/* This file is part of Spica, released under MIT license.
+ * See LICENSE for details.
+ */
+
+/* Author: Piotr Polesiuk, 2022 */
+
+#include "SRemap.h"
+
+#include <math.h>
+#include <stdlib.h>
+
+void SRemap_init(SRemap_t *remap) {
+  remap->step       = 32;
+  remap->inverse    = 0;
+  remap->poly.order = 0;
+  remap->area       = SBoundingBox_empty();
+  remap->gridStep   = 0;
+  remap->gridWidth  = 0;
+  remap->gridHeight = 0;
+  remap->grid       = NULL;
+}
+
+void SRemap_deinit(SRemap_t *remap) {
+  free(remap->grid);
+}
+
+/* ========================================================================= */
+static int covers(SBoundingBox_t bb, SBoundingBox_t area) {
+  return
+    bb.minX <= area.minX && area.maxX <= bb.maxX &&
+    bb.minY <= area.minY && area.maxY <= bb.maxY;
+}
+
+int SRemap_prepare(
+  SRemap_t               *remap,
+  const STransformPoly_t *poly,
+  int                     inverse,
+  SBoundingBox_t          area)
+{
+  if (remap->grid != NULL &&
+      remap->gridStep == remap->step &&
+      !remap->inverse == !inverse &&
+      STransformPoly_equal(&remap->poly, poly) &&
+      (SBoundingBox_isEmpty(area) || covers(remap->area, area)))
+    return 0;
+
+  free(remap->grid);
+  unsigned step = remap->step > 0 ? remap->step : 1;
+  if (SBoundingBox_isEmpty(area)) {
+    area.minX = area.maxX = 0.0f;
+    area.minY = area.maxY = 0.0f;
+  }
+
+  remap->inverse    = inverse;
+  remap->poly       = *poly;
+  remap->gridStep   = remap->step;
+  remap->gridWidth  = (unsigned)ceilf((area.maxX - area.minX) / step) + 2;
+  remap->gridHeight = (unsigned)ceilf((area.maxY - area.minY) / step) + 2;
+  remap->area.minX  = area.minX;
+  remap->area.minY  = area.minY;
+  remap->area.maxX  = area.minX + (float)(remap->gridWidth  - 1) * step;
+  remap->area.maxY  = area.minY + (float)(remap->gridHeight - 1) * step;
+  remap->grid = malloc(
+    sizeof(SVec2f_t) * remap->gridWidth * remap->gridHeight);
+
+  for (unsigned i = 0; i < remap->gridHeight; i++) {
+    for (unsigned j = 0; j < remap->gridWidth; j++) {
+      SVec2f_t pos = SVec2f(area.minX + (float)j * step,
+                            area.minY + (float)i * step);
+      remap->grid[i * remap->gridWidth + j] = inverse ?
+        STransformPoly_applyInverse(poly, pos) :
+        STransformPoly_apply(poly, pos);
+    }
+  }
+  return 1;
+}
+
+/* ========================================================================= */
+/* Cell index and the position inside the cell, for coordinate x on the
+ * grid with n nodes. Positions outside the grid are extrapolated. */
+static int cellOf(float x, unsigned n, float *frac) {
+  float fl = floorf(x);
+  int   i  = fl < 0.0f ? 0 : fl > n - 2 ? (int)n - 2 : (int)fl;
+  *frac = x - i;
+  return i;
+}
+
+void SRemap_apply(
+  const SRemap_t *remap,
+  const SVec2f_t *src,
+  SVec2f_t       *dst,
+  size_t          n)
+{
+  float    inv_step = 1.0f / remap->gridStep;
+  unsigned w        = remap->gridWidth;
+  for (size_t k = 0; k < n; k++) {
+    float fx, fy;
+    int ix = cellOf((src[k][0] - remap->area.minX) * inv_step, w, &fx);
+    int iy = cellOf(
+      (src[k][1] - remap->area.minY) * inv_step, remap->gridHeight, &fy);
+
+    const SVec2f_t *node = &remap->grid[iy * w + ix];
+    dst[k] = SVec2f_lerp(fy,
+      SVec2f_lerp(fx, node[0], node[1]),
+      SVec2f_lerp(fx, node[w], node[w + 1]));
+  }
+}
@@ -0,0 +1,87 @@
+/* This file is part of Spica, released under MIT license.
+ * See LICENSE for details.
+ */
+
+/* Author: Piotr Polesiuk, 2022 */
+
+#include "SStar.h"
+
+#include "SDataRepr.h"
+
+#include <stdint.h>
+
+/* Stored star: 8 floats (position, brightness, bias, sigma, sigmaX, sigmaY,
+ * and theta), followed by 3 integers (index, id, and weight). All values
+ * are 32-bit little-endian. */
+#define FLOAT_N     8
+#define INT_N       3
+#define RECORD_SIZE (4 * (FLOAT_N + INT_N))
+
+/* The set is preceded by the number of stars and the size of a record, so
+ * records can be extended in the future */
+typedef struct SetHeader {
+  uint32_t length;
+  uint32_t record_size;
+} SetHeader_t;
+
+int SStarSet_write(const SStarSet_t *sset, FILE *file) {
+  if (sset->length > UINT32_MAX) return SPICA_ERROR;
+
+  SetHeader_t header = {
+    .length      = SLittleEndian32(sset->length),
+    .record_size = SLittleEndian32(RECORD_SIZE)
+  };
+  if (fwrite(&header, sizeof(header), 1, file) != 1) return SPICA_ERROR;
+
+  for (size_t i = 0; i < sset->length; i++) {
+    const SStar_t *star = &sset->data[i];
+    uint32_t record[FLOAT_N + INT_N] = {
+      SLittleEndianFromFloat(star->pos[0]),
+      SLittleEndianFromFloat(star->pos[1]),
+      SLittleEndianFromFloat(star->brightness),
+      SLittleEndianFromFloat(star->bias),
+      SLittleEndianFromFloat(star->sigma),
+      SLittleEndianFromFloat(star->sigmaX),
+      SLittleEndianFromFloat(star->sigmaY),
+      SLittleEndianFromFloat(star->theta),
+      SLittleEndian32((uint32_t)star->index),
+      SLittleEndian32((uint32_t)star->id),
+      SLittleEndian32((uint32_t)star->weight)
+    };
+    if (fwrite(record, RECORD_SIZE, 1, file) != 1) return SPICA_ERROR;
+  }
+  return SPICA_OK;
+}
+
+int SStarSet_read(SStarSet_t *sset, FILE *file) {
+  SetHeader_t header;
+  if (fread(&header, sizeof(header), 1, file) != 1) return SPICA_ERROR;
+  uint32_t length      = SLittleEndian32(header.length);
+  uint32_t record_size = SLittleEndian32(header.record_size);
+  if (record_size < RECORD_SIZE) return SPICA_ERROR;
+
+  for (uint32_t i = 0; i < length; i++) {
+    uint32_t record[FLOAT_N + INT_N];
+    if (fread(record, RECORD_SIZE, 1, file) != 1) return SPICA_ERROR;
+    /* Skip fields of future versions */
+    if (record_size > RECORD_SIZE &&
+        fseek(file, record_size - RECORD_SIZE, SEEK_CUR) != 0)
+      return SPICA_ERROR;
+
+    SStar_t star = {
+      .pos        = { SLittleEndianToFloat(record[0]),
+                      SLittleEndianToFloat(record[1]) },
+      .brightness = SLittleEndianToFloat(record[2]),
+      .bias       = SLittleEndianToFloat(record[3]),
+      .sigma      = SLittleEndianToFloat(record[4]),
+      .sigmaX     = SLittleEndianToFloat(record[5]),
+      .sigmaY     = SLittleEndianToFloat(record[6]),
+      .theta      = SLittleEndianToFloat(record[7]),
+      .index      = (int32_t)SLittleEndian32(record[8]),
+      .id         = (int32_t)SLittleEndian32(record[9]),
+      .weight     = (int32_t)SLittleEndian32(record[10])
+    };
+    SStarSet_add(sset, &star);
+  }
+  return SPICA_OK;
+}
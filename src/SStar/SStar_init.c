@@ -11,6 +11,10 @@ void SStar_init(SStar_t *star) {
   star->brightness = 1.0f;
   star->bias       = 0.0f;
   star->sigma      = 3.0f;
+  star->sigmaX     = 3.0f;
+  star->sigmaY     = 3.0f;
+  star->theta      = 0.0f;
   star->index      = -1;
+  star->id         = -1;
   star->weight     = 1;
 }
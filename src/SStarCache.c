@@ -0,0 +1,239 @@
+/* This file is part of Spica, released under MIT license.
+ * See LICENSE for details.
+ */
+
+/* Author: Piotr Polesiuk, 2022 */
+
+#define _XOPEN_SOURCE 700
+
+#include "SStarCache.h"
+
+#include "SDataRepr.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define CACHE_MAGIC "SPICASTC"
+/* Should be increased when the format of entries, or the star finding
+ * algorithm changes */
+#define CACHE_VERSION 1
+
+#define FNV_OFFSET 0xcbf29ce484222325ULL
+#define FNV_PRIME  0x100000001b3ULL
+
+typedef struct EntryHeader {
+  char     magic[8];
+  uint32_t version;
+  uint32_t path_length;
+  uint64_t key;
+  /* Modification time and size of the image file */
+  int64_t  mtime_sec;
+  int64_t  mtime_nsec;
+  uint64_t size;
+  uint32_t format;
+  uint32_t width;
+  uint32_t height;
+  uint32_t reserved;
+} EntryHeader_t;
+
+/* ========================================================================= */
+/* FNV-1a hash */
+static uint64_t hashBytes(uint64_t hash, const void *data, size_t size) {
+  const unsigned char *bytes = data;
+  for (size_t i = 0; i < size; i++) {
+    hash ^= bytes[i];
+    hash *= FNV_PRIME;
+  }
+  return hash;
+}
+
+/* Values are hashed in little-endian, so keys do not depend on the
+ * machine */
+static uint64_t hashInt(uint64_t hash, int32_t x) {
+  uint32_t v = SLittleEndian32((uint32_t)x);
+  return hashBytes(hash, &v, sizeof(v));
+}
+
+static uint64_t hashFloat(uint64_t hash, float x) {
+  uint32_t v;
+  memcpy(&v, &x, sizeof(v));
+  v = SLittleEndian32(v);
+  return hashBytes(hash, &v, sizeof(v));
+}
+
+void SStarCache_init(
+  SStarCache_t        *cache,
+  const char          *directory,
+  const SStarFinder_t *finder)
+{
+  uint64_t h = hashInt(FNV_OFFSET, CACHE_VERSION);
+  h = hashFloat(h, finder->sigma);
+  h = hashFloat(h, finder->brightnessThreshold);
+  h = hashFloat(h, finder->candidateThreshold);
+  h = hashInt  (h, finder->candidateRadius);
+  h = hashInt  (h, finder->maxStars);
+  h = hashFloat(h, finder->minDist);
+  h = hashInt  (h, finder->fitSteps);
+  h = hashFloat(h, finder->fitTolerance);
+  h = hashInt  (h, finder->fitMethod);
+  h = hashInt  (h, finder->backgroundBox);
+  h = hashFloat(h, finder->noiseThreshold);
+
+  cache->directory = directory;
+  cache->key       = h;
+}
+
+void SStarCache_addKey(SStarCache_t *cache, const void *data, size_t size) {
+  cache->key = hashBytes(cache->key, data, size);
+}
+
+/* ========================================================================= */
+/* Entry of the image file, identified by its canonical path */
+typedef struct Entry {
+  char          *path;
+  char          *entryName;
+  EntryHeader_t  header;
+} Entry_t;
+
+static void freeEntry(Entry_t *entry) {
+  free(entry->path);
+  free(entry->entryName);
+}
+
+/* Find the name of the entry, and fill its header (except the image size
+ * and format) */
+static int openEntry(
+  const SStarCache_t *cache, const char *fname, Entry_t *entry)
+{
+  entry->path      = realpath(fname, NULL);
+  entry->entryName = NULL;
+  if (entry->path == NULL) return 0;
+
+  struct stat st;
+  if (stat(entry->path, &st) != 0) return 0;
+
+  size_t path_length = strlen(entry->path);
+  if (path_length > UINT32_MAX) return 0;
+
+  EntryHeader_t *header = &entry->header;
+  memset(header, 0, sizeof(EntryHeader_t));
+  memcpy(header->magic, CACHE_MAGIC, 8);
+  header->version     = SLittleEndian32(CACHE_VERSION);
+  header->path_length = SLittleEndian32(path_length);
+  header->key         = SLittleEndian64(cache->key);
+  header->mtime_sec   = SLittleEndian64(st.st_mtim.tv_sec);
+  header->mtime_nsec  = SLittleEndian64(st.st_mtim.tv_nsec);
+  header->size        = SLittleEndian64(st.st_size);
+
+  /* Entries are named after the hash of the path. Collisions are detected
+   * by comparing paths */
+  uint64_t h = hashBytes(FNV_OFFSET, entry->path, path_length);
+  size_t len = strlen(cache->directory) + 32;
+  entry->entryName = malloc(len + 1);
+  if (entry->entryName == NULL) return 0;
+  snprintf(entry->entryName, len + 1, "%s/%016llx.stars",
+    cache->directory, (unsigned long long)h);
+  return 1;
+}
+
+/* ------------------------------------------------------------------------- */
+int SStarCache_load(
+  const SStarCache_t *cache,
+  const char         *fname,
+  SStarSet_t         *sset,
+  SImageFormat_t     *format,
+  unsigned           *width,
+  unsigned           *height)
+{
+  Entry_t entry;
+  FILE   *file = NULL;
+  char   *path = NULL;
+  int     ok   = 0;
+
+  do {
+    if (!openEntry(cache, fname, &entry)) break;
+    file = fopen(entry.entryName, "rb");
+    if (file == NULL) break;
+
+    /* Everything except the format and the size of the image must match */
+    EntryHeader_t header;
+    size_t cmp_size = offsetof(EntryHeader_t, format);
+    if (fread(&header, sizeof(header), 1, file) != 1 ||
+        memcmp(&header, &entry.header, cmp_size) != 0)
+      break;
+
+    size_t path_length = strlen(entry.path);
+    path = malloc(path_length + 1);
+    if (path == NULL ||
+        fread(path, 1, path_length, file) != path_length ||
+        memcmp(path, entry.path, path_length) != 0)
+      break;
+
+    SStarSet_t stars;
+    SStarSet_init(&stars);
+    if (SStarSet_read(&stars, file) != SPICA_OK) {
+      SStarSet_deinit(&stars);
+      break;
+    }
+    for (size_t i = 0; i < stars.length; i++)
+      SStarSet_add(sset, &stars.data[i]);
+    SStarSet_deinit(&stars);
+
+    if (format != NULL) *format = SLittleEndian32(header.format);
+    if (width  != NULL) *width  = SLittleEndian32(header.width);
+    if (height != NULL) *height = SLittleEndian32(header.height);
+    ok = 1;
+  } while (0);
+
+  free(path);
+  if (file != NULL) fclose(file);
+  freeEntry(&entry);
+  return ok ? SPICA_OK : SPICA_ERROR;
+}
+
+/* ------------------------------------------------------------------------- */
+int SStarCache_store(
+  const SStarCache_t *cache,
+  const char         *fname,
+  const SStarSet_t   *sset,
+  SImageFormat_t      format,
+  unsigned            width,
+  unsigned            height)
+{
+  Entry_t entry;
+  FILE   *file     = NULL;
+  char   *tmp_name = NULL;
+  int     ok       = 0;
+
+  do {
+    if (!openEntry(cache, fname, &entry)) break;
+    entry.header.format = SLittleEndian32(format);
+    entry.header.width  = SLittleEndian32(width);
+    entry.header.height = SLittleEndian32(height);
+
+    size_t len = strlen(entry.entryName) + 32;
+    tmp_name = malloc(len + 1);
+    if (tmp_name == NULL) break;
+    snprintf(tmp_name, len + 1, "%s.tmp%ld",
+      entry.entryName, (long)getpid());
+
+    file = fopen(tmp_name, "wb");
+    if (file == NULL) break;
+    size_t path_length = strlen(entry.path);
+    ok = fwrite(&entry.header, sizeof(EntryHeader_t), 1, file) == 1
+      && fwrite(entry.path, 1, path_length, file) == path_length
+      && SStarSet_write(sset, file) == SPICA_OK;
+    ok = fclose(file) == 0 && ok;
+    file = NULL;
+
+    if (ok) ok = rename(tmp_name, entry.entryName) == 0;
+    if (!ok) remove(tmp_name);
+  } while (0);
+
+  free(tmp_name);
+  freeEntry(&entry);
+  return ok ? SPICA_OK : SPICA_ERROR;
+}
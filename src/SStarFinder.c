@@ -5,9 +5,10 @@
 /* Author: Piotr Polesiuk, 2022 */
 
 #include "SStarFinder.h"
+#include "SStarFinder/SCandidateList.h"
 
 #include <assert.h>
-#include <math.h>
+
 
 /* ========================================================================= */
 void SStarFinder_init(SStarFinder_t *finder) {
@@ -16,6 +17,30 @@ void SStarFinder_init(SStarFinder_t *finder) {
   finder->candidateThreshold  = 0.5f;
   finder->minDist             = 2.0f;
   finder->fitSteps            = 30;
+  finder->fitTolerance        = 0.001f;
+  finder->fitMethod           = SFit_Gauss;
+  finder->backgroundBox       = 0;
+  finder->noiseThreshold      = 5.0f;
+  finder->candidateRadius     = 1;
+  finder->maxStars            = -1;
+}
+
+/* ========================================================================= */
+int SStarFinder_fitStar(
+  const SStarFinder_t *finder,
+  SStar_t             *star,
+  const SImage_t      *image,
+  const SBackground_t *bkg)
+{
+  switch (finder->fitMethod) {
+  case SFit_Gauss:
+    return SStar_fitTol(
+      star, image, bkg, finder->fitSteps, finder->fitTolerance);
+  case SFit_Elliptic:
+    return SStar_fitElliptic(
+      star, image, bkg, finder->fitSteps, finder->fitTolerance);
+  }
+  assert(0 && "Impossible case");
 }
 
 /* ========================================================================= */
@@ -29,33 +54,6 @@ SStarSet_t *SStarFinder_findStars(
 }
 
 /* ========================================================================= */
-static int isCandidate(
-  const SStarFinder_t *finder,
-  const SImage_t      *image,
-  int x, int y)
-{
-  SVec2f_t pix = image->data_gray[y * image->width + x];
-  if (pix[1] == 0.0f) return 0;
-  
-  /* Compute pixel brightness */
-  float v = pix[0] / pix[1];
-
-  /* Compute background brightness */
-  SVec2f_t sum = { 0.0f, 0.0f };
-  for (int y1 = y - 1; y1 < y + 1; y1++) {
-    for (int x1 = x - 1; x1 < x + 1; x1++) {
-      pix = image->data_gray[y1 * image->width + x1];
-      if (pix[1] > 0.0f && pix[0] > v * pix[1])
-        return 0; /* Pixel is not a local maximum */
-      sum += pix;
-    }
-  }
-  float b = sum[0] / sum[1];
-
-  return (v - b > finder->brightnessThreshold * finder->candidateThreshold);
-}
-
-/* ------------------------------------------------------------------------- */
 static int starIsInSet(
   const SStarFinder_t *finder, const SStar_t *star, const SStarSet_t *sset)
 {
@@ -73,152 +71,195 @@ static int starIsInSet(
 static void processCandidate(
   const SStarFinder_t *finder,
   const SImage_t      *image,
+  const SBackground_t *bkg,
   SStarSet_t          *sset,
-  float x, float y)
+  SVec2f_t             pos)
 {
   SStar_t star = {
-    .pos        = { x, y },
+    .pos        = pos,
     .brightness = 1.0f,
     .bias       = 0.0f,
     .sigma      = finder->sigma,
+    .sigmaX     = finder->sigma,
+    .sigmaY     = finder->sigma,
+    .theta      = 0.0f,
     .index      = -1,
+    .id         = -1,
     .weight     = 1
   };
 
-  SStar_fit(&star, image, finder->fitSteps);
+  SStarFinder_fitStar(finder, &star, image, bkg);
 
-  if (star.brightness < finder->brightnessThreshold) return;
+  if (!(star.brightness >= SStarFinder_threshold(finder, bkg, star.pos)))
+    return;
   if (starIsInSet(finder, &star, sset)) return;
 
   SStarSet_add(sset, &star);
 }
 
 /* ------------------------------------------------------------------------- */
-void SStarFinder_findStars_at(
+/* Find stars on gray image. When binned is NULL, the image is scaled down
+ * here */
+static void findStars(
   SStarSet_t          *sset,
   const SStarFinder_t *finder,
-  const SImage_t      *image)
+  const SImage_t      *gray_image,
+  const SImage_t      *binned,
+  const SBackground_t *bkg)
 {
-  if (image->format == SFmt_Invalid) return;
-
-  SImage_t *gray_image;
-  if (image->format == SFmt_Gray) gray_image = (SImage_t *)image;
-  else gray_image = SImage_toFormat(image, SFmt_Gray);
-
-  int scale = finder->sigma;
-  if (scale < 1) scale = 1;
+  int scale = SStarFinder_binning(finder);
 
   SImage_t *scaled_image;
-  if (scale == 1) scaled_image = gray_image;
+  if (binned != NULL) scaled_image = (SImage_t *)binned;
+  else if (scale == 1) scaled_image = (SImage_t *)gray_image;
   else scaled_image = SImage_scaleDown(gray_image, scale);
 
-  unsigned scaled_width  = scaled_image->width;
-  unsigned scaled_height = scaled_image->height;
-  
-  for (unsigned y = 1; y < scaled_height-1; y++) {
-    for (unsigned x = 1; x < scaled_width-1; x++) {
-      if (isCandidate(finder, scaled_image, x, y)) {
-        processCandidate(finder, gray_image, sset,
-          x * scale + 0.5f * (scale - 1),
-          y * scale + 0.5f * (scale - 1));
-      }
-    }
+  SCandidateList_t cands;
+  SCandidateList_init(&cands);
+  if (finder->maxStars >= 0) {
+    /* Fit only the highest candidates, brightest first. Some of them are
+     * rejected by fitting, so a few more are taken. */
+    cands.maxLength = finder->maxStars + finder->maxStars / 2 + 8;
   }
+  SCandidateList_find(&cands, finder, scaled_image, scale, bkg);
+  if (finder->maxStars >= 0)
+    SCandidateList_sort(&cands);
 
-  if (scaled_image != gray_image)
+  if (scaled_image != gray_image && scaled_image != binned)
     SImage_free(scaled_image);
-  if (gray_image != image)
-    SImage_free(gray_image);
+
+  size_t start = sset->length;
+  for (size_t i = 0; i < cands.length; i++)
+    processCandidate(finder, gray_image, bkg, sset, cands.data[i].pos);
+
+  SCandidateList_deinit(&cands);
+
+  size_t found_n = sset->length - start;
+  if (finder->maxStars >= 0 && found_n > (size_t)finder->maxStars) {
+    /* Keep only the brightest of newly found stars */
+    SStarSet_t found = {
+      .length   = found_n,
+      .capacity = found_n,
+      .data     = sset->data + start
+    };
+    SStarSet_sort(&found);
+    sset->length = start + finder->maxStars;
+  }
 
   SStarSet_sort(sset);
 }
 
-/* ========================================================================= */
-static float gauss2(float a, float sigma, float x, float y) {
-  return a * expf(- (x*x + y*y) / (2.0f * sigma * sigma));
+/* ------------------------------------------------------------------------- */
+static void findStarsGray(
+  SStarSet_t          *sset,
+  const SStarFinder_t *finder,
+  const SImage_t      *image,
+  const SImage_t      *binned,
+  const SBackground_t *bkg)
+{
+  if (image->format == SFmt_Invalid) return;
+
+  SImage_t *gray_image;
+  if (image->format == SFmt_Gray) gray_image = (SImage_t *)image;
+  else gray_image = SImage_toFormat(image, SFmt_Gray);
+
+  findStars(sset, finder, gray_image, binned, bkg);
+
+  if (gray_image != image)
+    SImage_free(gray_image);
 }
 
 /* ------------------------------------------------------------------------- */
-static void fitStarPos(SStar_t *star, const SImage_t *image) {
-  assert(image->format == SFmt_Gray);
-
-  SVec2f_t pos = { 0.0f, 0.0f };
-  float mass  = 0.0f;
-  float px    = star->pos[0];
-  float py    = star->pos[1];
-  float sigma = star->sigma;
-  float bias  = star->bias;
-  int cx = (int)px;
-  int cy = (int)py;
-  int dist = (int)(sigma * 3.0f) + 1;
-
-  for (int y = cy - dist; y <= cy + dist; y++) {
-    if (y < 0 || y >= image->height) continue;
-
-    for (int x = cx - dist; x <= cx + dist; x++) {
-      if (x < 0 || x >= image->width) continue;
-
-      SVec2f_t pix = image->data_gray[y * image->width + x];
-      if (pix[1] == 0.0f) continue;
-
-      float v = pix[0] / pix[1] - bias;
-      SVec2f_t pm = { x, y };
-      v *= gauss2(1.0f, sigma, x - px, y - py);
-      pos  += pm * v;
-      mass += v;
-    }
-  }
+void SStarFinder_findStars_at(
+  SStarSet_t          *sset,
+  const SStarFinder_t *finder,
+  const SImage_t      *image)
+{
+  SStarFinder_findStarsBinned_at(sset, finder, image, NULL);
+}
 
-  star->pos = pos / mass;
+/* ------------------------------------------------------------------------- */
+void SStarFinder_findStarsBkg(
+  SStarSet_t          *sset,
+  const SStarFinder_t *finder,
+  const SImage_t      *image,
+  const SBackground_t *bkg)
+{
+  findStarsGray(sset, finder, image, NULL, bkg);
 }
 
 /* ------------------------------------------------------------------------- */
-static void fitStarBrightness(SStar_t *star, const SImage_t *image) {
-  assert(image->format == SFmt_Gray);
-
-  SVec2f_t bght = { 0.0f, 0.0f };
-  SVec2f_t bias = { 0.0f, 0.0f };
-  float px    = star->pos[0];
-  float py    = star->pos[1];
-  float sigma = star->sigma;
-  int cx = (int)px;
-  int cy = (int)py;
-  int dist = (int)(sigma * 3.0f) + 1;
-  float bias0 = star->bias;
-  float bght0 = star->brightness;
-
-  for (int y = cy - dist; y <= cy + dist; y++) {
-    if (y < 0 || y >= image->height) continue;
-
-    for (int x = cx - dist; x <= cx + dist; x++) {
-      if (x < 0 || x >= image->width) continue;
-
-      SVec2f_t pix = image->data_gray[y * image->width + x];
-      if (pix[1] == 0.0f) continue;
-
-      float v = pix[0] / pix[1];
-      float g = gauss2(1.0f, sigma, x - px, y - py);
-
-      /* take (v-bias0)/g with weight g*g */
-      bght[0] += (v - bias0) * g;
-      bght[1] += g * g;
-
-      bias[0] += (v - g*bght0) * (1.0f - g);
-      bias[1] += 1.0f - g;
-    }
+unsigned SStarFinder_binning(const SStarFinder_t *finder) {
+  int scale = finder->sigma;
+  return scale < 1 ? 1 : scale;
+}
+
+void SStarFinder_findStarsBinned_at(
+  SStarSet_t          *sset,
+  const SStarFinder_t *finder,
+  const SImage_t      *image,
+  const SImage_t      *binned)
+{
+  if (finder->backgroundBox == 0 || image->format == SFmt_Invalid) {
+    findStarsGray(sset, finder, image, binned, NULL);
+    return;
   }
 
-  star->brightness = bght[0] / bght[1];
-  star->bias       = bias[0] / bias[1];
+  SBackground_t bkg;
+  SBackground_init(&bkg);
+  SBackground_estimate(&bkg, image, finder->backgroundBox);
+  findStarsGray(sset, finder, image, binned, &bkg);
+  SBackground_deinit(&bkg);
 }
 
-/* ------------------------------------------------------------------------- */
-void SStar_fit(SStar_t *star, const SImage_t *image, int steps) {
-  assert(image->format == SFmt_Gray);
-  assert(steps >= 0);
+/* ========================================================================= */
+void SStarFinder_trackStars_at(
+  SStarSet_t          *sset,
+  const SStarFinder_t *finder,
+  const SImage_t      *image,
+  const SBackground_t *bkg,
+  const SStarSet_t    *prev,
+  const STransform_t  *tr)
+{
+  if (image->format == SFmt_Invalid) return;
+  if (tr != NULL && tr->type == STr_Drop) return;
 
-  for (int i = 0; i < steps; i++) {
-    fitStarPos(star, image);
-    fitStarBrightness(star, image);
+  SImage_t *gray_image;
+  if (image->format == SFmt_Gray) gray_image = (SImage_t *)image;
+  else gray_image = SImage_toFormat(image, SFmt_Gray);
+
+  /* Fit that moves the star further than this from the predicted position
+   * has probably jumped to another star */
+  float max_move_sq = finder->sigma * finder->minDist;
+  max_move_sq *= max_move_sq;
+
+  for (size_t i = 0; i < prev->length; i++) {
+    SVec2f_t pos = prev->data[i].pos;
+    if (tr != NULL) pos = STransform_apply(tr, pos);
+    if (!(pos[0] >= 0.0f && pos[0] < gray_image->width &&
+          pos[1] >= 0.0f && pos[1] < gray_image->height))
+      continue;
+
+    SStar_t star = prev->data[i];
+    star.pos    = pos;
+    star.sigma  = finder->sigma;
+    star.sigmaX = finder->sigma;
+    star.sigmaY = finder->sigma;
+    star.theta  = 0.0f;
+    star.weight = 1;
+
+    SStarFinder_fitStar(finder, &star, gray_image, bkg);
+
+    if (!(SVec2f_lengthSq(star.pos - pos) <= max_move_sq)) continue;
+    if (!(star.brightness >= SStarFinder_threshold(finder, bkg, star.pos)))
+      continue;
+    if (starIsInSet(finder, &star, sset)) continue;
+
+    SStarSet_add(sset, &star);
   }
+
+  if (gray_image != image)
+    SImage_free(gray_image);
+
+  SStarSet_sort(sset);
 }
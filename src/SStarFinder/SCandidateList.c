@@ -0,0 +1,335 @@
+/* This file is part of Spica, released under MIT license.
+ * See LICENSE for details.
+ */
+
+/* Author: Piotr Polesiuk, 2022 */
+
+#include "SCandidateList.h"
+
+#include <math.h>
+#include <stdlib.h>
+
+/* The image is processed in bands of BAND_ROWS rows (plus margins), so
+ * memory used by intermediate results does not depend on the image size. */
+#define BAND_ROWS 64
+
+typedef int SVec4i_t __attribute__((vector_size(sizeof(int) * 4)));
+
+/* ========================================================================= */
+void SCandidateList_init(SCandidateList_t *list) {
+  list->length    = 0;
+  list->capacity  = 16;
+  list->maxLength = 0;
+  list->data      = malloc(sizeof(SCandidate_t) * list->capacity);
+}
+
+void SCandidateList_deinit(SCandidateList_t *list) {
+  free(list->data);
+}
+
+/* ------------------------------------------------------------------------- */
+/* Operations on min-heap of first n elements */
+static void siftUp(SCandidate_t *heap, size_t i) {
+  SCandidate_t cand = heap[i];
+  while (i > 0) {
+    size_t parent = (i - 1) / 2;
+    if (heap[parent].height <= cand.height) break;
+    heap[i] = heap[parent];
+    i = parent;
+  }
+  heap[i] = cand;
+}
+
+static void siftDown(SCandidate_t *heap, size_t n, size_t i) {
+  SCandidate_t cand = heap[i];
+  for (;;) {
+    size_t child = 2 * i + 1;
+    if (child >= n) break;
+    if (child + 1 < n && heap[child + 1].height < heap[child].height)
+      child++;
+    if (cand.height <= heap[child].height) break;
+    heap[i] = heap[child];
+    i = child;
+  }
+  heap[i] = cand;
+}
+
+/* ------------------------------------------------------------------------- */
+void SCandidateList_add(SCandidateList_t *list, const SCandidate_t *cand) {
+  if (list->maxLength > 0 && list->length >= list->maxLength) {
+    /* Bounded list is full: replace the lowest candidate */
+    if (cand->height <= list->data[0].height) return;
+    list->data[0] = *cand;
+    siftDown(list->data, list->length, 0);
+    return;
+  }
+
+  if (list->length >= list->capacity) {
+    list->capacity *= 2;
+    list->data = realloc(list->data, sizeof(SCandidate_t) * list->capacity);
+  }
+  list->data[list->length++] = *cand;
+  if (list->maxLength > 0)
+    siftUp(list->data, list->length - 1);
+}
+
+/* ------------------------------------------------------------------------- */
+void SCandidateList_sort(SCandidateList_t *list) {
+  if (list->maxLength == 0) {
+    for (size_t i = 1; i < list->length; i++)
+      siftUp(list->data, i);
+  }
+  list->maxLength = 0;
+
+  /* Heap-sort: the lowest candidates go to the end */
+  for (size_t n = list->length; n > 1; n--) {
+    SCandidate_t cand = list->data[0];
+    list->data[0]     = list->data[n - 1];
+    list->data[n - 1] = cand;
+    siftDown(list->data, n - 1, 0);
+  }
+}
+
+/* ========================================================================= */
+inline static float maxf(float a, float b) {
+  return a > b ? a : b;
+}
+
+inline static SVec4f_t maxv(SVec4f_t a, SVec4f_t b) {
+  SVec4i_t m = a > b;
+  return (SVec4f_t)(((SVec4i_t)a & m) | ((SVec4i_t)b & ~m));
+}
+
+/* ------------------------------------------------------------------------- */
+/* Running maximum of a row of n values in windows [i-r, i+r] (van Herk/Gil-
+ * Werman algorithm). The row is split into blocks of size 2r+1, and every
+ * window is covered by a suffix of one block and a prefix of the next one.
+ * It takes three comparisons per value, independently of r. Values outside
+ * the row are -∞. Buffers g and h have room for n+2r values. */
+static void rowMax(
+  float *dst, const float *src, int n, int r, float *g, float *h)
+{
+  int k  = 2 * r + 1;
+  int np = n + 2 * r;
+
+  for (int p = 0; p < np; p++) {
+    float v = (p < r || p >= n + r ? -INFINITY : src[p - r]);
+    g[p] = (p % k == 0 ? v : maxf(g[p - 1], v));
+  }
+  for (int p = np - 1; p >= 0; p--) {
+    float v = (p < r || p >= n + r ? -INFINITY : src[p - r]);
+    h[p] = (p % k == k - 1 || p == np - 1 ? v : maxf(h[p + 1], v));
+  }
+  for (int i = 0; i < n; i++)
+    dst[i] = maxf(h[i], g[i + 2 * r]);
+}
+
+/* ------------------------------------------------------------------------- */
+/* The same as rowMax, but computes the running maximum along columns of
+ * n rows of vw vectors each. Buffers g and h have room for (n+2r)·vw
+ * vectors. */
+static void colMax(
+  SVec4f_t *dst, const SVec4f_t *src, int n, int vw, int r,
+  SVec4f_t *g, SVec4f_t *h)
+{
+  int k  = 2 * r + 1;
+  int np = n + 2 * r;
+  SVec4f_t ninf = { -INFINITY, -INFINITY, -INFINITY, -INFINITY };
+
+  for (int p = 0; p < np; p++) {
+    const SVec4f_t *s = (p < r || p >= n + r ? NULL : src + (p - r) * vw);
+    SVec4f_t *gp = g + p * vw;
+    for (int i = 0; i < vw; i++) {
+      SVec4f_t v = (s == NULL ? ninf : s[i]);
+      gp[i] = (p % k == 0 ? v : maxv(gp[i - vw], v));
+    }
+  }
+  for (int p = np - 1; p >= 0; p--) {
+    const SVec4f_t *s = (p < r || p >= n + r ? NULL : src + (p - r) * vw);
+    SVec4f_t *hp = h + p * vw;
+    for (int i = 0; i < vw; i++) {
+      SVec4f_t v = (s == NULL ? ninf : s[i]);
+      hp[i] = (p % k == k - 1 || p == np - 1 ? v : maxv(hp[i + vw], v));
+    }
+  }
+  for (int j = 0; j < n; j++) {
+    for (int i = 0; i < vw; i++)
+      dst[j * vw + i] = maxv(h[j * vw + i], g[(j + 2 * r) * vw + i]);
+  }
+}
+
+/* ------------------------------------------------------------------------- */
+/* Running sum of a row of n values in windows [i-r, i+r] clipped to the
+ * row */
+static void rowSum(float *dst, const float *src, int n, int r) {
+  float s = 0.0f;
+  for (int i = 0; i < r && i < n; i++) s += src[i];
+  for (int i = 0; i < n; i++) {
+    if (i + r < n)      s += src[i + r];
+    if (i - r - 1 >= 0) s -= src[i - r - 1];
+    dst[i] = s;
+  }
+}
+
+/* ------------------------------------------------------------------------- */
+/* Running sum along columns of n rows of vw vectors each */
+static void colSum(SVec4f_t *dst, const SVec4f_t *src, int n, int vw, int r) {
+  for (int i = 0; i < vw; i++) {
+    SVec4f_t v = { 0.0f, 0.0f, 0.0f, 0.0f };
+    for (int j = 0; j <= r && j < n; j++) v += src[j * vw + i];
+    dst[i] = v;
+  }
+  for (int j = 1; j < n; j++) {
+    for (int i = 0; i < vw; i++) {
+      SVec4f_t v = dst[(j - 1) * vw + i];
+      if (j + r < n)  v += src[(j + r) * vw + i];
+      if (j - r >= 1) v -= src[(j - r - 1) * vw + i];
+      dst[j * vw + i] = v;
+    }
+  }
+}
+
+/* ========================================================================= */
+/* Intermediate results for a single band of the image. Each plane has rows
+ * of vw vectors. */
+typedef struct Band {
+  int       vw;    /* Number of vectors in a single row */
+  SVec4f_t *val;   /* Normalized pixel values (-∞ for invalid pixels) */
+  SVec4f_t *wgt;   /* Pixel weights */
+  SVec4f_t *mx;    /* Maximum of values in the neighbourhood */
+  SVec4f_t *sv[2]; /* Sums of values in squares of radius r and r+1 */
+  SVec4f_t *sw[2]; /* Sums of weights in squares of radius r and r+1 */
+  SVec4f_t *tmp;   /* Buffers for colMax, or for row sums */
+} Band_t;
+
+/* ------------------------------------------------------------------------- */
+/* Compute all planes for rows [y0, y1) of the image */
+static void processBand(
+  Band_t *band, const SImage_t *image, int y0, int y1, int r, int sums)
+{
+  int w  = image->width;
+  int vw = band->vw;
+  int n  = y1 - y0;
+
+  for (int j = 0; j < n; j++) {
+    const SVec2f_t *row = image->data_gray + (size_t)(y0 + j) * w;
+    float *val = (float *)(band->val + j * vw);
+    float *wgt = (float *)(band->wgt + j * vw);
+    for (int x = 0; x < 4 * vw; x++) {
+      SVec2f_t pix = (x < w ? row[x] : SVec2f(0.0f, 0.0f));
+      wgt[x] = pix[1];
+      val[x] = (pix[1] > 0.0f ? pix[0] / pix[1] : -INFINITY);
+    }
+  }
+
+  /* Separable maximum filter */
+  float *g = (float *)band->tmp;
+  float *h = g + w + 2 * r;
+  for (int j = 0; j < n; j++) {
+    float *row = (float *)(band->mx + j * vw);
+    rowMax(row, (float *)(band->val + j * vw), w, r, g, h);
+    for (int x = w; x < 4 * vw; x++) row[x] = -INFINITY;
+  }
+  SVec4f_t *vg = band->tmp;
+  SVec4f_t *vh = vg + (n + 2 * r) * vw;
+  colMax(band->mx, band->mx, n, vw, r, vg, vh);
+
+  if (!sums) return;
+
+  /* Separable box sums. Planes sv[k] are used as temporary buffers for
+   * weighted values, before they are overwritten by final sums. */
+  for (int k = 0; k < 2; k++) {
+    for (int j = 0; j < n; j++) {
+      float *val = (float *)(band->val + j * vw);
+      float *wgt = (float *)(band->wgt + j * vw);
+      float *wv  = (float *)(band->sv[k] + j * vw);
+      float *sv  = (float *)(band->tmp + j * vw);
+      float *sw  = (float *)(band->tmp + (n + j) * vw);
+      for (int x = 0; x < 4 * vw; x++)
+        wv[x] = (wgt[x] > 0.0f ? val[x] * wgt[x] : 0.0f);
+      rowSum(sv, wv, w, r + k);
+      rowSum(sw, wgt, w, r + k);
+      for (int x = w; x < 4 * vw; x++) sv[x] = sw[x] = 0.0f;
+    }
+    colSum(band->sv[k], band->tmp, n, vw, r + k);
+    colSum(band->sw[k], band->tmp + n * vw, n, vw, r + k);
+  }
+}
+
+/* ------------------------------------------------------------------------- */
+void SCandidateList_find(
+  SCandidateList_t    *list,
+  const SStarFinder_t *finder,
+  const SImage_t      *image,
+  int                  scale,
+  const SBackground_t *bkg)
+{
+  int w = image->width;
+  int h = image->height;
+  int r = finder->candidateRadius;
+  if (r < 1) r = 1;
+  if (w <= 2 * r || h <= 2 * r) return;
+
+  /* Margin of rows around each band, needed by filters */
+  int margin = r + 1;
+  int rows   = BAND_ROWS + 2 * margin;
+  int vw     = (w + 3) / 4;
+  int sums   = (bkg == NULL);
+
+  Band_t band;
+  band.vw = vw;
+  size_t plane  = (size_t)rows * vw;
+  size_t tmp_n  = 2 * (size_t)(rows + 2 * r) * vw;
+  size_t plane_n = sums ? 7 : 3;
+  band.val = malloc(sizeof(SVec4f_t) * (plane * plane_n + tmp_n));
+  if (band.val == NULL) return;
+  band.wgt = band.val + plane;
+  band.mx  = band.wgt + plane;
+  band.sv[0] = band.mx    + plane;
+  band.sv[1] = band.sv[0] + (sums ? plane : 0);
+  band.sw[0] = band.sv[1] + (sums ? plane : 0);
+  band.sw[1] = band.sw[0] + (sums ? plane : 0);
+  band.tmp   = band.sw[1] + (sums ? plane : 0);
+
+  float cand_thr = finder->candidateThreshold;
+  float shift    = 0.5f * (scale - 1);
+
+  for (int by = r; by < h - r; by += BAND_ROWS) {
+    int ey = by + BAND_ROWS < h - r ? by + BAND_ROWS : h - r;
+    int y0 = by - margin < 0 ? 0 : by - margin;
+    int y1 = ey + margin > h ? h : ey + margin;
+    processBand(&band, image, y0, y1, r, sums);
+
+    for (int y = by; y < ey; y++) {
+      int j = y - y0;
+      const float *val = (const float *)(band.val + j * vw);
+      const float *mx  = (const float *)(band.mx  + j * vw);
+
+      for (int x = r; x < w - r; x++) {
+        float v = val[x];
+        /* Invalid pixel, or pixel that is not a local maximum */
+        if (v == -INFINITY || v < mx[x]) continue;
+
+        SVec2f_t pos = { x * scale + shift, y * scale + shift };
+        float b;
+        if (sums) {
+          /* Mean of the border of the larger square */
+          const float *sv0 = (const float *)(band.sv[0] + j * vw);
+          const float *sv1 = (const float *)(band.sv[1] + j * vw);
+          const float *sw0 = (const float *)(band.sw[0] + j * vw);
+          const float *sw1 = (const float *)(band.sw[1] + j * vw);
+          float bw = sw1[x] - sw0[x];
+          b = (bw > 0.0f ? (sv1[x] - sv0[x]) / bw : sv1[x] / sw1[x]);
+        } else {
+          b = SBackground_level(bkg, pos);
+        }
+
+        SCandidate_t cand = { .pos = pos, .height = v - b };
+        if (cand.height > SStarFinder_threshold(finder, bkg, pos) * cand_thr)
+          SCandidateList_add(list, &cand);
+      }
+    }
+  }
+
+  free(band.val);
+}
@@ -0,0 +1,76 @@
+/* This file is part of Spica, released under MIT license.
+ * See LICENSE for details.
+ */
+
+/* Detection of star candidates on scaled images */
+
+/* Author: Piotr Polesiuk, 2022 */
+
+#ifndef __SCANDIDATE_LIST_H__
+#define __SCANDIDATE_LIST_H__
+
+#include "SBackground.h"
+#include "SImage.h"
+#include "SStarFinder.h"
+
+#include <stddef.h>
+
+/* Pixel of the scaled image that may be a star */
+typedef struct SCandidate {
+  SVec2f_t pos;    /** Position of the pixel center on the original image */
+  float    height; /** Brightness of the pixel above the background */
+} SCandidate_t;
+
+/* Growable array of candidates. If maxLength is not 0, the list is bounded:
+ * it keeps at most maxLength highest candidates, organized in a min-heap
+ * (with respect to the height), until it is sorted. */
+typedef struct SCandidateList {
+  size_t        length;
+  size_t        capacity;
+  size_t        maxLength;
+  SCandidate_t *data;
+} SCandidateList_t;
+
+/** Initialize empty unbounded list */
+void SCandidateList_init(SCandidateList_t *list);
+
+/** Free memory used by the list */
+void SCandidateList_deinit(SCandidateList_t *list);
+
+/** Add candidate at the end of the list. If the list is bounded and full,
+ * the lowest candidate is dropped. */
+void SCandidateList_add(SCandidateList_t *list, const SCandidate_t *cand);
+
+/** Sort candidates (highest first). The list becomes unbounded. */
+void SCandidateList_sort(SCandidateList_t *list);
+
+/** Find candidates on gray-scale image scaled down \p scale times, and add
+ * them to the list. Candidates are pixels that are local maxima in the
+ * (2r+1)x(2r+1) neighbourhood (r is candidateRadius field of the finder),
+ * and are brighter than the background by candidateThreshold times the
+ * brightness threshold. The background is read from \p bkg, or (when it is
+ * NULL) it is the mean of pixels on the border of (2r+3)x(2r+3) square
+ * around the pixel. Candidates are added in row-major order. */
+void SCandidateList_find(
+  SCandidateList_t    *list,
+  const SStarFinder_t *finder,
+  const SImage_t      *image,
+  int                  scale,
+  const SBackground_t *bkg);
+
+/** Threshold of star brightness at given position of the original image */
+static inline float SStarFinder_threshold(
+  const SStarFinder_t *finder, const SBackground_t *bkg, SVec2f_t pos)
+  __attribute__((unused));
+
+static inline float SStarFinder_threshold(
+  const SStarFinder_t *finder, const SBackground_t *bkg, SVec2f_t pos)
+{
+  float thr = finder->brightnessThreshold;
+  if (bkg == NULL) return thr;
+
+  float noise_thr = finder->noiseThreshold * SBackground_noise(bkg, pos);
+  return noise_thr > thr ? noise_thr : thr;
+}
+
+#endif /* __SCANDIDATE_LIST_H__ */
@@ -0,0 +1,68 @@
+/* This file is part of Spica, released under MIT license.
+ * See LICENSE for details.
+ */
+
+/* Author: Piotr Polesiuk, 2022 */
+
+#include "SFitWindow.h"
+
+#include <stdlib.h>
+
+int SFitWindow_init(SFitWindow_t *win, float sigma) {
+  win->dist  = (int)(sigma * 3.0f) + 1;
+  win->size  = 2 * win->dist + 1;
+  win->vsize = (win->size + 3) / 4;
+
+  size_t n = (size_t)win->vsize * win->size;
+  win->val = malloc(sizeof(SVec4f_t) * (2 * n + 2 * win->vsize));
+  win->gy  = malloc(sizeof(float) * win->size);
+  if (win->val == NULL || win->gy == NULL) {
+    free(win->val);
+    free(win->gy);
+    return 0;
+  }
+  win->msk = win->val + n;
+  win->xs  = win->msk + n;
+  win->gx  = win->xs  + win->vsize;
+  return 1;
+}
+
+void SFitWindow_deinit(SFitWindow_t *win) {
+  free(win->val);
+  free(win->gy);
+}
+
+void SFitWindow_load(
+  SFitWindow_t *win, const SImage_t *image, int cx, int cy)
+{
+  win->cx = cx;
+  win->cy = cy;
+
+  int x0 = cx - win->dist;
+  int y0 = cy - win->dist;
+  for (int i = 0; i < win->vsize * 4; i++)
+    win->xs[i / 4][i % 4] = x0 + i;
+
+  for (int j = 0; j < win->size; j++) {
+    float *val = (float *)(win->val + j * win->vsize);
+    float *msk = (float *)(win->msk + j * win->vsize);
+    int y = y0 + j;
+
+    for (int i = 0; i < win->vsize * 4; i++) {
+      int x = x0 + i;
+      val[i] = 0.0f;
+      msk[i] = 0.0f;
+      if (i >= win->size || y < 0 || y >= (int)image->height
+        || x < 0 || x >= (int)image->width)
+      {
+        continue;
+      }
+
+      SVec2f_t pix = image->data_gray[y * image->width + x];
+      if (pix[1] == 0.0f) continue;
+
+      val[i] = pix[0] / pix[1];
+      msk[i] = 1.0f;
+    }
+  }
+}
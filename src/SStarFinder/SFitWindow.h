@@ -0,0 +1,49 @@
+/* This file is part of Spica, released under MIT license.
+ * See LICENSE for details.
+ */
+
+/* Helper functions for fitting stars on small image windows */
+
+/* Author: Piotr Polesiuk, 2022 */
+
+#ifndef __SFIT_WINDOW_H__
+#define __SFIT_WINDOW_H__
+
+#include "SImage.h"
+
+/* Square window around the star. Normalized pixel values are extracted from
+ * the image once, so fitting procedures operate on plain arrays of SVec4f_t,
+ * i.e., four pixels at once. Rows are padded to the multiple of four pixels
+ * with invalid pixels. */
+typedef struct SFitWindow {
+  int       cx;    /** Center of the window (image coordinates) */
+  int       cy;
+  int       dist;  /** Distance from the center to the window border */
+  int       size;  /** Window is size x size pixels large */
+  int       vsize; /** Number of SVec4f_t vectors in a single row */
+  SVec4f_t *val;   /** Normalized pixel values (zero for invalid pixels) */
+  SVec4f_t *msk;   /** 1 for valid pixels, 0 for invalid pixels */
+  SVec4f_t *xs;    /** X-coordinates of window columns */
+  SVec4f_t *gx;    /** Space for the per-column factors of fit function */
+  float    *gy;    /** Space for the per-row factors of fit function */
+} SFitWindow_t;
+
+/** Allocate window large enough to fit a star of given sigma. Returns 0 on
+ * malloc error. */
+int SFitWindow_init(SFitWindow_t *win, float sigma);
+
+/** Free memory used by the window */
+void SFitWindow_deinit(SFitWindow_t *win);
+
+/** Load pixels of a gray-scale image around (cx, cy) point */
+void SFitWindow_load(
+  SFitWindow_t *win, const SImage_t *image, int cx, int cy);
+
+/** Sum of vector components */
+static inline float SFitWindow_hsum(SVec4f_t v) __attribute__((unused));
+
+static inline float SFitWindow_hsum(SVec4f_t v) {
+  return (v[0] + v[1]) + (v[2] + v[3]);
+}
+
+#endif /* __SFIT_WINDOW_H__ */
@@ -0,0 +1,96 @@
+/* This file is part of Spica, released under MIT license.
+ * See LICENSE for details.
+ */
+
+/* Author: Piotr Polesiuk, 2022 */
+
+#include "SStarTracker.h"
+
+#include <stdlib.h>
+
+/* ========================================================================= */
+void SStarTracker_init(SStarTracker_t *tracker) {
+  tracker->detectPeriod    = 10;
+  tracker->minTrackedRatio = 0.7f;
+  tracker->detectedN       = 0;
+  tracker->frameN          = 0;
+  SStarSet_init(&tracker->sset);
+  SBackground_init(&tracker->bkg);
+}
+
+void SStarTracker_deinit(SStarTracker_t *tracker) {
+  SStarSet_deinit(&tracker->sset);
+  SBackground_deinit(&tracker->bkg);
+}
+
+SStarTracker_t *SStarTracker_alloc(void) {
+  SStarTracker_t *tracker = malloc(sizeof(SStarTracker_t));
+  if (tracker == NULL) return NULL;
+
+  SStarTracker_init(tracker);
+  return tracker;
+}
+
+void SStarTracker_free(SStarTracker_t *tracker) {
+  if (tracker == NULL) return;
+  SStarTracker_deinit(tracker);
+  free(tracker);
+}
+
+/* ========================================================================= */
+void SStarTracker_reset(SStarTracker_t *tracker) {
+  tracker->frameN = 0;
+}
+
+/* ------------------------------------------------------------------------- */
+int SStarTracker_findStars_at(
+  SStarTracker_t      *tracker,
+  SStarSet_t          *sset,
+  const SStarFinder_t *finder,
+  const SImage_t      *image,
+  const STransform_t  *tr)
+{
+  int detect =
+    tracker->frameN == 0 ||
+    tracker->frameN >= tracker->detectPeriod ||
+    (tr != NULL && tr->type == STr_Drop);
+
+  const SBackground_t *bkg =
+    tracker->bkg.meshWidth > 0 ? &tracker->bkg : NULL;
+
+  SStarSet_t found;
+  SStarSet_init(&found);
+
+  if (!detect) {
+    SStarFinder_trackStars_at(
+      &found, finder, image, bkg, &tracker->sset, tr);
+    if (found.length < tracker->minTrackedRatio * tracker->detectedN) {
+      /* Too many stars lost */
+      SStarSet_deinit(&found);
+      SStarSet_init(&found);
+      detect = 1;
+    }
+  }
+
+  if (detect) {
+    bkg = NULL;
+    SBackground_deinit(&tracker->bkg);
+    SBackground_init(&tracker->bkg);
+    if (finder->backgroundBox > 0 && image->format != SFmt_Invalid) {
+      SBackground_estimate(&tracker->bkg, image, finder->backgroundBox);
+      bkg = &tracker->bkg;
+    }
+
+    SStarFinder_findStarsBkg(&found, finder, image, bkg);
+    tracker->detectedN = found.length;
+    tracker->frameN    = 0;
+  }
+  tracker->frameN++;
+
+  for (size_t i = 0; i < found.length; i++)
+    SStarSet_add(sset, &found.data[i]);
+
+  SStarSet_deinit(&tracker->sset);
+  tracker->sset = found;
+  return detect;
+}
@@ -0,0 +1,152 @@
+/* This file is part of Spica, released under MIT license.
+ * See LICENSE for details.
+ */
+
+/* Author: Piotr Polesiuk, 2022 */
+
+#include "SStarFinder.h"
+#include "SFitWindow.h"
+
+#include <assert.h>
+#include <math.h>
+
+/* ========================================================================= */
+/* Gaussian function is separable: exp(-(x²+y²)/2σ²) = exp(-x²/2σ²)·exp(-y²/2σ²),
+ * so each step evaluates only 2·size exponents instead of size² of them. */
+static void fitGauss(SFitWindow_t *win, float sigma, float px, float py) {
+  float c = -1.0f / (2.0f * sigma * sigma);
+  int x0 = win->cx - win->dist;
+  int y0 = win->cy - win->dist;
+
+  for (int i = 0; i < win->vsize * 4; i++) {
+    float dx = x0 + i - px;
+    win->gx[i / 4][i % 4] = (i < win->size ? expf(c * dx * dx) : 0.0f);
+  }
+  for (int j = 0; j < win->size; j++) {
+    float dy = y0 + j - py;
+    win->gy[j] = expf(c * dy * dy);
+  }
+}
+
+/* ========================================================================= */
+static void fitStarPos(SStar_t *star, const SFitWindow_t *win) {
+  float bias = star->bias;
+  int y0 = win->cy - win->dist;
+
+  SVec2f_t pos = { 0.0f, 0.0f };
+  float mass = 0.0f;
+
+  for (int j = 0; j < win->size; j++) {
+    const SVec4f_t *val = win->val + j * win->vsize;
+    const SVec4f_t *msk = win->msk + j * win->vsize;
+    SVec4f_t row_mass = { 0.0f, 0.0f, 0.0f, 0.0f };
+    SVec4f_t row_x    = { 0.0f, 0.0f, 0.0f, 0.0f };
+
+    for (int i = 0; i < win->vsize; i++) {
+      SVec4f_t v = (val[i] - bias * msk[i]) * win->gx[i];
+      row_mass += v;
+      row_x    += v * win->xs[i];
+    }
+
+    float gy = win->gy[j];
+    float rm = SFitWindow_hsum(row_mass) * gy;
+    pos[0] += SFitWindow_hsum(row_x) * gy;
+    pos[1] += rm * (y0 + j);
+    mass   += rm;
+  }
+
+  star->pos = pos / mass;
+}
+
+/* ------------------------------------------------------------------------- */
+static void fitStarBrightness(
+  SStar_t *star, const SFitWindow_t *win, int fix_bias)
+{
+  float bias0 = star->bias;
+  float bght0 = star->brightness;
+
+  SVec4f_t bght_v = { 0.0f, 0.0f, 0.0f, 0.0f };
+  SVec4f_t bght_w = { 0.0f, 0.0f, 0.0f, 0.0f };
+  SVec4f_t bias_v = { 0.0f, 0.0f, 0.0f, 0.0f };
+  SVec4f_t bias_w = { 0.0f, 0.0f, 0.0f, 0.0f };
+
+  for (int j = 0; j < win->size; j++) {
+    const SVec4f_t *val = win->val + j * win->vsize;
+    const SVec4f_t *msk = win->msk + j * win->vsize;
+    float gy = win->gy[j];
+
+    for (int i = 0; i < win->vsize; i++) {
+      SVec4f_t g  = win->gx[i] * gy;
+      SVec4f_t m  = msk[i];
+      SVec4f_t ng = m - g * m;
+
+      /* take (v-bias0)/g with weight g*g */
+      bght_v += (val[i] - bias0 * m) * g;
+      bght_w += g * g * m;
+
+      bias_v += (val[i] - g * bght0 * m) * ng;
+      bias_w += ng;
+    }
+  }
+
+  star->brightness = SFitWindow_hsum(bght_v) / SFitWindow_hsum(bght_w);
+  if (!fix_bias)
+    star->bias = SFitWindow_hsum(bias_v) / SFitWindow_hsum(bias_w);
+}
+
+/* ========================================================================= */
+int SStar_fitTol(
+  SStar_t             *star,
+  const SImage_t      *image,
+  const SBackground_t *bkg,
+  int                  steps,
+  float                tol)
+{
+  assert(image->format == SFmt_Gray);
+  assert(steps >= 0);
+
+  SFitWindow_t win;
+  if (!SFitWindow_init(&win, star->sigma)) return 0;
+
+  float tol_sq = tol * tol;
+  int   cx     = (int)star->pos[0];
+  int   cy     = (int)star->pos[1];
+  SFitWindow_load(&win, image, cx, cy);
+  if (bkg != NULL) star->bias = SBackground_level(bkg, star->pos);
+
+  int i;
+  for (i = 0; i < steps; ) {
+    SVec2f_t old_pos = star->pos;
+
+    fitGauss(&win, star->sigma, star->pos[0], star->pos[1]);
+    fitStarPos(star, &win);
+    i++;
+
+    /* Degenerated window (e.g. no signal at all). Keep the last position,
+     * because there is nothing to fit. */
+    if (!isfinite(star->pos[0]) || !isfinite(star->pos[1])) {
+      star->pos = old_pos;
+      break;
+    }
+
+    cx = (int)star->pos[0];
+    cy = (int)star->pos[1];
+    if (cx != win.cx || cy != win.cy)
+      SFitWindow_load(&win, image, cx, cy);
+
+    if (bkg != NULL) star->bias = SBackground_level(bkg, star->pos);
+
+    fitGauss(&win, star->sigma, star->pos[0], star->pos[1]);
+    fitStarBrightness(star, &win, bkg != NULL);
+
+    if (SVec2f_lengthSq(star->pos - old_pos) < tol_sq) break;
+  }
+
+  SFitWindow_deinit(&win);
+  return i;
+}
+
+/* ------------------------------------------------------------------------- */
+void SStar_fit(SStar_t *star, const SImage_t *image, int steps) {
+  SStar_fitTol(star, image, NULL, steps, 0.0f);
+}
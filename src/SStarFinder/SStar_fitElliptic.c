@@ -0,0 +1,297 @@
+/* This file is part of Spica, released under MIT license.
+ * See LICENSE for details.
+ */
+
+/* Author: Piotr Polesiuk, 2022 */
+
+#include "SStarFinder.h"
+#include "SFitWindow.h"
+#include "SLinAlg.h"
+
+#include <assert.h>
+#include <math.h>
+
+/* Levenberg-Marquardt fitting of the elliptical gaussian function
+ *
+ *   f(x,y) = B + A·exp(-(a·dx² + 2b·dx·dy + c·dy²)/2), where
+ *   dx = x - x0, and dy = y - y0.
+ *
+ * The shape is fit as a quadratic form (a, b, c), because parametrization
+ * by σx, σy, and θ is singular for circular stars (θ has no influence on the
+ * model, when σx = σy). The quadratic form is converted to axes and angle
+ * at the end. Parameters are stored in the following order. */
+enum {
+  P_X0, P_Y0, P_A, P_B, P_QA, P_QB, P_QC,
+  P_N
+};
+
+/* Number of elements of the upper triangle of P_N x P_N matrix */
+#define TRI_N (P_N * (P_N + 1) / 2)
+
+#define PI_F       3.14159265358979f
+#define MIN_SIGMA  0.25f
+#define MIN_LAMBDA 1e-7
+#define MAX_LAMBDA 1e7
+
+typedef struct Params {
+  float p[P_N];
+} Params_t;
+
+/* ========================================================================= */
+static SVec4f_t expv(SVec4f_t x) {
+  SVec4f_t r = { expf(x[0]), expf(x[1]), expf(x[2]), expf(x[3]) };
+  return r;
+}
+
+/* ------------------------------------------------------------------------- */
+/* Compute the sum of squared residuals, and (when jtj is not NULL) normal
+ * equations of the linearized problem: J^T·J and J^T·r, where J is the
+ * Jacobian of the model. Matrix J^T·J is stored as its upper triangle. */
+static double evaluate(
+  const SFitWindow_t *win, const Params_t *par, double *jtj, double *jtr)
+{
+  const float *p = par->p;
+  int y0 = win->cy - win->dist;
+
+  SVec4f_t chi2 = { 0.0f, 0.0f, 0.0f, 0.0f };
+  SVec4f_t mtr[TRI_N];
+  SVec4f_t vec[P_N];
+  for (int k = 0; k < TRI_N; k++) mtr[k] = chi2;
+  for (int k = 0; k < P_N; k++)   vec[k] = chi2;
+
+  for (int j = 0; j < win->size; j++) {
+    const SVec4f_t *val = win->val + j * win->vsize;
+    const SVec4f_t *msk = win->msk + j * win->vsize;
+    float dy = y0 + j - p[P_Y0];
+
+    for (int i = 0; i < win->vsize; i++) {
+      SVec4f_t dx = win->xs[i] - p[P_X0];
+      SVec4f_t qx = p[P_QA] * dx + p[P_QB] * dy;
+      SVec4f_t qy = p[P_QB] * dx + p[P_QC] * dy;
+      SVec4f_t e  = expv(-0.5f * (qx * dx + qy * dy));
+      SVec4f_t m  = msk[i];
+      SVec4f_t r  = (val[i] - p[P_B] * m - p[P_A] * e) * m;
+      chi2 += r * r;
+
+      if (jtj == NULL) continue;
+
+      SVec4f_t ae = p[P_A] * e * m;
+      SVec4f_t jac[P_N];
+      jac[P_X0] = ae * qx;
+      jac[P_Y0] = ae * qy;
+      jac[P_A]  = e * m;
+      jac[P_B]  = m;
+      jac[P_QA] = -0.5f * ae * dx * dx;
+      jac[P_QB] = -ae * dx * dy;
+      jac[P_QC] = -0.5f * ae * dy * dy;
+
+      int t = 0;
+      for (int k = 0; k < P_N; k++) {
+        vec[k] += jac[k] * r;
+        for (int l = k; l < P_N; l++)
+          mtr[t++] += jac[k] * jac[l];
+      }
+    }
+  }
+
+  if (jtj != NULL) {
+    int t = 0;
+    for (int k = 0; k < P_N; k++) {
+      jtr[k] = SFitWindow_hsum(vec[k]);
+      for (int l = k; l < P_N; l++)
+        jtj[k * P_N + l] = jtj[l * P_N + k] = SFitWindow_hsum(mtr[t++]);
+    }
+  }
+  return SFitWindow_hsum(chi2);
+}
+
+/* ------------------------------------------------------------------------- */
+/* Initial brightness and bias: linear least squares with fixed shape */
+static void initBrightness(
+  const SFitWindow_t *win, Params_t *par, int fix_bias)
+{
+  float c  = -0.5f * par->p[P_QA];
+  int y0 = win->cy - win->dist;
+
+  SVec4f_t sgg = { 0.0f, 0.0f, 0.0f, 0.0f };
+  SVec4f_t sg1 = sgg, s11 = sgg, sgv = sgg, s1v = sgg;
+
+  for (int j = 0; j < win->size; j++) {
+    const SVec4f_t *val = win->val + j * win->vsize;
+    const SVec4f_t *msk = win->msk + j * win->vsize;
+    float dy = y0 + j - par->p[P_Y0];
+
+    for (int i = 0; i < win->vsize; i++) {
+      SVec4f_t dx = win->xs[i] - par->p[P_X0];
+      SVec4f_t g  = expv(c * (dx * dx + dy * dy)) * msk[i];
+      sgg += g * g;
+      sg1 += g;
+      s11 += msk[i];
+      sgv += g * val[i];
+      s1v += val[i];
+    }
+  }
+
+  double a[4] = {
+    SFitWindow_hsum(sgg), SFitWindow_hsum(sg1),
+    SFitWindow_hsum(sg1), SFitWindow_hsum(s11) };
+  double b[2] = { SFitWindow_hsum(sgv), SFitWindow_hsum(s1v) };
+  if (fix_bias) {
+    /* Only brightness: minimize |v - B·1 - A·g|² over A */
+    if (a[0] > 0.0) par->p[P_A] = (b[0] - par->p[P_B] * a[1]) / a[0];
+    return;
+  }
+  if (SLinAlg_solve(2, a, b)) {
+    par->p[P_A] = b[0];
+    par->p[P_B] = b[1];
+  }
+}
+
+/* ------------------------------------------------------------------------- */
+/* Remove bias from the set of fit parameters: the step in P_B direction is
+ * always zero. */
+static void fixBias(double *jtj, double *jtr) {
+  for (int k = 0; k < P_N; k++)
+    jtj[k * P_N + P_B] = jtj[P_B * P_N + k] = 0.0;
+  jtj[P_B * P_N + P_B] = 1.0;
+  jtr[P_B] = 0.0;
+}
+
+/* ------------------------------------------------------------------------- */
+static int isValid(const SFitWindow_t *win, const Params_t *par) {
+  for (int k = 0; k < P_N; k++) {
+    if (!isfinite(par->p[k])) return 0;
+  }
+  /* The shape should be an ellipse not smaller than MIN_SIGMA, and the star
+   * should not leave the window */
+  float qmax = 1.0f / (MIN_SIGMA * MIN_SIGMA);
+  const float *p = par->p;
+  return p[P_QA] > 0.0f && p[P_QC] > 0.0f
+    && p[P_QA] * p[P_QC] > p[P_QB] * p[P_QB]
+    && p[P_QA] + p[P_QC] <= qmax
+    && fabsf(p[P_X0] - win->cx) <= 0.5f * win->dist
+    && fabsf(p[P_Y0] - win->cy) <= 0.5f * win->dist;
+}
+
+/* ========================================================================= */
+int SStar_fitElliptic(
+  SStar_t             *star,
+  const SImage_t      *image,
+  const SBackground_t *bkg,
+  int                  steps,
+  float                tol)
+{
+  assert(image->format == SFmt_Gray);
+  assert(steps >= 0);
+
+  SFitWindow_t win;
+  if (!SFitWindow_init(&win, star->sigma)) return 0;
+  SFitWindow_load(&win, image, (int)star->pos[0], (int)star->pos[1]);
+  if (bkg != NULL) star->bias = SBackground_level(bkg, star->pos);
+
+  Params_t par = { .p = {
+    [P_X0] = star->pos[0],
+    [P_Y0] = star->pos[1],
+    [P_A]  = star->brightness,
+    [P_B]  = star->bias,
+    [P_QA] = 1.0f / (star->sigma * star->sigma),
+    [P_QB] = 0.0f,
+    [P_QC] = 1.0f / (star->sigma * star->sigma),
+  } };
+  initBrightness(&win, &par, bkg != NULL);
+
+  double jtj[P_N * P_N];
+  double jtr[P_N];
+  double lambda = 1e-3;
+  double chi2 = evaluate(&win, &par, jtj, jtr);
+  if (bkg != NULL) fixBias(jtj, jtr);
+  float  tol_sq = tol * tol;
+
+  int i;
+  for (i = 0; i < steps; i++) {
+    /* Solve damped normal equations */
+    double a[P_N * P_N];
+    double d[P_N];
+    double diag_max = 0.0;
+    for (int k = 0; k < P_N * P_N; k++) a[k] = jtj[k];
+    for (int k = 0; k < P_N; k++) {
+      if (jtj[k * P_N + k] > diag_max) diag_max = jtj[k * P_N + k];
+    }
+    for (int k = 0; k < P_N; k++) {
+      /* Small additive term keeps the system regular, e.g., for very faint
+       * stars, where the shape has almost no influence on the model. */
+      a[k * P_N + k] += lambda * jtj[k * P_N + k] + 1e-9 * diag_max;
+      d[k] = jtr[k];
+    }
+
+    Params_t np = par;
+    double nchi2 = chi2;
+    int ok = SLinAlg_solve(P_N, a, d);
+    if (ok) {
+      for (int k = 0; k < P_N; k++) np.p[k] += d[k];
+      ok = isValid(&win, &np);
+    }
+    if (ok) {
+      nchi2 = evaluate(&win, &np, NULL, NULL);
+      ok = nchi2 < chi2;
+    }
+
+    if (!ok) {
+      /* Rejected step -- move towards gradient descent */
+      lambda *= 10.0;
+      if (lambda > MAX_LAMBDA) break;
+      continue;
+    }
+
+    /* Accepted step -- move towards Gauss-Newton method */
+    float move_sq =
+      SVec2f_lengthSq(SVec2f(np.p[P_X0] - par.p[P_X0],
+                             np.p[P_Y0] - par.p[P_Y0]));
+    par = np;
+    lambda /= 10.0;
+    if (lambda < MIN_LAMBDA) lambda = MIN_LAMBDA;
+
+    if (move_sq < tol_sq && chi2 - nchi2 <= 1e-6 * chi2) {
+      i++;
+      break;
+    }
+
+    /* Move the window, when the star moves to another pixel. The background
+     * level is taken at the new position. */
+    int cx = (int)par.p[P_X0];
+    int cy = (int)par.p[P_Y0];
+    if (cx != win.cx || cy != win.cy) {
+      SFitWindow_load(&win, image, cx, cy);
+      if (bkg != NULL)
+        par.p[P_B] =
+          SBackground_level(bkg, SVec2f(par.p[P_X0], par.p[P_Y0]));
+    }
+
+    chi2 = evaluate(&win, &par, jtj, jtr);
+    if (bkg != NULL) fixBias(jtj, jtr);
+  }
+
+  SFitWindow_deinit(&win);
+
+  /* Convert the quadratic form to axes and angle. Eigenvalues of the form
+   * are 1/σ², and the first (longer) axis corresponds to the smaller one. The
+   * angle is in range (-π/2, π/2]. */
+  float qa = par.p[P_QA];
+  float qb = par.p[P_QB];
+  float qc = par.p[P_QC];
+  float mid  = 0.5f * (qa + qc);
+  float diff = sqrtf(0.25f * (qa - qc) * (qa - qc) + qb * qb);
+  float sx = 1.0f / sqrtf(mid - diff);
+  float sy = 1.0f / sqrtf(mid + diff);
+  float th = 0.5f * atan2f(2.0f * qb, qa - qc) + 0.5f * PI_F;
+  if (th > 0.5f * PI_F) th -= PI_F;
+
+  star->pos        = SVec2f(par.p[P_X0], par.p[P_Y0]);
+  star->brightness = par.p[P_A];
+  star->bias       = par.p[P_B];
+  star->sigmaX     = sx;
+  star->sigmaY     = sy;
+  star->theta      = th;
+  star->sigma      = sqrtf(sx * sy);
+  return i;
+}
@@ -0,0 +1,263 @@
+/* This file is part of Spica, released under MIT license.
+ * See LICENSE for details.
+ */
+
+/* Author: Piotr Polesiuk, 2022 */
+
+#include "SStarIndex.h"
+
+#include <limits.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Initial number of buckets */
+#define MIN_BUCKET_N 64
+/* Cell coordinates are clamped to this range */
+#define MAX_CELL     (1 << 28)
+/* Cell coordinate of stars that are not in any bucket (e.g., with NaN
+ * positions) */
+#define NO_CELL      INT_MIN
+
+/* ========================================================================= */
+void SStarIndex_init(SStarIndex_t *idx) {
+  idx->cellSize = 16.0f;
+  idx->maxSigma = 0.0f;
+  idx->length   = 0;
+  idx->capacity = 0;
+  idx->bucketN  = MIN_BUCKET_N;
+  idx->head     = malloc(sizeof(int) * idx->bucketN);
+  idx->next     = NULL;
+  idx->cellX    = NULL;
+  idx->cellY    = NULL;
+  for (size_t i = 0; i < idx->bucketN; i++) idx->head[i] = -1;
+}
+
+void SStarIndex_deinit(SStarIndex_t *idx) {
+  free(idx->head);
+  free(idx->next);
+  free(idx->cellX);
+  free(idx->cellY);
+}
+
+SStarIndex_t *SStarIndex_alloc(void) {
+  SStarIndex_t *idx = malloc(sizeof(SStarIndex_t));
+  if (idx == NULL) return NULL;
+
+  SStarIndex_init(idx);
+  return idx;
+}
+
+void SStarIndex_free(SStarIndex_t *idx) {
+  if (idx == NULL) return;
+  SStarIndex_deinit(idx);
+  free(idx);
+}
+
+/* ------------------------------------------------------------------------- */
+static int *cloneArray(const int *arr, size_t n) {
+  if (arr == NULL) return NULL;
+  int *result = malloc(sizeof(int) * n);
+  memcpy(result, arr, sizeof(int) * n);
+  return result;
+}
+
+void SStarIndex_clone_at(SStarIndex_t *dst, const SStarIndex_t *idx) {
+  *dst = *idx;
+  dst->head  = cloneArray(idx->head,  idx->bucketN);
+  dst->next  = cloneArray(idx->next,  idx->capacity);
+  dst->cellX = cloneArray(idx->cellX, idx->capacity);
+  dst->cellY = cloneArray(idx->cellY, idx->capacity);
+}
+
+/* ========================================================================= */
+static int cellCoord(const SStarIndex_t *idx, float v) {
+  float c = floorf(v / idx->cellSize);
+  if (c < -MAX_CELL) return -MAX_CELL;
+  if (c > MAX_CELL)  return MAX_CELL;
+  return (int)c;
+}
+
+static size_t bucketOf(const SStarIndex_t *idx, int cx, int cy) {
+  uint32_t h = (uint32_t)cx * 73856093u ^ (uint32_t)cy * 19349663u;
+  h ^= h >> 15;
+  return h & (idx->bucketN - 1);
+}
+
+/* ------------------------------------------------------------------------- */
+static void linkStar(SStarIndex_t *idx, const SStarSet_t *sset, size_t i) {
+  SVec2f_t pos = sset->data[i].pos;
+  if (!isfinite(pos[0]) || !isfinite(pos[1])) {
+    idx->cellX[i] = NO_CELL;
+    idx->cellY[i] = NO_CELL;
+    return;
+  }
+
+  int cx = cellCoord(idx, pos[0]);
+  int cy = cellCoord(idx, pos[1]);
+  size_t b = bucketOf(idx, cx, cy);
+  idx->cellX[i] = cx;
+  idx->cellY[i] = cy;
+  idx->next[i]  = idx->head[b];
+  idx->head[b]  = i;
+
+  float sigma = sset->data[i].sigma;
+  if (sigma > idx->maxSigma) idx->maxSigma = sigma;
+}
+
+static void unlinkStar(SStarIndex_t *idx, size_t i) {
+  if (idx->cellX[i] == NO_CELL) return;
+
+  int *p = &idx->head[bucketOf(idx, idx->cellX[i], idx->cellY[i])];
+  while (*p != (int)i) p = &idx->next[*p];
+  *p = idx->next[i];
+}
+
+/* ------------------------------------------------------------------------- */
+/* Rebuild the hash table with given number of buckets */
+static void rehash(SStarIndex_t *idx, const SStarSet_t *sset, size_t n) {
+  free(idx->head);
+  idx->bucketN = n;
+  idx->head    = malloc(sizeof(int) * n);
+  for (size_t b = 0; b < n; b++) idx->head[b] = -1;
+  for (size_t i = 0; i < idx->length; i++) linkStar(idx, sset, i);
+}
+
+/* ========================================================================= */
+void SStarIndex_clear(SStarIndex_t *idx) {
+  idx->length   = 0;
+  idx->maxSigma = 0.0f;
+  for (size_t b = 0; b < idx->bucketN; b++) idx->head[b] = -1;
+}
+
+void SStarIndex_build(SStarIndex_t *idx, const SStarSet_t *sset) {
+  SStarIndex_clear(idx);
+  SStarIndex_add(idx, sset);
+}
+
+/* ------------------------------------------------------------------------- */
+void SStarIndex_add(SStarIndex_t *idx, const SStarSet_t *sset) {
+  if (sset->length <= idx->length) return;
+
+  if (sset->length > idx->capacity) {
+    idx->capacity = sset->length + (sset->length >> 1);
+    idx->next  = realloc(idx->next,  sizeof(int) * idx->capacity);
+    idx->cellX = realloc(idx->cellX, sizeof(int) * idx->capacity);
+    idx->cellY = realloc(idx->cellY, sizeof(int) * idx->capacity);
+  }
+
+  size_t old_length = idx->length;
+  idx->length = sset->length;
+
+  /* Keep the load factor of the hash table below 1 */
+  if (idx->length > idx->bucketN) {
+    size_t n = idx->bucketN;
+    while (n < idx->length) n *= 2;
+    rehash(idx, sset, 2 * n);
+  } else {
+    for (size_t i = old_length; i < idx->length; i++) linkStar(idx, sset, i);
+  }
+}
+
+/* ------------------------------------------------------------------------- */
+void SStarIndex_move(SStarIndex_t *idx, const SStarSet_t *sset, size_t i) {
+  /* Stars that are not indexed yet will be linked by SStarIndex_add */
+  if (i >= idx->length) return;
+
+  unlinkStar(idx, i);
+  linkStar(idx, sset, i);
+}
+
+/* ------------------------------------------------------------------------- */
+int SStarIndex_isValid(const SStarIndex_t *idx, const SStarSet_t *sset) {
+  if (idx->length != sset->length) return 0;
+
+  for (size_t i = 0; i < idx->length; i++) {
+    SVec2f_t pos = sset->data[i].pos;
+    if (!isfinite(pos[0]) || !isfinite(pos[1])) {
+      if (idx->cellX[i] != NO_CELL) return 0;
+      continue;
+    }
+    if (idx->cellX[i] != cellCoord(idx, pos[0]) ||
+        idx->cellY[i] != cellCoord(idx, pos[1]) ||
+        !(sset->data[i].sigma <= idx->maxSigma))
+      return 0;
+  }
+  return 1;
+}
+
+/* ========================================================================= */
+typedef struct Query {
+  SVec2f_t pos;
+  float    sigma;
+  float    max_dist_sq;
+  int      best_idx;
+  float    best_dist;
+} Query_t;
+
+static void checkStar(Query_t *q, const SStarSet_t *sset, int i) {
+  float dist =
+    SVec2f_lengthSq(q->pos - sset->data[i].pos) /
+      (q->sigma * sset->data[i].sigma);
+  /* Stars exactly at max_dist are matched too */
+  if (!(dist <= q->max_dist_sq)) return;
+  /* On ties, the lowest index wins */
+  if (q->best_idx < 0 || dist < q->best_dist ||
+      (dist == q->best_dist && i < q->best_idx))
+  {
+    q->best_idx  = i;
+    q->best_dist = dist;
+  }
+}
+
+/* ------------------------------------------------------------------------- */
+int SStarIndex_nearest(
+  const SStarIndex_t *idx,
+  const SStarSet_t   *sset,
+  SVec2f_t            pos,
+  float               sigma,
+  float               max_dist,
+  float              *dist_sq)
+{
+  if (!isfinite(pos[0]) || !isfinite(pos[1])) return -1;
+
+  /* Distance in pixels that corresponds to max_dist for the largest star,
+   * slightly enlarged to be on the safe side of rounding errors. */
+  float radius = max_dist * sqrtf(sigma * idx->maxSigma) * 1.001f + 1e-3f;
+  if (!(radius >= 0.0f)) return -1;
+
+  Query_t q = {
+    .pos         = pos,
+    .sigma       = sigma,
+    .max_dist_sq = max_dist * max_dist,
+    .best_idx    = -1,
+    .best_dist   = 0.0f
+  };
+
+  int x0 = cellCoord(idx, pos[0] - radius);
+  int x1 = cellCoord(idx, pos[0] + radius);
+  int y0 = cellCoord(idx, pos[1] - radius);
+  int y1 = cellCoord(idx, pos[1] + radius);
+
+  if ((double)(x1 - x0 + 1) * (y1 - y0 + 1) > (double)idx->length) {
+    /* For very large radius, scanning all stars is faster */
+    for (size_t i = 0; i < idx->length; i++) {
+      if (idx->cellX[i] != NO_CELL) checkStar(&q, sset, i);
+    }
+  } else {
+    for (int cy = y0; cy <= y1; cy++) {
+      for (int cx = x0; cx <= x1; cx++) {
+        size_t b = bucketOf(idx, cx, cy);
+        for (int i = idx->head[b]; i >= 0; i = idx->next[i]) {
+          /* Other cells may be stored in the same bucket */
+          if (idx->cellX[i] == cx && idx->cellY[i] == cy)
+            checkStar(&q, sset, i);
+        }
+      }
+    }
+  }
+
+  if (dist_sq != NULL) *dist_sq = q.best_dist;
+  return q.best_idx;
+}
@@ -10,7 +10,17 @@
 
 void SStarMatcher_clone_at(SStarMatcher_t *dst, const SStarMatcher_t *sm) {
   SStarSet_clone_at(&dst->sset, &sm->sset);
-  dst->distThreshold = sm->distThreshold;
+  dst->distThreshold  = sm->distThreshold;
+  dst->model          = sm->model;
+  dst->polyOrder      = sm->polyOrder;
+  dst->distortion     = sm->distortion;
+  dst->pruneInterval  = sm->pruneInterval;
+  dst->pruneMinWeight = sm->pruneMinWeight;
+  dst->maxStars       = sm->maxStars;
+  dst->updateN        = sm->updateN;
+  dst->nextId         = sm->nextId;
+  dst->pruneIdMark    = sm->pruneIdMark;
+  SStarIndex_clone_at(&dst->index, &sm->index);
 }
 
 SStarMatcher_t *SStarMatcher_clone(const SStarMatcher_t *sm) {
@@ -10,11 +10,22 @@
 
 void SStarMatcher_init(SStarMatcher_t *sm) {
   SStarSet_init(&sm->sset);
-  sm->distThreshold = 1.4;
+  sm->distThreshold  = 1.4;
+  sm->model          = STr_Linear;
+  sm->polyOrder      = 3;
+  sm->distortion     = (STransformPoly_t){ .order = 0 };
+  sm->pruneInterval  = 0;
+  sm->pruneMinWeight = 2;
+  sm->maxStars       = -1;
+  sm->updateN        = 0;
+  sm->nextId         = 0;
+  sm->pruneIdMark    = 0;
+  SStarIndex_init(&sm->index);
 }
 
 void SStarMatcher_deinit(SStarMatcher_t *sm) {
   SStarSet_deinit(&sm->sset);
+  SStarIndex_deinit(&sm->index);
 }
 
 SStarMatcher_t *SStarMatcher_alloc(void) {
@@ -5,22 +5,123 @@
 /* Author: Piotr Polesiuk, 2022 */
 
 #include "SStarMatcher.h"
+#include "SLinAlg.h"
+#include "SPolyFit.h"
 
-STransform_t SStarMatcher_getTransform(
-  const SStarMatcher_t *sm, const SStarSet_t *sset)
+#include <math.h>
+#include <stdlib.h>
+
+static STransform_t dropTransform(void) {
+  STransform_t tr = {
+    .type  = STr_Drop,
+    .rot   = { 1.0f, 0.0f },
+    .shift = { 0.0f, 0.0f }
+  };
+  return tr;
+}
+
+/* ========================================================================= */
+/* Positions of matched stars (x) and corresponding reference stars (y) */
+typedef struct Pairs {
+  SVec2f_t *x;
+  SVec2f_t *y;
+  size_t    n;
+} Pairs_t;
+
+static void collectPairs(
+  Pairs_t *pairs, const SStarMatcher_t *sm, const SStarSet_t *sset)
 {
+  pairs->x = malloc(sizeof(SVec2f_t) * (sset->length + 1));
+  pairs->y = malloc(sizeof(SVec2f_t) * (sset->length + 1));
+  pairs->n = 0;
+  for (size_t i = 0; i < sset->length; i++) {
+    int idx = sset->data[i].index;
+    if (idx < 0 || idx >= sm->sset.length) continue;
+
+    pairs->x[pairs->n] = sset->data[i].pos;
+    pairs->y[pairs->n] = sm->sset.data[idx].pos;
+    pairs->n++;
+  }
+}
+
+/* ------------------------------------------------------------------------- */
+/* Similarity that moves the centroid of points to the origin, and scales
+ * them to the unit RMS distance from it. It improves the conditioning of
+ * normal equations. */
+typedef struct Normalization {
+  double cx, cy;
+  double scale;
+} Normalization_t;
+
+static Normalization_t normalization(const SVec2f_t *p, size_t n) {
+  Normalization_t nrm = { 0.0, 0.0, 1.0 };
+  for (size_t i = 0; i < n; i++) {
+    nrm.cx += p[i][0];
+    nrm.cy += p[i][1];
+  }
+  nrm.cx /= n;
+  nrm.cy /= n;
+
+  double d2 = 0.0;
+  for (size_t i = 0; i < n; i++) {
+    double dx = p[i][0] - nrm.cx;
+    double dy = p[i][1] - nrm.cy;
+    d2 += dx * dx + dy * dy;
+  }
+  if (d2 > 0.0) nrm.scale = 1.0 / sqrt(d2 / n);
+  return nrm;
+}
+
+/* Matrix of the transformation that maps normalized coordinates of x to
+ * coordinates of y, i.e., inv(ny) · h · nx */
+static STransform_t denormalize(
+  STransformType_t type, double h[3][3],
+  const Normalization_t *nx, const Normalization_t *ny)
+{
+  double t[3][3];
+  for (int i = 0; i < 3; i++) {
+    t[i][0] = h[i][0] * nx->scale;
+    t[i][1] = h[i][1] * nx->scale;
+    t[i][2] = h[i][2] - (h[i][0] * nx->cx + h[i][1] * nx->cy) * nx->scale;
+  }
+
+  float m[3][3];
+  for (int j = 0; j < 3; j++) {
+    m[0][j] = t[0][j] / ny->scale + ny->cx * t[2][j];
+    m[1][j] = t[1][j] / ny->scale + ny->cy * t[2][j];
+    m[2][j] = t[2][j];
+  }
+
+  if (type == STr_Projective) {
+    if (m[2][2] == 0.0f) return dropTransform();
+    float w = m[2][2];
+    for (int i = 0; i < 3; i++) {
+      for (int j = 0; j < 3; j++) m[i][j] /= w;
+    }
+  }
+  return STransform_matrix(type, &m[0][0]);
+}
+
+/* ========================================================================= */
+static STransform_t fitShift(const Pairs_t *pairs) {
+  if (pairs->n < 1) return dropTransform();
+
+  SVec2f_t s = { 0.0f, 0.0f };
+  for (size_t i = 0; i < pairs->n; i++) s += pairs->y[i] - pairs->x[i];
+  return STransform_shift(s / (float)pairs->n);
+}
+
+/* ------------------------------------------------------------------------- */
+static STransform_t fitLinear(const Pairs_t *pairs) {
   SVec2f_t sx  = { 0.0f, 0.0f };
   SVec2f_t sy  = { 0.0f, 0.0f };
   SVec2f_t sxy = { 0.0f, 0.0f };
   float sx2  = 0.0f;
   float tot  = 0.0f;
 
-  for (size_t i = 0; i < sset->length; i++) {
-    int idx = sset->data[i].index;
-    if (idx < 0 || idx >= sm->sset.length) continue;
-
-    SVec2f_t x = sset->data[i].pos;
-    SVec2f_t y = sm->sset.data[idx].pos;
+  for (size_t i = 0; i < pairs->n; i++) {
+    SVec2f_t x = pairs->x[i];
+    SVec2f_t y = pairs->y[i];
 
     sx += x;
     sy += y;
@@ -35,9 +136,7 @@ STransform_t SStarMatcher_getTransform(
   sx2 *= tot;
   float s2x = SVec2f_lengthSq(sx);
   if (sx2 == s2x) {
-    tr.type  = STr_Drop;
-    tr.rot   = SVec2f(1.0f, 0.0f);
-    tr.shift = SVec2f(0.0f, 0.0f);
+    tr = dropTransform();
   } else {
     tr.type  = STr_Linear;
     tr.rot   = (sxy - SVec2f_complexMul(SVec2f_complexConj(sx), sy)) /
@@ -46,3 +145,132 @@ STransform_t SStarMatcher_getTransform(
   }
   return tr;
 }
+
+/* ------------------------------------------------------------------------- */
+/* Each row of the affine matrix is fitted independently, but both rows
+ * share the same normal matrix. */
+static STransform_t fitAffine(const Pairs_t *pairs) {
+  if (pairs->n < 3) return dropTransform();
+
+  Normalization_t nx = normalization(pairs->x, pairs->n);
+  Normalization_t ny = normalization(pairs->y, pairs->n);
+
+  double a[9] = { 0.0 };
+  double b[2][3] = { { 0.0 } };
+  for (size_t i = 0; i < pairs->n; i++) {
+    double p[3] = {
+      (pairs->x[i][0] - nx.cx) * nx.scale,
+      (pairs->x[i][1] - nx.cy) * nx.scale,
+      1.0
+    };
+    double u = (pairs->y[i][0] - ny.cx) * ny.scale;
+    double v = (pairs->y[i][1] - ny.cy) * ny.scale;
+    for (int j = 0; j < 3; j++) {
+      for (int k = 0; k < 3; k++) a[3*j + k] += p[j] * p[k];
+      b[0][j] += p[j] * u;
+      b[1][j] += p[j] * v;
+    }
+  }
+
+  double h[3][3] = { { 0.0 }, { 0.0 }, { 0.0, 0.0, 1.0 } };
+  for (int r = 0; r < 2; r++) {
+    double ac[9];
+    for (int j = 0; j < 9; j++) ac[j] = a[j];
+    if (!SLinAlg_solve(3, ac, b[r])) return dropTransform();
+    for (int j = 0; j < 3; j++) h[r][j] = b[r][j];
+  }
+  return denormalize(STr_Affine, h, &nx, &ny);
+}
+
+/* ------------------------------------------------------------------------- */
+/* Direct linear transformation: the last element of the matrix is fixed to
+ * one, and the equations u·(g·x + h·y + 1) = a·x + b·y + c (and similar for
+ * v) are solved in the least squares sense. */
+#define PROJ_N 8
+
+static STransform_t fitProjective(const Pairs_t *pairs) {
+  if (pairs->n < 4) return dropTransform();
+
+  Normalization_t nx = normalization(pairs->x, pairs->n);
+  Normalization_t ny = normalization(pairs->y, pairs->n);
+
+  double a[PROJ_N * PROJ_N] = { 0.0 };
+  double b[PROJ_N] = { 0.0 };
+  for (size_t i = 0; i < pairs->n; i++) {
+    double x = (pairs->x[i][0] - nx.cx) * nx.scale;
+    double y = (pairs->x[i][1] - nx.cy) * nx.scale;
+    double u = (pairs->y[i][0] - ny.cx) * ny.scale;
+    double v = (pairs->y[i][1] - ny.cy) * ny.scale;
+    double rows[2][PROJ_N + 1] = {
+      { x, y, 1.0, 0.0, 0.0, 0.0, -x * u, -y * u, u },
+      { 0.0, 0.0, 0.0, x, y, 1.0, -x * v, -y * v, v }
+    };
+    for (int r = 0; r < 2; r++) {
+      for (int j = 0; j < PROJ_N; j++) {
+        for (int k = 0; k < PROJ_N; k++)
+          a[PROJ_N*j + k] += rows[r][j] * rows[r][k];
+        b[j] += rows[r][j] * rows[r][PROJ_N];
+      }
+    }
+  }
+
+  if (!SLinAlg_solve(PROJ_N, a, b)) return dropTransform();
+
+  double h[3][3] = {
+    { b[0], b[1], b[2] },
+    { b[3], b[4], b[5] },
+    { b[6], b[7], 1.0  }
+  };
+  return denormalize(STr_Projective, h, &nx, &ny);
+}
+
+/* ------------------------------------------------------------------------- */
+static STransform_t fitPolynomial(
+  const SStarMatcher_t *sm, const Pairs_t *pairs)
+{
+  if (sm->distortion.order < 2)
+    return SPolyFit_fit(sm->polyOrder, pairs->x, pairs->y, pairs->n);
+
+  /* Fixed distortion: fit the affine part to distorted positions */
+  for (size_t i = 0; i < pairs->n; i++)
+    pairs->x[i] = STransformPoly_apply(&sm->distortion, pairs->x[i]);
+  STransform_t tr = fitAffine(pairs);
+  if (tr.type == STr_Drop) return tr;
+
+  tr.type = STr_Polynomial;
+  tr.poly = sm->distortion;
+  return tr;
+}
+
+/* ========================================================================= */
+STransform_t SStarMatcher_getTransform(
+  const SStarMatcher_t *sm, const SStarSet_t *sset)
+{
+  Pairs_t pairs;
+  collectPairs(&pairs, sm, sset);
+
+  STransform_t tr = dropTransform();
+  switch (sm->model) {
+  case STr_Shift:
+    tr = fitShift(&pairs);
+    break;
+  case STr_Drop:
+  case STr_Identity:
+  case STr_Linear:
+    tr = fitLinear(&pairs);
+    break;
+  case STr_Affine:
+    tr = fitAffine(&pairs);
+    break;
+  case STr_Projective:
+    tr = fitProjective(&pairs);
+    break;
+  case STr_Polynomial:
+    tr = fitPolynomial(sm, &pairs);
+    break;
+  }
+
+  free(pairs.x);
+  free(pairs.y);
+  return tr;
+}
@@ -0,0 +1,58 @@
+/* This file is part of Spica, released under MIT license.
+ * See LICENSE for details.
+ */
+
+/* Author: Piotr Polesiuk, 2022 */
+
+#include "SStarMatcher.h"
+
+#include "SDataRepr.h"
+
+#include <stdint.h>
+
+/* Counters of the matcher, followed by the distortion and the reference
+ * set */
+typedef struct StateHeader {
+  int32_t update_n;
+  int32_t next_id;
+  int32_t prune_id_mark;
+  int32_t reserved;
+} StateHeader_t;
+
+int SStarMatcher_write(const SStarMatcher_t *sm, FILE *file) {
+  StateHeader_t header = {
+    .update_n      = SLittleEndian32(sm->updateN),
+    .next_id       = SLittleEndian32(sm->nextId),
+    .prune_id_mark = SLittleEndian32(sm->pruneIdMark),
+    .reserved      = 0
+  };
+  if (fwrite(&header, sizeof(header), 1, file) != 1 ||
+      STransformPoly_write(&sm->distortion, file) != SPICA_OK ||
+      SStarSet_write(&sm->sset, file) != SPICA_OK)
+    return SPICA_ERROR;
+  return SPICA_OK;
+}
+
+int SStarMatcher_read(SStarMatcher_t *sm, FILE *file) {
+  StateHeader_t    header;
+  STransformPoly_t distortion;
+  SStarSet_t       sset;
+
+  SStarSet_init(&sset);
+  if (fread(&header, sizeof(header), 1, file) != 1 ||
+      STransformPoly_read(&distortion, file) != SPICA_OK ||
+      SStarSet_read(&sset, file) != SPICA_OK)
+  {
+    SStarSet_deinit(&sset);
+    return SPICA_ERROR;
+  }
+
+  SStarSet_deinit(&sm->sset);
+  sm->sset        = sset;
+  sm->distortion  = distortion;
+  sm->updateN     = (int32_t)SLittleEndian32(header.update_n);
+  sm->nextId      = (int32_t)SLittleEndian32(header.next_id);
+  sm->pruneIdMark = (int32_t)SLittleEndian32(header.prune_id_mark);
+  SStarIndex_build(&sm->index, &sm->sset);
+  return SPICA_OK;
+}
@@ -6,40 +6,52 @@
 
 #include "SStarMatcher.h"
 
+#include <stdlib.h>
+
 static void matchStar(
-  const SStarMatcher_t *sm, const STransform_t *tr, SStar_t *star)
+  const SStarMatcher_t *sm,
+  const SStarIndex_t   *index,
+  SVec2f_t              pos,
+  SStar_t              *star)
 {
   star->index = -1;
+  star->id    = -1;
 
   if (sm->sset.length == 0) {
     return;
   }
 
-  SVec2f_t pos = STransform_apply(tr, star->pos);
-  float sigma = star->sigma;
-
-  size_t best_index = 0;
-  float best_dist = SVec2f_lengthSq(pos - sm->sset.data[0].pos);
-  best_dist /= sigma * sm->sset.data[0].sigma;
-
-  for (size_t i = 1; i < sm->sset.length; i++) {
-    float dist = SVec2f_lengthSq(pos - sm->sset.data[i].pos);
-    dist /= sigma * sm->sset.data[i].sigma;
-    if (dist < best_dist) {
-      best_index = i;
-      best_dist  = dist;
-    }
-  }
+  float best_dist;
+  int best_index = SStarIndex_nearest(index, &sm->sset,
+    pos, star->sigma, sm->distThreshold, &best_dist);
 
-  if (best_dist < sm->distThreshold * sm->distThreshold) {
+  if (best_index >= 0 && best_dist < sm->distThreshold * sm->distThreshold) {
     star->index = best_index;
+    star->id    = sm->sset.data[best_index].id;
   }
 }
 
 void SStarMatcher_matchStars(
   const SStarMatcher_t *sm, const STransform_t *tr, SStarSet_t *sset)
 {
+  /* The reference set was modified directly: use temporary index */
+  SStarIndex_t tmp_index;
+  const SStarIndex_t *index = &sm->index;
+  if (!SStarIndex_isValid(&sm->index, &sm->sset)) {
+    SStarIndex_init(&tmp_index);
+    SStarIndex_build(&tmp_index, &sm->sset);
+    index = &tmp_index;
+  }
+
+  SVec2f_t *pos = malloc(sizeof(SVec2f_t) * (sset->length + 1));
+  for (size_t i = 0; i < sset->length; i++) pos[i] = sset->data[i].pos;
+  STransform_applyBatch(tr, pos, pos, sset->length);
+
   for (size_t i = 0; i < sset->length; i++) {
-    matchStar(sm, tr, &sset->data[i]);
+    matchStar(sm, index, pos[i], &sset->data[i]);
   }
+  free(pos);
+
+  if (index == &tmp_index)
+    SStarIndex_deinit(&tmp_index);
 }
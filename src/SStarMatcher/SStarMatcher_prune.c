@@ -0,0 +1,105 @@
+/* This file is part of Spica, released under MIT license.
+ * See LICENSE for details.
+ */
+
+/* Author: Piotr Polesiuk, 2022 */
+
+#include "SStarMatcher.h"
+
+#include <stdlib.h>
+
+/* Reference star considered by the brightness limit */
+typedef struct Ranked {
+  float brightness;
+  int   index;
+} Ranked_t;
+
+static int compareRanked(const void *p1, const void *p2) {
+  const Ranked_t *r1 = p1;
+  const Ranked_t *r2 = p2;
+  if (r1->brightness > r2->brightness) return -1;
+  if (r1->brightness < r2->brightness) return 1;
+  return (r1->index > r2->index) - (r1->index < r2->index);
+}
+
+/* Keep only max_n brightest stars among those marked in keep array */
+static void limitStars(
+  const SStarSet_t *sset, char *keep, size_t kept_n, size_t max_n)
+{
+  Ranked_t *ranked = malloc(sizeof(Ranked_t) * (kept_n + 1));
+  size_t n = 0;
+  for (size_t i = 0; i < sset->length; i++) {
+    if (!keep[i]) continue;
+    ranked[n].brightness = sset->data[i].brightness;
+    ranked[n].index      = i;
+    n++;
+  }
+  qsort(ranked, n, sizeof(Ranked_t), compareRanked);
+
+  for (size_t k = max_n; k < n; k++) keep[ranked[k].index] = 0;
+  free(ranked);
+}
+
+/* ========================================================================= */
+void SStarMatcher_prune(SStarMatcher_t *sm, SStarSet_t *sset) {
+  size_t n = sm->sset.length;
+  char *keep  = malloc(n + 1);
+  int  *remap = malloc(sizeof(int) * (n + 1));
+
+  size_t kept_n = 0;
+  for (size_t i = 0; i < n; i++) {
+    const SStar_t *star = &sm->sset.data[i];
+    /* Young stars had no chance to gain weight yet */
+    keep[i] =
+      star->weight >= sm->pruneMinWeight || star->id >= sm->pruneIdMark;
+    kept_n += keep[i];
+  }
+
+  if (sm->maxStars >= 0 && kept_n > (size_t)sm->maxStars)
+    limitStars(&sm->sset, keep, kept_n, sm->maxStars);
+
+  /* Compaction that preserves the order of stars */
+  size_t j = 0;
+  for (size_t i = 0; i < n; i++) {
+    if (keep[i]) {
+      sm->sset.data[j] = sm->sset.data[i];
+      remap[i] = j++;
+    } else {
+      remap[i] = -1;
+    }
+  }
+  sm->sset.length = j;
+
+  if (sset != NULL) {
+    for (size_t i = 0; i < sset->length; i++) {
+      int idx = sset->data[i].index;
+      if (idx < 0 || idx >= (int)n) continue;
+      sset->data[i].index = remap[idx];
+      if (remap[idx] < 0) sset->data[i].id = -1;
+    }
+  }
+
+  SStarIndex_build(&sm->index, &sm->sset);
+  sm->updateN     = 0;
+  sm->pruneIdMark = sm->nextId;
+
+  free(keep);
+  free(remap);
+}
+
+/* ========================================================================= */
+int SStarMatcher_indexOf(const SStarMatcher_t *sm, int id) {
+  if (id < 0) return -1;
+
+  /* Stars are added with increasing ids, and pruning preserves the order,
+   * so ids are sorted */
+  size_t lo = 0;
+  size_t hi = sm->sset.length;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (sm->sset.data[mid].id < id) lo = mid + 1;
+    else hi = mid;
+  }
+  if (lo < sm->sset.length && sm->sset.data[lo].id == id) return lo;
+  return -1;
+}
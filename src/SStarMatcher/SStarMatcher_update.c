@@ -6,19 +6,27 @@
 
 #include "SStarMatcher.h"
 
+#include <stdlib.h>
+
 void SStarMatcher_update(
   SStarMatcher_t *sm, const STransform_t *tr, SStarSet_t *sset)
 {
+  SVec2f_t *aligned = malloc(sizeof(SVec2f_t) * (sset->length + 1));
+  for (size_t i = 0; i < sset->length; i++) aligned[i] = sset->data[i].pos;
+  STransform_applyBatch(tr, aligned, aligned, sset->length);
+
   for (size_t i = 0; i < sset->length; i++) {
-    SVec2f_t pos = STransform_apply(tr, sset->data[i].pos);
+    SVec2f_t pos = aligned[i];
     int idx = sset->data[i].index;
     if (idx < 0 || idx >= sm->sset.length) {
       idx = sm->sset.length;
       SStarSet_add(&sm->sset, &sset->data[i]);
       sm->sset.data[idx].pos    = pos;
       sm->sset.data[idx].index  = -1;
+      sm->sset.data[idx].id     = sm->nextId++;
       sm->sset.data[idx].weight = 1;
       sset->data[i].index = idx;
+      sset->data[i].id    = sm->sset.data[idx].id;
     } else {
       float w = sm->sset.data[idx].weight;
       pos += sm->sset.data[idx].pos * w;
@@ -30,6 +38,14 @@ void SStarMatcher_update(
         (sm->sset.data[idx].bias * w + sset->data[i].bias) / (w+1);
       sm->sset.data[idx].sigma =
         (sm->sset.data[idx].sigma * w + sset->data[i].sigma) / (w+1);
+      SStarIndex_move(&sm->index, &sm->sset, idx);
+      sset->data[i].id = sm->sset.data[idx].id;
     }
   }
+  SStarIndex_add(&sm->index, &sm->sset);
+  free(aligned);
+
+  sm->updateN++;
+  if (sm->pruneInterval > 0 && sm->updateN >= sm->pruneInterval)
+    SStarMatcher_prune(sm, sset);
 }
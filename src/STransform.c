@@ -5,11 +5,178 @@
 /* Author: Piotr Polesiuk, 2022 */
 
 #include "STransform.h"
+#include "SPolyFit.h"
 
 #include <assert.h>
+#include <math.h>
+#include <string.h>
 
+/* Newton's method used to invert polynomial distortion */
+#define NEWTON_MAX_STEPS 20
+#define NEWTON_EPS       1e-5
+
+/* Polynomial transformations that cannot be expressed exactly (inverses and
+ * some compositions) are approximated by polynomials of the maximal order,
+ * fitted on a regular grid of SAMPLE_N × SAMPLE_N points, spanning
+ * SAMPLE_RANGE units of the distortion from its center. */
+#define SAMPLE_N     13
+#define SAMPLE_RANGE 1.5f
+
+/* Number of segments of each edge of a bounding box transformed by
+ * a polynomial transformation */
+#define BB_EDGE_STEPS 16
+
+STransform_t STransform_matrix(STransformType_t type, const float *mat) {
+  STransform_t tr = {
+    .type  = type,
+    .rot   = { 1.0f, 0.0f },
+    .shift = { 0.0f, 0.0f }
+  };
+  memcpy(tr.mat, mat, sizeof(tr.mat));
+  if (type == STr_Affine || type == STr_Polynomial) {
+    tr.mat[2][0] = 0.0f;
+    tr.mat[2][1] = 0.0f;
+    tr.mat[2][2] = 1.0f;
+  }
+  return tr;
+}
+
+/* Matrix of any transformation other than STr_Drop. For polynomial
+ * transformations, it is the matrix of the affine part. */
+static void toMatrix(const STransform_t *tr, float m[3][3]) {
+  switch (tr->type) {
+  case STr_Affine:
+  case STr_Projective:
+  case STr_Polynomial:
+    memcpy(m, tr->mat, sizeof(tr->mat));
+    return;
+  case STr_Drop:
+  case STr_Identity:
+  case STr_Shift:
+  case STr_Linear:
+    break;
+  }
+  SVec2f_t rot   = tr->type == STr_Linear ? tr->rot : SVec2f(1.0f, 0.0f);
+  SVec2f_t shift = tr->type == STr_Identity ? SVec2f(0.0f, 0.0f) : tr->shift;
+  m[0][0] = rot[0]; m[0][1] = -rot[1]; m[0][2] = shift[0];
+  m[1][0] = rot[1]; m[1][1] =  rot[0]; m[1][2] = shift[1];
+  m[2][0] = 0.0f;   m[2][1] = 0.0f;    m[2][2] = 1.0f;
+}
+
+/* ========================================================================= */
+SVec2f_t STransformPoly_apply(const STransformPoly_t *poly, SVec2f_t v) {
+  if (poly->order < 2) return v;
+
+  double phi[(STRANSFORM_POLY_MAX_ORDER + 1) * (STRANSFORM_POLY_MAX_ORDER + 2)
+    / 2];
+  SPolyFit_monomials(poly->order,
+    (v[0] - poly->center[0]) * poly->scale,
+    (v[1] - poly->center[1]) * poly->scale, phi);
+
+  int    n  = SPolyFit_monomialN(poly->order);
+  double dx = 0.0;
+  double dy = 0.0;
+  for (int k = 3; k < n; k++) {
+    dx += poly->coef[k - 3][0] * phi[k];
+    dy += poly->coef[k - 3][1] * phi[k];
+  }
+  return v + SVec2f(dx, dy);
+}
+
+/* Distortion of point (x, y) and the Jacobian matrix of the distorted
+ * point */
+static void distortJacobian(
+  const STransformPoly_t *poly, double x, double y,
+  double result[2], double jac[2][2])
+{
+  double u = (x - poly->center[0]) * poly->scale;
+  double v = (y - poly->center[1]) * poly->scale;
+  double pu[STRANSFORM_POLY_MAX_ORDER + 1];
+  double pv[STRANSFORM_POLY_MAX_ORDER + 1];
+  pu[0] = pv[0] = 1.0;
+  for (int k = 1; k <= poly->order; k++) {
+    pu[k] = pu[k-1] * u;
+    pv[k] = pv[k-1] * v;
+  }
+
+  result[0] = x;
+  result[1] = y;
+  jac[0][0] = jac[1][1] = 1.0;
+  jac[0][1] = jac[1][0] = 0.0;
+
+  int k = 0;
+  for (int d = 2; d <= poly->order; d++) {
+    for (int j = 0; j <= d; j++, k++) {
+      int    i  = d - j;
+      double m  = pu[i] * pv[j];
+      double du = i > 0 ? i * pu[i-1] * pv[j] * poly->scale : 0.0;
+      double dv = j > 0 ? j * pu[i] * pv[j-1] * poly->scale : 0.0;
+      for (int c = 0; c < 2; c++) {
+        result[c] += poly->coef[k][c] * m;
+        jac[c][0] += poly->coef[k][c] * du;
+        jac[c][1] += poly->coef[k][c] * dv;
+      }
+    }
+  }
+}
+
+SVec2f_t STransformPoly_applyInverse(const STransformPoly_t *poly, SVec2f_t v)
+{
+  if (poly->order < 2) return v;
+
+  double x = v[0];
+  double y = v[1];
+  for (int step = 0; step < NEWTON_MAX_STEPS; step++) {
+    double f[2], jac[2][2];
+    distortJacobian(poly, x, y, f, jac);
+    f[0] -= v[0];
+    f[1] -= v[1];
+
+    double det = jac[0][0] * jac[1][1] - jac[0][1] * jac[1][0];
+    if (det == 0.0) break;
+    double dx = (jac[1][1] * f[0] - jac[0][1] * f[1]) / det;
+    double dy = (jac[0][0] * f[1] - jac[1][0] * f[0]) / det;
+    x -= dx;
+    y -= dy;
+    if (fabs(dx) + fabs(dy) < NEWTON_EPS) break;
+  }
+  return SVec2f(x, y);
+}
+
+int STransformPoly_equal(
+  const STransformPoly_t *poly1,
+  const STransformPoly_t *poly2)
+{
+  if (poly1->order < 2 && poly2->order < 2) return 1;
+  if (poly1->order     != poly2->order     ||
+      poly1->center[0] != poly2->center[0] ||
+      poly1->center[1] != poly2->center[1] ||
+      poly1->scale     != poly2->scale) return 0;
+
+  int n = SPolyFit_monomialN(poly1->order) - 3;
+  for (int k = 0; k < n; k++) {
+    if (poly1->coef[k][0] != poly2->coef[k][0] ||
+        poly1->coef[k][1] != poly2->coef[k][1]) return 0;
+  }
+  return 1;
+}
+
+/* ========================================================================= */
 SVec2f_t STransform_apply(const STransform_t *tr, SVec2f_t v) {
+  const float (*m)[3] = tr->mat;
+  float w;
   switch (tr->type) {
+  case STr_Projective:
+    w = m[2][0] * v[0] + m[2][1] * v[1] + m[2][2];
+    return SVec2f(
+      m[0][0] * v[0] + m[0][1] * v[1] + m[0][2],
+      m[1][0] * v[0] + m[1][1] * v[1] + m[1][2]) / w;
+  case STr_Polynomial:
+    v = STransformPoly_apply(&tr->poly, v);
+  case STr_Affine:
+    return SVec2f(
+      m[0][0] * v[0] + m[0][1] * v[1] + m[0][2],
+      m[1][0] * v[0] + m[1][1] * v[1] + m[1][2]);
   case STr_Linear:
     v = SVec2f_complexMul(v, tr->rot);
   case STr_Shift:
@@ -21,6 +188,145 @@ SVec2f_t STransform_apply(const STransform_t *tr, SVec2f_t v) {
   return v;
 }
 
+/* ------------------------------------------------------------------------- */
+/* Transform pairs of vectors packed as (x1, y1, x2, y2). Each coordinate is
+ * computed as a·p + b·q + c, where q is p with swapped coordinates. */
+static void applyBatchAffine(
+  SVec4f_t a, SVec4f_t b, SVec4f_t c,
+  const SVec2f_t *src, SVec2f_t *dst, size_t n)
+{
+  for (size_t i = 0; i + 1 < n; i += 2) {
+    SVec4f_t p = { src[i][0], src[i][1], src[i+1][0], src[i+1][1] };
+    SVec4f_t q = { p[1], p[0], p[3], p[2] };
+    SVec4f_t r = a * p + b * q + c;
+    dst[i]   = SVec2f(r[0], r[1]);
+    dst[i+1] = SVec2f(r[2], r[3]);
+  }
+}
+
+/* The same as applyBatchAffine, but the result is divided by the
+ * homogeneous coordinate d·p + e·q + f */
+static void applyBatchProjective(
+  SVec4f_t a, SVec4f_t b, SVec4f_t c,
+  SVec4f_t d, SVec4f_t e, SVec4f_t f,
+  const SVec2f_t *src, SVec2f_t *dst, size_t n)
+{
+  for (size_t i = 0; i + 1 < n; i += 2) {
+    SVec4f_t p = { src[i][0], src[i][1], src[i+1][0], src[i+1][1] };
+    SVec4f_t q = { p[1], p[0], p[3], p[2] };
+    SVec4f_t r = (a * p + b * q + c) / (d * p + e * q + f);
+    dst[i]   = SVec2f(r[0], r[1]);
+    dst[i+1] = SVec2f(r[2], r[3]);
+  }
+}
+
+void STransform_applyBatch(
+  const STransform_t *tr,
+  const SVec2f_t     *src,
+  SVec2f_t           *dst,
+  size_t              n)
+{
+  const float (*m)[3] = tr->mat;
+  SVec2f_t rot   = tr->rot;
+  SVec2f_t shift = tr->shift;
+
+  switch (tr->type) {
+  case STr_Drop:
+  case STr_Identity:
+    if (dst != src) memmove(dst, src, sizeof(SVec2f_t) * n);
+    return;
+  case STr_Shift:
+    for (size_t i = 0; i < n; i++) dst[i] = src[i] + shift;
+    return;
+  case STr_Linear:
+    applyBatchAffine(
+      SVec4f(rot[0], rot[0], rot[0], rot[0]),
+      SVec4f(-rot[1], rot[1], -rot[1], rot[1]),
+      SVec4f(shift[0], shift[1], shift[0], shift[1]),
+      src, dst, n);
+    break;
+  case STr_Affine:
+    applyBatchAffine(
+      SVec4f(m[0][0], m[1][1], m[0][0], m[1][1]),
+      SVec4f(m[0][1], m[1][0], m[0][1], m[1][0]),
+      SVec4f(m[0][2], m[1][2], m[0][2], m[1][2]),
+      src, dst, n);
+    break;
+  case STr_Projective:
+    applyBatchProjective(
+      SVec4f(m[0][0], m[1][1], m[0][0], m[1][1]),
+      SVec4f(m[0][1], m[1][0], m[0][1], m[1][0]),
+      SVec4f(m[0][2], m[1][2], m[0][2], m[1][2]),
+      SVec4f(m[2][0], m[2][1], m[2][0], m[2][1]),
+      SVec4f(m[2][1], m[2][0], m[2][1], m[2][0]),
+      SVec4f(m[2][2], m[2][2], m[2][2], m[2][2]),
+      src, dst, n);
+    break;
+  case STr_Polynomial: {
+    for (size_t i = 0; i < n; i++)
+      dst[i] = STransformPoly_apply(&tr->poly, src[i]);
+    STransform_t affine = STransform_matrix(STr_Affine, &m[0][0]);
+    STransform_applyBatch(&affine, dst, dst, n);
+    return;
+  }
+  }
+
+  /* The last vector, if the number of vectors is odd */
+  if (n % 2 == 1) dst[n-1] = STransform_apply(tr, src[n-1]);
+}
+
+/* ========================================================================= */
+/* Regular grid of points around the center of the distortion */
+static void samplePoints(SVec2f_t center, float scale, SVec2f_t *pts) {
+  for (int i = 0; i < SAMPLE_N; i++) {
+    for (int j = 0; j < SAMPLE_N; j++) {
+      float u = SAMPLE_RANGE * (2.0f * j / (SAMPLE_N - 1) - 1.0f);
+      float v = SAMPLE_RANGE * (2.0f * i / (SAMPLE_N - 1) - 1.0f);
+      pts[i * SAMPLE_N + j] = center + SVec2f(u, v) / scale;
+    }
+  }
+}
+
+static STransform_t inversePoly(const STransform_t *tr) {
+  SVec2f_t x[SAMPLE_N * SAMPLE_N];
+  SVec2f_t y[SAMPLE_N * SAMPLE_N];
+  samplePoints(tr->poly.center, tr->poly.scale, x);
+  STransform_applyBatch(tr, x, y, SAMPLE_N * SAMPLE_N);
+  return SPolyFit_fit(STRANSFORM_POLY_MAX_ORDER, y, x, SAMPLE_N * SAMPLE_N);
+}
+
+/* ------------------------------------------------------------------------- */
+static STransform_t inverseMatrix(const STransform_t *tr) {
+  const float (*m)[3] = tr->mat;
+  float inv[3][3] = {
+    { m[1][1] * m[2][2] - m[1][2] * m[2][1],
+      m[0][2] * m[2][1] - m[0][1] * m[2][2],
+      m[0][1] * m[1][2] - m[0][2] * m[1][1] },
+    { m[1][2] * m[2][0] - m[1][0] * m[2][2],
+      m[0][0] * m[2][2] - m[0][2] * m[2][0],
+      m[0][2] * m[1][0] - m[0][0] * m[1][2] },
+    { m[1][0] * m[2][1] - m[1][1] * m[2][0],
+      m[0][1] * m[2][0] - m[0][0] * m[2][1],
+      m[0][0] * m[1][1] - m[0][1] * m[1][0] }
+  };
+  float det =
+    m[0][0] * inv[0][0] + m[0][1] * inv[1][0] + m[0][2] * inv[2][0];
+
+  if (det == 0.0f) {
+    STransform_t result = {
+      .type  = STr_Drop,
+      .rot   = { 1.0f, 0.0f },
+      .shift = { 0.0f, 0.0f }
+    };
+    return result;
+  }
+
+  for (int i = 0; i < 3; i++) {
+    for (int j = 0; j < 3; j++) inv[i][j] /= det;
+  }
+  return STransform_matrix(tr->type, &inv[0][0]);
+}
+
 STransform_t STransform_inverse(const STransform_t *tr) {
   STransform_t result = {
     .type  = tr->type,
@@ -38,11 +344,80 @@ STransform_t STransform_inverse(const STransform_t *tr) {
     result.shift = -SVec2f_complexDiv(tr->shift, tr->rot);
     result.rot   = SVec2f_complexInv(tr->rot);
     break;
+  case STr_Affine:
+  case STr_Projective:
+    return inverseMatrix(tr);
+  case STr_Polynomial:
+    return inversePoly(tr);
   }
   return result;
 }
 
 /* ========================================================================= */
+/* Polynomial approximation of composition, where at least one of
+ * transformations is polynomial */
+static STransform_t composeSampled(
+  const STransform_t *tr2,
+  const STransform_t *tr1)
+{
+  SVec2f_t center;
+  float    scale;
+  if (tr1->type == STr_Polynomial) {
+    center = tr1->poly.center;
+    scale  = tr1->poly.scale;
+  } else {
+    /* The area of the distortion of tr2 mapped back by tr1 */
+    STransform_t inv1 = STransform_inverse(tr1);
+    SVec2f_t c  = tr2->poly.center;
+    SVec2f_t ex = SVec2f(1.0f / tr2->poly.scale, 0.0f);
+    SVec2f_t ey = SVec2f(0.0f, 1.0f / tr2->poly.scale);
+    center = STransform_apply(&inv1, c);
+    scale  = 2.0f / (
+      sqrtf(SVec2f_lengthSq(STransform_apply(&inv1, c + ex) - center)) +
+      sqrtf(SVec2f_lengthSq(STransform_apply(&inv1, c + ey) - center)));
+  }
+
+  SVec2f_t x[SAMPLE_N * SAMPLE_N];
+  SVec2f_t y[SAMPLE_N * SAMPLE_N];
+  samplePoints(center, scale, x);
+  STransform_applyBatch(tr1, x, y, SAMPLE_N * SAMPLE_N);
+  STransform_applyBatch(tr2, y, y, SAMPLE_N * SAMPLE_N);
+  return SPolyFit_fitIn(STRANSFORM_POLY_MAX_ORDER, center, scale,
+    x, y, SAMPLE_N * SAMPLE_N);
+}
+
+/* ------------------------------------------------------------------------- */
+static STransform_t composeMatrix(
+  const STransform_t *tr2,
+  const STransform_t *tr1)
+{
+  if (tr1->type == STr_Drop) return *tr1;
+  if (tr2->type == STr_Polynomial ||
+      (tr1->type == STr_Polynomial && tr2->type == STr_Projective))
+    return composeSampled(tr2, tr1);
+
+  float m1[3][3], m2[3][3], m[3][3];
+  toMatrix(tr1, m1);
+  toMatrix(tr2, m2);
+  for (int i = 0; i < 3; i++) {
+    for (int j = 0; j < 3; j++) {
+      m[i][j] = m2[i][0] * m1[0][j] + m2[i][1] * m1[1][j] + m2[i][2] * m1[2][j];
+    }
+  }
+
+  /* Affine transformation applied after the distortion */
+  if (tr1->type == STr_Polynomial) {
+    STransform_t result = *tr1;
+    memcpy(result.mat, m, sizeof(result.mat));
+    return result;
+  }
+
+  STransformType_t type =
+    tr1->type == STr_Projective || tr2->type == STr_Projective ?
+      STr_Projective : STr_Affine;
+  return STransform_matrix(type, &m[0][0]);
+}
+
 static STransform_t composeWithShift(SVec2f_t shift, const STransform_t *tr) {
   switch (tr->type) {
   case STr_Drop:
@@ -53,6 +428,12 @@ static STransform_t composeWithShift(SVec2f_t shift, const STransform_t *tr) {
     return STransform_shift(shift + tr->shift);
   case STr_Linear:
     return STransform_linear(tr->rot, tr->shift + shift);
+  case STr_Affine:
+  case STr_Projective:
+  case STr_Polynomial: {
+    STransform_t tr2 = STransform_shift(shift);
+    return composeMatrix(&tr2, tr);
+  }
   }
   assert(0 && "Impossible case");
 }
@@ -71,6 +452,12 @@ static STransform_t composeWithLinear(
     return STransform_linear(
       SVec2f_complexMul(rot, tr->rot),
       SVec2f_complexMul(rot, tr->shift) + shift);
+  case STr_Affine:
+  case STr_Projective:
+  case STr_Polynomial: {
+    STransform_t tr2 = STransform_linear(rot, shift);
+    return composeMatrix(&tr2, tr);
+  }
   }
   assert(0 && "Impossible case");
 }
@@ -88,6 +475,12 @@ STransform_t STransform_compose(
     return composeWithShift(tr2->shift, tr1);
   case STr_Linear:
     return composeWithLinear(tr2->rot, tr2->shift, tr1);
+  case STr_Affine:
+  case STr_Projective:
+    return composeMatrix(tr2, tr1);
+  case STr_Polynomial:
+    if (tr1->type == STr_Identity) return *tr2;
+    return composeMatrix(tr2, tr1);
   }
   assert(0 && "Impossible case");
 }
@@ -109,16 +502,31 @@ SBoundingBox_t STransform_boundingBox(
     return SBoundingBox_empty();
   }
 
-  SVec2f_t p1 = STransform_apply(tr, SVec2f(bb.minX, bb.minY));
-  SVec2f_t p2 = STransform_apply(tr, SVec2f(bb.minX, bb.maxY));
-  SVec2f_t p3 = STransform_apply(tr, SVec2f(bb.maxX, bb.minY));
-  SVec2f_t p4 = STransform_apply(tr, SVec2f(bb.maxX, bb.maxY));
+  /* Edges of polynomially transformed box are curved, so more points on
+   * them are checked */
+  int steps = tr->type == STr_Polynomial ? BB_EDGE_STEPS : 1;
 
+  SVec2f_t p = STransform_apply(tr, SVec2f(bb.minX, bb.minY));
   SBoundingBox_t result = {
-    .minX = minf(minf(p1[0], p2[0]), minf(p3[0], p4[0])),
-    .minY = minf(minf(p1[1], p2[1]), minf(p3[1], p4[1])),
-    .maxX = maxf(maxf(p1[0], p2[0]), maxf(p3[0], p4[0])),
-    .maxY = maxf(maxf(p1[1], p2[1]), maxf(p3[1], p4[1])),
+    .minX = p[0], .minY = p[1],
+    .maxX = p[0], .maxY = p[1]
   };
+  for (int k = 0; k <= steps; k++) {
+    float a = (float)k / steps;
+    float x = k == steps ? bb.maxX : bb.minX + a * (bb.maxX - bb.minX);
+    float y = k == steps ? bb.maxY : bb.minY + a * (bb.maxY - bb.minY);
+    SVec2f_t pts[4] = {
+      STransform_apply(tr, SVec2f(x, bb.minY)),
+      STransform_apply(tr, SVec2f(x, bb.maxY)),
+      STransform_apply(tr, SVec2f(bb.minX, y)),
+      STransform_apply(tr, SVec2f(bb.maxX, y))
+    };
+    for (int i = 0; i < 4; i++) {
+      result.minX = minf(result.minX, pts[i][0]);
+      result.minY = minf(result.minY, pts[i][1]);
+      result.maxX = maxf(result.maxX, pts[i][0]);
+      result.maxY = maxf(result.maxY, pts[i][1]);
+    }
+  }
   return result;
 }
@@ -0,0 +1,136 @@
+/* This file is part of Spica, released under MIT license.
+ * See LICENSE for details.
+ */
+
+/* Author: Piotr Polesiuk, 2022 */
+
+#include "STransform.h"
+
+#include "SDataRepr.h"
+
+#include <stdint.h>
+#include <string.h>
+
+/* Stored distortion: order, center (2 floats), scale, and coefficients
+ * (2 floats each). Stored transformation: type, rot, shift (2 floats
+ * each), the matrix (9 floats) followed by the distortion. All values are
+ * 32-bit little-endian. */
+#define POLY_WORDS (4 + 2 * STRANSFORM_POLY_TERMS)
+#define TR_WORDS   (1 + 2 + 2 + 9 + POLY_WORDS)
+
+static void encodePoly(uint32_t *words, const STransformPoly_t *poly) {
+  *words++ = SLittleEndian32((uint32_t)poly->order);
+  *words++ = SLittleEndianFromFloat(poly->center[0]);
+  *words++ = SLittleEndianFromFloat(poly->center[1]);
+  *words++ = SLittleEndianFromFloat(poly->scale);
+  for (int k = 0; k < STRANSFORM_POLY_TERMS; k++) {
+    *words++ = SLittleEndianFromFloat(poly->coef[k][0]);
+    *words++ = SLittleEndianFromFloat(poly->coef[k][1]);
+  }
+}
+
+static int decodePoly(STransformPoly_t *poly, const uint32_t *words) {
+  int order = (int32_t)SLittleEndian32(*words++);
+  if (order > STRANSFORM_POLY_MAX_ORDER) return 0;
+
+  poly->order     = order;
+  poly->center[0] = SLittleEndianToFloat(*words++);
+  poly->center[1] = SLittleEndianToFloat(*words++);
+  poly->scale     = SLittleEndianToFloat(*words++);
+  for (int k = 0; k < STRANSFORM_POLY_TERMS; k++) {
+    poly->coef[k][0] = SLittleEndianToFloat(*words++);
+    poly->coef[k][1] = SLittleEndianToFloat(*words++);
+  }
+  return 1;
+}
+
+/* ========================================================================= */
+int STransformPoly_write(const STransformPoly_t *poly, FILE *file) {
+  uint32_t words[POLY_WORDS];
+  encodePoly(words, poly);
+  return fwrite(words, sizeof(words), 1, file) == 1 ?
+    SPICA_OK : SPICA_ERROR;
+}
+
+int STransformPoly_read(STransformPoly_t *poly, FILE *file) {
+  uint32_t words[POLY_WORDS];
+  STransformPoly_t result;
+  if (fread(words, sizeof(words), 1, file) != 1 ||
+      !decodePoly(&result, words))
+    return SPICA_ERROR;
+
+  *poly = result;
+  return SPICA_OK;
+}
+
+/* ------------------------------------------------------------------------- */
+/* Fields ignored by the type of the transformation may be uninitialized.
+ * They are replaced by values set by constructors of transformations, so
+ * files do not depend on garbage, and the distortion is always valid. */
+static STransform_t normalize(const STransform_t *tr) {
+  STransform_t result = {
+    .type = tr->type,
+    .rot  = { 1.0f, 0.0f }
+  };
+  switch (tr->type) {
+  case STr_Polynomial:
+    result.poly = tr->poly;
+    /* fall through */
+  case STr_Affine:
+  case STr_Projective:
+    memcpy(result.mat, tr->mat, sizeof(result.mat));
+    break;
+  case STr_Linear:
+    result.rot = tr->rot;
+    /* fall through */
+  case STr_Shift:
+    result.shift = tr->shift;
+    break;
+  case STr_Drop:
+  case STr_Identity:
+    break;
+  }
+  return result;
+}
+
+int STransform_write(const STransform_t *tr, FILE *file) {
+  STransform_t t = normalize(tr);
+  uint32_t words[TR_WORDS];
+  uint32_t *w = words;
+  *w++ = SLittleEndian32((uint32_t)t.type);
+  *w++ = SLittleEndianFromFloat(t.rot[0]);
+  *w++ = SLittleEndianFromFloat(t.rot[1]);
+  *w++ = SLittleEndianFromFloat(t.shift[0]);
+  *w++ = SLittleEndianFromFloat(t.shift[1]);
+  for (int i = 0; i < 3; i++) {
+    for (int j = 0; j < 3; j++)
+      *w++ = SLittleEndianFromFloat(t.mat[i][j]);
+  }
+  encodePoly(w, &t.poly);
+  return fwrite(words, sizeof(words), 1, file) == 1 ?
+    SPICA_OK : SPICA_ERROR;
+}
+
+int STransform_read(STransform_t *tr, FILE *file) {
+  uint32_t words[TR_WORDS];
+  if (fread(words, sizeof(words), 1, file) != 1) return SPICA_ERROR;
+
+  const uint32_t *w = words;
+  uint32_t type = SLittleEndian32(*w++);
+  if (type > STr_Polynomial) return SPICA_ERROR;
+
+  STransform_t result;
+  result.type     = type;
+  result.rot[0]   = SLittleEndianToFloat(*w++);
+  result.rot[1]   = SLittleEndianToFloat(*w++);
+  result.shift[0] = SLittleEndianToFloat(*w++);
+  result.shift[1] = SLittleEndianToFloat(*w++);
+  for (int i = 0; i < 3; i++) {
+    for (int j = 0; j < 3; j++)
+      result.mat[i][j] = SLittleEndianToFloat(*w++);
+  }
+  if (!decodePoly(&result.poly, w)) return SPICA_ERROR;
+
+  *tr = result;
+  return SPICA_OK;
+}